@@ -36,9 +36,12 @@ sources = [
   'graphics/matrixstack.c',
   'graphics/mesh.c',
   'graphics/particlesystem.c',
+  'graphics/polyline.c',
   'graphics/quad.c',
   'graphics/shader.c',
   'image/imagedata.c',
+  'image/compressedimagedata.c',
+  'image/blockdecode.c',
   'luaapi/audio.c',
   'luaapi/boot.c',
   'luaapi/event.c',
@@ -57,6 +60,7 @@ sources = [
   'luaapi/graphics_image.c',
   'luaapi/graphics_mesh.c',
   'luaapi/graphics_particlesystem.c',
+  'luaapi/graphics_polyline.c',
   'luaapi/graphics_quad.c',
   'luaapi/graphics_shader.c',
   'luaapi/graphics_texture.c',
@@ -71,6 +75,7 @@ sources = [
   'math/math.c',
   'math/minmax.c',
   'math/randomgenerator.c',
+  'math/simd.c',
   'math/triangulate.c',
   'math/util.c',
   'math/vector.c',
@@ -80,6 +85,8 @@ sources = [
   'main.c',
   'motor.c',
   'mouse.c',
+  'tools/ringbuffer.c',
+  'tools/threadpool.c',
   'tools/utf8.c',
   'timer/timer.c',
 
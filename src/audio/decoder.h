@@ -19,20 +19,20 @@ typedef struct {
 } audio_StaticSourceDecoder;
 
 /*
-  preloadSamples must return:  0 if end of stream reached
-                              -1 if buffer is full
-                               n where n > 0 if n samples were preloaded
+  readSamples decodes up to sampleCount interleaved samples, a multiple of
+  the channel count, and returns the number written. 0 means the end of the
+  stream was reached. Streams are decoded on the audio thread, the decoder
+  must not use global state.
 */
 
 typedef struct {
   bool (*testFile)(char const *filename);
   bool (*openFile)(char const* filename, void **decoderData);
+  // Channels of the decoded samples, 1 or 2
   int  (*getChannelCount)(void *decoderData);
   int  (*getSampleRate)(void *decoderData);
   bool (*closeFile)(void **decoderData);
   bool (*atEnd)(void const *decoderData);
   void (*rewind)(void *decoderData);
-  int  (*preloadSamples)(void *decoderData, int sampleCount);
-  int  (*uploadPreloadedSamples)(void *decoderData, ALuint buffer);
-  void (*flush)(void *decoderData);
+  int  (*readSamples)(void *decoderData, ALshort *out, int sampleCount);
 } audio_StreamSourceDecoder;
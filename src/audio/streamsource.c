@@ -13,10 +13,38 @@
 #include "streamsource.h"
 #include "decoder.h"
 
+// Samples decoded per step, small enough to answer commands quickly
+static const int decodeChunkSamples = 4096;
+
+typedef enum {
+  StreamCommand_add,
+  StreamCommand_remove,
+  StreamCommand_setLooping
+} StreamCommandType;
+
+typedef struct {
+  StreamCommandType type;
+  audio_StreamSource *source;
+  bool looping;
+} StreamCommand;
+
 static struct {
   audio_StreamSource ** playingStreams;
   int playingStreamSize;
   int playingStreamCount;
+
+  // Streams being decoded, only touched by the audio thread
+  audio_StreamSource ** decodingStreams;
+  int decodingStreamSize;
+  int decodingStreamCount;
+
+#ifndef EMSCRIPTEN
+  SDL_Thread *thread;
+  // StreamCommands from the main thread to the audio thread
+  ringbuffer_RingBuffer commands;
+  SDL_sem *wake;
+  SDL_sem *commandDone;
+#endif
 } moduleData;
 
 
@@ -29,10 +57,144 @@ static audio_StreamSourceDecoder const* streamDecoders[] = {
 static void audio_StreamSource_stop1(audio_StreamSource *source);
 
 
+// Runs on the audio thread. Returns true if there may be more to decode
+// right away.
+static bool decodeStep(audio_StreamSource *source) {
+  if(SDL_AtomicGet(&source->decodeDone)) {
+    return false;
+  }
+
+  int samples = ringbuffer_RingBuffer_getFree(&source->pcm) / sizeof(ALshort);
+  if(samples > decodeChunkSamples) {
+    samples = decodeChunkSamples;
+  }
+  samples -= samples % source->channels;
+  if(samples == 0) {
+    return false;
+  }
+
+  int decoded = source->decoder->readSamples(source->decoderData, source->decodeBuffer, samples);
+  if(decoded == 0) {
+    if(source->decodeLooping) {
+      source->decoder->rewind(source->decoderData);
+      return true;
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&source->decodeDone, 1);
+    return false;
+  }
+
+  ringbuffer_RingBuffer_write(&source->pcm, source->decodeBuffer, decoded * sizeof(ALshort));
+  return true;
+}
+
+
+static void applyCommand(StreamCommand const* command) {
+  switch(command->type) {
+  case StreamCommand_add:
+    if(moduleData.decodingStreamCount == moduleData.decodingStreamSize) {
+      moduleData.decodingStreamSize = 2 * moduleData.decodingStreamSize;
+      moduleData.decodingStreams = realloc(moduleData.decodingStreams, moduleData.decodingStreamSize*sizeof(audio_StreamSource*));
+    }
+    moduleData.decodingStreams[moduleData.decodingStreamCount++] = command->source;
+    break;
+
+  case StreamCommand_remove:
+    for(int i = 0; i < moduleData.decodingStreamCount; ++i) {
+      if(moduleData.decodingStreams[i] == command->source) {
+        --moduleData.decodingStreamCount;
+        moduleData.decodingStreams[i] = moduleData.decodingStreams[moduleData.decodingStreamCount];
+        break;
+      }
+    }
+    break;
+
+  case StreamCommand_setLooping:
+    command->source->decodeLooping = command->looping;
+    break;
+  }
+}
+
+
+#ifdef EMSCRIPTEN
+
+// No threads on the web, commands apply at once and decoding happens in
+// audio_updateStreams
+static void sendCommand(StreamCommandType type, audio_StreamSource *source, bool looping) {
+  StreamCommand command = { type, source, looping };
+  applyCommand(&command);
+}
+
+static void startAudioThread(void) {
+}
+
+#else
+
+// Returns once the audio thread has applied the command for removals, after
+// which the main thread owns the stream's decoder again
+static void sendCommand(StreamCommandType type, audio_StreamSource *source, bool looping) {
+  StreamCommand command = { type, source, looping };
+  while(ringbuffer_RingBuffer_getFree(&moduleData.commands) < (int)sizeof(command)) {
+    SDL_Delay(1);
+  }
+  ringbuffer_RingBuffer_write(&moduleData.commands, &command, sizeof(command));
+  SDL_SemPost(moduleData.wake);
+
+  if(type == StreamCommand_remove) {
+    SDL_SemWait(moduleData.commandDone);
+  }
+}
+
+
+static int audioThreadMain(void *unused) {
+  (void)unused;
+  for(;;) {
+    StreamCommand command;
+    while(ringbuffer_RingBuffer_read(&moduleData.commands, &command, sizeof(command))) {
+      applyCommand(&command);
+      if(command.type == StreamCommand_remove) {
+        SDL_SemPost(moduleData.commandDone);
+      }
+    }
+
+    bool busy = false;
+    for(int i = 0; i < moduleData.decodingStreamCount; ++i) {
+      busy = decodeStep(moduleData.decodingStreams[i]) || busy;
+    }
+
+    // Rings are full, wait until some of them are drained or a command
+    // comes in
+    if(!busy) {
+      SDL_SemWaitTimeout(moduleData.wake, 10);
+    }
+  }
+
+  return 0;
+}
+
+
+static void startAudioThread(void) {
+  ringbuffer_RingBuffer_new(&moduleData.commands, 64 * sizeof(StreamCommand));
+  moduleData.wake = SDL_CreateSemaphore(0);
+  moduleData.commandDone = SDL_CreateSemaphore(0);
+  moduleData.thread = SDL_CreateThread(audioThreadMain, "motor2d audio", NULL);
+}
+
+#endif
+
+
+// Fills the OpenAL buffers directly, the audio thread does not know about
+// the stream yet
 static void initialPreload(audio_StreamSource *source) {
+  source->preloadedBuffers = 0;
   for(int i = 0; i < preloadBufferCount; ++i) {
-    source->decoder->preloadSamples(source->decoderData, 44100);
-    source->decoder->uploadPreloadedSamples(source->decoderData, source->buffers[i]);
+    int samples = source->decoder->readSamples(source->decoderData, source->uploadBuffer, source->bufferSamples);
+    if(samples == 0) {
+      break;
+    }
+    alBufferData(source->buffers[i], source->channels == 2 ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
+                 source->uploadBuffer, samples * sizeof(ALshort), source->sampleRate);
+    ++source->preloadedBuffers;
   }
 }
 
@@ -40,18 +202,23 @@ static void initialPreload(audio_StreamSource *source) {
 void audio_StreamSource_free(audio_StreamSource *source) {
   // Stop without rewind
   audio_StreamSource_stop1(source);
+  // Waits for commands still queued for the stream
+  sendCommand(StreamCommand_remove, source, false);
 
   free(source->filename);
   alDeleteBuffers(preloadBufferCount, source->buffers);
   audio_SourceCommon_free(&source->common);
   source->decoder->closeFile(source->decoderData);
+  ringbuffer_RingBuffer_free(&source->pcm);
+  free(source->uploadBuffer);
+  free(source->decodeBuffer);
 }
 
 
 bool audio_loadStream(audio_StreamSource *source, char const * filename) {
   // TODO select approprate decoder (there is only one right now though!)
   source->decoder = streamDecoders[0];
-  
+
   char const* infile = filesystem_locateReadableFile(filename);
 
   bool good = source->decoder->openFile(infile, &source->decoderData);
@@ -63,6 +230,17 @@ bool audio_loadStream(audio_StreamSource *source, char const * filename) {
 
   alGenBuffers(preloadBufferCount, source->buffers);
 
+  // Half a second per buffer, the ring holds at least as much again
+  source->channels = source->decoder->getChannelCount(source->decoderData);
+  source->sampleRate = source->decoder->getSampleRate(source->decoderData);
+  source->bufferSamples = source->sampleRate / 2 * source->channels;
+  source->uploadBuffer = malloc(source->bufferSamples * sizeof(ALshort));
+  source->decodeBuffer = malloc(decodeChunkSamples * sizeof(ALshort));
+  ringbuffer_RingBuffer_new(&source->pcm, 2 * source->bufferSamples * sizeof(ALshort));
+  SDL_AtomicSet(&source->decodeDone, 0);
+  source->decodeLooping = false;
+  source->freeBufferCount = 0;
+
   initialPreload(source);
 
   source->looping = false;
@@ -83,7 +261,10 @@ static void prepareToPlay(audio_StreamSource *source) {
     return;
   }
 
-  alSourceQueueBuffers(source->common.source, preloadBufferCount, source->buffers);
+  alSourceQueueBuffers(source->common.source, source->preloadedBuffers, source->buffers);
+  for(int i = source->preloadedBuffers; i < preloadBufferCount; ++i) {
+    source->freeBuffers[source->freeBufferCount++] = source->buffers[i];
+  }
 
   if(moduleData.playingStreamCount == moduleData.playingStreamSize) {
     moduleData.playingStreamSize = 2 * moduleData.playingStreamSize;
@@ -92,6 +273,8 @@ static void prepareToPlay(audio_StreamSource *source) {
 
   moduleData.playingStreams[moduleData.playingStreamCount] = source;
   ++moduleData.playingStreamCount;
+
+  sendCommand(StreamCommand_add, source, false);
 }
 
 
@@ -109,47 +292,74 @@ void audio_StreamSource_play(audio_StreamSource *source) {
 }
 
 
+static void removePlayingStream(int index) {
+  sendCommand(StreamCommand_remove, moduleData.playingStreams[index], false);
+  --moduleData.playingStreamCount;
+  moduleData.playingStreams[index] = moduleData.playingStreams[moduleData.playingStreamCount];
+}
+
+
+// Queues decoded samples in the free buffers. Partial buffers are only sent
+// at the end of the stream or when OpenAL is about to run dry.
+static void refillBuffers(audio_StreamSource *source, bool decodeDone, ALint queued) {
+  int const bufferBytes = source->bufferSamples * sizeof(ALshort);
+  while(source->freeBufferCount > 0) {
+    int available = ringbuffer_RingBuffer_getUsed(&source->pcm);
+    if(available == 0 || (available < bufferBytes && !decodeDone && queued > 0)) {
+      break;
+    }
+
+    int bytes = available < bufferBytes ? available : bufferBytes;
+    bytes -= bytes % (source->channels * sizeof(ALshort));
+    ringbuffer_RingBuffer_read(&source->pcm, source->uploadBuffer, bytes);
+
+    ALuint buf = source->freeBuffers[--source->freeBufferCount];
+    alBufferData(buf, source->channels == 2 ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
+                 source->uploadBuffer, bytes, source->sampleRate);
+    alSourceQueueBuffers(source->common.source, 1, &buf);
+    ++queued;
+  }
+}
+
+
+// Moves decoded samples to OpenAL. Decoding itself happens on the audio
+// thread, except on the web.
 void audio_updateStreams(void) {
-  for(int i = 0; i < moduleData.playingStreamCount;) {
-    audio_StreamSource const* source = moduleData.playingStreams[i];
-
-    int loaded = source->decoder->preloadSamples(source->decoderData, 8000);
-    if(loaded == 0) {
-      if(source->looping) {
-        source->decoder->rewind(source->decoderData);
-      } else {
-        
-      }
+#ifdef EMSCRIPTEN
+  for(int i = 0; i < moduleData.decodingStreamCount; ++i) {
+    for(int chunk = 0; chunk < 8 && decodeStep(moduleData.decodingStreams[i]); ++chunk) {
     }
+  }
+#endif
+
+  for(int i = 0; i < moduleData.playingStreamCount;) {
+    audio_StreamSource *source = moduleData.playingStreams[i];
 
     ALuint src = source->common.source;
     ALint count;
     ALint queued;
     ALint state;
     alGetSourcei(src, AL_BUFFERS_PROCESSED, &count);
-    alGetSourcei(src, AL_BUFFERS_QUEUED, &queued);
     alGetSourcei(src, AL_SOURCE_STATE, &state);
-  //  printf("%d buffers free, %d queued, state=%d\n", count, queued, state);
 
     for(int j = 0; j < count; ++j) {
-      ALuint buf;
-      alSourceUnqueueBuffers(src, 1, &buf);
-      // This may cause preloading two full frames
-      
-      int uploaded = source->decoder->uploadPreloadedSamples(source->decoderData, buf);
-      if(uploaded) {
-        alSourceQueueBuffers(src, 1, &buf);
-      }
+      alSourceUnqueueBuffers(src, 1, &source->freeBuffers[source->freeBufferCount++]);
     }
 
+    bool decodeDone = SDL_AtomicGet(&source->decodeDone);
+    SDL_MemoryBarrierAcquire();
+
     alGetSourcei(src, AL_BUFFERS_QUEUED, &queued);
-    if(state == AL_STOPPED && queued == 0) {
-      --moduleData.playingStreamCount;
-      moduleData.playingStreams[i] = moduleData.playingStreams[moduleData.playingStreamCount];
+    refillBuffers(source, decodeDone, queued);
+
+    alGetSourcei(src, AL_BUFFERS_QUEUED, &queued);
+    if(state == AL_STOPPED && queued == 0 && decodeDone) {
+      removePlayingStream(i);
     } else if(state == AL_STOPPED && queued > 0) {
       // Should only happen when we seriously ran out of time,
       // but there are documented cases where it happened during load time.
       alSourcePlay(src);
+      ++i;
     } else {
       ++i;
     }
@@ -159,6 +369,7 @@ void audio_updateStreams(void) {
 
 void audio_StreamSource_setLooping(audio_StreamSource *source, bool loop) {
   source->looping = loop;
+  sendCommand(StreamCommand_setLooping, source, loop);
 }
 
 
@@ -171,6 +382,12 @@ void audio_streamsource_init(void) {
   moduleData.playingStreamCount = 0;
   moduleData.playingStreamSize  = 16;
   moduleData.playingStreams     = malloc(sizeof(audio_StreamSource*) * 16);
+
+  moduleData.decodingStreamCount = 0;
+  moduleData.decodingStreamSize  = 16;
+  moduleData.decodingStreams     = malloc(sizeof(audio_StreamSource*) * 16);
+
+  startAudioThread();
 }
 
 
@@ -178,8 +395,7 @@ static void audio_StreamSource_stop1(audio_StreamSource *source) {
   // Remove from list of active streams
   for(int i = 0; i < moduleData.playingStreamCount; ++i) {
     if(moduleData.playingStreams[i] == source) {
-      --moduleData.playingStreamCount;
-      moduleData.playingStreams[i] = moduleData.playingStreams[moduleData.playingStreamCount];
+      removePlayingStream(i);
       break;
     }
   }
@@ -192,6 +408,7 @@ static void audio_StreamSource_stop1(audio_StreamSource *source) {
     ALuint buf;
     alSourceUnqueueBuffers(source->common.source, 1, &buf);
   }
+  source->freeBufferCount = 0;
 }
 
 
@@ -202,8 +419,10 @@ void audio_StreamSource_stop(audio_StreamSource *source) {
 
   audio_StreamSource_stop1(source);
 
+  // The audio thread let go of the stream in stop1
   source->decoder->rewind(source->decoderData);
-  source->decoder->flush(source->decoderData);
+  ringbuffer_RingBuffer_clear(&source->pcm);
+  SDL_AtomicSet(&source->decodeDone, 0);
   initialPreload(source);
 }
 
@@ -14,6 +14,7 @@
 
 #include "source.h"
 #include "decoder.h"
+#include "../tools/ringbuffer.h"
 
 static const int preloadBufferCount = 4;
 
@@ -24,6 +25,25 @@ typedef struct {
   ALuint buffers[preloadBufferCount];
   bool   looping;
   char  *filename;
+
+  int    channels;
+  int    sampleRate;
+  // Samples per OpenAL buffer
+  int    bufferSamples;
+  ALshort *uploadBuffer;
+  // Unqueued buffers waiting for samples
+  ALuint freeBuffers[preloadBufferCount];
+  int    freeBufferCount;
+  int    preloadedBuffers;
+
+  // Decoded samples, filled by the audio thread and drained into OpenAL
+  // buffers by audio_updateStreams. The decoder and everything below belong
+  // to the audio thread while the stream is playing.
+  ringbuffer_RingBuffer pcm;
+  // Set once the end is decoded and the stream does not loop
+  SDL_atomic_t decodeDone;
+  bool   decodeLooping;
+  ALshort *decodeBuffer;
 } audio_StreamSource;
 
 bool audio_loadStream(audio_StreamSource *source, char const * filename);
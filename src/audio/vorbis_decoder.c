@@ -15,24 +15,27 @@
 
 typedef struct {
   stb_vorbis *vorbis;
-  ALshort    *readBuffer;
-  int         readBufferSize;
-  int         preloadedSamples;
+  // Decoded channels, files with more than two are mixed down to stereo
+  int         channels;
+  int         sampleRate;
   bool        atEnd;
 } audio_vorbis_DecoderData;
 
 
 bool audio_vorbis_openStream(char const* filename, void **decoderData) {
   int err;
-  audio_vorbis_DecoderData* data = malloc(sizeof(audio_vorbis_DecoderData));
-  data->vorbis = stb_vorbis_open_filename(filename, &err, NULL);
+  stb_vorbis *vorbis = stb_vorbis_open_filename(filename, &err, NULL);
+  if(!vorbis) {
+    return false;
+  }
 
-  stb_vorbis_info info = stb_vorbis_get_info(data->vorbis);
+  stb_vorbis_info info = stb_vorbis_get_info(vorbis);
 
-  data->readBufferSize    = info.channels * info.sample_rate + 4096;
-  data->readBuffer        = malloc(sizeof(ALshort) * data->readBufferSize);
-  data->preloadedSamples  = 0;
-  data->atEnd             = false;
+  audio_vorbis_DecoderData* data = malloc(sizeof(audio_vorbis_DecoderData));
+  data->vorbis     = vorbis;
+  data->channels   = info.channels >= 2 ? 2 : 1;   // Force to mono or stereo
+  data->sampleRate = info.sample_rate;
+  data->atEnd      = false;
 
   *decoderData = data;
 
@@ -43,92 +46,54 @@ bool audio_vorbis_openStream(char const* filename, void **decoderData) {
 bool audio_vorbis_closeStream(void **decoderData) {
   audio_vorbis_DecoderData * data = (audio_vorbis_DecoderData*)decoderData;
   stb_vorbis_close(data->vorbis);
-  free(data->readBuffer);
+  free(data);
   return true;
 }
 
 
-int audio_vorbis_preloadStreamSamples(void* decoderData, int sampleCount) {
+// stb_vorbis interleaves and converts to 16 bit with saturation itself,
+// straight into out
+int audio_vorbis_readStreamSamples(void* decoderData, ALshort *out, int sampleCount) {
   audio_vorbis_DecoderData * data = (audio_vorbis_DecoderData*)decoderData;
-  stb_vorbis_info info = stb_vorbis_get_info(data->vorbis);
-  int channels = info.channels >= 2 ? 2 : 1;   // Force to mono or stereo
-
-  int safeBufferSize = sampleCount * channels + 4096;
-  if(safeBufferSize > data->readBufferSize) {
-    data->readBufferSize = safeBufferSize;
-    data->readBuffer = realloc(data->readBuffer, sizeof(ALshort) * safeBufferSize);
-  }
-
-  int space = data->readBufferSize - data->preloadedSamples - 4096;
-  if(space <= 0) {
-    return -1;
-  }
 
-  if(space < sampleCount) {
-    sampleCount = space;
+  int frames = stb_vorbis_get_samples_short_interleaved(data->vorbis, data->channels, out, sampleCount);
+  if(frames == 0) {
+    data->atEnd = true;
   }
 
-  int readSamples = 0;
-  while(readSamples < sampleCount) {
-    float **channelData;
-    int samples = stb_vorbis_get_frame_float(data->vorbis, NULL, &channelData);
-    if(samples == 0) {
-      data->atEnd = true;
-      break;
-    }
-    for(int i = 0; i < samples; ++i) {
-      for(int c = 0; c < channels; ++c) {
-        data->readBuffer[data->preloadedSamples + readSamples + channels * i + c] = (ALshort)(channelData[c][i] * 0x7FFF);
-      }
-    }
-
-    readSamples += channels * samples;
-  }
-
-  data->preloadedSamples += readSamples;
-
-  return readSamples;
+  return frames * data->channels;
 }
 
-int audio_vorbis_uploadPreloadedStreamSamples(void *decoderData, ALuint buffer) {
-  audio_vorbis_DecoderData * data = (audio_vorbis_DecoderData*)decoderData;
-  stb_vorbis_info info = stb_vorbis_get_info(data->vorbis);
-  int channels = info.channels >= 2 ? 2 : 1;   // Force to mono or stereo
 
-  // Emergency loading if we ran out of time for proper preloading
-  if(!data->atEnd && data->preloadedSamples < data->readBufferSize / 2) {
-    audio_vorbis_preloadStreamSamples(decoderData, data->readBufferSize / 2);
-  }
-
-  if(data->preloadedSamples == 0) {
-    return 0;
+// Decodes the whole file into a buffer sized from the stream length, which
+// only grows if the length was off
+bool audio_vorbis_load(ALuint buffer, char const* filename) {
+  int err;
+  stb_vorbis *vorbis = stb_vorbis_open_filename(filename, &err, NULL);
+  if(!vorbis) {
+    return false;
   }
 
-  alBufferData(
-    buffer,
-    channels == 2 ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16,
-    data->readBuffer,
-    data->preloadedSamples * sizeof(ALshort),
-    info.sample_rate
-  );
-
-  int uploaded = data->preloadedSamples;
-  data->preloadedSamples = 0;
-  return uploaded;
-}
-
-
-bool audio_vorbis_load(ALuint buffer, char const* filename) {
-  short *data;
-  int channels;
-  int samplingrate;
-  int len = stb_vorbis_decode_filename(filename, &channels, &samplingrate, &data);
+  stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+  int channels = info.channels >= 2 ? 2 : 1;
 
-  if(len == -1) {
-    return false;
+  int capacity = stb_vorbis_stream_length_in_samples(vorbis) * channels + 4096;
+  short *data = malloc(capacity * sizeof(short));
+  int len = 0;
+  for(;;) {
+    if(capacity - len < 4096) {
+      capacity *= 2;
+      data = realloc(data, capacity * sizeof(short));
+    }
+    int frames = stb_vorbis_get_samples_short_interleaved(vorbis, channels, data + len, capacity - len);
+    if(frames == 0) {
+      break;
+    }
+    len += frames * channels;
   }
+  stb_vorbis_close(vorbis);
 
-  alBufferData(buffer, channels == 2 ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16, data, len * sizeof(short) * channels, samplingrate);
+  alBufferData(buffer, channels == 2 ? AL_FORMAT_STEREO16 : AL_FORMAT_MONO16, data, len * sizeof(short), info.sample_rate);
 
   free(data);
 
@@ -147,18 +112,13 @@ bool audio_vorbis_atEnd(void const *decoderData) {
 }
 
 int audio_vorbis_getChannelCount(void *decoderData) {
-  stb_vorbis_info info = stb_vorbis_get_info((stb_vorbis*)decoderData);
-  return info.channels;
+  audio_vorbis_DecoderData * data = (audio_vorbis_DecoderData*)decoderData;
+  return data->channels;
 }
 
 int audio_vorbis_getSampleRate(void *decoderData) {
-  stb_vorbis_info info = stb_vorbis_get_info((stb_vorbis*)decoderData);
-  return info.sample_rate;
-}
-
-void audio_vorbis_flushBuffer(void *decoderData) {
   audio_vorbis_DecoderData * data = (audio_vorbis_DecoderData*)decoderData;
-  data->preloadedSamples = 0;
+  return data->sampleRate;
 }
 
 audio_StreamSourceDecoder audio_vorbis_decoder = {
@@ -169,9 +129,7 @@ audio_StreamSourceDecoder audio_vorbis_decoder = {
   .closeFile         = audio_vorbis_closeStream,
   .atEnd             = audio_vorbis_atEnd,
   .rewind            = audio_vorbis_rewindStream,
-  .preloadSamples    = audio_vorbis_preloadStreamSamples,
-  .uploadPreloadedSamples = audio_vorbis_uploadPreloadedStreamSamples,
-  .flush             = audio_vorbis_flushBuffer
+  .readSamples       = audio_vorbis_readStreamSamples
 };
 
 audio_StaticSourceDecoder audio_vorbis_static_decoder = {
@@ -178,6 +178,12 @@ bool filesystem_getLastModified(char const* filename, double *out) {
 }
 
 
+// Null until the identity is set
+char const* filesystem_getSaveDirectory(void) {
+  return moduleData.identityPath;
+}
+
+
 char const* filesystem_locateWritableFile(char const* filename) {
   buildFilename(moduleData.identityPath, filename);
   return moduleData.nameBuffer;
@@ -25,3 +25,4 @@ DIR* filesystem_openDir(char const* dirname, bool identity);
 bool filesystem_getLastModified(char const* filename, double *out);
 char const* filesystem_locateReadableFile(char const* filename);
 char const* filesystem_locateWritableFile(char const* filename);
+char const* filesystem_getSaveDirectory(void);
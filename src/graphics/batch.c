@@ -40,9 +40,17 @@ static void graphics_batch_makeIndexBuffer(int quadCount) {
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, moduleData.sharedIndexBuffer);
 
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) *6*quadCount, moduleData.sharedIndexBufferData, GL_STATIC_DRAW);
+  graphics_countBufferUpload(sizeof(uint16_t) *6*quadCount);
   moduleData.indexBufferSize = quadCount;
 }
 
+// Returns the shared index buffer for drawing quads made of four consecutive
+// vertices, grown to hold at least quadCount quads
+GLuint graphics_batch_getQuadIndexBuffer(int quadCount) {
+  graphics_batch_makeIndexBuffer(quadCount);
+  return moduleData.sharedIndexBuffer;
+}
+
 void graphics_batch_init(void) {
   glGenBuffers(1, &moduleData.sharedIndexBuffer);
   moduleData.sharedIndexBufferData = NULL; 
@@ -127,6 +135,7 @@ int graphics_Batch_add(graphics_Batch* batch, graphics_Quad const* q, float x, f
   } else {
     glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
     glBufferSubData(GL_ARRAY_BUFFER, batch->insertPos * 4, 4*sizeof(graphics_Vertex), v);
+    graphics_countBufferUpload(4*sizeof(graphics_Vertex));
   }
 
   return batch->insertPos++;
@@ -150,6 +159,7 @@ void graphics_Batch_setBufferSize(graphics_Batch* batch, int newsize) {
   if(!batch->bound) {
     glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
     glBufferData(GL_ARRAY_BUFFER, 4*newsize*sizeof(graphics_Vertex), batch->vertexData, batch->usage);
+    graphics_countBufferUpload(4*newsize*sizeof(graphics_Vertex));
   }
   batch->maxCount = newsize;
   if(batch->insertPos > newsize) {
@@ -190,6 +200,7 @@ void graphics_Batch_set(graphics_Batch* batch, int id, graphics_Quad const* q, f
   } else {
     glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
     glBufferSubData(GL_ARRAY_BUFFER, id * 4, 4*sizeof(graphics_Vertex), v);
+    graphics_countBufferUpload(4*sizeof(graphics_Vertex));
   }
 }
 
@@ -204,10 +215,10 @@ void graphics_Batch_draw(graphics_Batch const* batch,
                          float ox, float oy, float kx, float ky) {
 
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, batch->texture->texID);
+  graphics_Image_use(batch->texture);
   mat4x4 tr2d;
   m4x4_newTransform2d(&tr2d, x, y, r, sx, sy, ox, oy, kx, ky);
-  float const * color = batch->colorUsed ? defaultColor : graphics_getColor();
+  float const * color = batch->colorUsed ? defaultColor : graphics_getDrawColor();
 
   graphics_drawArray(&fullQuad, &tr2d, batch->vao, moduleData.sharedIndexBuffer, 0, batch->insertPos*6, GL_TRIANGLES, GL_UNSIGNED_SHORT, color, 1.0f, 1.0f, batch->colorUsed);
 }
@@ -221,6 +232,7 @@ void graphics_Batch_flush(graphics_Batch *batch) {
   glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
   glBufferData(GL_ARRAY_BUFFER, 4*batch->maxCount*sizeof(graphics_Vertex), NULL, batch->usage);
   glBufferSubData(GL_ARRAY_BUFFER, 0, 4*batch->insertPos*sizeof(graphics_Vertex), batch->vertexData);
+  graphics_countBufferUpload(4*batch->insertPos*sizeof(graphics_Vertex));
 }
 
 
@@ -39,6 +39,7 @@ typedef struct {
 
 
 void graphics_batch_init(void);
+GLuint graphics_batch_getQuadIndexBuffer(int quadCount);
 void graphics_Batch_new(graphics_Batch* batch, graphics_Image const* texture, int maxSize, graphics_BatchUsage usage);
 void graphics_Batch_free(graphics_Batch* batch);
 int graphics_Batch_add(graphics_Batch* batch, graphics_Quad const* q, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky);
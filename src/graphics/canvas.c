@@ -45,13 +45,24 @@ void graphics_Canvas_new(graphics_Canvas *canvas, int width, int height) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  // Gamma correct rendering blends in linear space on canvases too. It only
+  // exists on native builds, where GL_SRGB8_ALPHA8 is core.
+  bool srgb = graphics_isGammaCorrect();
+  glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
   glBindTexture(GL_TEXTURE_2D, oldTex);
 
   m4x4_newTranslation(&canvas->projectionMatrix, -1.0f, -1.0f, 0.0f);
   m4x4_scale(&canvas->projectionMatrix, 2.0f / width, 2.0f / height, 0.0f);
   canvas->image.width = width;
   canvas->image.height = height;
+  canvas->image.mipmaps = false;
+  canvas->image.compressed = false;
+  canvas->image.srgb = srgb;
+  canvas->image.bytes = 0;
+  canvas->image.source = 0;
+  canvas->image.evicted = false;
+  canvas->image.lruPrev = canvas->image.lruNext = 0;
+  graphics_Image_trackMemory(&canvas->image);
   canvas->stencilBuf = 0;
 }
 
@@ -85,6 +96,16 @@ void graphics_Canvas_draw(graphics_Canvas const* canvas, graphics_Quad const* qu
 }
 
 void graphics_setCanvas(graphics_Canvas ** canvas, int count) {
+  ++graphics_getStats()->canvasSwitches;
+
+  // Rendering only touched level 0 of the canvases we leave
+  for(int i = 0; i < moduleData.canvasCount; ++i) {
+    graphics_Canvas *old = moduleData.canvases[i];
+    if(old != &moduleData.defaultCanvas && old->image.mipmaps) {
+      graphics_Image_generateMipmaps(&old->image);
+    }
+  }
+
   if(!canvas || count == 0 || canvas[0]->image.texID == 0) {
     moduleData.canvases[0] = &moduleData.defaultCanvas;
     moduleData.canvasCount = 1;
@@ -92,12 +113,13 @@ void graphics_setCanvas(graphics_Canvas ** canvas, int count) {
     glViewport(0,0,graphics_getWidth(), graphics_getHeight());
   } else {
     glBindFramebuffer(GL_FRAMEBUFFER, moduleData.fbo);
+    assertCanvasCount(count);
     for(int i = 0; i < count; ++i) {
       glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, canvas[i]->image.texID, 0);
       moduleData.canvases[i] = canvas[i];
     }
     glDrawBuffers(count, moduleData.colorAttachments);
-    moduleData.canvasListSize = count;
+    moduleData.canvasCount = count;
     glViewport(0,0,canvas[0]->image.width, canvas[0]->image.height);
   }
 }
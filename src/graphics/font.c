@@ -26,7 +26,7 @@
 static const int GlyphTexturePadding = 1;
 
 typedef struct {
-  char const* ptr;
+  int start;
   int len;
   int width;
 } Word;
@@ -46,6 +46,7 @@ void graphics_GlyphMap_newTexture(graphics_GlyphMap *map) {
   glGenTextures(1, &map->textures[map->numTextures]);
   glBindTexture(GL_TEXTURE_2D, map->textures[map->numTextures]);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE_ALPHA, map->textureWidth, map->textureHeight, 0, GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, NULL);
+  graphics_image_adjustTextureMemory(map->textureWidth * map->textureHeight * 2);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
@@ -60,7 +61,16 @@ void graphics_GlyphMap_newTexture(graphics_GlyphMap *map) {
 
 void graphics_GlyphMap_free(graphics_GlyphMap* map) {
   glDeleteTextures(map->numTextures, map->textures);
+  graphics_image_adjustTextureMemory(-map->numTextures * map->textureWidth * map->textureHeight * 2);
   free(map->textures);
+
+  for(int i = 0; i < 256; ++i) {
+    graphics_GlyphSet *set = &map->glyphs[i];
+    for(int j = 0; j < set->numGlyphs; ++j) {
+      free(set->glyphs[j]);
+    }
+    free(set->glyphs);
+  }
 }
 
 graphics_Glyph const* graphics_Font_findGlyph(graphics_Font *font, unsigned unicode) {
@@ -78,7 +88,7 @@ graphics_Glyph const* graphics_Font_findGlyph(graphics_Font *font, unsigned unic
   // Do we already have the glyph?
   int i = 0;
   for(; i < set->numGlyphs; ++i) {
-    graphics_Glyph const* glyph = &set->glyphs[i];
+    graphics_Glyph const* glyph = set->glyphs[i];
     // The list is sorted, break early if possible
     if(glyph->code > unicode) {
       break;
@@ -87,22 +97,15 @@ graphics_Glyph const* graphics_Font_findGlyph(graphics_Font *font, unsigned unic
     }
   }
 
-  // Not found -> insert before last checked position
-  if(i > 0)
-    --i;
-
-  // Allocate new glyphs, copy old glyphs over and make space for the new one in the
-  // right position (leave space at insert point)
-  graphics_Glyph * newGlyphs = malloc(sizeof(graphics_Glyph) * (set->numGlyphs+1));
-  memcpy(newGlyphs, set->glyphs, i * sizeof(graphics_Glyph));
-  memcpy(newGlyphs + i + 1, set->glyphs + i, (set->numGlyphs - i) * sizeof(graphics_Glyph));
-  free((void*)set->glyphs);
-  set->glyphs = newGlyphs;
+  // Not found -> insert at the first position with a greater code point.
+  // Glyphs are allocated individually, so pointers to them stay valid
+  // when the set grows (shaped glyph runs depend on that).
+  set->glyphs = realloc(set->glyphs, sizeof(graphics_Glyph*) * (set->numGlyphs+1));
+  memmove(set->glyphs + i + 1, set->glyphs + i, (set->numGlyphs - i) * sizeof(graphics_Glyph*));
   ++set->numGlyphs;
 
-  // The storage for the new glyph data has been prepared in the last step,
-  // we can just use it.
-  graphics_Glyph * newGlyph = newGlyphs + i;
+  graphics_Glyph * newGlyph = malloc(sizeof(graphics_Glyph));
+  set->glyphs[i] = newGlyph;
 
   // Load and render the glyph at the desired size
   unsigned index = FT_Get_Char_Index(font->face, unicode);
@@ -150,6 +153,7 @@ graphics_Glyph const* graphics_Font_findGlyph(graphics_Font *font, unsigned unic
 
   // Store geometric information for the glyph
   newGlyph->code = unicode;
+  newGlyph->index           = index;
   newGlyph->bearingX        = font->face->glyph->metrics.horiBearingX >> 6;
   newGlyph->bearingY        = font->face->glyph->metrics.horiBearingY >> 6;
   newGlyph->advance         = font->face->glyph->metrics.horiAdvance  >> 6;
@@ -169,6 +173,109 @@ graphics_Glyph const* graphics_Font_findGlyph(graphics_Font *font, unsigned unic
   return newGlyph;
 }
 
+// Shaped glyph runs are cached per font and looked up by their source string.
+// Strings that are drawn every frame (labels, scores, ...) will only have to be
+// decoded and kerned once. The cache is flushed completely once it holds
+// GlyphRunCacheSize strings, which keeps constantly changing text from
+// accumulating stale runs without needing to track their usage.
+static const int GlyphRunCacheSize = 1024;
+
+static unsigned hashString(char const* str) {
+  // FNV-1a
+  unsigned hash = 2166136261u;
+  for(; *str; ++str) {
+    hash = (hash ^ (unsigned char)*str) * 16777619u;
+  }
+  return hash;
+}
+
+static void graphics_GlyphRunCache_clear(graphics_GlyphRunCache *cache) {
+  for(int i = 0; i < 256; ++i) {
+    graphics_GlyphRun *run = cache->buckets[i];
+    while(run) {
+      graphics_GlyphRun *next = run->next;
+      free(run->text);
+      free(run->glyphs);
+      free(run);
+      run = next;
+    }
+    cache->buckets[i] = NULL;
+  }
+  cache->count = 0;
+}
+
+static int getKerning(graphics_Font const* font, graphics_Glyph const* left, graphics_Glyph const* right) {
+  if(!font->hasKerning || !left || !right) {
+    return 0;
+  }
+
+  FT_Vector delta;
+  if(FT_Get_Kerning(font->face, left->index, right->index, FT_KERNING_DEFAULT, &delta)) {
+    return 0;
+  }
+
+  return delta.x >> 6;
+}
+
+graphics_GlyphRun const* graphics_Font_shape(graphics_Font *font, char const* text) {
+  unsigned hash = hashString(text);
+  graphics_GlyphRun **bucket = &font->runs.buckets[hash & 0xFF];
+
+  for(graphics_GlyphRun *run = *bucket; run; run = run->next) {
+    if(run->hash == hash && !strcmp(run->text, text)) {
+      return run;
+    }
+  }
+
+  if(font->runs.count >= GlyphRunCacheSize) {
+    graphics_GlyphRunCache_clear(&font->runs);
+  }
+
+  int len = strlen(text);
+  graphics_GlyphRun *run = malloc(sizeof(graphics_GlyphRun));
+  run->text = malloc(len + 1);
+  memcpy(run->text, text, len + 1);
+  run->hash = hash;
+
+  // Number of bytes is an upper limit for the number of code points
+  run->glyphs = malloc(sizeof(graphics_ShapedGlyph) * len);
+  run->count = 0;
+
+  graphics_Glyph const* previous = NULL;
+  int x = 0;
+  int line = 0;
+  uint32_t cp;
+  while((cp = utf8_scan(&text))) {
+    graphics_ShapedGlyph *shaped = &run->glyphs[run->count++];
+    shaped->line = line;
+
+    if(cp == '\n') {
+      shaped->glyph = NULL;
+      shaped->x = x;
+      shaped->kerning = 0;
+      previous = NULL;
+      x = 0;
+      ++line;
+      continue;
+    }
+
+    // This will create the glyph if required
+    graphics_Glyph const* glyph = graphics_Font_findGlyph(font, cp);
+    shaped->glyph = glyph;
+    shaped->kerning = getKerning(font, previous, glyph);
+    x += shaped->kerning;
+    shaped->x = x;
+    x += glyph->advance;
+    previous = glyph;
+  }
+
+  run->next = *bucket;
+  *bucket = run;
+  ++font->runs.count;
+
+  return run;
+}
+
 static int const TextureWidths[] =  {128, 128, 256, 256, 512,  512, 1024};
 static int const TextureHeights[] = {128, 256, 256, 512, 512, 1024, 1024};
 static int const TextureSizeCount = sizeof(TextureWidths) / sizeof(int);
@@ -186,6 +293,8 @@ int graphics_Font_new(graphics_Font *dst, char const* filename, int ptsize) {
   FT_Set_Pixel_Sizes(dst->face, 0, ptsize);
 
   memset(&dst->glyphs, 0, sizeof(graphics_GlyphMap));
+  memset(&dst->runs, 0, sizeof(graphics_GlyphRunCache));
+  dst->hasKerning = FT_HAS_KERNING(dst->face);
   int sizeIdx = TextureSizeCount - 1;
   dst->height = dst->face->size->metrics.height >> 6;
   int estArea = dst->height * dst->height * 80;
@@ -209,6 +318,7 @@ int graphics_Font_new(graphics_Font *dst, char const* filename, int ptsize) {
 }
 
 void graphics_Font_free(graphics_Font *obj) {
+  graphics_GlyphRunCache_clear(&obj->runs);
   FT_Done_Face(obj->face);
   graphics_GlyphMap_free(&obj->glyphs);
 }
@@ -229,16 +339,19 @@ int graphics_Font_getWrap(graphics_Font * font, char const* text, int width, cha
   return 0;
 }
 
-static void drawLine(graphics_Font* font, int x, int y, int start, int end, int rest, int spacewidth, float leftScale, float centerScale) {
+static void drawLine(graphics_GlyphRun const* run, int x, int y, int start, int end, int rest, int spacewidth, float leftScale, float centerScale) {
   if(rest < 0)
     rest = 0;
   x += rest * leftScale;
   spacewidth += centerScale / (end - start - 1) * rest;
   for(int i = start; i < end; ++i) {
+    graphics_ShapedGlyph const* shaped = run->glyphs + moduleData.line[i].start;
     for(int j = 0; j < moduleData.line[i].len; ++j) {
-      uint32_t cp = utf8_scan(&moduleData.line[i].ptr);
+      graphics_Glyph const* glyph = shaped[j].glyph;
+      if(j > 0) {
+        x += shaped[j].kerning;
+      }
 
-      graphics_Glyph const* glyph = graphics_Font_findGlyph(font, cp);
       graphics_Batch_add(&moduleData.batches[glyph->textureIdx], &glyph->textureCoords, x+glyph->bearingX, y-glyph->bearingY, 0, 1, 1, 0,0, 0, 0);
 
       x += glyph->advance;
@@ -247,12 +360,22 @@ static void drawLine(graphics_Font* font, int x, int y, int start, int end, int
   }
 }
 
+// Code point of the shaped glyph at idx, 0 past the end of the run
+static uint32_t runCodepoint(graphics_GlyphRun const* run, int idx) {
+  if(idx >= run->count) {
+    return 0;
+  }
+
+  graphics_Glyph const* glyph = run->glyphs[idx].glyph;
+  return glyph ? glyph->code : '\n';
+}
+
 static void prepareBatches(graphics_Font const* font, int chars) {
   int newSize = max(chars, moduleData.batchsize);
   if(font->glyphs.numTextures > moduleData.batchcount) {
     moduleData.batches = realloc(moduleData.batches, font->glyphs.numTextures * sizeof(graphics_Batch));
     for(int i = moduleData.batchcount; i < font->glyphs.numTextures; ++i) {
-      graphics_Image *img = malloc(sizeof(graphics_Image));
+      graphics_Image *img = calloc(1, sizeof(graphics_Image));
       img->texID = font->glyphs.textures[i];
       img->width = font->glyphs.textureWidth;
       img->height = font->glyphs.textureHeight;
@@ -282,25 +405,21 @@ static void prepareBatches(graphics_Font const* font, int chars) {
 }
 
 void graphics_Font_render(graphics_Font* font, char const* text, int px, int py, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
-  prepareBatches(font, strlen(text));
-  uint32_t cp;
+  graphics_GlyphRun const* run = graphics_Font_shape(font, text);
+  prepareBatches(font, run->count);
   graphics_Shader* shader = graphics_getShader();
   graphics_setDefaultShader();
-  int x = 0;
   //py += font->ascent;
-  int y = font->ascent;
-  while((cp = utf8_scan(&text))) {
-    if(cp == '\n') {
-      x = 0;
-      y += floor(font->height * font->lineHeight + 0.5f);
+  int lineHeight = floor(font->height * font->lineHeight + 0.5f);
+  for(int i = 0; i < run->count; ++i) {
+    graphics_ShapedGlyph const* shaped = &run->glyphs[i];
+    graphics_Glyph const* glyph = shaped->glyph;
+    if(!glyph) {
       continue;
     }
-    // This will create the glyph if required
-    graphics_Glyph const* glyph = graphics_Font_findGlyph(font, cp);
-
-    graphics_Batch_add(&moduleData.batches[glyph->textureIdx], &glyph->textureCoords, x+glyph->bearingX, y-glyph->bearingY, 0, 1, 1, 0, 0, 0, 0);
 
-    x += glyph->advance;
+    int y = font->ascent + shaped->line * lineHeight;
+    graphics_Batch_add(&moduleData.batches[glyph->textureIdx], &glyph->textureCoords, shaped->x+glyph->bearingX, y-glyph->bearingY, 0, 1, 1, 0, 0, 0, 0);
   }
 
   for(int i = 0; i < moduleData.batchcount; ++i) {
@@ -313,17 +432,16 @@ void graphics_Font_render(graphics_Font* font, char const* text, int px, int py,
 
 
 void graphics_Font_printf(graphics_Font* font, char const* text, int px, int py, int limit, graphics_TextAlign align, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
-  // Very cheap estimate of upper limit for actual string length
-  int count = strlen(text);
-  prepareBatches(font, count);
+  graphics_GlyphRun const* run = graphics_Font_shape(font, text);
+  prepareBatches(font, run->count);
 
   int currentWord = 0;
 
   //py += font->ascent;
   int y = font->ascent;
   int x = 0;
-  char const *lastPos = text;
-  int c = utf8_scan(&text);
+  int pos = 0;
+  uint32_t c = runCodepoint(run, pos);
   int currentWidth = 0;
   int spaceWidth = graphics_Font_findGlyph(font, ' ')->advance;
 
@@ -359,7 +477,7 @@ void graphics_Font_printf(graphics_Font* font, char const* text, int px, int py,
               default:
                 break;
               }
-              drawLine(font, x, y, start, xword, limit - width, spaceWidth, leftScale, centerScale);
+              drawLine(run, x, y, start, xword, limit - width, spaceWidth, leftScale, centerScale);
               start = xword;
               width = moduleData.line[xword].width;
               y += floor(font->height * font->lineHeight + 0.5f);
@@ -380,7 +498,7 @@ void graphics_Font_printf(graphics_Font* font, char const* text, int px, int py,
           default:
             break;
           }
-          drawLine(font, x, y, start, xword, limit - width, spaceWidth, leftScale, centerScale);
+          drawLine(run, x, y, start, xword, limit - width, spaceWidth, leftScale, centerScale);
           y += floor(font->height * font->lineHeight + 0.5f);
 
           currentWord = 0;
@@ -393,24 +511,26 @@ void graphics_Font_printf(graphics_Font* font, char const* text, int px, int py,
         }
       }
 
-      lastPos = text;
-      c = utf8_scan(&text);
+      c = runCodepoint(run, ++pos);
     }
 
     if(currentWord >= moduleData.wordcount) {
       moduleData.wordcount *= 2;
       moduleData.line = realloc(moduleData.line, moduleData.wordcount * sizeof(Word));
     }
-    moduleData.line[currentWord].ptr = lastPos;
+    moduleData.line[currentWord].start = pos;
     moduleData.line[currentWord].len = 0;
     moduleData.line[currentWord].width = 0;
 
     // Find end of current word, sum up length and width
     while(c != ' ' && c != '\t' && c != '\n' && c != '\0') {
+      graphics_ShapedGlyph const* shaped = &run->glyphs[pos];
+      if(moduleData.line[currentWord].len > 0) {
+        moduleData.line[currentWord].width += shaped->kerning;
+      }
+      moduleData.line[currentWord].width += shaped->glyph->advance;
       ++moduleData.line[currentWord].len;
-      graphics_Glyph const* g = graphics_Font_findGlyph(font, c);
-      moduleData.line[currentWord].width += g->advance;
-      c = utf8_scan(&text);
+      c = runCodepoint(run, ++pos);
     }
 
     ++currentWord;
@@ -453,11 +573,12 @@ int graphics_Font_getBaseline(graphics_Font const* font) {
 }
 
 int graphics_Font_getWidth(graphics_Font * font, char const* line) {
-  uint32_t uni;
+  graphics_GlyphRun const* run = graphics_Font_shape(font, line);
   int width=0;
-  while((uni = utf8_scan(&line))) {
-    graphics_Glyph const* g = graphics_Font_findGlyph(font, uni);
-    width += g->advance;
+  for(int i = 0; i < run->count; ++i) {
+    if(run->glyphs[i].glyph) {
+      width += run->glyphs[i].glyph->advance + run->glyphs[i].kerning;
+    }
   }
   return width;
 }
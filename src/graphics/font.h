@@ -10,6 +10,7 @@
 #pragma once
 
 #include <tgmath.h>
+#include <stdbool.h>
 #include "image.h"
 #include "quad.h"
 #include <ft2build.h>
@@ -17,6 +18,7 @@
 
 typedef struct {
   unsigned code;
+  unsigned index;
   int bearingX;
   int bearingY;
   int advance;
@@ -25,7 +27,7 @@ typedef struct {
 } graphics_Glyph;
 
 typedef struct {
-  graphics_Glyph const* glyphs;
+  graphics_Glyph ** glyphs;
   int numGlyphs;
 
 } graphics_GlyphSet;
@@ -44,9 +46,31 @@ typedef struct {
 
 } graphics_GlyphMap;
 
+typedef struct {
+  graphics_Glyph const* glyph;  // NULL for line breaks
+  int x;                        // Pen position relative to the start of the line, kerning included
+  int kerning;                  // Kerning applied between the previous glyph and this one
+  int line;
+} graphics_ShapedGlyph;
+
+typedef struct graphics_GlyphRun {
+  struct graphics_GlyphRun *next;
+  char *text;
+  unsigned hash;
+  int count;
+  graphics_ShapedGlyph *glyphs;
+} graphics_GlyphRun;
+
+typedef struct {
+  graphics_GlyphRun *buckets[256];
+  int count;
+} graphics_GlyphRunCache;
+
 typedef struct {
   FT_Face face;
   graphics_GlyphMap glyphs;
+  graphics_GlyphRunCache runs;
+  bool hasKerning;
   int height;
   int descent;
   int ascent;
@@ -72,6 +96,8 @@ int graphics_Font_getBaseline(graphics_Font const* font);
 
 int graphics_Font_getWidth(graphics_Font * font, char const* line);
 
+graphics_GlyphRun const* graphics_Font_shape(graphics_Font *font, char const* text);
+
 typedef enum {
   graphics_TextAlign_center,
   graphics_TextAlign_left,
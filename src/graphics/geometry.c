@@ -10,11 +10,23 @@
 #include <tgmath.h>
 #include <stdlib.h>
 #include "../math/util.h"
+#include "../math/simd.h"
 #include "geometry.h"
 #include "graphics.h"
 #include "shader.h"
 #include "matrixstack.h"
 
+// Unit circle points sin(i * 2pi / segments), cos(i * 2pi / segments),
+// padded to a multiple of four
+typedef struct {
+  int segments;
+  float *sin;
+  float *cos;
+} CircleTable;
+
+// Direct mapped by segment count, most programs only use a handful
+#define CIRCLE_CACHE_SIZE 32
+
 static struct {
   GLuint dataVBO;
   GLuint dataIBO;
@@ -28,6 +40,7 @@ static struct {
   graphics_LineJoin join;
   graphics_DrawStyle pointStyle;
   float pointSize;
+  CircleTable circles[CIRCLE_CACHE_SIZE];
 } moduleData;
 
 
@@ -71,11 +84,61 @@ static void growBuffers(int vertices, int indices) {
 }
 
 
+static CircleTable const* getCircleTable(int segments) {
+  CircleTable *table = moduleData.circles + segments % CIRCLE_CACHE_SIZE;
+  if(table->segments == segments) {
+    return table;
+  }
+
+  free(table->sin);
+  free(table->cos);
+  int padded = (segments + 3) & ~3;
+  table->sin = malloc(padded * sizeof(float));
+  table->cos = malloc(padded * sizeof(float));
+  table->segments = segments;
+
+  // Computed in double precision from the index, so the last point does not
+  // drift the way an accumulated angle does
+  double step = 2.0 * PI / segments;
+  for(int i = 0; i < padded; ++i) {
+    table->sin[i] = (float)sin(step * i);
+    table->cos[i] = (float)cos(step * i);
+  }
+
+  return table;
+}
+
+
+// Writes x + sin * sx, y + cos * sy to the first two floats of every
+// stride floats in out
+static void placeCircle(float *out, int stride, CircleTable const* table, float x, float y, float sx, float sy) {
+  math_float4 const x4  = math_float4_set1(x);
+  math_float4 const y4  = math_float4_set1(y);
+  math_float4 const sx4 = math_float4_set1(sx);
+  math_float4 const sy4 = math_float4_set1(sy);
+  float px[4];
+  float py[4];
+
+  for(int i = 0; i < table->segments; i += 4) {
+    math_float4_store(px, math_float4_madd(x4, math_float4_load(table->sin + i), sx4));
+    math_float4_store(py, math_float4_madd(y4, math_float4_load(table->cos + i), sy4));
+
+    int n = table->segments - i < 4 ? table->segments - i : 4;
+    for(int j = 0; j < n; ++j) {
+      out[(i+j) * stride    ] = px[j];
+      out[(i+j) * stride + 1] = py[j];
+    }
+  }
+}
+
+
 static void drawBuffer(int vertices, int indices, GLenum type) {
   glBindBuffer(GL_ARRAY_BUFFER, moduleData.dataVBO);
   glBufferData(GL_ARRAY_BUFFER, vertices*6*sizeof(float), moduleData.data, GL_STREAM_DRAW);
+  graphics_countBufferUpload(vertices*6*sizeof(float));
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, moduleData.dataIBO);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices*sizeof(uint16_t), moduleData.index, GL_STREAM_DRAW);
+  graphics_countBufferUpload(indices*sizeof(uint16_t));
 
   graphics_Shader *shader = graphics_getShader();
   graphics_setShader(&moduleData.plainColorShader);
@@ -83,42 +146,33 @@ static void drawBuffer(int vertices, int indices, GLenum type) {
   m4x4_newIdentity(&tr);
   graphics_Quad quad = {0,0,1,1};
 
-  graphics_drawArray(&quad, &tr, moduleData.dataVAO, moduleData.dataIBO, 0, indices, type, GL_UNSIGNED_SHORT, graphics_getColor(), 1, 1, false);
+  graphics_drawArray(&quad, &tr, moduleData.dataVAO, moduleData.dataIBO, 0, indices, type, GL_UNSIGNED_SHORT, graphics_getDrawColor(), 1, 1, false);
 
   graphics_setShader(shader);
 }
 
 void graphics_geometry_drawCircle(float x, float y, float radius, int segments) {
+  if(segments < 1) {
+    return;
+  }
+
   growBuffers(segments*2, segments*2+2);
+  CircleTable const* table = getCircleTable(segments);
+
+  float lwh = moduleData.lineWidth / 2.0f;
+  // outer and inner vertices alternate
+  placeCircle(moduleData.data,     12, table, x, y, radius + lwh, radius + lwh);
+  placeCircle(moduleData.data + 6, 12, table, x, y, radius - lwh, radius - lwh);
 
-  float step = 2*PI / segments;
-  float ang = 0;
   moduleData.index[2*segments  ] = 0;
   moduleData.index[2*segments+1] = 1;
-  float lwh = moduleData.lineWidth / 2.0f;
-  for(int i = 0; i < segments; ++i, ang += step) {
-    float s = sin(ang);
-    float c = cos(ang);
-    float * base = moduleData.data + 12*i;
-
-    // outer vertex
-    base[0] = s * (radius+lwh) + x;
-    base[1] = c * (radius+lwh) + y;
-    base[2]  = 1.0f;
-    base[3]  = 1.0f;
-    base[4]  = 1.0f;
-    base[5]  = 1.0f;
-
-    // inner vertex
-    base[6] = s * (radius-lwh) + x;
-    base[7] = c * (radius-lwh) + y;
-    base[8]  = 1.0f;
-    base[9]  = 1.0f;
-    base[10] = 1.0f;
-    base[11] = 1.0f;
-
-    moduleData.index[2*i] = 2*i;
-    moduleData.index[2*i+1] = 2*i+1;
+  for(int i = 0; i < 2*segments; ++i) {
+    float * base = moduleData.data + 6*i;
+    base[2] = 1.0f;
+    base[3] = 1.0f;
+    base[4] = 1.0f;
+    base[5] = 1.0f;
+    moduleData.index[i] = i;
   }
 
   drawBuffer(segments*2, segments*2+2, GL_TRIANGLE_STRIP);
@@ -126,27 +180,26 @@ void graphics_geometry_drawCircle(float x, float y, float radius, int segments)
 
 
 void graphics_geometry_fillCircle(float x, float y, float radius, int segments) {
+  if(segments < 1) {
+    return;
+  }
+
   growBuffers(segments+1, segments+2);
+  CircleTable const* table = getCircleTable(segments);
 
-  float step = 2*PI / segments;
-  float ang = 0;
   moduleData.data[0] = x;
   moduleData.data[1] = y;
-  moduleData.data[2] = 1.0f;
-  moduleData.data[3] = 1.0f;
-  moduleData.data[4] = 1.0f;
-  moduleData.data[5] = 1.0f;
-  moduleData.index[0] = 0;
+  // Mirrored in x to keep the winding of the fan
+  placeCircle(moduleData.data + 6, 6, table, x, y, -radius, radius);
+
   moduleData.index[segments+1] = 1;
-  for(int i = 0; i < segments; ++i, ang -= step) {
-    float * base = moduleData.data + 6*(i+1);
-    base[0] = sin(ang) * radius + x;
-    base[1] = cos(ang) * radius + y;
+  for(int i = 0; i <= segments; ++i) {
+    float * base = moduleData.data + 6*i;
     base[2] = 1.0f;
     base[3] = 1.0f;
     base[4] = 1.0f;
     base[5] = 1.0f;
-    moduleData.index[i+1] = i+1;
+    moduleData.index[i] = i;
   }
 
   drawBuffer(segments+1, segments+2, GL_TRIANGLE_FAN);
@@ -462,6 +515,11 @@ void graphics_geometry_point(float x, float y) {
 }
 
 
+graphics_Shader* graphics_geometry_getPlainColorShader(void) {
+  return &moduleData.plainColorShader;
+}
+
+
 float graphics_geometry_getLineWidth(void) {
   return moduleData.lineWidth;
 }
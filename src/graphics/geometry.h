@@ -10,6 +10,7 @@
 #pragma once
 
 #include "graphics.h"
+#include "shader.h"
 
 typedef enum {
   graphics_DrawMode_fill,
@@ -29,6 +30,9 @@ typedef enum {
 
 void graphics_geometry_init(void);
 
+// Ignores textures and draws in the current color
+graphics_Shader* graphics_geometry_getPlainColorShader(void);
+
 void graphics_geometry_fillRectangle(float x, float y, float w, float h);
 void graphics_geometry_drawRectangle(float x, float y, float w, float h);
 
@@ -49,8 +49,6 @@ void graphics_Texture_setFilter(GLuint texID, graphics_Filter const* filter) {
         break;
       }
     }
-    glGenerateMipmap(GL_TEXTURE_2D);
-
   }
 
   int magFilter = (filter->magMode == graphics_FilterMode_linear) ? GL_LINEAR : GL_NEAREST;
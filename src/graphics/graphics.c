@@ -9,10 +9,12 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <SDL.h>
 #include "graphics.h"
 #include "gl.h"
 #include "../math/vector.h"
+#include "../math/gamma.h"
 #include "matrixstack.h"
 #include "font.h"
 #include "batch.h"
@@ -21,6 +23,7 @@
 #include "shader.h"
 #include "geometry.h"
 #include "particlesystem.h"
+#include "mesh.h"
 #ifdef EMSCRIPTEN
 # include <emscripten.h>
 #endif
@@ -35,10 +38,17 @@ static struct {
 
   graphics_DisplayState state;
 
+  // Rendering goes to an sRGB framebuffer and blends in linear space
+  bool gammaCorrect;
+  // Foreground colour as given to the shaders, linear when gamma correct
+  graphics_Color drawColor;
+
   GLuint polygonVBO;
   GLuint polygonIBO;
   GLuint polygonVAO;
   graphics_Filter defaultFilter;
+
+  graphics_Stats stats;
 } moduleData = {
   .defaultFilter = {
     .maxAnisotropy = 1.0f,
@@ -55,7 +65,7 @@ static struct {
   }
 //#endif
 
-void graphics_init(int width, int height) {
+void graphics_init(int width, int height, bool srgb) {
   SDL_Init(SDL_INIT_VIDEO);
   //#ifdef EMSCRIPTEN
   //  moduleData.surface = SDL_SetVideoMode(width, height, 0, SDL_OPENGL);
@@ -71,6 +81,9 @@ void graphics_init(int width, int height) {
   #endif
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 16);
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+  #ifndef EMSCRIPTEN
+    SDL_GL_SetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, srgb);
+  #endif
 
     #if EMSCRIPTEN
       char const * title = emscripten_run_script_string("document.title");
@@ -89,6 +102,17 @@ void graphics_init(int width, int height) {
     printf("%d\n", glewInit());
   #ifndef EMSCRIPTEN
     SDL_GL_SetSwapInterval(1);
+
+    // WebGL 1 has no sRGB framebuffers
+    int srgbCapable = 0;
+    SDL_GL_GetAttribute(SDL_GL_FRAMEBUFFER_SRGB_CAPABLE, &srgbCapable);
+    moduleData.gammaCorrect = srgb && srgbCapable;
+    if(moduleData.gammaCorrect) {
+      glEnable(GL_FRAMEBUFFER_SRGB);
+    }
+  #else
+    (void)srgb;
+    moduleData.gammaCorrect = false;
   #endif
 
   //#endif
@@ -107,6 +131,7 @@ void graphics_init(int width, int height) {
   graphics_image_init();
   graphics_shader_init();
   graphics_particlesystem_init();
+  graphics_mesh_init();
 
   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   glPixelStorei(GL_PACK_ALIGNMENT, 1);
@@ -127,14 +152,27 @@ void graphics_setBackgroundColor(float red, float green, float blue, float alpha
   moduleData.state.backgroundColor.green = green;
   moduleData.state.backgroundColor.blue  = blue;
   moduleData.state.backgroundColor.alpha = alpha;
-  glClearColor(red, green, blue, alpha);
+  if(moduleData.gammaCorrect) {
+    glClearColor(math_gammaToLinear(red), math_gammaToLinear(green), math_gammaToLinear(blue), alpha);
+  } else {
+    glClearColor(red, green, blue, alpha);
+  }
 }
 
+// Colours are given in sRGB. They are converted here once instead of in
+// every shader invocation.
 void graphics_setColor(float red, float green, float blue, float alpha) {
   moduleData.state.foregroundColor.red   = red;
   moduleData.state.foregroundColor.green = green;
   moduleData.state.foregroundColor.blue  = blue;
   moduleData.state.foregroundColor.alpha = alpha;
+
+  moduleData.drawColor = moduleData.state.foregroundColor;
+  if(moduleData.gammaCorrect) {
+    moduleData.drawColor.red   = math_gammaToLinear(red);
+    moduleData.drawColor.green = math_gammaToLinear(green);
+    moduleData.drawColor.blue  = math_gammaToLinear(blue);
+  }
 }
 
 void graphics_clear(void) {
@@ -147,10 +185,19 @@ void graphics_swap(void) {
 //#else
   SDL_GL_SwapWindow(moduleData.window);
 //#endif
+  memset(&moduleData.stats, 0, sizeof(moduleData.stats));
 }
 
-void graphics_drawArray(graphics_Quad const* quad, mat4x4 const* tr2d, GLuint vao, GLuint ibo, GLuint offset, GLuint count, GLenum type, GLenum indexType, float const* useColor, float ws, float hs, bool useVertexColors) {
+graphics_Stats* graphics_getStats(void) {
+  return &moduleData.stats;
+}
 
+void graphics_countBufferUpload(size_t bytes) {
+  ++moduleData.stats.bufferUploads;
+  moduleData.stats.bufferUploadBytes += bytes;
+}
+
+static void activateShader(graphics_Quad const* quad, mat4x4 const* tr2d, float const* useColor, float ws, float hs, bool useVertexColors) {
   mat4x4 tr;
   m4x4_mulM4x4(&tr, tr2d, matrixstack_head());
 
@@ -172,10 +219,31 @@ void graphics_drawArray(graphics_Quad const* quad, mat4x4 const* tr2d, GLuint va
     useVertexColors,
     screenSize
   );
+}
+
+void graphics_drawArray(graphics_Quad const* quad, mat4x4 const* tr2d, GLuint vao, GLuint ibo, GLuint offset, GLuint count, GLenum type, GLenum indexType, float const* useColor, float ws, float hs, bool useVertexColors) {
+
+  activateShader(quad, tr2d, useColor, ws, hs, useVertexColors);
 
   glBindVertexArray(vao);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
   glDrawElements(type, count, indexType, (GLvoid const*)offset);
+
+  ++moduleData.stats.drawCalls;
+  moduleData.stats.vertices += count;
+}
+
+// Needs instancing support, see graphics_mesh_isInstancingSupported
+void graphics_drawArrayInstanced(graphics_Quad const* quad, mat4x4 const* tr2d, GLuint vao, GLuint ibo, GLuint offset, GLuint count, GLenum type, GLenum indexType, float const* useColor, float ws, float hs, bool useVertexColors, GLuint instances) {
+
+  activateShader(quad, tr2d, useColor, ws, hs, useVertexColors);
+
+  glBindVertexArray(vao);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+  glDrawElementsInstanced(type, count, indexType, (GLvoid const*)(uintptr_t)offset, instances);
+
+  ++moduleData.stats.drawCalls;
+  moduleData.stats.vertices += count * instances;
 }
 
 int graphics_getWidth(void) {
@@ -190,6 +258,14 @@ float* graphics_getColor(void) {
   return (float*)(&moduleData.state.foregroundColor);
 }
 
+float const* graphics_getDrawColor(void) {
+  return (float const*)(&moduleData.drawColor);
+}
+
+bool graphics_isGammaCorrect(void) {
+  return moduleData.gammaCorrect;
+}
+
 float* graphics_getBackgroundColor(void) {
   return (float*)(&moduleData.state.backgroundColor);
 }
@@ -339,4 +415,6 @@ graphics_DisplayState const* graphics_getState(void) {
 
 void graphics_setState(graphics_DisplayState const* state) {
   memcpy(&moduleData.state, state, sizeof(*state));
+  graphics_Color const* c = &state->foregroundColor;
+  graphics_setColor(c->red, c->green, c->blue, c->alpha);
 }
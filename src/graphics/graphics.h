@@ -15,7 +15,7 @@
 #include "../math/vector.h"
 #include "canvas.h"
 
-void graphics_init(int width, int height);
+void graphics_init(int width, int height, bool srgb);
 
 typedef enum {
   graphics_BlendMode_additive,
@@ -45,13 +45,27 @@ typedef struct {
 
 } graphics_DisplayState;
 
+// Work done since the last graphics_swap
+typedef struct {
+  int drawCalls;
+  int vertices;
+  int shaderSwitches;
+  int canvasSwitches;
+  int textureBinds;
+  int bufferUploads;
+  size_t bufferUploadBytes;
+} graphics_Stats;
+
 void graphics_setBackgroundColor(float red, float green, float blue, float alpha);
 void graphics_setColor(float red, float green, float blue, float alpha);
 float* graphics_getColor(void);
+float const* graphics_getDrawColor(void);
+bool graphics_isGammaCorrect(void);
 float* graphics_getBackgroundColor(void);
 void graphics_clear(void);
 void graphics_swap(void);
 void graphics_drawArray(graphics_Quad const* quad, mat4x4 const* tr2d, GLuint vao, GLuint ibo, GLuint offset, GLuint count, GLenum type, GLenum indexType, float const * useColor, float ws, float hs, bool useVertexColors);
+void graphics_drawArrayInstanced(graphics_Quad const* quad, mat4x4 const* tr2d, GLuint vao, GLuint ibo, GLuint offset, GLuint count, GLenum type, GLenum indexType, float const * useColor, float ws, float hs, bool useVertexColors, GLuint instances);
 int graphics_getWidth(void);
 int graphics_getHeight(void);
 void graphics_setColorMask(bool r, bool g, bool b, bool a);
@@ -68,3 +82,5 @@ void graphics_discardStencil(void);
 graphics_Filter* graphics_getDefaultFilter(void);
 graphics_DisplayState const* graphics_getState(void);
 void graphics_setState(graphics_DisplayState const* state);
+graphics_Stats* graphics_getStats(void);
+void graphics_countBufferUpload(size_t bytes);
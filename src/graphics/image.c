@@ -7,6 +7,8 @@
     under the terms of the MIT license. See LICENSE.md for details.
 */
 
+#include <stdlib.h>
+#include <string.h>
 #include "image.h"
 #include "../image/imagedata.h"
 #include "../math/vector.h"
@@ -17,9 +19,136 @@ static struct {
   GLuint imageVBO;
   GLuint imageIBO;
   GLuint imageVAO;
+
+  // Loads waiting for decoding or upload, oldest first
+  graphics_ImageLoad *firstLoad;
+  graphics_ImageLoad *lastLoad;
+  // Bytes uploaded per frame, at least one row always makes it
+  int uploadBudget;
+
+  // Formats the GPU can sample directly, the others are decoded on load
+  bool compressedFormats[image_CompressedFormat_count];
+  GLenum etc1Format;
+
+  bool srgbTextures;
+
+  // Texture memory of images, canvases and font atlases
+  size_t textureMemory;
+  size_t peakTextureMemory;
+  // 0 for no limit
+  size_t textureBudget;
+  unsigned frame;
+  graphics_Image *lruFirst;
+  graphics_Image *lruLast;
 } moduleData;
 
+#ifndef GL_SRGB_ALPHA_EXT
+# define GL_SRGB_ALPHA_EXT 0x8C42
+#endif
+#ifndef GL_SRGB8_ALPHA8
+# define GL_SRGB8_ALPHA8 0x8C43
+#endif
+
+// Enums from the compression extensions, missing in some headers
+static GLenum const compressedGLFormats[image_CompressedFormat_count] = {
+  0x83F1, // COMPRESSED_RGBA_S3TC_DXT1_EXT
+  0x83F2, // COMPRESSED_RGBA_S3TC_DXT3_EXT
+  0x83F3, // COMPRESSED_RGBA_S3TC_DXT5_EXT
+  0,      // ETC1, see moduleData.etc1Format
+  0x9274, // COMPRESSED_RGB8_ETC2
+  0x9278, // COMPRESSED_RGBA8_ETC2_EAC
+  0x93B0, // COMPRESSED_RGBA_ASTC_4x4_KHR
+  0x93B2, // COMPRESSED_RGBA_ASTC_5x5_KHR
+  0x93B4, // COMPRESSED_RGBA_ASTC_6x6_KHR
+  0x93B7, // COMPRESSED_RGBA_ASTC_8x8_KHR
+  0x93BB, // COMPRESSED_RGBA_ASTC_10x10_KHR
+  0x93BD  // COMPRESSED_RGBA_ASTC_12x12_KHR
+};
+
+// sRGB variants of the above, ETC1 has none and uses the ETC2 one
+static GLenum const compressedSRGBFormats[image_CompressedFormat_count] = {
+  0x8C4D, // COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+  0x8C4E, // COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT
+  0x8C4F, // COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+  0x9275, // COMPRESSED_SRGB8_ETC2
+  0x9275, // COMPRESSED_SRGB8_ETC2
+  0x9279, // COMPRESSED_SRGB8_ALPHA8_ETC2_EAC
+  0x93D0, // COMPRESSED_SRGB8_ALPHA8_ASTC_4x4_KHR
+  0x93D2, // COMPRESSED_SRGB8_ALPHA8_ASTC_5x5_KHR
+  0x93D4, // COMPRESSED_SRGB8_ALPHA8_ASTC_6x6_KHR
+  0x93D7, // COMPRESSED_SRGB8_ALPHA8_ASTC_8x8_KHR
+  0x93DB, // COMPRESSED_SRGB8_ALPHA8_ASTC_10x10_KHR
+  0x93DD  // COMPRESSED_SRGB8_ALPHA8_ASTC_12x12_KHR
+};
+
+#ifdef EMSCRIPTEN
+// Emscripten lists WebGL extensions with and without a GL_ prefix. Names
+// must match whole, WEBGL_compressed_texture_etc is a prefix of ..._etc1.
+static bool hasExtension(char const* extensions, char const* name) {
+  size_t len = strlen(name);
+  char const* p = extensions;
+  while(p && (p = strstr(p, name))) {
+    bool start = p == extensions || p[-1] == ' ' || p[-1] == '_';
+    bool end = p[len] == ' ' || p[len] == 0;
+    if(start && end) {
+      return true;
+    }
+    p += len;
+  }
+  return false;
+}
+#endif
+
+static void detectCompressedFormats(void) {
+  bool s3tc, etc1, etc2, astc;
+#ifdef EMSCRIPTEN
+  char const* extensions = (char const*)glGetString(GL_EXTENSIONS);
+  s3tc = hasExtension(extensions, "WEBGL_compressed_texture_s3tc");
+  etc2 = hasExtension(extensions, "WEBGL_compressed_texture_etc");
+  etc1 = hasExtension(extensions, "WEBGL_compressed_texture_etc1");
+  astc = hasExtension(extensions, "WEBGL_compressed_texture_astc");
+#else
+  s3tc = GLEW_EXT_texture_compression_s3tc;
+  etc2 = GLEW_ARB_ES3_compatibility;
+  etc1 = false;
+  astc = GLEW_KHR_texture_compression_astc_ldr;
+#endif
+
+  // ETC2 decoders read ETC1 data as well
+  moduleData.etc1Format = etc2 ? 0x9274 : 0x8D64;
+  etc1 = etc1 || etc2;
+
+  for(int i = 0; i < image_CompressedFormat_count; ++i) {
+    switch(i) {
+    case image_CompressedFormat_DXT1:
+    case image_CompressedFormat_DXT3:
+    case image_CompressedFormat_DXT5:
+      moduleData.compressedFormats[i] = s3tc;
+      break;
+    case image_CompressedFormat_ETC1:
+      moduleData.compressedFormats[i] = etc1;
+      break;
+    case image_CompressedFormat_ETC2RGB:
+    case image_CompressedFormat_ETC2RGBA:
+      moduleData.compressedFormats[i] = etc2;
+      break;
+    default:
+      moduleData.compressedFormats[i] = astc;
+      break;
+    }
+  }
+}
+
 void graphics_image_init(void) {
+  moduleData.uploadBudget = 4 * 1024 * 1024;
+  detectCompressedFormats();
+
+#ifdef EMSCRIPTEN
+  moduleData.srgbTextures = hasExtension((char const*)glGetString(GL_EXTENSIONS), "EXT_sRGB");
+#else
+  moduleData.srgbTextures = true;
+#endif
+
   glGenVertexArrays(1, &moduleData.imageVAO);
   glBindVertexArray(moduleData.imageVAO);
   glGenBuffers(1, &moduleData.imageVBO);
@@ -54,29 +183,499 @@ static const graphics_Wrap defaultWrap = {
 };
 
 
-void graphics_Image_new_with_ImageData(graphics_Image *dst, image_ImageData const *data) {
+// WebGL 1 with EXT_sRGB uses the unsized sRGB format for both the texture
+// and the pixel data
+static GLenum internalFormat(graphics_Image const* img) {
+#ifdef EMSCRIPTEN
+  return img->srgb ? GL_SRGB_ALPHA_EXT : GL_RGBA;
+#else
+  return img->srgb ? GL_SRGB8_ALPHA8 : GL_RGBA;
+#endif
+}
+
+static GLenum pixelFormat(graphics_Image const* img) {
+#ifdef EMSCRIPTEN
+  return img->srgb ? GL_SRGB_ALPHA_EXT : GL_RGBA;
+#else
+  (void)img;
+  return GL_RGBA;
+#endif
+}
+
+void graphics_image_adjustTextureMemory(int bytes) {
+  moduleData.textureMemory += bytes;
+  if(moduleData.textureMemory > moduleData.peakTextureMemory) {
+    moduleData.peakTextureMemory = moduleData.textureMemory;
+  }
+}
+
+static void setTextureBytes(graphics_Image *img, int bytes) {
+  graphics_image_adjustTextureMemory(bytes - img->bytes);
+  img->bytes = bytes;
+}
+
+// Counts 4 bytes per texel on every level of an uncompressed texture
+void graphics_Image_trackMemory(graphics_Image *img) {
+  int w = img->width;
+  int h = img->height;
+  int bytes = w * h * 4;
+  while(img->mipmaps && (w > 1 || h > 1)) {
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+    bytes += w * h * 4;
+  }
+  setTextureBytes(img, bytes);
+}
+
+static void createTexture(graphics_Image *dst, bool srgb) {
+  dst->mipmaps = false;
+  dst->compressed = false;
+  dst->srgb = srgb && moduleData.srgbTextures;
+  dst->bytes = 0;
+  dst->source = 0;
+  dst->evicted = false;
+  dst->lastDrawn = 0;
+  dst->lruPrev = dst->lruNext = 0;
   glGenTextures(1, &dst->texID);
   glBindTexture(GL_TEXTURE_2D, dst->texID);
   graphics_Image_setFilter(dst, graphics_getDefaultFilter());
 
   graphics_Image_setWrap(dst, &defaultWrap);
+}
+
+bool graphics_image_isSRGBSupported(void) {
+  return moduleData.srgbTextures;
+}
+
+// srgb is ignored if sRGB textures are not supported
+void graphics_Image_new_with_ImageData(graphics_Image *dst, image_ImageData const *data, bool srgb) {
+  createTexture(dst, srgb);
 
   graphics_Image_refresh(dst, data);
 }
 
+bool graphics_image_isCompressedFormatSupported(image_CompressedFormat format) {
+  return moduleData.compressedFormats[format];
+}
+
+// Uploads all mipmap levels as they are if the GPU supports the format.
+// Otherwise they are decoded to RGBA first, which fails for formats without
+// a software decoder.
+bool graphics_Image_new_with_CompressedImageData(graphics_Image *dst, image_CompressedImageData const* data, bool srgb) {
+  bool native = moduleData.compressedFormats[data->format];
+  if(!native && !image_compressedFormat_canDecode(data->format)) {
+    return false;
+  }
+
+  createTexture(dst, srgb);
+
+  GLenum format = data->format == image_CompressedFormat_ETC1
+                ? moduleData.etc1Format
+                : compressedGLFormats[data->format];
+#ifdef EMSCRIPTEN
+  // The sRGB variants need separate WebGL extensions, decode instead
+  if(dst->srgb && native && image_compressedFormat_canDecode(data->format)) {
+    native = false;
+  } else if(native) {
+    dst->srgb = false;
+  }
+#else
+  if(dst->srgb && native) {
+    format = compressedSRGBFormats[data->format];
+  }
+#endif
+
+  int bytes = 0;
+  for(int i = 0; i < data->mipmapCount; ++i) {
+    image_CompressedMipmap const* mip = data->mipmaps + i;
+    if(native) {
+      glCompressedTexImage2D(GL_TEXTURE_2D, i, format, mip->width, mip->height, 0, mip->size, mip->data);
+      bytes += mip->size;
+    } else {
+      bytes += mip->width * mip->height * 4;
+      image_ImageData decoded;
+      image_CompressedImageData_decode(data, i, &decoded);
+      glTexImage2D(GL_TEXTURE_2D, i, internalFormat(dst), decoded.w, decoded.h, 0, pixelFormat(dst), GL_UNSIGNED_BYTE, decoded.surface);
+      image_ImageData_free(&decoded);
+    }
+  }
+
+#ifndef EMSCRIPTEN
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, data->mipmapCount - 1);
+#endif
+
+  dst->width = data->mipmaps[0].width;
+  dst->height = data->mipmaps[0].height;
+  dst->mipmaps = data->mipmapCount > 1;
+  dst->compressed = native;
+  setTextureBytes(dst, bytes);
+  return true;
+}
+
+static void lruUnlink(graphics_Image *img) {
+  if(img->lruPrev) {
+    img->lruPrev->lruNext = img->lruNext;
+  } else if(moduleData.lruFirst == img) {
+    moduleData.lruFirst = img->lruNext;
+  }
+
+  if(img->lruNext) {
+    img->lruNext->lruPrev = img->lruPrev;
+  } else if(moduleData.lruLast == img) {
+    moduleData.lruLast = img->lruPrev;
+  }
+
+  img->lruPrev = img->lruNext = 0;
+}
+
+static void lruAppend(graphics_Image *img) {
+  img->lruNext = 0;
+  img->lruPrev = moduleData.lruLast;
+  if(moduleData.lruLast) {
+    moduleData.lruLast->lruNext = img;
+  } else {
+    moduleData.lruFirst = img;
+  }
+  moduleData.lruLast = img;
+}
+
 void graphics_Image_refresh(graphics_Image *img, image_ImageData const *data) {
+  if(img->evicted) {
+    img->evicted = false;
+    lruAppend(img);
+  }
+
   glBindTexture(GL_TEXTURE_2D, img->texID);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, data->w, data->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data->surface);
+  glTexImage2D(GL_TEXTURE_2D, 0, internalFormat(img), data->w, data->h, 0, pixelFormat(img), GL_UNSIGNED_BYTE, data->surface);
   img->width = data->w;
   img->height = data->h;
+
+  if(img->mipmaps) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+  graphics_Image_trackMemory(img);
+}
+
+
+// Respecifying every level as 0x0 frees the storage, but keeps the texture
+// object with its filter and wrap settings
+static void evict(graphics_Image *img) {
+  glBindTexture(GL_TEXTURE_2D, img->texID);
+  int w = img->width;
+  int h = img->height;
+  for(int level = 0; ; ++level) {
+    glTexImage2D(GL_TEXTURE_2D, level, internalFormat(img), 0, 0, 0, pixelFormat(img), GL_UNSIGNED_BYTE, 0);
+    if(!img->mipmaps || (w == 1 && h == 1)) {
+      break;
+    }
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+  }
+
+  lruUnlink(img);
+  img->evicted = true;
+  setTextureBytes(img, 0);
+}
+
+static void restore(graphics_Image *img) {
+  graphics_Image_refresh(img, img->source);
+}
+
+// Images drawn in the current frame are kept even if that exceeds the
+// budget, uploading them again every frame would be worse
+static void enforceBudget(void) {
+  while(moduleData.textureBudget && moduleData.textureMemory > moduleData.textureBudget
+        && moduleData.lruFirst && moduleData.lruFirst->lastDrawn != moduleData.frame) {
+    evict(moduleData.lruFirst);
+  }
+}
+
+// Images with a source may be evicted when the texture budget is exceeded
+// and are uploaded from it again on the next draw. source has to outlive
+// the image or be replaced. Without a source the image stays resident.
+void graphics_Image_setSource(graphics_Image *img, image_ImageData const* source) {
+  if(img->evicted) {
+    restore(img);
+  }
+  if(img->source) {
+    lruUnlink(img);
+  }
+
+  img->source = source;
+  if(source) {
+    img->lastDrawn = moduleData.frame;
+    lruAppend(img);
+    enforceBudget();
+  }
+}
+
+// Binds the texture for drawing. Residency is not part of the visible state
+// of an image, hence the const.
+void graphics_Image_use(graphics_Image const* image) {
+  graphics_Image *img = (graphics_Image*)image;
+  img->lastDrawn = moduleData.frame;
+  if(img->evicted) {
+    restore(img);
+  } else if(img->source && img != moduleData.lruLast) {
+    lruUnlink(img);
+    lruAppend(img);
+  }
+  enforceBudget();
+
+  glBindTexture(GL_TEXTURE_2D, img->texID);
+  ++graphics_getStats()->textureBinds;
+}
+
+size_t graphics_image_getTextureMemory(void) {
+  return moduleData.textureMemory;
+}
+
+size_t graphics_image_getPeakTextureMemory(void) {
+  return moduleData.peakTextureMemory;
+}
+
+void graphics_image_setTextureBudget(size_t bytes) {
+  moduleData.textureBudget = bytes;
+  enforceBudget();
+}
+
+size_t graphics_image_getTextureBudget(void) {
+  return moduleData.textureBudget;
+}
+
+// Uploads a region of data, which has to be the size of the image. WebGL 1
+// has no GL_UNPACK_ROW_LENGTH, so narrow regions are sent row by row there.
+void graphics_Image_replacePixels(graphics_Image *img, image_ImageData const* data, image_Rect const* rect) {
+  if(rect->w <= 0 || rect->h <= 0) {
+    return;
+  }
+
+  if(img->evicted) {
+    restore(img);
+  }
+
+  // The texture no longer matches the source, restoring from it after an
+  // eviction would bring back the old pixels
+  if(data != img->source) {
+    graphics_Image_setSource(img, 0);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, img->texID);
+  uint8_t const* first = data->surface + (rect->y * data->w + rect->x) * 4;
+
+#ifdef EMSCRIPTEN
+  if(rect->w == data->w) {
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h, pixelFormat(img), GL_UNSIGNED_BYTE, first);
+  } else {
+    for(int row = 0; row < rect->h; ++row) {
+      glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y + row, rect->w, 1, pixelFormat(img), GL_UNSIGNED_BYTE, first + row * data->w * 4);
+    }
+  }
+#else
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, data->w);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h, pixelFormat(img), GL_UNSIGNED_BYTE, first);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+
+  if(img->mipmaps) {
+    glGenerateMipmap(GL_TEXTURE_2D);
+  }
+}
+
+// WebGL 1 can only mipmap power of two textures
+static bool canGenerateMipmaps(graphics_Image const* img) {
+  if(img->compressed) {
+    return false;
+  }
+#ifdef EMSCRIPTEN
+  // EXT_sRGB does not allow glGenerateMipmap either
+  if(img->srgb) {
+    return false;
+  }
+  return !(img->width & (img->width - 1)) && !(img->height & (img->height - 1));
+#else
+  return true;
+#endif
+}
+
+// Builds the lower levels from level 0. Later calls to refresh keep them
+// up to date.
+bool graphics_Image_generateMipmaps(graphics_Image *img) {
+  if(!canGenerateMipmaps(img)) {
+    return false;
+  }
+
+  if(img->evicted) {
+    restore(img);
+  }
+
+  glBindTexture(GL_TEXTURE_2D, img->texID);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  img->mipmaps = true;
+  graphics_Image_trackMemory(img);
+  return true;
 }
 
 void graphics_Image_free(graphics_Image *obj) {
+  if(obj->source) {
+    lruUnlink(obj);
+  }
+  setTextureBytes(obj, 0);
   glDeleteTextures(1, &obj->texID);
 }
 
+
+static void unlinkLoad(graphics_ImageLoad *load) {
+  if(load->prev) {
+    load->prev->next = load->next;
+  } else if(moduleData.firstLoad == load) {
+    moduleData.firstLoad = load->next;
+  }
+
+  if(load->next) {
+    load->next->prev = load->prev;
+  } else if(moduleData.lastLoad == load) {
+    moduleData.lastLoad = load->prev;
+  }
+
+  load->prev = load->next = 0;
+}
+
+
+// Takes ownership of decode
+void graphics_ImageLoad_new(graphics_ImageLoad *load, image_ImageDataLoad *decode, bool srgb) {
+  load->decode = decode;
+  load->srgb = srgb;
+  load->data.surface = 0;
+  load->image.texID = 0;
+  load->uploadedRows = -1;
+  load->failed = false;
+  load->error = 0;
+  load->taken = false;
+
+  load->next = 0;
+  load->prev = moduleData.lastLoad;
+  if(moduleData.lastLoad) {
+    moduleData.lastLoad->next = load;
+  } else {
+    moduleData.firstLoad = load;
+  }
+  moduleData.lastLoad = load;
+}
+
+
+void graphics_ImageLoad_free(graphics_ImageLoad *load) {
+  unlinkLoad(load);
+  if(load->decode) {
+    image_ImageDataLoad_free(load->decode);
+  }
+  if(!load->taken) {
+    if(load->image.texID) {
+      graphics_Image_free(&load->image);
+    }
+    free(load->data.surface);
+  }
+}
+
+
+// Ready means uploaded completely or failed
+bool graphics_ImageLoad_isReady(graphics_ImageLoad const* load) {
+  return load->failed || (load->data.surface && load->uploadedRows == load->data.h);
+}
+
+
+// Moves texture and pixels to the caller. Returns false unless the load is
+// ready and did not fail.
+bool graphics_ImageLoad_take(graphics_ImageLoad *load, graphics_Image *image, image_ImageData *data) {
+  if(load->taken || load->failed || !graphics_ImageLoad_isReady(load)) {
+    return false;
+  }
+
+  *image = load->image;
+  *data = load->data;
+  load->taken = true;
+  return true;
+}
+
+
+// Uploads rows of decoded images until the budget for this frame is used
+// up. Images are finished in the order they were requested. Runs once per
+// frame, which also starts a new frame for the texture budget.
+void graphics_image_uploadPending(void) {
+  ++moduleData.frame;
+
+  int budget = moduleData.uploadBudget;
+  graphics_ImageLoad *load = moduleData.firstLoad;
+
+  while(load && budget > 0) {
+    graphics_ImageLoad *next = load->next;
+
+    if(load->decode) {
+      if(!image_ImageDataLoad_isDone(load->decode)) {
+        load = next;
+        continue;
+      }
+      load->failed = !image_ImageDataLoad_take(load->decode, &load->data);
+      load->error = image_ImageDataLoad_getError(load->decode);
+      image_ImageDataLoad_free(load->decode);
+      load->decode = 0;
+      if(load->failed) {
+        unlinkLoad(load);
+        load = next;
+        continue;
+      }
+    }
+
+    image_ImageData const* data = &load->data;
+    if(load->uploadedRows < 0) {
+      createTexture(&load->image, load->srgb);
+      glTexImage2D(GL_TEXTURE_2D, 0, internalFormat(&load->image), data->w, data->h, 0, pixelFormat(&load->image), GL_UNSIGNED_BYTE, 0);
+      load->image.width = data->w;
+      load->image.height = data->h;
+      graphics_Image_trackMemory(&load->image);
+      load->uploadedRows = 0;
+    }
+
+    int const rowSize = data->w * 4;
+    int rows = budget / rowSize;
+    if(rows < 1) {
+      rows = 1;
+    }
+    if(rows > data->h - load->uploadedRows) {
+      rows = data->h - load->uploadedRows;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, load->image.texID);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, load->uploadedRows, data->w, rows, pixelFormat(&load->image), GL_UNSIGNED_BYTE,
+                    data->surface + load->uploadedRows * rowSize);
+    load->uploadedRows += rows;
+    budget -= rows * rowSize;
+
+    if(load->uploadedRows == data->h) {
+      unlinkLoad(load);
+    }
+    load = next;
+  }
+}
+
+
+void graphics_image_setUploadBudget(int bytes) {
+  moduleData.uploadBudget = bytes;
+}
+
+
+int graphics_image_getUploadBudget(void) {
+  return moduleData.uploadBudget;
+}
+
+// Sampling missing levels gives black pixels, so they are generated on first
+// use. Images that can not have mipmaps fall back to plain filtering.
 void graphics_Image_setFilter(graphics_Image *img, graphics_Filter const* filter) {
-  graphics_Texture_setFilter(img->texID, filter);
+  graphics_Filter f = *filter;
+  if(f.mipmapMode != graphics_FilterMode_none && !img->mipmaps && !graphics_Image_generateMipmaps(img)) {
+    f.mipmapMode = graphics_FilterMode_none;
+  }
+  graphics_Texture_setFilter(img->texID, &f);
 }
 
 void graphics_Image_getFilter(graphics_Image *img, graphics_Filter *filter) {
@@ -100,9 +699,9 @@ void graphics_Image_draw(graphics_Image const* image, graphics_Quad const* quad,
                          float ox, float oy, float kx, float ky) {
 
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, image->texID);
+  graphics_Image_use(image);
   mat4x4 tr2d;
   m4x4_newTransform2d(&tr2d, x, y, r, sx, sy, ox, oy, kx, ky);
-  graphics_drawArray(quad, &tr2d, moduleData.imageVAO, moduleData.imageIBO, 0, 4, GL_TRIANGLE_STRIP, GL_UNSIGNED_BYTE, graphics_getColor(), image->width * quad->w, image->height * quad->h, false);
+  graphics_drawArray(quad, &tr2d, moduleData.imageVAO, moduleData.imageIBO, 0, 4, GL_TRIANGLE_STRIP, GL_UNSIGNED_BYTE, graphics_getDrawColor(), image->width * quad->w, image->height * quad->h, false);
   
 }
@@ -9,7 +9,11 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "../image/imagedata.h"
+#include "../image/compressedimagedata.h"
 #include "quad.h"
 #include "gl.h"
 
@@ -26,15 +30,52 @@ typedef struct {
   graphics_WrapMode horMode;
 } graphics_Wrap;
 
-typedef struct {
+typedef struct graphics_Image {
   GLuint texID;
   int width;
   int height;
+  // Lower levels exist, regenerated when the image changes
+  bool mipmaps;
+  // glGenerateMipmap can not fill compressed textures
+  bool compressed;
+  // Sampling converts to linear colour
+  bool srgb;
+
+  // Texture memory counted towards the budget, 0 while evicted
+  int bytes;
+  // Pixels the texture is restored from after eviction. Only images with a
+  // source can be evicted, see graphics_Image_setSource.
+  image_ImageData const* source;
+  bool evicted;
+  // Frame of the last draw, those drawn in the current frame are kept
+  unsigned lastDrawn;
+  // Evictable images, least recently drawn first
+  struct graphics_Image *lruPrev;
+  struct graphics_Image *lruNext;
 } graphics_Image;
 
+// Image decoded on a worker thread and uploaded a few rows per frame by
+// graphics_image_uploadPending
+typedef struct graphics_ImageLoad {
+  image_ImageDataLoad *decode;
+  image_ImageData data;
+  graphics_Image image;
+  // -1 until the texture storage exists
+  int uploadedRows;
+  bool failed;
+  char const* error;
+  bool taken;
+  bool srgb;
+  struct graphics_ImageLoad *prev;
+  struct graphics_ImageLoad *next;
+} graphics_ImageLoad;
+
 
 void graphics_image_init(void);
-void graphics_Image_new_with_ImageData(graphics_Image *dst, image_ImageData const *data);
+void graphics_Image_new_with_ImageData(graphics_Image *dst, image_ImageData const *data, bool srgb);
+bool graphics_Image_new_with_CompressedImageData(graphics_Image *dst, image_CompressedImageData const* data, bool srgb);
+bool graphics_image_isCompressedFormatSupported(image_CompressedFormat format);
+bool graphics_image_isSRGBSupported(void);
 void graphics_Image_new(graphics_Image *dst);
 void graphics_Image_free(graphics_Image *obj);
 void graphics_Image_setFilter(graphics_Image *img, graphics_Filter const* filter);
@@ -42,4 +83,21 @@ void graphics_Image_getFilter(graphics_Image *img, graphics_Filter *filter);
 void graphics_Image_setWrap(graphics_Image *img, graphics_Wrap const* wrap);
 void graphics_Image_getWrap(graphics_Image *img, graphics_Wrap *wrap);
 void graphics_Image_refresh(graphics_Image *img, image_ImageData const* data);
+bool graphics_Image_generateMipmaps(graphics_Image *img);
+void graphics_Image_replacePixels(graphics_Image *img, image_ImageData const* data, image_Rect const* rect);
+void graphics_ImageLoad_new(graphics_ImageLoad *load, image_ImageDataLoad *decode, bool srgb);
+void graphics_ImageLoad_free(graphics_ImageLoad *load);
+bool graphics_ImageLoad_isReady(graphics_ImageLoad const* load);
+bool graphics_ImageLoad_take(graphics_ImageLoad *load, graphics_Image *image, image_ImageData *data);
+void graphics_image_uploadPending(void);
+void graphics_image_setUploadBudget(int bytes);
+int graphics_image_getUploadBudget(void);
+void graphics_Image_setSource(graphics_Image *img, image_ImageData const* source);
+void graphics_Image_use(graphics_Image const* img);
+void graphics_Image_trackMemory(graphics_Image *img);
+void graphics_image_adjustTextureMemory(int bytes);
+size_t graphics_image_getTextureMemory(void);
+size_t graphics_image_getPeakTextureMemory(void);
+void graphics_image_setTextureBudget(size_t bytes);
+size_t graphics_image_getTextureBudget(void);
 void graphics_Image_draw(graphics_Image const* image, graphics_Quad const* quad, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky);
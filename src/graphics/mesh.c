@@ -11,19 +11,169 @@
 #include <string.h>
 #include "mesh.h"
 #include "graphics.h"
+#include "shader.h"
 #include "../math/minmax.h"
 
+static struct {
+  bool instancing;
+  // Holds 0, 1, 2, ... as floats, read once per instance as love_InstanceID.
+  // GLSL ES 1.0 has no gl_InstanceID.
+  GLuint instanceIDBuffer;
+  size_t instanceIDCount;
+} moduleData;
+
 // TODO: What happens when changing the number of vertices after setting a custom vertex map or draw range?
 // TODO: Apparently, LOVE does nothing about this situation, so that's what I'm gonna do, to.
 
-void graphics_Mesh_new(graphics_Mesh *mesh, size_t vertexCount, graphics_Vertex const* vertices, graphics_Image const* texture, graphics_MeshDrawMode mode, bool useVertexColor) {
+static void setDivisor(GLuint location, GLuint divisor) {
+#ifndef EMSCRIPTEN
+  if(!GLEW_VERSION_3_3) {
+    glVertexAttribDivisorARB(location, divisor);
+    return;
+  }
+#endif
+  glVertexAttribDivisor(location, divisor);
+}
+
+
+// Grows the instance ID buffer to at least count entries
+static void ensureInstanceIDs(size_t count) {
+  if(count <= moduleData.instanceIDCount) {
+    return;
+  }
+
+  size_t newCount = 2 * moduleData.instanceIDCount;
+  if(newCount < count) {
+    newCount = count;
+  }
+  float *ids = malloc(newCount * sizeof(float));
+  for(size_t i = 0; i < newCount; ++i) {
+    ids[i] = (float)i;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, moduleData.instanceIDBuffer);
+  glBufferData(GL_ARRAY_BUFFER, newCount * sizeof(float), ids, GL_STATIC_DRAW);
+  graphics_countBufferUpload(newCount * sizeof(float));
+  free(ids);
+  moduleData.instanceIDCount = newCount;
+}
+
+
+void graphics_mesh_init(void) {
+#ifdef EMSCRIPTEN
+  char const* extensions = (char const*)glGetString(GL_EXTENSIONS);
+  moduleData.instancing = extensions && strstr(extensions, "ANGLE_instanced_arrays");
+#else
+  // ARB_instanced_arrays only brings the divisor, the instanced draw calls
+  // need GL 3.1 or ARB_draw_instanced
+  moduleData.instancing = GLEW_VERSION_3_3 || (GLEW_ARB_instanced_arrays && (GLEW_VERSION_3_1 || GLEW_ARB_draw_instanced));
+#endif
+
+  // Plain draws read the first entry too, so the buffer must never be empty
+  glGenBuffers(1, &moduleData.instanceIDBuffer);
+  moduleData.instanceIDCount = 0;
+  ensureInstanceIDs(256);
+}
+
+
+bool graphics_mesh_isInstancingSupported(void) {
+  return moduleData.instancing;
+}
+
+
+void graphics_VertexFormat_new(graphics_VertexFormat *format) {
+  format->attributes = 0;
+  format->attributeCount = 0;
+  format->stride = 0;
+}
+
+
+void graphics_VertexFormat_free(graphics_VertexFormat *format) {
+  for(int i = 0; i < format->attributeCount; ++i) {
+    free(format->attributes[i].name);
+  }
+  free(format->attributes);
+}
+
+
+static size_t const attributeTypeSizes[] = {
+  [graphics_MeshAttributeType_float] = sizeof(float),
+  [graphics_MeshAttributeType_byte]  = sizeof(uint8_t),
+  [graphics_MeshAttributeType_unorm] = sizeof(uint8_t)
+};
+
+
+void graphics_VertexFormat_add(graphics_VertexFormat *format, char const* name, graphics_MeshAttributeType type, int components) {
+  format->attributes = realloc(format->attributes, (format->attributeCount + 1) * sizeof(graphics_MeshAttribute));
+  graphics_MeshAttribute *attr = format->attributes + format->attributeCount;
+  ++format->attributeCount;
+
+  attr->name = malloc(strlen(name) + 1);
+  strcpy(attr->name, name);
+  attr->type = type;
+  attr->components = components;
+  attr->offset = format->stride;
+
+  size_t size = attributeTypeSizes[type] * components;
+  format->stride += (size + 3) & ~(size_t)3;
+}
+
+
+void graphics_VertexFormat_copy(graphics_VertexFormat *dst, graphics_VertexFormat const* src) {
+  graphics_VertexFormat_new(dst);
+  for(int i = 0; i < src->attributeCount; ++i) {
+    graphics_VertexFormat_add(dst, src->attributes[i].name, src->attributes[i].type, src->attributes[i].components);
+  }
+}
+
+
+graphics_MeshAttribute const* graphics_VertexFormat_find(graphics_VertexFormat const* format, char const* name) {
+  for(int i = 0; i < format->attributeCount; ++i) {
+    if(!strcmp(format->attributes[i].name, name)) {
+      return format->attributes + i;
+    }
+  }
+  return 0;
+}
+
+
+static graphics_MeshAttribute const defaultAttributes[] = {
+  {"VertexPosition", graphics_MeshAttributeType_float, 2, 0},
+  {"VertexTexCoord", graphics_MeshAttributeType_float, 2, 2 * sizeof(float)},
+  {"VertexColor",    graphics_MeshAttributeType_unorm, 4, 4 * sizeof(float)}
+};
+
+static graphics_VertexFormat const defaultFormat = {
+  (graphics_MeshAttribute*)defaultAttributes,
+  sizeof(defaultAttributes) / sizeof(*defaultAttributes),
+  4 * sizeof(float) + 4
+};
+
+graphics_VertexFormat const* graphics_mesh_getDefaultFormat(void) {
+  return &defaultFormat;
+}
+
+
+void graphics_Mesh_new(graphics_Mesh *mesh, graphics_VertexFormat const* format, size_t vertexCount, void const* vertices, graphics_Image const* texture, graphics_MeshDrawMode mode, bool useVertexColor, graphics_MeshUsage usage) {
   mesh->texture = texture;
   mesh->drawMode = mode;
+  mesh->usage = usage;
+
+  graphics_VertexFormat_copy(&mesh->format, format ? format : &defaultFormat);
 
   mesh->vertices = 0;
+  mesh->vertexCount = 0;
+  mesh->bufferCount = 0;
+  mesh->dirtyStart = mesh->dirtyEnd = 0;
   mesh->indices = 0;
   mesh->indexBufferSize = 0;
 
+  mesh->attachments = 0;
+  mesh->attachmentCount = 0;
+  mesh->boundProgram = 0;
+  mesh->attributesChanged = true;
+  mesh->enabledAttributes = 0;
+
   mesh->useVertexColor = useVertexColor;
   mesh->useDrawRange = false;
 
@@ -35,13 +185,7 @@ void graphics_Mesh_new(graphics_Mesh *mesh, size_t vertexCount, graphics_Vertex
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
   glGenBuffers(1, &mesh->vertexBuffer);
   graphics_Mesh_setVertices(mesh, vertexCount, vertices);
-
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(graphics_Vertex), 0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(graphics_Vertex), (GLvoid const*)(2*sizeof(float)));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(graphics_Vertex), (GLvoid const*)(4*sizeof(float)));
+  graphics_Mesh_flush(mesh);
 }
 
 
@@ -49,35 +193,147 @@ void graphics_Mesh_free(graphics_Mesh *mesh) {
   glDeleteBuffers(1,      &mesh->vertexBuffer);
   glDeleteBuffers(1,      &mesh->indexBuffer);
   glDeleteVertexArrays(1, &mesh->vertexArray);
+  for(int i = 0; i < mesh->attachmentCount; ++i) {
+    free(mesh->attachments[i].name);
+  }
+  free(mesh->attachments);
+  graphics_VertexFormat_free(&mesh->format);
   free(mesh->indices);
   free(mesh->vertices);
 }
 
 
-void graphics_Mesh_setVertices(graphics_Mesh *mesh, size_t vertexCount, graphics_Vertex const* vertices) {
-  glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-  glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(graphics_Vertex), vertices, GL_DYNAMIC_DRAW);
+static void markDirty(graphics_Mesh *mesh, size_t start, size_t end) {
+  if(mesh->dirtyStart >= mesh->dirtyEnd) {
+    mesh->dirtyStart = start;
+    mesh->dirtyEnd = end;
+  } else {
+    mesh->dirtyStart = min(mesh->dirtyStart, start);
+    mesh->dirtyEnd   = max(mesh->dirtyEnd,   end);
+  }
+}
 
-  if(mesh->vertexCount != vertexCount) {
+
+// Only changes the CPU copy, the GPU buffer is updated by the next flush.
+// Passing no vertices zeroes the mesh.
+void graphics_Mesh_setVertices(graphics_Mesh *mesh, size_t vertexCount, void const* vertices) {
+  size_t const stride = mesh->format.stride;
+  bool countChanged = mesh->vertexCount != vertexCount;
+  if(countChanged) {
     free(mesh->vertices);
-    mesh->vertices = malloc(sizeof(graphics_Vertex) * vertexCount);
+    mesh->vertices = malloc(stride * vertexCount);
     mesh->vertexCount = vertexCount;
   }
 
-  memcpy(mesh->vertices, vertices, vertexCount * sizeof(graphics_Vertex));
+  if(vertices) {
+    memcpy(mesh->vertices, vertices, vertexCount * stride);
+  } else {
+    memset(mesh->vertices, 0, vertexCount * stride);
+  }
+  markDirty(mesh, 0, vertexCount);
 
-  if(!mesh->customIndexBuffer) {
+  // The default map only depends on the number of vertices
+  if(countChanged && !mesh->customIndexBuffer) {
     graphics_Mesh_setVertexMap(mesh, 0, 0);
   }
 }
 
 
-graphics_Vertex const* graphics_Mesh_getVertices(graphics_Mesh const* mesh, size_t *count) {
+void graphics_Mesh_setVertexRange(graphics_Mesh *mesh, size_t start, size_t count, void const* vertices) {
+  size_t const stride = mesh->format.stride;
+  memcpy((uint8_t*)mesh->vertices + start * stride, vertices, count * stride);
+  markDirty(mesh, start, start + count);
+}
+
+
+// Uploads all vertices changed since the last flush. Replacing the whole
+// buffer reallocates its storage, so the driver does not have to wait for
+// draws still using the old contents.
+void graphics_Mesh_flush(graphics_Mesh *mesh) {
+  if(mesh->dirtyStart >= mesh->dirtyEnd) {
+    return;
+  }
+
+  size_t const stride = mesh->format.stride;
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
+  if(mesh->bufferCount != mesh->vertexCount || (mesh->dirtyStart == 0 && mesh->dirtyEnd == mesh->vertexCount)) {
+    glBufferData(GL_ARRAY_BUFFER, mesh->vertexCount * stride, mesh->vertices, mesh->usage);
+    graphics_countBufferUpload(mesh->vertexCount * stride);
+    mesh->bufferCount = mesh->vertexCount;
+  } else {
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    mesh->dirtyStart * stride,
+                    (mesh->dirtyEnd - mesh->dirtyStart) * stride,
+                    (uint8_t const*)mesh->vertices + mesh->dirtyStart * stride);
+    graphics_countBufferUpload((mesh->dirtyEnd - mesh->dirtyStart) * stride);
+  }
+
+  mesh->dirtyStart = mesh->dirtyEnd = 0;
+}
+
+
+graphics_MeshUsage graphics_Mesh_getUsage(graphics_Mesh const *mesh) {
+  return mesh->usage;
+}
+
+
+graphics_VertexFormat const* graphics_Mesh_getVertexFormat(graphics_Mesh const *mesh) {
+  return &mesh->format;
+}
+
+
+void const* graphics_Mesh_getVertices(graphics_Mesh const* mesh, size_t *count) {
   *count = mesh->vertexCount;
   return mesh->vertices;
 }
 
 
+static graphics_MeshAttachment* findAttachment(graphics_Mesh *mesh, char const* name) {
+  for(int i = 0; i < mesh->attachmentCount; ++i) {
+    if(!strcmp(mesh->attachments[i].name, name)) {
+      return mesh->attachments + i;
+    }
+  }
+  return 0;
+}
+
+
+// Takes the named attribute from other's vertex buffer instead of this
+// mesh's own. Fails if other has no such attribute. Per instance attributes
+// advance once per instance in graphics_Mesh_drawInstanced instead of once
+// per vertex.
+bool graphics_Mesh_attachAttribute(graphics_Mesh *mesh, char const* name, graphics_Mesh *other, bool perInstance) {
+  if(!graphics_VertexFormat_find(&other->format, name)) {
+    return false;
+  }
+
+  graphics_MeshAttachment *att = findAttachment(mesh, name);
+  if(!att) {
+    mesh->attachments = realloc(mesh->attachments, (mesh->attachmentCount + 1) * sizeof(graphics_MeshAttachment));
+    att = mesh->attachments + mesh->attachmentCount;
+    ++mesh->attachmentCount;
+    att->name = malloc(strlen(name) + 1);
+    strcpy(att->name, name);
+  }
+
+  att->mesh = other;
+  att->perInstance = perInstance;
+  mesh->attributesChanged = true;
+  return true;
+}
+
+
+void graphics_Mesh_detachAttribute(graphics_Mesh *mesh, char const* name) {
+  graphics_MeshAttachment *att = findAttachment(mesh, name);
+  if(!att) {
+    return;
+  }
+
+  free(att->name);
+  *att = mesh->attachments[--mesh->attachmentCount];
+  mesh->attributesChanged = true;
+}
+
 
 #define makeFillDefaultIndexBufferFunc(type)                             \
   static void fillDefaultIndexBuffer_ ## type(void *out, size_t count) { \
@@ -174,7 +430,8 @@ void graphics_Mesh_setVertexMap(graphics_Mesh *mesh, size_t count, uint32_t cons
   }
 
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBuffer);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBufferSize, mesh->indices, GL_DYNAMIC_DRAW);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->indexBufferSize, mesh->indices, mesh->usage);
+  graphics_countBufferUpload(mesh->indexBufferSize);
 }
 
 
@@ -190,10 +447,107 @@ void const* graphics_Mesh_getVertexMap(graphics_Mesh const* mesh, size_t *count)
 static graphics_Quad const fullQuad = {0.0f, 0.0f, 1.0f, 1.0f};
 static float const defaultColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
 static GLenum const glTypes[] = {GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, 0, GL_UNSIGNED_INT};
-void graphics_Mesh_draw(graphics_Mesh const* mesh, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
+static GLenum const glAttributeTypes[] = {
+  [graphics_MeshAttributeType_float] = GL_FLOAT,
+  [graphics_MeshAttributeType_byte]  = GL_UNSIGNED_BYTE,
+  [graphics_MeshAttributeType_unorm] = GL_UNSIGNED_BYTE
+};
+
+
+// The built in attributes have fixed locations in every shader
+static GLint attributeLocation(GLuint program, char const* name) {
+  if(!strcmp(name, "VertexPosition")) {
+    return 0;
+  } else if(!strcmp(name, "VertexTexCoord")) {
+    return 1;
+  } else if(!strcmp(name, "VertexColor")) {
+    return 2;
+  }
+  return glGetAttribLocation(program, name);
+}
+
+
+static void bindAttribute(graphics_Mesh *mesh, GLuint program, graphics_Mesh const* source, graphics_MeshAttribute const* attr, bool perInstance) {
+  GLint location = attributeLocation(program, attr->name);
+  if(location < 0 || location >= 32) {
+    return;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, source->vertexBuffer);
+  glEnableVertexAttribArray(location);
+  glVertexAttribPointer(location, attr->components, glAttributeTypes[attr->type],
+                        attr->type == graphics_MeshAttributeType_unorm, source->format.stride,
+                        (GLvoid const*)attr->offset);
+  if(moduleData.instancing) {
+    setDivisor(location, perInstance);
+  }
+  mesh->enabledAttributes |= 1u << location;
+}
+
+
+static void bindAttributes(graphics_Mesh *mesh) {
+  GLuint program = graphics_getShader()->program;
+
+  for(int i = 0; i < mesh->attachmentCount; ++i) {
+    graphics_Mesh_flush(mesh->attachments[i].mesh);
+  }
+
+  if(program != mesh->boundProgram || mesh->attributesChanged) {
+    glBindVertexArray(mesh->vertexArray);
+    for(int i = 0; i < 32; ++i) {
+      if(mesh->enabledAttributes & (1u << i)) {
+        glDisableVertexAttribArray(i);
+      }
+    }
+    mesh->enabledAttributes = 0;
+
+    for(int i = 0; i < mesh->format.attributeCount; ++i) {
+      graphics_MeshAttribute const* attr = mesh->format.attributes + i;
+      if(!findAttachment(mesh, attr->name)) {
+        bindAttribute(mesh, program, mesh, attr, false);
+      }
+    }
+
+    for(int i = 0; i < mesh->attachmentCount; ++i) {
+      graphics_Mesh const* other = mesh->attachments[i].mesh;
+      bindAttribute(mesh, program, other, graphics_VertexFormat_find(&other->format, mesh->attachments[i].name), mesh->attachments[i].perInstance);
+    }
+
+    GLint instanceID = glGetAttribLocation(program, "love_InstanceID");
+    if(moduleData.instancing && instanceID >= 0 && instanceID < 32) {
+      glBindBuffer(GL_ARRAY_BUFFER, moduleData.instanceIDBuffer);
+      glEnableVertexAttribArray(instanceID);
+      glVertexAttribPointer(instanceID, 1, GL_FLOAT, GL_FALSE, 0, 0);
+      setDivisor(instanceID, 1);
+      mesh->enabledAttributes |= 1u << instanceID;
+    }
+
+    mesh->boundProgram = program;
+    mesh->attributesChanged = false;
+  }
+
+  // Constant values for missing built in attributes are not part of the
+  // vertex array state
+  if(!(mesh->enabledAttributes & 2)) {
+    glVertexAttrib4f(1, 0.0f, 0.0f, 0.0f, 1.0f);
+  }
+  if(!(mesh->enabledAttributes & 4)) {
+    glVertexAttrib4f(2, 1.0f, 1.0f, 1.0f, 1.0f);
+  }
+}
+
+
+static void draw(graphics_Mesh *mesh, GLuint instances, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
+  graphics_Mesh_flush(mesh);
+  bindAttributes(mesh);
 
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, mesh->texture->texID);
+  if(mesh->texture) {
+    graphics_Image_use(mesh->texture);
+  } else {
+    glBindTexture(GL_TEXTURE_2D, 0);
+    ++graphics_getStats()->textureBinds;
+  }
   mat4x4 tr2d;
   m4x4_newTransform2d(&tr2d, x, y, r, sx, sy, ox, oy, kx, ky);
 
@@ -202,20 +556,30 @@ void graphics_Mesh_draw(graphics_Mesh const* mesh, float x, float y, float r, fl
   int count = end - start + 1;
 
   size_t idxSize = indexSize(mesh);
-  graphics_drawArray(
-    &fullQuad,
-    &tr2d,
-    mesh->vertexArray,
-    mesh->indexBuffer,
-    start * idxSize,
-    count,
-    mesh->drawMode,
-    glTypes[idxSize-1],
-    mesh->useVertexColor ? defaultColor : graphics_getColor(),
-    1.0f,
-    1.0f,
-    mesh->useVertexColor
-  );
+  float const* color = mesh->useVertexColor ? defaultColor : graphics_getDrawColor();
+  if(instances > 0) {
+    ensureInstanceIDs(instances);
+    graphics_drawArrayInstanced(&fullQuad, &tr2d, mesh->vertexArray, mesh->indexBuffer, start * idxSize, count,
+                                mesh->drawMode, glTypes[idxSize-1], color, 1.0f, 1.0f, mesh->useVertexColor, instances);
+  } else {
+    graphics_drawArray(&fullQuad, &tr2d, mesh->vertexArray, mesh->indexBuffer, start * idxSize, count,
+                       mesh->drawMode, glTypes[idxSize-1], color, 1.0f, 1.0f, mesh->useVertexColor);
+  }
+}
+
+
+void graphics_Mesh_draw(graphics_Mesh *mesh, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
+  draw(mesh, 0, x, y, r, sx, sy, ox, oy, kx, ky);
+}
+
+
+// Draws instances copies of the mesh in a single call. Only valid if
+// graphics_mesh_isInstancingSupported returns true.
+void graphics_Mesh_drawInstanced(graphics_Mesh *mesh, size_t instances, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
+  if(instances == 0) {
+    return;
+  }
+  draw(mesh, instances, x, y, r, sx, sy, ox, oy, kx, ky);
 }
 
 
@@ -251,15 +615,13 @@ bool graphics_Mesh_getDrawRange(graphics_Mesh const* mesh, int *min, int *max) {
 }
 
 
-graphics_Vertex const* graphics_Mesh_getVertex(graphics_Mesh const *mesh, size_t index) {
-  return mesh->vertices + index;
+void const* graphics_Mesh_getVertex(graphics_Mesh const *mesh, size_t index) {
+  return (uint8_t const*)mesh->vertices + index * mesh->format.stride;
 }
 
 
-void graphics_Mesh_setVertex(graphics_Mesh *mesh, size_t index, graphics_Vertex const *vertex) {
-  memcpy(mesh->vertices + index, vertex, sizeof(*vertex));
-  glBindBuffer(GL_ARRAY_BUFFER, mesh->vertexBuffer);
-  glBufferSubData(GL_ARRAY_BUFFER, index * sizeof(*vertex), sizeof(*vertex), vertex);
+void graphics_Mesh_setVertex(graphics_Mesh *mesh, size_t index, void const *vertex) {
+  graphics_Mesh_setVertexRange(mesh, index, 1, vertex);
 }
 
 
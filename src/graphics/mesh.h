@@ -10,9 +10,9 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "gl.h"
 #include "image.h"
-#include "vertex.h"
 
 typedef enum {
   graphics_MeshDrawMode_fan       = GL_TRIANGLE_FAN,
@@ -21,14 +21,78 @@ typedef enum {
   graphics_MeshDrawMode_points    = GL_POINTS
 } graphics_MeshDrawMode;
 
+typedef enum {
+  graphics_MeshUsage_static  = GL_STATIC_DRAW,
+  graphics_MeshUsage_dynamic = GL_DYNAMIC_DRAW,
+  graphics_MeshUsage_stream  = GL_STREAM_DRAW
+} graphics_MeshUsage;
+
+typedef enum {
+  graphics_MeshAttributeType_float,
+  // Unsigned bytes the shader sees as 0 to 255
+  graphics_MeshAttributeType_byte,
+  // Unsigned bytes the shader sees as 0 to 1
+  graphics_MeshAttributeType_unorm
+} graphics_MeshAttributeType;
+
+typedef struct {
+  char *name;
+  graphics_MeshAttributeType type;
+  int components;
+  size_t offset;
+} graphics_MeshAttribute;
+
+// Vertices are stored interleaved, every attribute starts on a four byte
+// boundary
 typedef struct {
+  graphics_MeshAttribute *attributes;
+  int attributeCount;
+  size_t stride;
+} graphics_VertexFormat;
+
+void graphics_VertexFormat_new(graphics_VertexFormat *format);
+void graphics_VertexFormat_free(graphics_VertexFormat *format);
+void graphics_VertexFormat_add(graphics_VertexFormat *format, char const* name, graphics_MeshAttributeType type, int components);
+void graphics_VertexFormat_copy(graphics_VertexFormat *dst, graphics_VertexFormat const* src);
+graphics_MeshAttribute const* graphics_VertexFormat_find(graphics_VertexFormat const* format, char const* name);
+// VertexPosition (2 floats), VertexTexCoord (2 floats), VertexColor (4 unorm),
+// laid out like graphics_PackedVertex
+graphics_VertexFormat const* graphics_mesh_getDefaultFormat(void);
+
+void graphics_mesh_init(void);
+bool graphics_mesh_isInstancingSupported(void);
+
+struct graphics_Mesh;
+
+// Attribute read from another mesh's vertex buffer
+typedef struct {
+  char *name;
+  struct graphics_Mesh *mesh;
+  bool perInstance;
+} graphics_MeshAttachment;
+
+typedef struct graphics_Mesh {
   graphics_Image const* texture;
   GLuint vertexBuffer;
   graphics_MeshDrawMode drawMode;
   GLuint indexBuffer;
   GLuint vertexArray;
+  graphics_MeshUsage usage;
+  graphics_VertexFormat format;
   size_t vertexCount;
-  graphics_Vertex *vertices;
+  void *vertices;
+  // Vertices [dirtyStart, dirtyEnd) have changed since the last upload
+  size_t dirtyStart;
+  size_t dirtyEnd;
+  // Number of vertices the GPU buffer was allocated for
+  size_t bufferCount;
+  graphics_MeshAttachment *attachments;
+  int attachmentCount;
+  // Attribute locations depend on the shader, the vertex array is set up
+  // again when a different program draws the mesh
+  GLuint boundProgram;
+  bool attributesChanged;
+  uint32_t enabledAttributes;
   void *indices;
   size_t indexBufferSize;
   bool customIndexBuffer;
@@ -39,21 +103,27 @@ typedef struct {
 } graphics_Mesh;
 
 
-void graphics_Mesh_new(graphics_Mesh *mesh, size_t vertexCount, graphics_Vertex const* vertices, graphics_Image const* texture, graphics_MeshDrawMode mode, bool useVertexColor);
+void graphics_Mesh_new(graphics_Mesh *mesh, graphics_VertexFormat const* format, size_t vertexCount, void const* vertices, graphics_Image const* texture, graphics_MeshDrawMode mode, bool useVertexColor, graphics_MeshUsage usage);
 void graphics_Mesh_free(graphics_Mesh *mesh);
-void graphics_Mesh_setVertices(graphics_Mesh *mesh, size_t vertexCount, graphics_Vertex const* vertices);
-graphics_Vertex const* graphics_Mesh_getVertices(graphics_Mesh const *mesh, size_t *count);
-graphics_Vertex const* graphics_Mesh_getVertex(graphics_Mesh const *mesh, size_t index);
+void graphics_Mesh_setVertices(graphics_Mesh *mesh, size_t vertexCount, void const* vertices);
+void graphics_Mesh_setVertexRange(graphics_Mesh *mesh, size_t start, size_t count, void const* vertices);
+void graphics_Mesh_flush(graphics_Mesh *mesh);
+graphics_MeshUsage graphics_Mesh_getUsage(graphics_Mesh const *mesh);
+graphics_VertexFormat const* graphics_Mesh_getVertexFormat(graphics_Mesh const *mesh);
+void const* graphics_Mesh_getVertices(graphics_Mesh const *mesh, size_t *count);
 void graphics_Mesh_setVertexMap(graphics_Mesh *mesh, size_t count, uint32_t const* indices);
 void const* graphics_Mesh_getVertexMap(graphics_Mesh const* mesh, size_t* count);
-void graphics_Mesh_draw(graphics_Mesh const* mesh, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky);
+void graphics_Mesh_draw(graphics_Mesh *mesh, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky);
+void graphics_Mesh_drawInstanced(graphics_Mesh *mesh, size_t instances, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky);
 void graphics_Mesh_setVertexColors(graphics_Mesh *mesh, bool use);
 bool graphics_Mesh_getVertexColors(graphics_Mesh const *mesh);
 void graphics_Mesh_resetDrawRange(graphics_Mesh *mesh);
 void graphics_Mesh_setDrawRange(graphics_Mesh *mesh, int min, int max);
 bool graphics_Mesh_getDrawRange(graphics_Mesh const* mesh, int *min, int *max);
-graphics_Vertex const* graphics_Mesh_getVertex(graphics_Mesh const *mesh, size_t index);
-void graphics_Mesh_setVertex(graphics_Mesh *mesh, size_t index, graphics_Vertex const *vertex);
+void const* graphics_Mesh_getVertex(graphics_Mesh const *mesh, size_t index);
+void graphics_Mesh_setVertex(graphics_Mesh *mesh, size_t index, void const *vertex);
 size_t graphics_Mesh_getVertexCount(graphics_Mesh const *mesh);
 void graphics_Mesh_setDrawMode(graphics_Mesh *mesh, graphics_MeshDrawMode mode);
 graphics_MeshDrawMode graphics_Mesh_getDrawMode(graphics_Mesh const *mesh);
+bool graphics_Mesh_attachAttribute(graphics_Mesh *mesh, char const* name, graphics_Mesh *other, bool perInstance);
+void graphics_Mesh_detachAttribute(graphics_Mesh *mesh, char const* name);
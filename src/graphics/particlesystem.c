@@ -8,235 +8,491 @@
 */
 
 #include <tgmath.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "particlesystem.h"
+#include "shader.h"
 #include "../math/minmax.h"
 #include "../math/lerp.h"
+#include "../math/gamma.h"
 #include "../math/randomgenerator.h"
 #include "../math/util.h"
+#include "../math/simd.h"
+#include "../tools/threadpool.h"
+
+
+// Size, color and quad tables are passed to the GPU path as uniform arrays
+// of this length. Longer tables are cut off.
+#define GPU_TABLE_SIZE 8
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+typedef struct {
+  graphics_Shader shader;
+  graphics_ShaderCompileStatus status;
+  bool compiled;
+  struct {
+    GLint time;
+    GLint textureSize;
+    GLint offset;
+    GLint relativeRotation;
+    GLint sizes;
+    GLint sizeCount;
+    GLint colors;
+    GLint colorCount;
+    GLint quads;
+    GLint quadCount;
+  } uniforms;
+} GPUParticleShader;
 
 
 static struct {
   math_RandomGenerator rng;
+  GPUParticleShader gpuShader;
 } moduleData;
 
+static bool prepareGPUShader(void);
+
+
+// Evaluates the same motion as updateParticles in closed form. With linear
+// damping k the velocity follows dv/dt = a - k*v, which integrates to an
+// exponential approach towards the terminal velocity a/k.
+static GLchar const gpuVertexSource[] =
+  "precision highp float;\n"
+  "uniform mat4 motor2d_transform;\n"
+  "uniform mat4 motor2d_projection;\n"
+  "uniform float motor2d_time;\n"
+  "uniform vec2 motor2d_textureSize;\n"
+  "uniform vec2 motor2d_offset;\n"
+  "uniform float motor2d_relativeRotation;\n"
+  "uniform float motor2d_sizes[" STRINGIFY(GPU_TABLE_SIZE) "];\n"
+  "uniform float motor2d_sizeCount;\n"
+  "uniform vec4 motor2d_colors[" STRINGIFY(GPU_TABLE_SIZE) "];\n"
+  "uniform float motor2d_colorCount;\n"
+  "uniform vec4 motor2d_quads[" STRINGIFY(GPU_TABLE_SIZE) "];\n"
+  "uniform float motor2d_quadCount;\n"
+  "attribute vec4 motor2d_pMotion;\n"
+  "attribute vec4 motor2d_pForces;\n"
+  "attribute vec4 motor2d_pSpin;\n"
+  "attribute vec4 motor2d_pShape;\n"
+  "varying vec2 motor2d_fUV;\n"
+  "varying vec4 motor2d_fColor;\n"
+  "void main() {\n"
+  "  float lifetime = motor2d_pForces.w;\n"
+  "  float age = motor2d_time - motor2d_pSpin.x;\n"
+  "  motor2d_fUV = vec2(0.0, 0.0);\n"
+  "  motor2d_fColor = vec4(0.0, 0.0, 0.0, 0.0);\n"
+  "  if(age < 0.0 || age >= lifetime) {\n"
+  "    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);\n"
+  "    return;\n"
+  "  }\n"
+  "  float t = age / lifetime;\n"
+  "  vec2 acc = motor2d_pForces.xy;\n"
+  "  float damping = motor2d_pForces.z;\n"
+  "  vec2 pos;\n"
+  "  vec2 vel;\n"
+  "  if(abs(damping) > 0.0001) {\n"
+  "    vec2 terminal = acc / damping;\n"
+  "    float decay = exp(-damping * age);\n"
+  "    vel = terminal + (motor2d_pMotion.zw - terminal) * decay;\n"
+  "    pos = motor2d_pMotion.xy + terminal * age + (motor2d_pMotion.zw - terminal) * ((1.0 - decay) / damping);\n"
+  "  } else {\n"
+  "    vel = motor2d_pMotion.zw + acc * age;\n"
+  "    pos = motor2d_pMotion.xy + (motor2d_pMotion.zw + 0.5 * acc * age) * age;\n"
+  "  }\n"
+  "  float angle = motor2d_pSpin.y + motor2d_pSpin.z * age + 0.5 * (motor2d_pSpin.w - motor2d_pSpin.z) * age * t;\n"
+  "  if(motor2d_relativeRotation > 0.5 && dot(vel, vel) > 0.0) {\n"
+  "    angle += atan(vel.y, vel.x);\n"
+  "  }\n"
+  "  float s = clamp(motor2d_pShape.x + t * motor2d_pShape.y, 0.0, 1.0) * (motor2d_sizeCount - 1.0);\n"
+  "  float si = floor(s);\n"
+  "  float size = mix(motor2d_sizes[int(si)], motor2d_sizes[int(min(si + 1.0, motor2d_sizeCount - 1.0))], s - si);\n"
+  "  float c = t * (motor2d_colorCount - 1.0);\n"
+  "  float ci = floor(c);\n"
+  "  motor2d_fColor = mix(motor2d_colors[int(ci)], motor2d_colors[int(min(ci + 1.0, motor2d_colorCount - 1.0))], c - ci);\n"
+  "  vec4 quad = motor2d_quads[int(min(floor(t * motor2d_quadCount), motor2d_quadCount - 1.0))];\n"
+  "  vec2 corner = motor2d_pShape.zw;\n"
+  "  vec2 local = (corner * quad.zw * motor2d_textureSize - motor2d_offset) * size;\n"
+  "  float sa = sin(angle);\n"
+  "  float ca = cos(angle);\n"
+  "  vec2 world = pos + vec2(ca * local.x - sa * local.y, sa * local.x + ca * local.y);\n"
+  "  gl_Position = motor2d_projection * motor2d_transform * vec4(world, 1.0, 1.0);\n"
+  "  motor2d_fUV = quad.xy + corner * quad.zw;\n"
+  "}\n";
+
+static GLchar const gpuFragmentSource[] =
+  "precision mediump float;\n"
+  "varying vec2 motor2d_fUV;\n"
+  "varying vec4 motor2d_fColor;\n"
+  "uniform sampler2D motor2d_tex;\n"
+  "uniform vec4 motor2d_color;\n"
+  "void main() {\n"
+  "  gl_FragColor = texture2D(motor2d_tex, motor2d_fUV) * motor2d_fColor * motor2d_color;\n"
+  "}\n";
+
+static char const* const gpuAttributes[] = {
+  "motor2d_pMotion",
+  "motor2d_pForces",
+  "motor2d_pSpin",
+  "motor2d_pShape"
+};
 
-struct graphics_Particle {
-  struct graphics_Particle *prev;
-  struct graphics_Particle *next;
 
-  float lifetime;
-  float life;
+static const graphics_Color defaultColor = {1.0f, 1.0f, 1.0f, 1.0f};
+static const graphics_Quad defaultQuad = {0.0f, 0.0f, 1.0f, 1.0f};
+static const graphics_Quad *defaultQuadPtr = &defaultQuad;
+static const float defaultSize = 1.0f;
 
-  float position[2];
 
-  float origin[2];
+static float calculateVariation(math_RandomGenerator *rng, float inner, float outer, float var) {
+  float v2 = (outer/2.0f) * var;
+  float low = inner - v2;
+  float high = inner + v2;
+  float r = math_RandomGenerator_random(rng);
+  return low * (1-r) + high * r;
+}
+
 
+// Spawn parameters of a new particle, shared by the CPU and GPU paths
+typedef struct {
+  float origin[2];
+  float position[2];
   float velocity[2];
   float linearAcceleration[2];
   float radialAcceleration;
   float tangentialAcceleration;
-
   float linearDamping;
-
-  float size;
+  float life;
   float sizeOffset;
   float sizeIntervalSize;
-
-  float rotation;
-  float angle;
   float spinStart;
   float spinEnd;
-
-  graphics_Color color;
-
-  int quadIndex;
-};
-
-static const graphics_Color defaultColor = {1.0f, 1.0f, 1.0f, 1.0f};
-static const graphics_Quad defaultQuad = {0.0f, 0.0f, 1.0f, 1.0f};
-static const graphics_Quad *defaultQuadPtr = &defaultQuad;
-static const float defaultSize = 1.0f;
-
-
-static float calculateVariation(float inner, float outer, float var) {
-  float v2 = (outer/2.0f) * var;
-  float low = inner - v2;
-  float high = inner + v2;
-  float r = math_RandomGenerator_random(&moduleData.rng);
-  return low * (1-r) + high * r;
-}
+  float rotation;
+} ParticleSpawn;
 
 
-static void initParticle(graphics_ParticleSystem const *ps, graphics_Particle *p, float t) {
+static void spawnParticle(graphics_ParticleSystem *ps, ParticleSpawn *p, float t) {
   p->origin[0] = p->position[0] = lerp(ps->prevPosition[0], ps->position[0], t);
   p->origin[1] = p->position[1] = lerp(ps->prevPosition[1], ps->position[1], t);
 
   if(ps->particleLifeMin == ps->particleLifeMax) {
     p->life = ps->particleLifeMin;
   } else {
-    p->life = (float) math_RandomGenerator_random2(&moduleData.rng, ps->particleLifeMin, ps->particleLifeMax);
+    p->life = (float) math_RandomGenerator_random2(&ps->rng, ps->particleLifeMin, ps->particleLifeMax);
   }
-  p->lifetime = p->life;
 
   switch(ps->areaSpreadDistribution) {
   case graphics_AreaSpreadDistribution_uniform:
-    p->position[0] += math_RandomGenerator_random2(&moduleData.rng, -1.0, 1.0) * ps->areaSpread[0];
-    p->position[1] += math_RandomGenerator_random2(&moduleData.rng, -1.0, 1.0) * ps->areaSpread[1];
+    p->position[0] += math_RandomGenerator_random2(&ps->rng, -1.0, 1.0) * ps->areaSpread[0];
+    p->position[1] += math_RandomGenerator_random2(&ps->rng, -1.0, 1.0) * ps->areaSpread[1];
     break;
   case graphics_AreaSpreadDistribution_normal:
-    p->position[0] += math_RandomGenerator_randomNormal(&moduleData.rng, ps->areaSpread[0]);
-    p->position[1] += math_RandomGenerator_randomNormal(&moduleData.rng, ps->areaSpread[1]);
+    p->position[0] += math_RandomGenerator_randomNormal(&ps->rng, ps->areaSpread[0]);
+    p->position[1] += math_RandomGenerator_randomNormal(&ps->rng, ps->areaSpread[1]);
     break;
   default:
     break;
   }
 
-  float direction = ps->direction + math_RandomGenerator_random2(&moduleData.rng, -1.0, 1.0) * ps->spread;
+  float direction = ps->direction + math_RandomGenerator_random2(&ps->rng, -1.0, 1.0) * ps->spread;
 
-  float speed = math_RandomGenerator_random2(&moduleData.rng, ps->speedMin, ps->speedMax);
+  float speed = math_RandomGenerator_random2(&ps->rng, ps->speedMin, ps->speedMax);
   p->velocity[0] = cos(direction) * speed;
   p->velocity[1] = sin(direction) * speed;
 
-  p->linearAcceleration[0] = math_RandomGenerator_random2(&moduleData.rng, ps->linearAccelerationMin[0], ps->linearAccelerationMax[0]);
-  p->linearAcceleration[1] = math_RandomGenerator_random2(&moduleData.rng, ps->linearAccelerationMin[1], ps->linearAccelerationMax[1]);
+  p->linearAcceleration[0] = math_RandomGenerator_random2(&ps->rng, ps->linearAccelerationMin[0], ps->linearAccelerationMax[0]);
+  p->linearAcceleration[1] = math_RandomGenerator_random2(&ps->rng, ps->linearAccelerationMin[1], ps->linearAccelerationMax[1]);
+
+  p->radialAcceleration = math_RandomGenerator_random2(&ps->rng, ps->radialAccelerationMin, ps->radialAccelerationMax);
+
+  p->tangentialAcceleration = math_RandomGenerator_random2(&ps->rng, ps->tangentialAccelerationMin, ps->tangentialAccelerationMax);
 
-  p->radialAcceleration = math_RandomGenerator_random2(&moduleData.rng, ps->radialAccelerationMin, ps->radialAccelerationMax);
+  p->linearDamping = math_RandomGenerator_random2(&ps->rng, ps->linearDampingMin, ps->linearDampingMax);
 
-  p->tangentialAcceleration = math_RandomGenerator_random2(&moduleData.rng, ps->tangentialAccelerationMin, ps->tangentialAccelerationMax);
+  p->sizeOffset = math_RandomGenerator_random(&ps->rng);
+  p->sizeIntervalSize = (1.0 - math_RandomGenerator_random2(&ps->rng, 0.0, ps->sizeVariation)) - p->sizeOffset;
 
-  p->linearDamping = math_RandomGenerator_random2(&moduleData.rng, ps->linearDampingMin, ps->linearDampingMax);
+  p->spinStart = calculateVariation(&ps->rng, ps->spinStart, ps->spinEnd,   ps->spinVariation);
+  p->spinEnd   = calculateVariation(&ps->rng, ps->spinEnd,   ps->spinStart, ps->spinVariation);
+  p->rotation  = math_RandomGenerator_random2(&ps->rng, ps->rotationMin, ps->rotationMax);
+}
+
+
+static void initParticle(graphics_ParticleSystem *ps, size_t i, ParticleSpawn const *p) {
+  graphics_ParticleData const *d = &ps->particles;
+
+  d->originX[i] = p->origin[0];
+  d->originY[i] = p->origin[1];
+  d->positionX[i] = p->position[0];
+  d->positionY[i] = p->position[1];
+  d->life[i] = d->lifetime[i] = p->life;
+  d->velocityX[i] = p->velocity[0];
+  d->velocityY[i] = p->velocity[1];
+  d->linearAccelerationX[i] = p->linearAcceleration[0];
+  d->linearAccelerationY[i] = p->linearAcceleration[1];
+  d->radialAcceleration[i] = p->radialAcceleration;
+  d->tangentialAcceleration[i] = p->tangentialAcceleration;
+  d->linearDamping[i] = p->linearDamping;
 
-  p->sizeOffset = math_RandomGenerator_random(&moduleData.rng);
-  p->sizeIntervalSize = (1.0 - math_RandomGenerator_random2(&moduleData.rng, 0.0, ps->sizeVariation)) - p->sizeOffset;
-  p->size = ps->sizes[(size_t)(p->sizeOffset - 0.5f) * (ps->sizeCount -1 )];
+  d->sizeOffset[i] = p->sizeOffset;
+  d->sizeIntervalSize[i] = p->sizeIntervalSize;
+  d->size[i] = ps->sizes[(size_t)(d->sizeOffset[i] - 0.5f) * (ps->sizeCount -1 )];
 
-  p->spinStart = calculateVariation(ps->spinStart, ps->spinEnd,   ps->spinVariation);
-  p->spinEnd   = calculateVariation(ps->spinEnd,   ps->spinStart, ps->spinVariation);
-  p->rotation  = math_RandomGenerator_random2(&moduleData.rng, ps->rotationMin, ps->rotationMax);
+  d->spinStart[i] = p->spinStart;
+  d->spinEnd[i]   = p->spinEnd;
+  d->rotation[i]  = p->rotation;
 
-  p->angle = p->rotation;
+  d->angle[i] = d->rotation[i];
   if(ps->relativeRotation) {
-    p->angle += atan2(p->velocity[1], p->velocity[0]);
+    d->angle[i] += atan2(d->velocityY[i], d->velocityX[i]);
   }
 
-  p->color = ps->colors[0];
-  p->quadIndex = 0;
+  d->color[i] = ps->colors[0];
+  d->quadIndex[i] = 0;
 
 }
 
 
-static void insertTop(graphics_ParticleSystem *ps, graphics_Particle *p) {
-  if(ps->pHead == 0) {
-    ps->pHead = p;
-    p->prev = 0;
-  } else {
-    ps->pTail->next = p;
-    p->prev = ps->pTail;
+// Radial and tangential acceleration depend on the direction from the
+// origin, which changes as the particle moves and has no closed form. The
+// GPU path keeps the direction of the particle at spawn time instead: its
+// offset from the emitter, or its velocity if it starts at the emitter.
+// This is exact for particles moving straight away from the emitter.
+static void writeGPUParticle(graphics_ParticleSystem *ps, size_t slot, ParticleSpawn const *p) {
+  graphics_GPUParticleData *g = &ps->gpu;
+
+  float dx = p->position[0] - p->origin[0];
+  float dy = p->position[1] - p->origin[1];
+  if(dx == 0.0f && dy == 0.0f) {
+    dx = p->velocity[0];
+    dy = p->velocity[1];
+  }
+  float len = sqrt(dx * dx + dy * dy);
+  if(len > 0.0f) {
+    dx /= len;
+    dy /= len;
   }
 
-  p->next = 0;
-  ps->pTail = p;
+  float const ax = p->linearAcceleration[0] + dx * p->radialAcceleration - dy * p->tangentialAcceleration;
+  float const ay = p->linearAcceleration[1] + dy * p->radialAcceleration + dx * p->tangentialAcceleration;
+
+  // Same corner order as the CPU path, so both use the shared index buffer
+  static float const corners[4][2] = {{0.0f, 0.0f}, {0.0f, 1.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}};
+
+  graphics_GPUParticleVertex *v = g->vertices + 4 * slot;
+  for(int k = 0; k < 4; ++k) {
+    v[k].motion[0] = p->position[0];
+    v[k].motion[1] = p->position[1];
+    v[k].motion[2] = p->velocity[0];
+    v[k].motion[3] = p->velocity[1];
+    v[k].forces[0] = ax;
+    v[k].forces[1] = ay;
+    v[k].forces[2] = p->linearDamping;
+    v[k].forces[3] = p->life;
+    v[k].spin[0] = g->time;
+    v[k].spin[1] = p->rotation;
+    v[k].spin[2] = p->spinStart;
+    v[k].spin[3] = p->spinEnd;
+    v[k].shape[0] = p->sizeOffset;
+    v[k].shape[1] = p->sizeIntervalSize;
+    v[k].shape[2] = corners[k][0];
+    v[k].shape[3] = corners[k][1];
+  }
+
+  g->deathTimes[slot] = g->time + p->life;
 }
 
 
-static void insertBottom(graphics_ParticleSystem *ps, graphics_Particle *p) {
-  if(ps->pTail == 0) {
-    ps->pTail = p;
-    p->next = 0;
-  } else {
-    ps->pHead->prev = p;
-    p->next = ps->pHead;
+// Moves the draw order back to the middle of its buffer, so there is
+// room to insert at both ends again.
+static void centerOrder(graphics_ParticleSystem *ps) {
+  graphics_ParticleData *d = &ps->particles;
+  size_t newStart = ps->maxParticles - ps->activeParticles / 2;
+  memmove(d->order + newStart, d->order + d->orderStart, ps->activeParticles * sizeof(uint32_t));
+  d->orderStart = newStart;
+}
+
+
+static void insertTop(graphics_ParticleSystem *ps, uint32_t slot) {
+  graphics_ParticleData *d = &ps->particles;
+  if(d->orderStart + ps->activeParticles == 2 * ps->maxParticles) {
+    centerOrder(ps);
   }
 
-  p->prev = 0;
-  ps->pHead = p;
+  d->order[d->orderStart + ps->activeParticles] = slot;
 }
 
 
-static void insertRandom(graphics_ParticleSystem *ps, graphics_Particle *p) {
-  uint64_t pos = math_RandomGenerator_rand(&moduleData.rng) % ((int64_t) ps->activeParticles + 1);
+static void insertBottom(graphics_ParticleSystem *ps, uint32_t slot) {
+  graphics_ParticleData *d = &ps->particles;
+  if(d->orderStart == 0) {
+    centerOrder(ps);
+  }
+
+  d->order[--d->orderStart] = slot;
+}
 
-  if(pos == ps->activeParticles) {
-    graphics_Particle *pA = ps->pHead;
-    if(pA) {
-      pA->prev = p;
+
+static void insertRandom(graphics_ParticleSystem *ps, uint32_t slot) {
+  graphics_ParticleData *d = &ps->particles;
+  uint64_t pos = math_RandomGenerator_rand(&ps->rng) % ((int64_t) ps->activeParticles + 1);
+
+  if(d->orderStart + ps->activeParticles == 2 * ps->maxParticles) {
+    centerOrder(ps);
+  }
+
+  uint32_t *at = d->order + d->orderStart + pos;
+  memmove(at + 1, at, (ps->activeParticles - pos) * sizeof(uint32_t));
+  *at = slot;
+}
+
+
+#define forEachParticleArray(d, f) \
+  f(d, lifetime)                   \
+  f(d, life)                       \
+  f(d, positionX)                  \
+  f(d, positionY)                  \
+  f(d, originX)                    \
+  f(d, originY)                    \
+  f(d, velocityX)                  \
+  f(d, velocityY)                  \
+  f(d, linearAccelerationX)        \
+  f(d, linearAccelerationY)        \
+  f(d, radialAcceleration)         \
+  f(d, tangentialAcceleration)     \
+  f(d, linearDamping)              \
+  f(d, size)                       \
+  f(d, sizeOffset)                 \
+  f(d, sizeIntervalSize)           \
+  f(d, rotation)                   \
+  f(d, angle)                      \
+  f(d, spinStart)                  \
+  f(d, spinEnd)                    \
+  f(d, color)                      \
+  f(d, quadIndex)
+
+
+// Removes all particles that ran out of life, keeping the draw order of
+// the remaining ones.
+static void removeDeadParticles(graphics_ParticleSystem *ps) {
+  graphics_ParticleData *d = &ps->particles;
+  size_t count = ps->activeParticles;
+
+  // Fill the slots of dead particles with the last live ones
+  size_t i = 0;
+  while(i < count) {
+    if(d->life[i] > 0.0f) {
+      d->remap[i] = i;
+      ++i;
+      continue;
     }
 
-    p->prev = 0;
-    p->next = pA;
-    ps->pHead = p;
-    return;
+    --count;
+    d->remap[i] = UINT32_MAX;
+    while(count > i && d->life[count] <= 0.0f) {
+      d->remap[count] = UINT32_MAX;
+      --count;
+    }
+
+    if(count > i) {
+#define moveSlot(d, name) d->name[i] = d->name[count];
+      forEachParticleArray(d, moveSlot)
+#undef moveSlot
+      d->remap[count] = i;
+      ++i;
+    }
   }
 
-  graphics_Particle *pA = ps->pMem + pos;
-  graphics_Particle *pB = pA->next;
-  pA->next = p;
-  if(pB) {
-    pB->prev = p;
-  } else {
-    ps->pTail = p;
+  // Drop dead particles from the draw order and apply the new slot indices
+  uint32_t *order = d->order + d->orderStart;
+  size_t k = 0;
+  for(size_t j = 0; j < ps->activeParticles; ++j) {
+    uint32_t slot = d->remap[order[j]];
+    if(slot != UINT32_MAX) {
+      order[k++] = slot;
+    }
   }
-  p->prev = pA;
-  p->next = pB;
+
+  ps->activeParticles = count;
 }
 
 
-static graphics_Particle* removeParticle(graphics_ParticleSystem *ps, graphics_Particle *p) {
-  graphics_Particle *pNext = 0;
-  if(p->prev) {
-    p->prev->next = p->next;
-  } else {
-    ps->pHead = p->next;
+// A full buffer in GPU mode replaces its oldest particle. Refusing new ones
+// as the CPU path does would stall emission behind a single long-lived
+// particle at the tail of the ring.
+static void addGPUParticle(graphics_ParticleSystem *ps, float t) {
+  graphics_GPUParticleData *g = &ps->gpu;
+  if(ps->maxParticles == 0) {
+    return;
   }
 
-  if(p->next) {
-    p->next->prev = p->prev;
-    pNext = p->next;
-  } else {
-    ps->pTail = p->prev;
+  if(g->used == ps->maxParticles) {
+    g->tail = (g->tail + 1) % ps->maxParticles;
+    --g->used;
   }
 
-  --ps->pFree;
+  ParticleSpawn p;
+  spawnParticle(ps, &p, t);
+  writeGPUParticle(ps, g->head, &p);
 
-  if(p != ps->pFree) {
-    *p = *ps->pFree;
-    if(pNext == ps->pFree) {
-      pNext = p;
-    }
+  if(g->dirtyCount == 0) {
+    g->dirtyFirst = g->head;
+  }
+  if(g->dirtyCount < ps->maxParticles) {
+    ++g->dirtyCount;
+  }
 
-    if(p->prev) {
-      p->prev->next = p;
-    } else {
-      ps->pHead = p;
-    }
+  g->head = (g->head + 1) % ps->maxParticles;
+  ++g->used;
+}
 
-    if(p->next) {
-      p->next->prev = p;
-    } else {
-      ps->pTail = p;
-    }
+
+// Drops particles from the tail of the ring that are known to be dead.
+// Lifetimes vary, so a dead particle behind a live one stays until the live
+// one dies; the shader hides it in the meantime.
+static void retireGPUParticles(graphics_ParticleSystem *ps) {
+  graphics_GPUParticleData *g = &ps->gpu;
+  while(g->used > 0 && g->deathTimes[g->tail] <= g->time) {
+    g->tail = (g->tail + 1) % ps->maxParticles;
+    --g->used;
   }
+}
 
-  --ps->activeParticles;
-  return pNext;
+
+static size_t getFreeSlots(graphics_ParticleSystem const *ps) {
+  if(ps->mode == graphics_ParticleMode_gpu) {
+    return ps->maxParticles;
+  }
+  return ps->maxParticles - ps->activeParticles;
 }
 
 
 static void addParticle(graphics_ParticleSystem *ps, float t) {
-  graphics_Particle *p = ps->pFree++;
-  initParticle(ps, p, t);
+  if(ps->mode == graphics_ParticleMode_gpu) {
+    addGPUParticle(ps, t);
+    return;
+  }
+
+  if(ps->activeParticles == ps->maxParticles) {
+    return;
+  }
+
+  uint32_t slot = ps->activeParticles;
+  ParticleSpawn p;
+  spawnParticle(ps, &p, t);
+  initParticle(ps, slot, &p);
 
   switch(ps->insertMode) {
   case graphics_ParticleInsertMode_top:
-    insertTop(ps, p);
+    insertTop(ps, slot);
     break;
   case graphics_ParticleInsertMode_bottom:
-    insertBottom(ps, p);
+    insertBottom(ps, slot);
     break;
   case graphics_ParticleInsertMode_random:
-    insertRandom(ps, p);
+    insertRandom(ps, slot);
     break;
   }
 
@@ -244,12 +500,53 @@ static void addParticle(graphics_ParticleSystem *ps, float t) {
 }
 
 
+// Every system has its own generator, so systems can be updated concurrently.
+// The module generator only hands out seeds.
+static void initRandomGenerator(graphics_ParticleSystem *ps) {
+  math_RandomGenerator_init(&ps->rng);
+  math_RandomGenerator_setSeed(&ps->rng, math_RandomGenerator_rand(&moduleData.rng));
+}
+
+
+static void initVertexBuffer(graphics_ParticleSystem *ps) {
+  glGenVertexArrays(1, &ps->vao);
+  glBindVertexArray(ps->vao);
+  glGenBuffers(1, &ps->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, ps->vbo);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(graphics_PackedVertex), 0);
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(graphics_PackedVertex), (GLvoid const*)(2*sizeof(float)));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(graphics_PackedVertex), (GLvoid const*)(4*sizeof(float)));
+}
+
+
+static void initGPUVertexBuffer(graphics_ParticleSystem *ps) {
+  glGenVertexArrays(1, &ps->gpu.vao);
+  glBindVertexArray(ps->gpu.vao);
+  glGenBuffers(1, &ps->gpu.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, ps->gpu.vbo);
+
+  for(int i = 0; i < 4; ++i) {
+    glEnableVertexAttribArray(i);
+  }
+}
+
+
 void graphics_ParticleSystem_new(graphics_ParticleSystem *ps, graphics_Image const *texture, size_t buffer) {
   ps->sizes = 0;
   ps->colors = 0;
   ps->quads = 0;
+  ps->sizeCount = ps->colorCount = ps->quadCount = 0;
+  ps->particles.mem = 0;
+  ps->vertices = 0;
+  memset(&ps->gpu, 0, sizeof(ps->gpu));
+  ps->mode = graphics_ParticleMode_cpu;
   ps->active = false;
-  graphics_Batch_new(&ps->batch, texture, buffer, graphics_BatchUsage_stream);
+  initRandomGenerator(ps);
+  initVertexBuffer(ps);
 
   graphics_ParticleSystem_setBufferSize(ps, buffer);
   graphics_ParticleSystem_reset(ps);
@@ -283,7 +580,14 @@ void graphics_ParticleSystem_clone(graphics_ParticleSystem const* ps, graphics_P
   psNew->sizes = 0;
   psNew->colors = 0;
   psNew->quads = 0;
+  psNew->sizeCount = psNew->colorCount = psNew->quadCount = 0;
+  psNew->particles.mem = 0;
+  psNew->vertices = 0;
+  memset(&psNew->gpu, 0, sizeof(psNew->gpu));
+  psNew->mode = ps->mode;
   psNew->active = false;
+  initRandomGenerator(psNew);
+  initVertexBuffer(psNew);
 
   graphics_ParticleSystem_setBufferSize(psNew, ps->maxParticles);
   graphics_ParticleSystem_reset(psNew);
@@ -328,19 +632,88 @@ void graphics_ParticleSystem_getLinearDamping(graphics_ParticleSystem const *ps,
 }
 
 
+static void freeGPUBuffers(graphics_ParticleSystem *ps) {
+  graphics_GPUParticleData *g = &ps->gpu;
+  if(g->vao) {
+    glDeleteBuffers(1,      &g->vbo);
+    glDeleteVertexArrays(1, &g->vao);
+    g->vbo = g->vao = 0;
+  }
+  free(g->vertices);
+  free(g->deathTimes);
+  g->vertices = 0;
+  g->deathTimes = 0;
+}
+
+
 void graphics_ParticleSystem_free(graphics_ParticleSystem *ps) {
-  graphics_Batch_free(&ps->batch);
-  free(ps->pMem);
+  glDeleteBuffers(1,      &ps->vbo);
+  glDeleteVertexArrays(1, &ps->vao);
+  freeGPUBuffers(ps);
+  free(ps->vertices);
+  free(ps->particles.mem);
   free(ps->colors);
   free(ps->quads);
   free(ps->sizes);
 }
 
 
+static void allocateGPUBuffers(graphics_ParticleSystem *ps, size_t size) {
+  graphics_GPUParticleData *g = &ps->gpu;
+  if(!g->vao) {
+    initGPUVertexBuffer(ps);
+  }
+
+  free(g->vertices);
+  free(g->deathTimes);
+  g->vertices = malloc(4 * size * sizeof(graphics_GPUParticleVertex));
+  g->deathTimes = malloc(size * sizeof(float));
+
+  glBindBuffer(GL_ARRAY_BUFFER, g->vbo);
+  glBufferData(GL_ARRAY_BUFFER, 4 * size * sizeof(graphics_GPUParticleVertex), NULL, GL_DYNAMIC_DRAW);
+}
+
+
 void graphics_ParticleSystem_setBufferSize(graphics_ParticleSystem *ps, size_t size) {
-  ps->pMem = malloc(sizeof(graphics_Particle) * size);
-  ps->pFree = ps->pMem;
+  if(ps->mode == graphics_ParticleMode_gpu) {
+    allocateGPUBuffers(ps, size);
+    ps->maxParticles = size;
+    graphics_ParticleSystem_reset(ps);
+    return;
+  }
+
+  graphics_ParticleData *d = &ps->particles;
+
+  // The update processes four particles at a time, round up so the last
+  // group stays inside the arrays.
+  size_t padded = (size + 3) & ~(size_t)3;
+
+  size_t const floatArrays = 20;
+  size_t bytes = padded * (floatArrays * sizeof(float) + sizeof(graphics_Color) + sizeof(uint32_t))
+               + 2 * size * sizeof(uint32_t)
+               + padded * sizeof(uint32_t);
+
+  free(d->mem);
+  d->mem = calloc(1, bytes);
+
+  char *ptr = d->mem;
+#define carveArray(d, name)               \
+  d->name = (void*)ptr;                   \
+  ptr += padded * sizeof(*d->name);
+  forEachParticleArray(d, carveArray)
+#undef carveArray
+  d->remap = (uint32_t*)ptr;
+  ptr += padded * sizeof(uint32_t);
+  d->order = (uint32_t*)ptr;
+
   ps->maxParticles = size;
+
+  free(ps->vertices);
+  ps->vertices = malloc(4 * size * sizeof(graphics_PackedVertex));
+  glBindBuffer(GL_ARRAY_BUFFER, ps->vbo);
+  glBufferData(GL_ARRAY_BUFFER, 4 * size * sizeof(graphics_PackedVertex), NULL, GL_STREAM_DRAW);
+
+  graphics_ParticleSystem_reset(ps);
 }
 
 
@@ -381,7 +754,52 @@ graphics_Color const* graphics_ParticleSystem_getColors(graphics_ParticleSystem
 }
 
 
+// Switching modes drops all particles. Only the buffers of the current mode
+// are kept around. Returns false and stays in the current mode if the GPU
+// particle shader can not be built.
+bool graphics_ParticleSystem_setMode(graphics_ParticleSystem *ps, graphics_ParticleMode mode) {
+  if(mode == ps->mode) {
+    return true;
+  }
+
+  if(mode == graphics_ParticleMode_gpu && !prepareGPUShader()) {
+    return false;
+  }
+
+  ps->mode = mode;
+  if(mode == graphics_ParticleMode_gpu) {
+    free(ps->particles.mem);
+    free(ps->vertices);
+    ps->particles.mem = 0;
+    ps->vertices = 0;
+  } else {
+    freeGPUBuffers(ps);
+  }
+
+  graphics_ParticleSystem_setBufferSize(ps, ps->maxParticles);
+  return true;
+}
+
+
+graphics_ParticleMode graphics_ParticleSystem_getMode(graphics_ParticleSystem const *ps) {
+  return ps->mode;
+}
+
+
 size_t graphics_ParticleSystem_getCount(graphics_ParticleSystem const *ps) {
+  if(ps->mode == graphics_ParticleMode_gpu) {
+    // Not tracked per frame, so this is the only place that costs time
+    // proportional to the number of particles.
+    graphics_GPUParticleData const *g = &ps->gpu;
+    size_t count = 0;
+    for(size_t i = 0, slot = g->tail; i < g->used; ++i, slot = (slot + 1) % ps->maxParticles) {
+      if(g->deathTimes[slot] > g->time) {
+        ++count;
+      }
+    }
+    return count;
+  }
+
   return ps->activeParticles;
 }
 
@@ -438,6 +856,7 @@ float graphics_ParticleSystem_getSpread(graphics_ParticleSystem const *ps) {
 void graphics_ParticleSystem_setOffset(graphics_ParticleSystem *ps, float x, float y) {
   ps->offsetX = x;
   ps->offsetY = y;
+  ps->verticesDirty = true;
 }
 
 void graphics_ParticleSystem_setParticleLifetime(graphics_ParticleSystem *ps, float min, float max) {
@@ -519,6 +938,7 @@ void graphics_ParticleSystem_getTangentialAcceleration(graphics_ParticleSystem c
 
 void graphics_ParticleSystem_setTexture(graphics_ParticleSystem *ps, graphics_Image const* texture) {
   ps->texture = texture;
+  ps->verticesDirty = true;
 }
 
 
@@ -550,6 +970,7 @@ void graphics_ParticleSystem_setQuads(graphics_ParticleSystem *ps, size_t count,
   }
 
   memcpy(ps->quads, quads, sizeof(graphics_Quad*) * count);
+  ps->verticesDirty = true;
 }
 
 
@@ -593,11 +1014,12 @@ void graphics_ParticleSystem_emit(graphics_ParticleSystem *ps, size_t count) {
     return;
   }
 
-  size_t num = min(count, ps->maxParticles - ps->activeParticles);
+  size_t num = min(count, getFreeSlots(ps));
   while(num) {
     addParticle(ps, 1.0f);
     --num;
   }
+  ps->verticesDirty = true;
 }
 
 void graphics_ParticleSystem_start(graphics_ParticleSystem *ps) {
@@ -611,10 +1033,12 @@ void graphics_ParticleSystem_stop(graphics_ParticleSystem *ps) {
 }
 
 void graphics_ParticleSystem_reset(graphics_ParticleSystem *ps) {
-  ps->pFree = ps->pMem;
-  ps->pHead = 0;
-  ps->pTail = 0;
+  ps->particles.orderStart = ps->maxParticles;
   ps->activeParticles = 0;
+  ps->verticesDirty = true;
+  ps->gpu.head = ps->gpu.tail = ps->gpu.used = 0;
+  ps->gpu.dirtyCount = 0;
+  ps->gpu.time = 0.0f;
   ps->life = ps->lifetime;
   ps->emitCounter = 0;
 }
@@ -639,71 +1063,105 @@ void graphics_ParticleSystem_pause(graphics_ParticleSystem *ps) {
   ps->active = false;
 }
 
-void graphics_ParticleSystem_update(graphics_ParticleSystem *ps, float dt) {
-  if(ps->pMem == 0 || dt == 0.0f) {
-    return;
+static void updateParticles(graphics_ParticleSystem *ps, float dt) {
+  graphics_ParticleData *d = &ps->particles;
+
+  // Movement, life and spin can be computed four particles at a time.
+  // This may run past activeParticles into the padding, which is harmless.
+  math_float4 const vdt   = math_float4_set1(dt);
+  math_float4 const vone  = math_float4_set1(1.0f);
+  math_float4 const vtiny = math_float4_set1(1e-30f);
+  for(size_t i = 0; i < ps->activeParticles; i += 4) {
+    math_float4 life = math_float4_sub(math_float4_load(d->life + i), vdt);
+    math_float4_store(d->life + i, life);
+
+    math_float4 posX = math_float4_load(d->positionX + i);
+    math_float4 posY = math_float4_load(d->positionY + i);
+
+    // Normalized radial direction, stays zero if the particle is at its origin
+    math_float4 radialX = math_float4_sub(posX, math_float4_load(d->originX + i));
+    math_float4 radialY = math_float4_sub(posY, math_float4_load(d->originY + i));
+    math_float4 len = math_float4_sqrt(math_float4_max(math_float4_madd(math_float4_mul(radialX, radialX), radialY, radialY), vtiny));
+    math_float4 invLen = math_float4_div(vone, len);
+    radialX = math_float4_mul(radialX, invLen);
+    radialY = math_float4_mul(radialY, invLen);
+
+    math_float4 tangential = math_float4_load(d->tangentialAcceleration + i);
+    math_float4 radial = math_float4_load(d->radialAcceleration + i);
+    math_float4 accX = math_float4_madd(math_float4_load(d->linearAccelerationX + i), radialX, radial);
+    math_float4 accY = math_float4_madd(math_float4_load(d->linearAccelerationY + i), radialY, radial);
+    accX = math_float4_sub(accX, math_float4_mul(radialY, tangential));
+    accY = math_float4_madd(accY, radialX, tangential);
+
+    math_float4 damping = math_float4_div(vone, math_float4_madd(vone, math_float4_load(d->linearDamping + i), vdt));
+    math_float4 velX = math_float4_mul(math_float4_madd(math_float4_load(d->velocityX + i), accX, vdt), damping);
+    math_float4 velY = math_float4_mul(math_float4_madd(math_float4_load(d->velocityY + i), accY, vdt), damping);
+    math_float4_store(d->velocityX + i, velX);
+    math_float4_store(d->velocityY + i, velY);
+
+    math_float4_store(d->positionX + i, math_float4_madd(posX, velX, vdt));
+    math_float4_store(d->positionY + i, math_float4_madd(posY, velY, vdt));
+
+    math_float4 t = math_float4_sub(vone, math_float4_div(life, math_float4_load(d->lifetime + i)));
+    math_float4 spinStart = math_float4_load(d->spinStart + i);
+    math_float4 spin = math_float4_madd(spinStart, math_float4_sub(math_float4_load(d->spinEnd + i), spinStart), t);
+    math_float4 rotation = math_float4_madd(math_float4_load(d->rotation + i), spin, vdt);
+    math_float4_store(d->rotation + i, rotation);
+    math_float4_store(d->angle + i, rotation);
   }
 
-  graphics_Particle *p = ps->pHead;
-
-  while(p) {
-    p->life -= dt;
-
-    if(p->life <= 0.0f) {
-      p = removeParticle(ps, p);
-      continue;
+  // Dead particles go first, their t would index past the end of the tables
+  for(size_t j = 0; j < ps->activeParticles; ++j) {
+    if(d->life[j] <= 0.0f) {
+      removeDeadParticles(ps);
+      break;
     }
+  }
 
-    float radialX = p->position[0] - p->origin[0];
-    float radialY = p->position[1] - p->origin[1];
-    normalizeInPlace(&radialX, &radialY);
-    float tangentialX = -radialY * p->tangentialAcceleration;
-    float tangentialY =  radialX * p->tangentialAcceleration;
-
-    radialX *= p->radialAcceleration;
-    radialY *= p->radialAcceleration;
-
-    p->velocity[0] += (radialX + tangentialX + p->linearAcceleration[0]) * dt;
-    p->velocity[1] += (radialY + tangentialY + p->linearAcceleration[1]) * dt;
-
-    p->velocity[0] *= 1.0f / (1.0f + p->linearDamping * dt);
-    p->velocity[1] *= 1.0f / (1.0f + p->linearDamping * dt);
-    
-    p->position[0] += p->velocity[0] * dt;
-    p->position[1] += p->velocity[1] * dt;
-
-    float const t = 1.0f - p->life / p->lifetime;
-    p->rotation += lerp(p->spinStart, p->spinEnd, t) * dt;
-    p->angle = p->rotation;
+  // Sizes, colors and quads are looked up from the system's tables
+  for(size_t j = 0; j < ps->activeParticles; ++j) {
+    float const t = 1.0f - d->life[j] / d->lifetime[j];
 
     if(ps->relativeRotation) {
-      p->angle += atan2(p->velocity[1], p->velocity[0]);
+      d->angle[j] += atan2(d->velocityY[j], d->velocityX[j]);
     }
 
-    float s = (p->sizeOffset + t * p->sizeIntervalSize) * (float)(ps->sizeCount - 1);
+    float s = (d->sizeOffset[j] + t * d->sizeIntervalSize[j]) * (float)(ps->sizeCount - 1);
     size_t i = (size_t)s;
     size_t k = (i == ps->sizeCount - 1) ? i : i + 1;
     s -= (float)i;
-    p->size = lerp(ps->sizes[i], ps->sizes[k], s);
+    d->size[j] = lerp(ps->sizes[i], ps->sizes[k], s);
 
     s = t * (float)(ps->colorCount - 1);
     i = (size_t)s;
     k = (i == ps->colorCount - 1) ? i : i + 1;
     s -= (float)i;
 
-    p->color.red   = lerp(ps->colors[i].red,   ps->colors[k].red,   s);
-    p->color.green = lerp(ps->colors[i].green, ps->colors[k].green, s);
-    p->color.blue  = lerp(ps->colors[i].blue,  ps->colors[k].blue,  s);
-    p->color.alpha = lerp(ps->colors[i].alpha, ps->colors[k].alpha, s);
+    d->color[j].red   = lerp(ps->colors[i].red,   ps->colors[k].red,   s);
+    d->color[j].green = lerp(ps->colors[i].green, ps->colors[k].green, s);
+    d->color[j].blue  = lerp(ps->colors[i].blue,  ps->colors[k].blue,  s);
+    d->color[j].alpha = lerp(ps->colors[i].alpha, ps->colors[k].alpha, s);
 
     k = ps->quadCount;
     if(k > 0) {
       s = t * (float)k;
       i = (s > 0.0f) ? (size_t) s : 0;
-      p->quadIndex = (i < k) ? i : k - 1;
+      d->quadIndex[j] = (i < k) ? i : k - 1;
     }
+  }
+}
 
-    p = p->next;
+void graphics_ParticleSystem_update(graphics_ParticleSystem *ps, float dt) {
+  if(ps->maxParticles == 0 || dt == 0.0f) {
+    return;
+  }
+
+  if(ps->mode == graphics_ParticleMode_gpu) {
+    ps->gpu.time += dt;
+    retireGPUParticles(ps);
+  } else {
+    updateParticles(ps, dt);
+    ps->verticesDirty = true;
   }
 
   if(ps->active) {
@@ -724,20 +1182,345 @@ void graphics_ParticleSystem_update(graphics_ParticleSystem *ps, float dt) {
   memcpy(ps->prevPosition, ps->position, sizeof(ps->position));
 }
 
+// Advances the emitter as update would, without spawning anything
+static void skipEmission(graphics_ParticleSystem *ps, float dt) {
+  if(!ps->active) {
+    return;
+  }
+
+  if(ps->emissionRate > 0.0f) {
+    float rate = 1.0f / ps->emissionRate;
+    ps->emitCounter = fmod(ps->emitCounter + dt, rate);
+  }
+
+  ps->life -= dt;
+  if(ps->lifetime != -1 && ps->life < 0) {
+    graphics_ParticleSystem_stop(ps);
+  }
+}
+
+
+static float const defaultPrewarmStep = 1.0f / 20.0f;
+
+// Runs the system for the given time in steps of at most step seconds.
+// Particles emitted more than particleLifeMax before the end can not be
+// alive anymore, so that part only advances the emitter. Particles already
+// alive that die within the window are dropped right away.
+void graphics_ParticleSystem_prewarm(graphics_ParticleSystem *ps, float seconds, float step) {
+  if(seconds <= 0.0f || ps->maxParticles == 0) {
+    return;
+  }
+
+  if(step <= 0.0f) {
+    step = defaultPrewarmStep;
+  }
+
+  float skip = seconds - ps->particleLifeMax;
+  if(skip > 0.0f) {
+    if(ps->mode == graphics_ParticleMode_gpu) {
+      ps->gpu.time += skip;
+      retireGPUParticles(ps);
+    } else {
+      graphics_ParticleData *d = &ps->particles;
+      bool dying = false;
+      for(size_t j = 0; j < ps->activeParticles; ++j) {
+        if(d->life[j] <= seconds) {
+          d->life[j] = 0.0f;
+          dying = true;
+        }
+      }
+      if(dying) {
+        removeDeadParticles(ps);
+      }
+
+      // Whatever is left lives past the skipped part and has to be moved
+      for(float left = skip; left > 0.0f && ps->activeParticles > 0; left -= step) {
+        updateParticles(ps, fmin(left, step));
+      }
+      ps->verticesDirty = true;
+    }
+
+    skipEmission(ps, skip);
+    seconds -= skip;
+  }
+
+  for(; seconds > 0.0f; seconds -= step) {
+    graphics_ParticleSystem_update(ps, fmin(seconds, step));
+  }
+}
+
+
+static uint8_t packColorComponent(float c) {
+  if(c <= 0.0f) {
+    return 0;
+  } else if(c >= 1.0f) {
+    return 255;
+  }
+  return (uint8_t)(c * 255.0f + 0.5f);
+}
+
+
+// Writes one quad per particle in draw order. This is the transform of
+// graphics_Batch_add (m3x3_newTransform2d without shearing) expanded by
+// hand, so each particle only needs one sin/cos pair.
+static void writeVertices(graphics_ParticleSystem *ps) {
+  graphics_ParticleData const *d = &ps->particles;
+  uint32_t const *order = d->order + d->orderStart;
+  float const texW = ps->texture->width;
+  float const texH = ps->texture->height;
+  float const ox = ps->offsetX;
+  float const oy = ps->offsetY;
+
+  graphics_PackedVertex *v = ps->vertices;
+  for(size_t j = 0; j < ps->activeParticles; ++j, v += 4) {
+    uint32_t i = order[j];
+    graphics_Quad const* q = ps->quads[d->quadIndex[i]];
+
+    float const s = d->size[i];
+    float const sa = sin(d->angle[i]) * s;
+    float const ca = cos(d->angle[i]) * s;
+
+    // Quad edges along u and v and the position of the first corner
+    float const w = q->w * texW;
+    float const h = q->h * texH;
+    float const ux =  w * ca;
+    float const uy =  w * sa;
+    float const vx = -h * sa;
+    float const vy =  h * ca;
+    float const x = d->positionX[i] - ca * ox + sa * oy;
+    float const y = d->positionY[i] - sa * ox - ca * oy;
+
+    v[0].pos.x = x;
+    v[0].pos.y = y;
+    v[1].pos.x = x + vx;
+    v[1].pos.y = y + vy;
+    v[2].pos.x = x + ux;
+    v[2].pos.y = y + uy;
+    v[3].pos.x = x + ux + vx;
+    v[3].pos.y = y + uy + vy;
+
+    v[0].uv.x = q->x;
+    v[0].uv.y = q->y;
+    v[1].uv.x = q->x;
+    v[1].uv.y = q->y + q->h;
+    v[2].uv.x = q->x + q->w;
+    v[2].uv.y = q->y;
+    v[3].uv.x = q->x + q->w;
+    v[3].uv.y = q->y + q->h;
+
+    graphics_Color const* c = &d->color[i];
+    uint8_t const packed[4] = {
+      packColorComponent(c->red),
+      packColorComponent(c->green),
+      packColorComponent(c->blue),
+      packColorComponent(c->alpha)
+    };
+    for(int k = 0; k < 4; ++k) {
+      memcpy(v[k].color, packed, sizeof(packed));
+    }
+  }
+}
+
+
+static const graphics_Quad fullQuad = {0.0f, 0.0f, 1.0f, 1.0f};
+
+// The shader is only built once the first GPU mode system is drawn
+static bool prepareGPUShader(void) {
+  GPUParticleShader *gs = &moduleData.gpuShader;
+  if(gs->compiled) {
+    return gs->status == graphics_ShaderCompileStatus_okay;
+  }
+
+  gs->compiled = true;
+  gs->status = graphics_Shader_newRaw(&gs->shader, gpuVertexSource, gpuFragmentSource,
+                                      gpuAttributes, sizeof(gpuAttributes) / sizeof(*gpuAttributes));
+  if(gs->status != graphics_ShaderCompileStatus_okay) {
+    return false;
+  }
+
+  GLuint program = gs->shader.program;
+  gs->uniforms.time             = glGetUniformLocation(program, "motor2d_time");
+  gs->uniforms.textureSize      = glGetUniformLocation(program, "motor2d_textureSize");
+  gs->uniforms.offset           = glGetUniformLocation(program, "motor2d_offset");
+  gs->uniforms.relativeRotation = glGetUniformLocation(program, "motor2d_relativeRotation");
+  gs->uniforms.sizes            = glGetUniformLocation(program, "motor2d_sizes");
+  gs->uniforms.sizeCount        = glGetUniformLocation(program, "motor2d_sizeCount");
+  gs->uniforms.colors           = glGetUniformLocation(program, "motor2d_colors");
+  gs->uniforms.colorCount       = glGetUniformLocation(program, "motor2d_colorCount");
+  gs->uniforms.quads            = glGetUniformLocation(program, "motor2d_quads");
+  gs->uniforms.quadCount        = glGetUniformLocation(program, "motor2d_quadCount");
+  return true;
+}
+
+
+static void sendGPUUniforms(graphics_ParticleSystem const *ps) {
+  GPUParticleShader const *gs = &moduleData.gpuShader;
+
+  size_t const sizeCount  = min(ps->sizeCount,  GPU_TABLE_SIZE);
+  size_t const colorCount = min(ps->colorCount, GPU_TABLE_SIZE);
+  size_t const quadCount  = min(ps->quadCount,  GPU_TABLE_SIZE);
+
+  float quads[4 * GPU_TABLE_SIZE];
+  for(size_t i = 0; i < quadCount; ++i) {
+    memcpy(quads + 4 * i, ps->quads[i], sizeof(graphics_Quad));
+  }
+
+  // The CPU path leaves this to the vertex color handling of the shaders
+  graphics_Color colors[GPU_TABLE_SIZE];
+  memcpy(colors, ps->colors, colorCount * sizeof(graphics_Color));
+  if(graphics_isGammaCorrect()) {
+    for(size_t i = 0; i < colorCount; ++i) {
+      colors[i].red   = math_gammaToLinear(colors[i].red);
+      colors[i].green = math_gammaToLinear(colors[i].green);
+      colors[i].blue  = math_gammaToLinear(colors[i].blue);
+    }
+  }
+
+  glUseProgram(gs->shader.program);
+  glUniform1f(gs->uniforms.time, ps->gpu.time);
+  glUniform2f(gs->uniforms.textureSize, ps->texture->width, ps->texture->height);
+  glUniform2f(gs->uniforms.offset, ps->offsetX, ps->offsetY);
+  glUniform1f(gs->uniforms.relativeRotation, ps->relativeRotation ? 1.0f : 0.0f);
+  glUniform1fv(gs->uniforms.sizes, sizeCount, ps->sizes);
+  glUniform1f(gs->uniforms.sizeCount, sizeCount);
+  glUniform4fv(gs->uniforms.colors, colorCount, (GLfloat const*)colors);
+  glUniform1f(gs->uniforms.colorCount, colorCount);
+  glUniform4fv(gs->uniforms.quads, quadCount, quads);
+  glUniform1f(gs->uniforms.quadCount, quadCount);
+}
+
+
+// Uploads the slots written since the last draw, the range may wrap around
+// the end of the ring.
+static void uploadGPUParticles(graphics_ParticleSystem *ps) {
+  graphics_GPUParticleData *g = &ps->gpu;
+  if(g->dirtyCount == 0) {
+    return;
+  }
+
+  size_t const stride = 4 * sizeof(graphics_GPUParticleVertex);
+  size_t const first = min(g->dirtyCount, ps->maxParticles - g->dirtyFirst);
+  glBindBuffer(GL_ARRAY_BUFFER, g->vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, g->dirtyFirst * stride, first * stride, g->vertices + 4 * g->dirtyFirst);
+  graphics_countBufferUpload(first * stride);
+  if(first < g->dirtyCount) {
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (g->dirtyCount - first) * stride, g->vertices);
+    graphics_countBufferUpload((g->dirtyCount - first) * stride);
+  }
+
+  g->dirtyCount = 0;
+}
+
+
+// Points the attributes at the given slot, so every chunk can start at
+// index zero of the 16 bit index buffer.
+static void bindGPUParticles(graphics_GPUParticleData const *g, size_t slot) {
+  glBindVertexArray(g->vao);
+  glBindBuffer(GL_ARRAY_BUFFER, g->vbo);
+
+  char const* base = (char const*)(slot * 4 * sizeof(graphics_GPUParticleVertex));
+  glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(graphics_GPUParticleVertex), base + offsetof(graphics_GPUParticleVertex, motion));
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(graphics_GPUParticleVertex), base + offsetof(graphics_GPUParticleVertex, forces));
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(graphics_GPUParticleVertex), base + offsetof(graphics_GPUParticleVertex, spin));
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(graphics_GPUParticleVertex), base + offsetof(graphics_GPUParticleVertex, shape));
+}
+
+
+graphics_Shader const* graphics_particlesystem_getGPUShader(void) {
+  return &moduleData.gpuShader.shader;
+}
+
+
+static size_t const gpuChunkSize = 16384;
+
+static void drawGPU(graphics_ParticleSystem *ps, mat4x4 const* tr2d) {
+  graphics_GPUParticleData *g = &ps->gpu;
+  if(!prepareGPUShader()) {
+    return;
+  }
+
+  uploadGPUParticles(ps);
+  if(g->used == 0) {
+    return;
+  }
+
+  graphics_Shader *shader = graphics_getShader();
+  graphics_setShader(&moduleData.gpuShader.shader);
+  sendGPUUniforms(ps);
+
+  glActiveTexture(GL_TEXTURE0);
+  graphics_Image_use(ps->texture);
+  GLuint ibo = graphics_batch_getQuadIndexBuffer(min(g->used, gpuChunkSize));
+
+  // Oldest particles first, matching the top insert mode
+  size_t slot = g->tail;
+  size_t remaining = g->used;
+  while(remaining > 0) {
+    size_t count = min(min(remaining, ps->maxParticles - slot), gpuChunkSize);
+    bindGPUParticles(g, slot);
+    graphics_drawArray(&fullQuad, tr2d, g->vao, ibo, 0, count*6, GL_TRIANGLES, GL_UNSIGNED_SHORT, (float const*)&defaultColor, 1.0f, 1.0f, false);
+    slot = (slot + count) % ps->maxParticles;
+    remaining -= count;
+  }
+
+  graphics_setShader(shader);
+}
+
+
 void graphics_ParticleSystem_draw(graphics_ParticleSystem *ps, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
   //printf("Drawing particle system, %d particles\n", ps->activeParticles);
 
-  graphics_Batch *b = &ps->batch;
-  //graphics_Batch_bind(b);
-  graphics_Batch_clear(b);
-  for(graphics_Particle *p = ps->pHead; p; p = p->next) {
-    // TODO move the following back to the draw function!
-    graphics_Quad const* q = ps->quads[p->quadIndex];
-    graphics_Batch_setColor(b, p->color.red, p->color.green, p->color.blue, p->color.alpha);
-    graphics_Batch_add(b, q, p->position[0], p->position[1], p->angle, p->size, p->size, ps->offsetX, ps->offsetY, 0.0f, 0.0f);
-  }
-  graphics_Batch_flush(b);
-  graphics_Batch_draw(&ps->batch, x, y, r, sx, sy, ox, oy, kx, ky);
+  if(ps->mode == graphics_ParticleMode_gpu) {
+    mat4x4 tr2d;
+    m4x4_newTransform2d(&tr2d, x, y, r, sx, sy, ox, oy, kx, ky);
+    drawGPU(ps, &tr2d);
+    return;
+  }
+
+  // Paused or stopped systems that have not been touched since the last
+  // draw can reuse the vertices already in the buffer
+  if(ps->verticesDirty) {
+    writeVertices(ps);
+    glBindBuffer(GL_ARRAY_BUFFER, ps->vbo);
+    glBufferData(GL_ARRAY_BUFFER, 4 * ps->maxParticles * sizeof(graphics_PackedVertex), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, 4 * ps->activeParticles * sizeof(graphics_PackedVertex), ps->vertices);
+    graphics_countBufferUpload(4 * ps->activeParticles * sizeof(graphics_PackedVertex));
+    ps->verticesDirty = false;
+  }
+
+  if(ps->activeParticles == 0) {
+    return;
+  }
+
+  glActiveTexture(GL_TEXTURE0);
+  graphics_Image_use(ps->texture);
+  mat4x4 tr2d;
+  m4x4_newTransform2d(&tr2d, x, y, r, sx, sy, ox, oy, kx, ky);
+  GLuint ibo = graphics_batch_getQuadIndexBuffer(ps->activeParticles);
+
+  graphics_drawArray(&fullQuad, &tr2d, ps->vao, ibo, 0, ps->activeParticles*6, GL_TRIANGLES, GL_UNSIGNED_SHORT, (float const*)&defaultColor, 1.0f, 1.0f, true);
+}
+
+
+typedef struct {
+  graphics_ParticleSystem **systems;
+  float dt;
+} UpdateJob;
+
+
+static void updateJob(void *data, int index) {
+  UpdateJob const* update = (UpdateJob const*)data;
+  graphics_ParticleSystem_update(update->systems[index], update->dt);
+}
+
+
+void graphics_particlesystem_updateMany(graphics_ParticleSystem **systems, int count, float dt) {
+  UpdateJob update = {
+    .systems = systems,
+    .dt = dt
+  };
+
+  threadpool_parallelFor(updateJob, &update, count);
 }
 
 
@@ -10,13 +10,56 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "graphics.h"
 #include "image.h"
 #include "quad.h"
 #include "batch.h"
-
-struct graphics_Particle;
-typedef struct graphics_Particle graphics_Particle;
+#include "vertex.h"
+#include "shader.h"
+#include "../math/randomgenerator.h"
+
+// Particles are stored as structure of arrays in a single allocation, so the
+// update can run over each attribute with vector instructions.
+// Slots [0, activeParticles) are always in use, removing a particle moves the
+// last slot into its place. The draw order is kept separately in order, which
+// lists slot indices from order[orderStart] to order[orderStart + activeParticles - 1].
+typedef struct {
+  void *mem;
+
+  float *lifetime;
+  float *life;
+
+  float *positionX;
+  float *positionY;
+  float *originX;
+  float *originY;
+  float *velocityX;
+  float *velocityY;
+  float *linearAccelerationX;
+  float *linearAccelerationY;
+  float *radialAcceleration;
+  float *tangentialAcceleration;
+  float *linearDamping;
+
+  float *size;
+  float *sizeOffset;
+  float *sizeIntervalSize;
+
+  float *rotation;
+  float *angle;
+  float *spinStart;
+  float *spinEnd;
+
+  graphics_Color *color;
+  uint32_t *quadIndex;
+
+  // Twice the buffer size, so particles can be inserted at either end
+  uint32_t *order;
+  size_t orderStart;
+  // Scratch space used to remap slots while removing dead particles
+  uint32_t *remap;
+} graphics_ParticleData;
 
 typedef enum {
   graphics_ParticleInsertMode_top,
@@ -25,6 +68,44 @@ typedef enum {
 } graphics_ParticleInsertMode;
 
 
+typedef enum {
+  graphics_ParticleMode_cpu,
+  graphics_ParticleMode_gpu
+} graphics_ParticleMode;
+
+
+// In GPU mode only the spawn parameters of a particle are written, once,
+// when it is emitted. Everything else is computed in the vertex shader from
+// the particle's age. Every particle uses four vertices so the buffer can
+// be drawn without instancing.
+typedef struct {
+  float motion[4];   // start position, start velocity
+  float forces[4];   // acceleration, linear damping, lifetime
+  float spin[4];     // spawn time, rotation, spin start, spin end
+  float shape[4];    // size offset, size interval, quad corner
+} graphics_GPUParticleVertex;
+
+
+// Particles live in a ring buffer of maxParticles slots. Slots between tail
+// and head may still be alive, everything before tail is known to be dead.
+typedef struct {
+  GLuint vbo;
+  GLuint vao;
+  graphics_GPUParticleVertex *vertices;
+  float *deathTimes;
+
+  size_t head;
+  size_t tail;
+  size_t used;
+
+  // Slots written since the last upload, starting at dirtyFirst
+  size_t dirtyFirst;
+  size_t dirtyCount;
+
+  float time;
+} graphics_GPUParticleData;
+
+
 typedef enum {
   graphics_AreaSpreadDistribution_uniform,
   graphics_AreaSpreadDistribution_normal,
@@ -33,13 +114,16 @@ typedef enum {
 
 
 typedef struct {
-  graphics_Particle *pMem;
-  graphics_Particle *pFree;
-  graphics_Particle *pHead;
-  graphics_Particle *pTail;
+  graphics_ParticleMode mode;
+  graphics_ParticleData particles;
+  graphics_GPUParticleData gpu;
 
   graphics_Image const* texture;
-  graphics_Batch batch;
+  GLuint vbo;
+  GLuint vao;
+  graphics_PackedVertex *vertices;
+  // Set whenever anything that affects the generated vertices changes
+  bool verticesDirty;
   bool active;
   
   graphics_ParticleInsertMode insertMode;
@@ -101,6 +185,8 @@ typedef struct {
   size_t quadCount;
 
   bool relativeRotation;
+
+  math_RandomGenerator rng;
 } graphics_ParticleSystem;
 
 
@@ -122,6 +208,9 @@ void graphics_ParticleSystem_setRelativeRotation(graphics_ParticleSystem *ps, bo
 void graphics_ParticleSystem_setInsertMode(graphics_ParticleSystem *ps, graphics_ParticleInsertMode mode);
 graphics_ParticleInsertMode graphics_ParticleSystem_getInsertMode(graphics_ParticleSystem const *ps);
 
+bool graphics_ParticleSystem_setMode(graphics_ParticleSystem *ps, graphics_ParticleMode mode);
+graphics_ParticleMode graphics_ParticleSystem_getMode(graphics_ParticleSystem const *ps);
+
 size_t graphics_ParticleSystem_getCount(graphics_ParticleSystem const *ps);
 
 void graphics_ParticleSystem_setDirection(graphics_ParticleSystem *ps, float dir);
@@ -170,6 +259,7 @@ void graphics_ParticleSystem_pause(graphics_ParticleSystem *ps);
 
 void graphics_ParticleSystem_emit(graphics_ParticleSystem *ps, size_t count);
 void graphics_ParticleSystem_update(graphics_ParticleSystem *ps, float dt);
+void graphics_ParticleSystem_prewarm(graphics_ParticleSystem *ps, float seconds, float step);
 void graphics_ParticleSystem_moveTo(graphics_ParticleSystem *ps, float x, float y);
 
 void graphics_ParticleSystem_clone(graphics_ParticleSystem const* ps, graphics_ParticleSystem *psNew);
@@ -178,4 +268,11 @@ void graphics_ParticleSystem_draw(graphics_ParticleSystem * ps, float x, float y
 void graphics_ParticleSystem_setLinearAcceleration(graphics_ParticleSystem *ps, float xmin, float ymin, float xmax, float ymax);
 void graphics_ParticleSystem_getLinearAcceleration(graphics_ParticleSystem const *ps, float *xmin, float *ymin, float *xmax, float *ymax);
 
+// Updates independent systems in parallel on the thread pool. The systems
+// must not be touched by anything else until this returns.
+void graphics_particlesystem_updateMany(graphics_ParticleSystem **systems, int count, float dt);
+
+// Holds the compiler output after setMode failed to switch to GPU mode
+graphics_Shader const* graphics_particlesystem_getGPUShader(void);
+
 void graphics_particlesystem_init();
@@ -0,0 +1,328 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <tgmath.h>
+#include "polyline.h"
+#include "graphics.h"
+#include "shader.h"
+
+// Miter joins are drawn as one triangle strip with two vertices per point.
+// Without joins every segment is a separate quad of four vertices and six
+// indices. Index buffers are always twice the size of the vertex buffers,
+// which covers both cases.
+
+static graphics_Quad const fullQuad = {0.0f, 0.0f, 1.0f, 1.0f};
+
+
+static void makeNormal(float const* p1, float const* p2, float halfWidth, float *nx, float *ny) {
+  float dx = p2[0] - p1[0];
+  float dy = p2[1] - p1[1];
+  float l = halfWidth / sqrt(dx*dx + dy*dy);
+  *nx = dy * l;
+  *ny = -dx * l;
+}
+
+
+static void ensureCapacity(graphics_Polyline *line, int vertices) {
+  if(vertices <= line->capacity) {
+    return;
+  }
+
+  int capacity = line->capacity * 2;
+  if(capacity < vertices) {
+    capacity = vertices;
+  }
+
+  int indexSize = capacity > 0xFFFF ? sizeof(uint32_t) : sizeof(uint16_t);
+  line->vertices = realloc(line->vertices, capacity * 2 * sizeof(float));
+  line->indices = realloc(line->indices, capacity * 2 * indexSize);
+
+  // Indices before the rebuilt part are kept, widen them in place
+  if(indexSize != line->indexSize && line->indexSize == sizeof(uint16_t)) {
+    uint16_t const* narrow = line->indices;
+    uint32_t *wide = line->indices;
+    for(int i = line->capacity * 2 - 1; i >= 0; --i) {
+      wide[i] = narrow[i];
+    }
+  }
+  line->indexSize = indexSize;
+  line->capacity = capacity;
+}
+
+
+static void setIndex(graphics_Polyline *line, int i, int value) {
+  if(line->indexSize == sizeof(uint16_t)) {
+    ((uint16_t*)line->indices)[i] = value;
+  } else {
+    ((uint32_t*)line->indices)[i] = value;
+  }
+}
+
+
+// Keeps the earliest change if the line is modified again before drawing
+static void markDirty(graphics_Polyline *line, int vertex, int index) {
+  if(vertex < line->dirtyVertex) {
+    line->dirtyVertex = vertex;
+  }
+  if(index < line->dirtyIndex) {
+    line->dirtyIndex = index;
+  }
+}
+
+
+static void setPair(float *out, float const* p, float ox, float oy) {
+  out[0] = p[0] - ox;
+  out[1] = p[1] - oy;
+  out[2] = p[0] + ox;
+  out[3] = p[1] + oy;
+}
+
+
+// Rebuilds the vertex pairs of points [first, pointCount). The offset at
+// inner points lies on the bisector of the adjacent segment normals and is
+// long enough to keep both edges half the width away from the center line.
+static void buildMiter(graphics_Polyline *line, int first) {
+  int const n = line->pointCount;
+  float const h = line->width / 2.0f;
+  float const* pts = line->points;
+
+  line->vertexCount = 2 * n;
+  line->indexCount = 2 * n;
+  ensureCapacity(line, line->vertexCount);
+
+  for(int i = first; i < n; ++i) {
+    float const* p = pts + 2*i;
+    float *out = line->vertices + 4*i;
+    float nx, ny;
+
+    if(i == 0) {
+      makeNormal(p, p + 2, h, &nx, &ny);
+      setPair(out, p, nx, ny);
+    } else if(i == n - 1) {
+      makeNormal(p - 2, p, h, &nx, &ny);
+      setPair(out, p, nx, ny);
+    } else {
+      float nx2, ny2;
+      makeNormal(p - 2, p, h, &nx, &ny);
+      makeNormal(p, p + 2, h, &nx2, &ny2);
+
+      float sx = nx + nx2;
+      float sy = ny + ny2;
+      float sl = sqrt(sx*sx + sy*sy);
+      if(sl < 1e-4f * h) {
+        // The line turns back on itself, there is no sensible miter
+        setPair(out, p, nx, ny);
+      } else {
+        sx /= sl;
+        sy /= sl;
+        float c = h * h / (nx*sx + ny*sy);
+        setPair(out, p, sx * c, sy * c);
+      }
+    }
+
+    setIndex(line, 2*i,   2*i);
+    setIndex(line, 2*i+1, 2*i+1);
+  }
+
+  markDirty(line, 2 * first, 2 * first);
+}
+
+
+// Rebuilds the quads of segments [first, pointCount - 1)
+static void buildNone(graphics_Polyline *line, int first) {
+  int const segments = line->pointCount - 1;
+  float const h = line->width / 2.0f;
+
+  line->vertexCount = 4 * segments;
+  line->indexCount = 6 * segments;
+  ensureCapacity(line, line->vertexCount);
+
+  for(int i = first; i < segments; ++i) {
+    float const* p = line->points + 2*i;
+    float *out = line->vertices + 8*i;
+    float nx, ny;
+    makeNormal(p, p + 2, h, &nx, &ny);
+    setPair(out,     p,     nx, ny);
+    setPair(out + 4, p + 2, nx, ny);
+
+    setIndex(line, 6*i,   4*i);
+    setIndex(line, 6*i+1, 4*i+1);
+    setIndex(line, 6*i+2, 4*i+2);
+    setIndex(line, 6*i+3, 4*i+1);
+    setIndex(line, 6*i+4, 4*i+2);
+    setIndex(line, 6*i+5, 4*i+3);
+  }
+
+  markDirty(line, 4 * first, 6 * first);
+}
+
+
+static void build(graphics_Polyline *line, int first) {
+  if(line->pointCount < 2) {
+    line->vertexCount = 0;
+    line->indexCount = 0;
+    line->dirtyVertex = 0;
+    line->dirtyIndex = 0;
+    return;
+  }
+
+  switch(line->join) {
+  case graphics_LineJoin_miter:
+    buildMiter(line, first);
+    break;
+
+  default:
+    buildNone(line, first);
+    break;
+  }
+}
+
+
+// Zero length segments have no normal, repeated points are dropped
+static void addPoints(graphics_Polyline *line, int count, float const* points) {
+  if(line->pointCount + count > line->pointCapacity) {
+    int capacity = line->pointCapacity * 2;
+    if(capacity < line->pointCount + count) {
+      capacity = line->pointCount + count;
+    }
+    line->points = realloc(line->points, capacity * 2 * sizeof(float));
+    line->pointCapacity = capacity;
+  }
+
+  for(int i = 0; i < count; ++i) {
+    float const* p = points + 2*i;
+    if(line->pointCount > 0) {
+      float const* last = line->points + 2 * (line->pointCount - 1);
+      if(last[0] == p[0] && last[1] == p[1]) {
+        continue;
+      }
+    }
+    line->points[2*line->pointCount]   = p[0];
+    line->points[2*line->pointCount+1] = p[1];
+    ++line->pointCount;
+  }
+}
+
+
+void graphics_Polyline_new(graphics_Polyline *line, int count, float const* points, float width, graphics_LineJoin join) {
+  memset(line, 0, sizeof(graphics_Polyline));
+  line->width = width;
+  line->join = join;
+
+  glGenVertexArrays(1, &line->vao);
+  glBindVertexArray(line->vao);
+  glGenBuffers(1, &line->vbo);
+  glGenBuffers(1, &line->ibo);
+  glBindBuffer(GL_ARRAY_BUFFER, line->vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, line->ibo);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2*sizeof(float), 0);
+
+  graphics_Polyline_setPoints(line, count, points);
+}
+
+
+void graphics_Polyline_free(graphics_Polyline *line) {
+  glDeleteBuffers(1, &line->vbo);
+  glDeleteBuffers(1, &line->ibo);
+  glDeleteVertexArrays(1, &line->vao);
+  free(line->points);
+  free(line->vertices);
+  free(line->indices);
+}
+
+
+void graphics_Polyline_setPoints(graphics_Polyline *line, int count, float const* points) {
+  line->pointCount = 0;
+  addPoints(line, count, points);
+  build(line, 0);
+}
+
+
+// Only the last point of the existing line changes, from a line end to a
+// join, everything before it is left alone on the GPU
+void graphics_Polyline_append(graphics_Polyline *line, int count, float const* points) {
+  int first = line->pointCount > 0 ? line->pointCount - 1 : 0;
+  addPoints(line, count, points);
+  build(line, first);
+}
+
+
+float const* graphics_Polyline_getPoints(graphics_Polyline const *line, int *count) {
+  *count = line->pointCount;
+  return line->points;
+}
+
+
+float graphics_Polyline_getWidth(graphics_Polyline const *line) {
+  return line->width;
+}
+
+
+graphics_LineJoin graphics_Polyline_getJoin(graphics_Polyline const *line) {
+  return line->join;
+}
+
+
+static void flush(graphics_Polyline *line) {
+  if(line->vertexCount > line->bufferCapacity) {
+    line->bufferCapacity = line->capacity;
+    glBindBuffer(GL_ARRAY_BUFFER, line->vbo);
+    glBufferData(GL_ARRAY_BUFFER, line->bufferCapacity * 2 * sizeof(float), 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, line->ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, line->bufferCapacity * 2 * line->indexSize, 0, GL_DYNAMIC_DRAW);
+    line->dirtyVertex = 0;
+    line->dirtyIndex = 0;
+  }
+
+  if(line->dirtyVertex < line->vertexCount) {
+    glBindBuffer(GL_ARRAY_BUFFER, line->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    line->dirtyVertex * 2 * sizeof(float),
+                    (line->vertexCount - line->dirtyVertex) * 2 * sizeof(float),
+                    line->vertices + 2 * line->dirtyVertex);
+    graphics_countBufferUpload((line->vertexCount - line->dirtyVertex) * 2 * sizeof(float));
+    line->dirtyVertex = line->vertexCount;
+  }
+
+  if(line->dirtyIndex < line->indexCount) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, line->ibo);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER,
+                    line->dirtyIndex * line->indexSize,
+                    (line->indexCount - line->dirtyIndex) * line->indexSize,
+                    (uint8_t const*)line->indices + line->dirtyIndex * line->indexSize);
+    graphics_countBufferUpload((line->indexCount - line->dirtyIndex) * line->indexSize);
+    line->dirtyIndex = line->indexCount;
+  }
+}
+
+
+void graphics_Polyline_draw(graphics_Polyline *line, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky) {
+  if(line->indexCount == 0) {
+    return;
+  }
+
+  glBindVertexArray(line->vao);
+  flush(line);
+
+  mat4x4 tr2d;
+  m4x4_newTransform2d(&tr2d, x, y, r, sx, sy, ox, oy, kx, ky);
+
+  graphics_Shader *shader = graphics_getShader();
+  graphics_setShader(graphics_geometry_getPlainColorShader());
+
+  graphics_drawArray(&fullQuad, &tr2d, line->vao, line->ibo, 0, line->indexCount,
+                     line->join == graphics_LineJoin_miter ? GL_TRIANGLE_STRIP : GL_TRIANGLES,
+                     line->indexSize == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                     graphics_getDrawColor(), 1.0f, 1.0f, false);
+
+  graphics_setShader(shader);
+}
@@ -0,0 +1,53 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gl.h"
+#include "geometry.h"
+
+// Stroked line whose triangles are built once and kept in GPU buffers.
+// Points can be appended, which only rebuilds the end of the line.
+typedef struct {
+  float *points;
+  int pointCount;
+  int pointCapacity;
+  float width;
+  graphics_LineJoin join;
+
+  // Two floats per vertex
+  float *vertices;
+  int vertexCount;
+  // uint16_t while the capacity allows it, WebGL 1 has no 32 bit indices
+  // without an extension. uint32_t otherwise.
+  void *indices;
+  int indexSize;
+  int indexCount;
+  int capacity;
+
+  GLuint vao;
+  GLuint vbo;
+  GLuint ibo;
+  // GPU buffer size in vertices, indices are sized to match
+  int bufferCapacity;
+  // Vertices and indices from these on are not uploaded yet
+  int dirtyVertex;
+  int dirtyIndex;
+} graphics_Polyline;
+
+void graphics_Polyline_new(graphics_Polyline *line, int count, float const* points, float width, graphics_LineJoin join);
+void graphics_Polyline_free(graphics_Polyline *line);
+void graphics_Polyline_append(graphics_Polyline *line, int count, float const* points);
+void graphics_Polyline_setPoints(graphics_Polyline *line, int count, float const* points);
+float const* graphics_Polyline_getPoints(graphics_Polyline const *line, int *count);
+float graphics_Polyline_getWidth(graphics_Polyline const *line);
+graphics_LineJoin graphics_Polyline_getJoin(graphics_Polyline const *line);
+void graphics_Polyline_draw(graphics_Polyline *line, float x, float y, float r, float sx, float sy, float ox, float oy, float kx, float ky);
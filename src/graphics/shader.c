@@ -8,19 +8,51 @@
 */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include "shader.h"
+#include "graphics.h"
+#include "../filesystem/filesystem.h"
 #include "../3rdparty/slre/slre.h"
 
 
+// Compiled vertex or fragment shader, reused when the same source is
+// compiled again. Status and log are read on first use, reading them right
+// after glCompileShader would wait for the compiler.
+typedef struct {
+  uint64_t key;
+  GLuint shader;
+  bool checked;
+  bool compiled;
+  char *log;
+} CachedStage;
+
+// From KHR_parallel_shader_compile, missing in older headers
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 static struct {
   graphics_Shader *activeShader;
+  // Shader of the previous draw, for counting switches
+  graphics_Shader const* lastActivated;
   graphics_Shader defaultShader;
   int maxTextureUnits;
   struct slre fragmentSingleShaderDetectRegex;
   struct slre fragmentMultiShaderDetectRegex;
   struct slre vertexShaderDetectRegex;
+
+  CachedStage *stages;
+  int stageCount;
+  // Mixed into every program key, binaries only work with the driver that
+  // produced them
+  uint64_t driverHash;
+  bool programBinaries;
+  // The driver compiles in the background and can tell when it is done
+  bool parallelCompile;
 } moduleData;
 
 GLchar const *defaultVertexSource = 
@@ -35,18 +67,24 @@ static GLchar const vertexHeader[] =
   "uniform   mat2 motor2d_textureRect;\n"
   "uniform   vec2 motor2d_size;\n"
   "uniform   bool motor2d_useVertexColor;\n"
+  "uniform   bool motor2d_gammaCorrect;\n"
   "#define extern uniform\n"
   "#define number float\n"
   "attribute vec2 motor2d_vPos;\n"
   "attribute vec2 motor2d_vUV;\n"
   "attribute vec4 motor2d_vColor;\n"
+  "attribute float love_InstanceID;\n"
   "varying   vec2 motor2d_fUV;\n"
   "varying   vec4 motor2d_fColor;\n"
   "varying   vec2 motor2d_screenPos;\n"
   "uniform   vec2 love_ScreenSize;\n"
   "#line 0\n";
 
+// Vertex colors are given in sRGB like setColor, which converts on the CPU
 static GLchar const vertexFooter[] =
+  "vec3 motor2d_gammaToLinear(vec3 c) {\n"
+  "  return mix(c / 12.92, pow((c + 0.055) / 1.055, vec3(2.4)), step(vec3(0.04045), c));\n"
+  "}\n"
   "void main() {\n"
   "  vec4 pos = position(motor2d_projection * motor2d_transform, vec4(motor2d_vPos * motor2d_size, 1.0, 1.0));\n"
   "  motor2d_screenPos = love_ScreenSize * (vec2(pos.x + 1.0, 1.0 - pos.y) / 2.0);\n"
@@ -54,6 +92,9 @@ static GLchar const vertexFooter[] =
   "  motor2d_fUV = motor2d_vUV * motor2d_textureRect[1] + motor2d_textureRect[0];\n"
   "  if(motor2d_useVertexColor) {\n"
   "    motor2d_fColor = motor2d_vColor;\n"
+  "    if(motor2d_gammaCorrect) {\n"
+  "      motor2d_fColor.rgb = motor2d_gammaToLinear(motor2d_vColor.rgb);\n"
+  "    }\n"
   "  } else {\n"
   "    motor2d_fColor = vec4(1.0, 1.0, 1.0, 1.0);\n"
   "  }\n"
@@ -108,20 +149,27 @@ static GLchar const multiFragmentFooter[] =
   "  effects(motor2d_color * motor2d_fColor, " DEFAULT_SAMPLER ", motor2d_fUV, motor2d_screenPos);\n"
   "}\n";
 
-bool graphics_Shader_compileAndAttachShaderRaw(graphics_Shader *program, GLenum shaderType, char const* code) {
-  GLuint shader = glCreateShader(shaderType);
-  glShaderSource(shader, 1, (GLchar const **)&code, 0);
-  glCompileShader(shader);
+static uint64_t const hashSeed = 14695981039346656037ull;
+
+// FNV-1a, including the terminator so consecutive strings can not run into
+// each other
+static uint64_t hashString(uint64_t hash, char const* str) {
+  do {
+    hash ^= (uint8_t)*str;
+    hash *= 1099511628211ull;
+  } while(*str++);
+  return hash;
+}
 
-  glAttachShader(program->program, shader);
 
-  int state;
-  int infolen;
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &state);
-  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infolen);
+static char* copyString(char const* str) {
+  char *copy = malloc(strlen(str) + 1);
+  strcpy(copy, str);
+  return copy;
+}
+
 
-  char *info = malloc(infolen);
-  glGetShaderInfoLog(shader, infolen, 0, info);
+static void setStageWarnings(graphics_Shader *program, GLenum shaderType, char *info) {
   switch(shaderType) {
   case GL_VERTEX_SHADER:
     free(program->warnings.vertex);
@@ -132,13 +180,78 @@ bool graphics_Shader_compileAndAttachShaderRaw(graphics_Shader *program, GLenum
     free(program->warnings.fragment);
     program->warnings.fragment = info;
     break;
+
+  default:
+    free(info);
+    break;
   }
+}
 
-  glDeleteShader(shader);
-  return state;
+
+// Attaches the stage for the given source, compiling it unless it is in
+// the cache already. Does not wait for the compiler.
+// Shader objects stay alive in the cache after the programs using them
+// are gone, a program only takes a reference while it is linked.
+static GLuint startStage(graphics_Shader *program, GLenum shaderType, char const* code) {
+  uint64_t key = hashString(hashSeed ^ shaderType, code);
+  for(int i = 0; i < moduleData.stageCount; ++i) {
+    CachedStage const* stage = moduleData.stages + i;
+    if(stage->key == key) {
+      glAttachShader(program->program, stage->shader);
+      return stage->shader;
+    }
+  }
+
+  GLuint shader = glCreateShader(shaderType);
+  glShaderSource(shader, 1, (GLchar const **)&code, 0);
+  glCompileShader(shader);
+
+  glAttachShader(program->program, shader);
+
+  moduleData.stages = realloc(moduleData.stages, (moduleData.stageCount + 1) * sizeof(CachedStage));
+  CachedStage *stage = moduleData.stages + moduleData.stageCount++;
+  stage->key = key;
+  stage->shader = shader;
+  stage->checked = false;
+  stage->compiled = false;
+  stage->log = 0;
+
+  return shader;
 }
 
-bool graphics_Shader_compileAndAttachShader(graphics_Shader *shader, GLenum shaderType, char const* code) {
+
+// Waits for the compiler if the stage was not checked before
+static CachedStage const* checkStage(GLuint shader) {
+  CachedStage *stage = moduleData.stages;
+  while(stage->shader != shader) {
+    ++stage;
+  }
+
+  if(!stage->checked) {
+    int state;
+    int infolen;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &state);
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infolen);
+
+    stage->log = malloc(infolen + 1);
+    *stage->log = 0;
+    glGetShaderInfoLog(shader, infolen, 0, stage->log);
+    stage->compiled = state;
+    stage->checked = true;
+  }
+
+  return stage;
+}
+
+
+bool graphics_Shader_compileAndAttachShaderRaw(graphics_Shader *program, GLenum shaderType, char const* code) {
+  CachedStage const* stage = checkStage(startStage(program, shaderType, code));
+  setStageWarnings(program, shaderType, copyString(stage->log));
+  return stage->compiled;
+}
+
+// Wraps user code in the matching header and footer
+static char* combineSource(GLenum shaderType, char const* code) {
   GLchar const* header;
   GLchar const* footer;
   int headerlen;
@@ -151,6 +264,7 @@ bool graphics_Shader_compileAndAttachShader(graphics_Shader *shader, GLenum shad
     footerlen = sizeof(vertexFooter) - 1;
     break;
   case GL_FRAGMENT_SHADER: 
+  default:
     {
       if(graphics_shader_isSingleFragmentShader(code)) {
         header = singleFragmentHeader;
@@ -172,6 +286,12 @@ bool graphics_Shader_compileAndAttachShader(graphics_Shader *shader, GLenum shad
   memcpy(combinedCode + headerlen, (GLchar const*)code, codelen);
   memcpy(combinedCode + headerlen + codelen, footer, footerlen+1); // include zero terminator
 
+  return combinedCode;
+}
+
+bool graphics_Shader_compileAndAttachShader(graphics_Shader *shader, GLenum shaderType, char const* code) {
+  GLchar *combinedCode = combineSource(shaderType, code);
+
   bool state = graphics_Shader_compileAndAttachShaderRaw(shader, shaderType, combinedCode);
 
   free(combinedCode);
@@ -253,6 +373,7 @@ static void readShaderUniforms(graphics_Shader *shader) {
   shader->uniformLocations.color       = glGetUniformLocation(shader->program, "motor2d_color");
   shader->uniformLocations.size        = glGetUniformLocation(shader->program, "motor2d_size");
   shader->uniformLocations.useVertCol  = glGetUniformLocation(shader->program, "motor2d_useVertexColor");
+  shader->uniformLocations.gammaCorrect = glGetUniformLocation(shader->program, "motor2d_gammaCorrect");
   shader->uniformLocations.screenSize  = glGetUniformLocation(shader->program, "love_ScreenSize");
 
   int maxLength;
@@ -268,6 +389,8 @@ static void readShaderUniforms(graphics_Shader *shader) {
 
     info->location = glGetUniformLocation(shader->program, info->name);
     info->extra = 0;
+    info->cache = 0;
+    info->cacheSize = 0;
 
     char *suffix = strstr(info->name, "[0]");
     if(suffix) {
@@ -307,42 +430,26 @@ static void allocateTextureUnits(graphics_Shader *shader) {
 }
 
 
-graphics_ShaderCompileStatus graphics_Shader_new(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode) {
-
+static void initShader(graphics_Shader *shader) {
   memset(shader, 0, sizeof(*shader));
   shader->warnings.vertex = malloc(1);
   shader->warnings.fragment = malloc(1);
   shader->warnings.program = malloc(1);
   *shader->warnings.vertex = *shader->warnings.fragment = *shader->warnings.program = 0;
 
-  if(!vertexCode) {
-    vertexCode = defaultVertexSource;
-  }
-
-  if(!fragmentCode) {
-    fragmentCode = defaultFragmentSource;
-  }
-
   shader->program = glCreateProgram();
+}
 
-  if(!graphics_Shader_compileAndAttachShader(shader, GL_VERTEX_SHADER, vertexCode)) {
-    return graphics_ShaderCompileStatus_vertexError;
-  }
-
-  if(!graphics_Shader_compileAndAttachShader(shader, GL_FRAGMENT_SHADER, fragmentCode)) {
-    return graphics_ShaderCompileStatus_fragmentError;
-  }
-
-  glBindAttribLocation(shader->program, 0, "motor2d_vPos");
-  glBindAttribLocation(shader->program, 1, "motor2d_vUV");
-  glBindAttribLocation(shader->program, 2, "motor2d_vColor");
-  glLinkProgram(shader->program);
 
+// Checks the result of linking or loading a binary and reads back the
+// uniforms
+static graphics_ShaderCompileStatus finishProgram(graphics_Shader *shader) {
   int linkState;
   int linkInfoLen;
   glGetProgramiv(shader->program, GL_LINK_STATUS, &linkState);
   glGetProgramiv(shader->program, GL_INFO_LOG_LENGTH, &linkInfoLen);
-  shader->warnings.program = realloc(shader->warnings.program, linkInfoLen);
+  shader->warnings.program = realloc(shader->warnings.program, linkInfoLen + 1);
+  *shader->warnings.program = 0;
   glGetProgramInfoLog(shader->program, linkInfoLen, 0, shader->warnings.program);
 
   if(!linkState) {
@@ -357,11 +464,242 @@ graphics_ShaderCompileStatus graphics_Shader_new(graphics_Shader *shader, char c
 }
 
 
+static char const* const defaultAttributes[] = {
+  "motor2d_vPos",
+  "motor2d_vUV",
+  "motor2d_vColor",
+  // Fed by the mesh module when drawing instanced, 0 otherwise
+  "love_InstanceID"
+};
+
+
+// Program binaries are stored in the save directory as
+// shadercache/<key>.bin, behind this header. They are only used by native
+// builds, WebGL has no program binaries.
+typedef struct {
+  char magic[4];
+  uint32_t format;
+  uint64_t key;
+  uint32_t length;
+} ProgramBinaryHeader;
+
+static char const programBinaryMagic[4] = {'M', '2', 'S', 'B'};
+
+
+static uint64_t programKey(char const* vertexCode, char const* fragmentCode, char const* const* attributes, int attributeCount) {
+  uint64_t key = hashString(moduleData.driverHash, vertexCode);
+  key = hashString(key, fragmentCode);
+  for(int i = 0; i < attributeCount; ++i) {
+    key = hashString(key, attributes[i]);
+  }
+  return key;
+}
+
+
+static bool programBinaryPath(uint64_t key, char *path, size_t size) {
+  char const* saveDir = filesystem_getSaveDirectory();
+  if(!saveDir) {
+    return false;
+  }
+  snprintf(path, size, "%s/shadercache/%016llx.bin", saveDir, (unsigned long long)key);
+  return true;
+}
+
+
+static bool loadProgramBinary(graphics_Shader *shader, uint64_t key) {
+#ifndef EMSCRIPTEN
+  char path[1024];
+  if(!moduleData.programBinaries || !programBinaryPath(key, path, sizeof(path))) {
+    return false;
+  }
+
+  FILE *file = fopen(path, "rb");
+  if(!file) {
+    return false;
+  }
+
+  ProgramBinaryHeader header;
+  void *data = 0;
+  bool loaded = fread(&header, sizeof(header), 1, file) == 1 &&
+                !memcmp(header.magic, programBinaryMagic, sizeof(programBinaryMagic)) &&
+                header.key == key &&
+                (data = malloc(header.length)) &&
+                fread(data, header.length, 1, file) == 1;
+  fclose(file);
+
+  if(loaded) {
+    glProgramBinary(shader->program, header.format, data, header.length);
+    int linkState;
+    glGetProgramiv(shader->program, GL_LINK_STATUS, &linkState);
+    // Binaries become invalid when the driver is updated
+    loaded = linkState;
+  }
+
+  free(data);
+  return loaded;
+#else
+  return false;
+#endif
+}
+
+
+static void saveProgramBinary(graphics_Shader const* shader, uint64_t key) {
+#ifndef EMSCRIPTEN
+  char path[1024];
+  if(!moduleData.programBinaries || !programBinaryPath(key, path, sizeof(path))) {
+    return;
+  }
+
+  int length;
+  glGetProgramiv(shader->program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if(length <= 0) {
+    return;
+  }
+
+  ProgramBinaryHeader header;
+  memcpy(header.magic, programBinaryMagic, sizeof(programBinaryMagic));
+  header.key = key;
+  void *data = malloc(length);
+  GLenum format;
+  glGetProgramBinary(shader->program, length, &length, &format, data);
+  header.format = format;
+  header.length = length;
+
+  char dir[1024];
+  snprintf(dir, sizeof(dir), "%s/shadercache", filesystem_getSaveDirectory());
+  mkdir(dir, 0755);
+
+  FILE *file = fopen(path, "wb");
+  if(file) {
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(data, length, 1, file);
+    fclose(file);
+  }
+  free(data);
+#endif
+}
+
+
+// Complete sources in, link started. Programs that were built before are
+// loaded from the binary cache instead, stages that were compiled before in
+// this session are reused. Compile and link results are only queried by
+// graphics_Shader_finish, until then the driver may work in the background.
+static void startProgram(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode, char const* const* attributes, int attributeCount) {
+  shader->binaryKey = programKey(vertexCode, fragmentCode, attributes, attributeCount);
+  if(loadProgramBinary(shader, shader->binaryKey)) {
+    shader->status = finishProgram(shader);
+    return;
+  }
+
+  shader->vertexStage = startStage(shader, GL_VERTEX_SHADER, vertexCode);
+  shader->fragmentStage = startStage(shader, GL_FRAGMENT_SHADER, fragmentCode);
+
+  for(int i = 0; i < attributeCount; ++i) {
+    glBindAttribLocation(shader->program, i, attributes[i]);
+  }
+
+#ifndef EMSCRIPTEN
+  if(moduleData.programBinaries) {
+    glProgramParameteri(shader->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+#endif
+
+  glLinkProgram(shader->program);
+  shader->pending = true;
+}
+
+
+// True if graphics_Shader_finish will not have to wait for the driver.
+// Without KHR_parallel_shader_compile there is no way to ask, the driver
+// has usually done most of the work by the time glLinkProgram returns.
+bool graphics_Shader_isReady(graphics_Shader const* shader) {
+  if(!shader->pending || !moduleData.parallelCompile) {
+    return true;
+  }
+
+  GLint done = 0;
+  glGetProgramiv(shader->program, GL_COMPLETION_STATUS_KHR, &done);
+  return done;
+}
+
+
+// Collects the results of compiling and linking, waiting for the driver if
+// necessary. Can be called any number of times.
+graphics_ShaderCompileStatus graphics_Shader_finish(graphics_Shader *shader) {
+  if(!shader->pending) {
+    return shader->status;
+  }
+  shader->pending = false;
+
+  CachedStage const* vertex = checkStage(shader->vertexStage);
+  bool vertexCompiled = vertex->compiled;
+  setStageWarnings(shader, GL_VERTEX_SHADER, copyString(vertex->log));
+
+  CachedStage const* fragment = checkStage(shader->fragmentStage);
+  bool fragmentCompiled = fragment->compiled;
+  setStageWarnings(shader, GL_FRAGMENT_SHADER, copyString(fragment->log));
+
+  if(!vertexCompiled) {
+    shader->status = graphics_ShaderCompileStatus_vertexError;
+  } else if(!fragmentCompiled) {
+    shader->status = graphics_ShaderCompileStatus_fragmentError;
+  } else {
+    shader->status = finishProgram(shader);
+    if(shader->status == graphics_ShaderCompileStatus_okay) {
+      saveProgramBinary(shader, shader->binaryKey);
+    }
+  }
+
+  return shader->status;
+}
+
+
+// Starts building the shader and returns without waiting for the driver.
+// Check graphics_Shader_isReady or call graphics_Shader_finish before using
+// it.
+void graphics_Shader_newAsync(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode) {
+  initShader(shader);
+
+  if(!vertexCode) {
+    vertexCode = defaultVertexSource;
+  }
+
+  if(!fragmentCode) {
+    fragmentCode = defaultFragmentSource;
+  }
+
+  char *vertexSource = combineSource(GL_VERTEX_SHADER, vertexCode);
+  char *fragmentSource = combineSource(GL_FRAGMENT_SHADER, fragmentCode);
+
+  startProgram(shader, vertexSource, fragmentSource, defaultAttributes, sizeof(defaultAttributes) / sizeof(*defaultAttributes));
+
+  free(vertexSource);
+  free(fragmentSource);
+}
+
+
+graphics_ShaderCompileStatus graphics_Shader_new(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode) {
+  graphics_Shader_newAsync(shader, vertexCode, fragmentCode);
+  return graphics_Shader_finish(shader);
+}
+
+
+// Builds a shader from complete sources without adding the usual headers
+// and footers. Attribute i is bound to location i.
+graphics_ShaderCompileStatus graphics_Shader_newRaw(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode, char const* const* attributes, int attributeCount) {
+  initShader(shader);
+
+  startProgram(shader, vertexCode, fragmentCode, attributes, attributeCount);
+  return graphics_Shader_finish(shader);
+}
+
+
 void graphics_Shader_free(graphics_Shader* shader) {
   glDeleteProgram(shader->program);
 
   for(int i = 0; i < shader->uniformCount; ++i) {
     free(shader->uniforms[i].name);
+    free(shader->uniforms[i].cache);
   }
   free(shader->textureUnits);
   free(shader->uniforms);
@@ -371,6 +709,10 @@ float const defaultColor[] = {1.0f, 1.0f, 1.0f, 1.0f};
 void graphics_Shader_activate(mat4x4 const* projection, mat4x4 const* transform, graphics_Quad const* textureRect, float const* useColor, float ws, float hs, bool useVertexColors, float const* screenSize) {
 
   glUseProgram(moduleData.activeShader->program);
+  if(moduleData.activeShader != moduleData.lastActivated) {
+    ++graphics_getStats()->shaderSwitches;
+    moduleData.lastActivated = moduleData.activeShader;
+  }
 
   float s[2] = { ws, hs };
 
@@ -381,12 +723,14 @@ void graphics_Shader_activate(mat4x4 const* projection, mat4x4 const* transform,
   glUniform2fv(      moduleData.activeShader->uniformLocations.size,        1,                    s);
   glUniformMatrix4fv(moduleData.activeShader->uniformLocations.transform,   1, 0, (GLfloat const*)transform);
   glUniform1i(       moduleData.activeShader->uniformLocations.useVertCol,  useVertexColors);
+  glUniform1i(       moduleData.activeShader->uniformLocations.gammaCorrect, graphics_isGammaCorrect());
   glUniform2fv(      moduleData.activeShader->uniformLocations.screenSize,  1, screenSize);
 
   for(int i = 0; i < moduleData.activeShader->textureUnitCount; ++i) {
     glActiveTexture(GL_TEXTURE0 + moduleData.activeShader->textureUnits[i].unit);
     glBindTexture(GL_TEXTURE_2D, moduleData.activeShader->textureUnits[i].boundTexture);
   }
+  graphics_getStats()->textureBinds += moduleData.activeShader->textureUnitCount;
 }
 
 void graphics_setDefaultShader(void) {
@@ -394,6 +738,7 @@ void graphics_setDefaultShader(void) {
 }
 
 void graphics_setShader(graphics_Shader* shader) {
+  graphics_Shader_finish(shader);
   moduleData.activeShader = shader;
 }
 
@@ -407,6 +752,27 @@ static char const * fragmentMultiShaderDetectRegexSrc = "void\\s*effects?\\s*\\(
 static char const * vertexShaderDetectRegexSrc = "vec4\\s*position\\s*\\(";
 
 void graphics_shader_init(void) {
+  moduleData.driverHash = hashString(hashSeed, (char const*)glGetString(GL_VENDOR));
+  moduleData.driverHash = hashString(moduleData.driverHash, (char const*)glGetString(GL_RENDERER));
+  moduleData.driverHash = hashString(moduleData.driverHash, (char const*)glGetString(GL_VERSION));
+
+#ifndef EMSCRIPTEN
+  GLint formats = 0;
+  if(GLEW_ARB_get_program_binary) {
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  }
+  moduleData.programBinaries = formats > 0;
+
+  moduleData.parallelCompile = GLEW_KHR_parallel_shader_compile;
+  if(moduleData.parallelCompile) {
+    // Let the driver choose the number of compiler threads
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+  }
+#else
+  char const* extensions = (char const*)glGetString(GL_EXTENSIONS);
+  moduleData.parallelCompile = extensions && strstr(extensions, "KHR_parallel_shader_compile");
+#endif
+
   graphics_Shader_new(&moduleData.defaultShader, NULL, NULL);
   moduleData.activeShader = &moduleData.defaultShader;
   glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &moduleData.maxTextureUnits);
@@ -416,8 +782,45 @@ void graphics_shader_init(void) {
   slre_compile(&moduleData.vertexShaderDetectRegex, vertexShaderDetectRegexSrc);
 }
 
+// Size of one array element in bytes, ints and floats are both four bytes
+static int uniformValueSize(GLenum type) {
+  int components = graphics_shader_toMotorComponents(type);
+  switch(type) {
+  case GL_FLOAT_MAT2:
+  case GL_FLOAT_MAT3:
+  case GL_FLOAT_MAT4:
+    return components * components * 4;
+
+  default:
+    return components * 4;
+  }
+}
+
+
+// Remembers the values and returns whether they differ from the values
+// uploaded before. Uniforms keep their values while other shaders are in
+// use, so unchanged values never have to be sent again.
+static bool updateCache(graphics_ShaderUniformInfo *info, int count, void const* values) {
+  int size = count * uniformValueSize(info->type);
+  if(size <= info->cacheSize && !memcmp(info->cache, values, size)) {
+    return false;
+  }
+
+  if(!info->cache) {
+    info->cache = malloc(info->elements * uniformValueSize(info->type));
+  }
+  memcpy(info->cache, values, size);
+  if(size > info->cacheSize) {
+    info->cacheSize = size;
+  }
+  return true;
+}
+
 #define mkScalarSendFunc(name, type, glfunc) \
-  void graphics_Shader_ ## name(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, type const* numbers) {  \
+  void graphics_Shader_ ## name(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, type const* numbers) {  \
+    if(!updateCache(info, count, numbers)) { \
+      return; \
+    } \
     glUseProgram(shader->program); \
     glfunc(info->location, count, numbers); \
   }
@@ -429,7 +832,10 @@ mkScalarSendFunc(sendFloats,   GLfloat, glUniform1fv)
 #undef mkScalarSendFunc
 
 #define mkVectorSendFunc(name, valuetype, abbr) \
-  void graphics_Shader_ ## name(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, valuetype const* numbers) {  \
+  void graphics_Shader_ ## name(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, valuetype const* numbers) {  \
+    if(!updateCache(info, count, numbers)) {                      \
+      return;                                                     \
+    }                                                             \
     glUseProgram(shader->program);                                \
     switch(graphics_shader_toMotorComponents(info->type)) {       \
     case 2:                                                       \
@@ -450,7 +856,10 @@ mkVectorSendFunc(sendFloatVectors,   GLfloat, f)
 
 #undef mkVectorSendFunc
 
-void graphics_Shader_sendFloatMatrices(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, float const* numbers) {
+void graphics_Shader_sendFloatMatrices(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, float const* numbers) {
+  if(!updateCache(info, count, numbers)) {
+    return;
+  }
   glUseProgram(shader->program);
 
   switch(graphics_shader_toMotorComponents(info->type)) {
@@ -469,13 +878,13 @@ void graphics_Shader_sendFloatMatrices(graphics_Shader *shader, graphics_ShaderU
 }
 
 
-void graphics_Shader_sendTexture(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, GLuint texture) {
+void graphics_Shader_sendTexture(graphics_Shader *shader, graphics_ShaderUniformInfo *info, GLuint texture) {
   graphics_ShaderTextureUnitInfo *unit = (graphics_ShaderTextureUnitInfo*)info->extra;
   unit->boundTexture = texture;
 }
 
 
-graphics_ShaderUniformInfo const* graphics_Shader_getUniform(graphics_Shader const* shader, char const* name) {
+graphics_ShaderUniformInfo* graphics_Shader_getUniform(graphics_Shader *shader, char const* name) {
   // Dirty trick to avoid duplicate code: Name will be treated as graphics_ShaderUniformInfo.
   return bsearch(&name, shader->uniforms, shader->uniformCount, sizeof(graphics_ShaderUniformInfo), (int(*)(void const*, void const*))compareUniformInfo);
 }
@@ -9,6 +9,8 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "gl.h"
 #include "../math/vector.h"
 #include "quad.h"
@@ -27,6 +29,10 @@ typedef struct {
   int      elements;
   GLint    location;
   void    *extra;
+  // Values uploaded last, sending the same values again does nothing.
+  // The first cacheSize bytes are valid.
+  void    *cache;
+  int      cacheSize;
 } graphics_ShaderUniformInfo;
 
 typedef struct {
@@ -34,6 +40,13 @@ typedef struct {
   GLuint boundTexture;
 } graphics_ShaderTextureUnitInfo;
 
+typedef enum {
+  graphics_ShaderCompileStatus_okay,
+  graphics_ShaderCompileStatus_linkError,
+  graphics_ShaderCompileStatus_vertexError,
+  graphics_ShaderCompileStatus_fragmentError
+} graphics_ShaderCompileStatus;
+
 typedef struct {
   // These are regularly needed on a per-drawcall basis.
   // This way we can access them real quick
@@ -45,6 +58,7 @@ typedef struct {
     GLuint color;
     GLuint size;
     GLuint useVertCol;
+    GLuint gammaCorrect;
     GLuint screenSize;
   } uniformLocations;
 
@@ -61,16 +75,21 @@ typedef struct {
   } warnings;
 
   GLuint program;
-} graphics_Shader;
 
-typedef enum {
-  graphics_ShaderCompileStatus_okay,
-  graphics_ShaderCompileStatus_linkError,
-  graphics_ShaderCompileStatus_vertexError,
-  graphics_ShaderCompileStatus_fragmentError
-} graphics_ShaderCompileStatus;
+  // Compiling and linking may still run in the driver while this is set.
+  // Uniforms and warnings are only valid after graphics_Shader_finish.
+  bool pending;
+  graphics_ShaderCompileStatus status;
+  GLuint vertexStage;
+  GLuint fragmentStage;
+  uint64_t binaryKey;
+} graphics_Shader;
 
 graphics_ShaderCompileStatus graphics_Shader_new(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode);
+void graphics_Shader_newAsync(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode);
+bool graphics_Shader_isReady(graphics_Shader const* shader);
+graphics_ShaderCompileStatus graphics_Shader_finish(graphics_Shader *shader);
+graphics_ShaderCompileStatus graphics_Shader_newRaw(graphics_Shader *shader, char const* vertexCode, char const* fragmentCode, char const* const* attributes, int attributeCount);
 void graphics_Shader_activate(mat4x4 const* projection, mat4x4 const* transform, graphics_Quad const* textureRect, float const* useColor, float ws,float hs, bool useVertexColors, float const* screenSize);
 graphics_Shader* graphics_getShader(void);
 void graphics_shader_init(void);
@@ -79,18 +98,18 @@ void graphics_setDefaultShader(void);
 void graphics_setShader(graphics_Shader* shader);
 bool graphics_Shader_compileAndAttachShaderRaw(graphics_Shader *shader, GLenum shaderType, char const* code);
 bool graphics_Shader_compileAndAttachShader(graphics_Shader *shader, GLenum shaderType, char const* code);
-graphics_ShaderUniformInfo const* graphics_Shader_getUniform(graphics_Shader const* shader, char const* name);
+graphics_ShaderUniformInfo* graphics_Shader_getUniform(graphics_Shader *shader, char const* name);
 graphics_ShaderUniformType graphics_shader_toMotorType(GLenum type);
 int graphics_shader_toMotorComponents(GLenum type);
 
-void graphics_Shader_sendIntegers(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, GLint const* numbers);
-void graphics_Shader_sendBooleans(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, GLint const* numbers);
-void graphics_Shader_sendFloats(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, GLfloat const* numbers);
-void graphics_Shader_sendIntegerVectors(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, GLint const* numbers);
-void graphics_Shader_sendFloatVectors(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, GLfloat const* numbers);
-void graphics_Shader_sendBooleanVectors(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, GLint const* numbers);
-void graphics_Shader_sendFloatMatrices(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, int count, float const* numbers);
-void graphics_Shader_sendTexture(graphics_Shader *shader, graphics_ShaderUniformInfo const* info, GLuint texture);
+void graphics_Shader_sendIntegers(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, GLint const* numbers);
+void graphics_Shader_sendBooleans(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, GLint const* numbers);
+void graphics_Shader_sendFloats(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, GLfloat const* numbers);
+void graphics_Shader_sendIntegerVectors(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, GLint const* numbers);
+void graphics_Shader_sendFloatVectors(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, GLfloat const* numbers);
+void graphics_Shader_sendBooleanVectors(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, GLint const* numbers);
+void graphics_Shader_sendFloatMatrices(graphics_Shader *shader, graphics_ShaderUniformInfo *info, int count, float const* numbers);
+void graphics_Shader_sendTexture(graphics_Shader *shader, graphics_ShaderUniformInfo *info, GLuint texture);
 
 bool graphics_shader_isVertexShader(char const* str);
 bool graphics_shader_isSingleFragmentShader(char const* str);
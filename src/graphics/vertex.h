@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include "../math/vector.h"
 
 typedef struct {
@@ -16,3 +17,11 @@ typedef struct {
   vec2 uv;
   vec4 color;
 } graphics_Vertex;
+
+// Compact vertex with normalized 8 bit color, used where vertices are
+// regenerated every frame
+typedef struct {
+  vec2 pos;
+  vec2 uv;
+  uint8_t color[4];
+} graphics_PackedVertex;
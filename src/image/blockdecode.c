@@ -0,0 +1,318 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include <stdbool.h>
+#include <string.h>
+#include "blockdecode.h"
+
+static uint8_t clamp255(int v) {
+  return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+
+static void expand565(uint16_t c, uint8_t *rgba) {
+  int r = (c >> 11) & 31;
+  int g = (c >> 5) & 63;
+  int b = c & 31;
+  rgba[0] = (r << 3) | (r >> 2);
+  rgba[1] = (g << 2) | (g >> 4);
+  rgba[2] = (b << 3) | (b >> 2);
+  rgba[3] = 255;
+}
+
+
+// DXT1 blocks with c0 <= c1 have three colors and transparent black, DXT3
+// and DXT5 always use four colors and leave alpha alone
+static void decodeColorBlock(uint8_t const* block, uint8_t *out, int stride, bool dxt1) {
+  uint16_t c0 = block[0] | block[1] << 8;
+  uint16_t c1 = block[2] | block[3] << 8;
+
+  uint8_t colors[4][4];
+  expand565(c0, colors[0]);
+  expand565(c1, colors[1]);
+  colors[2][3] = colors[3][3] = 255;
+
+  if(c0 > c1 || !dxt1) {
+    for(int k = 0; k < 3; ++k) {
+      colors[2][k] = (2 * colors[0][k] + colors[1][k]) / 3;
+      colors[3][k] = (colors[0][k] + 2 * colors[1][k]) / 3;
+    }
+  } else {
+    for(int k = 0; k < 3; ++k) {
+      colors[2][k] = (colors[0][k] + colors[1][k]) / 2;
+      colors[3][k] = 0;
+    }
+    colors[3][3] = 0;
+  }
+
+  uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+  for(int y = 0; y < 4; ++y) {
+    for(int x = 0; x < 4; ++x) {
+      int index = (indices >> (2 * (4 * y + x))) & 3;
+      memcpy(out + y * stride + x * 4, colors[index], dxt1 ? 4 : 3);
+    }
+  }
+}
+
+
+void image_decodeDXT1Block(uint8_t const* block, uint8_t *out, int stride) {
+  decodeColorBlock(block, out, stride, true);
+}
+
+
+void image_decodeDXT3Block(uint8_t const* block, uint8_t *out, int stride) {
+  decodeColorBlock(block + 8, out, stride, false);
+
+  for(int i = 0; i < 16; ++i) {
+    int alpha = (block[i / 2] >> (4 * (i & 1))) & 15;
+    out[(i / 4) * stride + (i % 4) * 4 + 3] = alpha * 17;
+  }
+}
+
+
+void image_decodeDXT5Block(uint8_t const* block, uint8_t *out, int stride) {
+  decodeColorBlock(block + 8, out, stride, false);
+
+  int a0 = block[0];
+  int a1 = block[1];
+  uint8_t alphas[8] = {a0, a1};
+  if(a0 > a1) {
+    for(int k = 2; k < 8; ++k) {
+      alphas[k] = ((8 - k) * a0 + (k - 1) * a1) / 7;
+    }
+  } else {
+    for(int k = 2; k < 6; ++k) {
+      alphas[k] = ((6 - k) * a0 + (k - 1) * a1) / 5;
+    }
+    alphas[6] = 0;
+    alphas[7] = 255;
+  }
+
+  uint64_t indices = 0;
+  for(int i = 7; i >= 2; --i) {
+    indices = indices << 8 | block[i];
+  }
+  for(int i = 0; i < 16; ++i) {
+    out[(i / 4) * stride + (i % 4) * 4 + 3] = alphas[(indices >> (3 * i)) & 7];
+  }
+}
+
+
+static int const etcModifiers[8][4] = {
+  { 2,   8,  -2,   -8},
+  { 5,  17,  -5,  -17},
+  { 9,  29,  -9,  -29},
+  {13,  42, -13,  -42},
+  {18,  60, -18,  -60},
+  {24,  80, -24,  -80},
+  {33, 106, -33, -106},
+  {47, 183, -47, -183}
+};
+
+static int const etcDistances[8] = {3, 6, 11, 16, 23, 32, 41, 64};
+
+static int const eacModifiers[16][8] = {
+  {-3, -6,  -9, -15, 2, 5, 8, 14},
+  {-3, -7, -10, -13, 2, 6, 9, 12},
+  {-2, -5,  -8, -13, 1, 4, 7, 12},
+  {-2, -4,  -6, -13, 1, 3, 5, 12},
+  {-3, -6,  -8, -12, 2, 5, 7, 11},
+  {-3, -7,  -9, -11, 2, 6, 8, 10},
+  {-4, -7,  -8, -11, 3, 6, 7, 10},
+  {-3, -5,  -8, -11, 2, 4, 7, 10},
+  {-2, -6,  -8, -10, 1, 5, 7,  9},
+  {-2, -5,  -8, -10, 1, 4, 7,  9},
+  {-2, -4,  -8, -10, 1, 3, 7,  9},
+  {-2, -5,  -7, -10, 1, 4, 6,  9},
+  {-3, -4,  -7, -10, 2, 3, 6,  9},
+  {-1, -2,  -3, -10, 0, 1, 2,  9},
+  {-4, -6,  -8,  -9, 3, 5, 7,  8},
+  {-3, -5,  -7,  -9, 2, 4, 6,  8}
+};
+
+static int extend4(int x) { return x << 4 | x; }
+static int extend5(int x) { return x << 3 | x >> 2; }
+static int extend6(int x) { return x << 2 | x >> 4; }
+static int extend7(int x) { return x << 1 | x >> 6; }
+
+static int signExtend3(int x) {
+  return (x ^ 4) - 4;
+}
+
+
+// ETC stores pixels column by column, the high bits of all indices come
+// before the low bits
+static int pixelIndex(uint32_t bits, int x, int y) {
+  int i = x * 4 + y;
+  return ((bits >> (i + 16)) & 1) << 1 | ((bits >> i) & 1);
+}
+
+
+static void writeRGB(uint8_t *texel, int r, int g, int b) {
+  texel[0] = clamp255(r);
+  texel[1] = clamp255(g);
+  texel[2] = clamp255(b);
+  texel[3] = 255;
+}
+
+
+// T and H modes pick one of four paint colors per pixel
+static void writePaintColors(uint32_t bits, int const paint[4][3], uint8_t *out, int stride) {
+  for(int y = 0; y < 4; ++y) {
+    for(int x = 0; x < 4; ++x) {
+      int const* c = paint[pixelIndex(bits, x, y)];
+      writeRGB(out + y * stride + x * 4, c[0], c[1], c[2]);
+    }
+  }
+}
+
+
+static void decodeTMode(uint8_t const* b, uint32_t bits, uint8_t *out, int stride) {
+  int c1[3] = {extend4(((b[0] >> 1) & 0xc) | (b[0] & 3)), extend4(b[1] >> 4), extend4(b[1] & 15)};
+  int c2[3] = {extend4(b[2] >> 4), extend4(b[2] & 15), extend4(b[3] >> 4)};
+  int d = etcDistances[((b[3] >> 1) & 6) | (b[3] & 1)];
+
+  int paint[4][3];
+  for(int k = 0; k < 3; ++k) {
+    paint[0][k] = c1[k];
+    paint[1][k] = c2[k] + d;
+    paint[2][k] = c2[k];
+    paint[3][k] = c2[k] - d;
+  }
+  writePaintColors(bits, paint, out, stride);
+}
+
+
+static void decodeHMode(uint8_t const* b, uint32_t bits, uint8_t *out, int stride) {
+  int r1 = (b[0] >> 3) & 15;
+  int g1 = ((b[0] & 7) << 1) | ((b[1] >> 4) & 1);
+  int b1 = (b[1] & 8) | ((b[1] & 3) << 1) | (b[2] >> 7);
+  int r2 = (b[2] >> 3) & 15;
+  int g2 = ((b[2] & 7) << 1) | (b[3] >> 7);
+  int b2 = (b[3] >> 3) & 15;
+
+  // The lowest distance bit is implied by the order of the base colors
+  int di = (b[3] & 4) | ((b[3] & 1) << 1);
+  if(((r1 << 8) | (g1 << 4) | b1) >= ((r2 << 8) | (g2 << 4) | b2)) {
+    ++di;
+  }
+  int d = etcDistances[di];
+
+  int c1[3] = {extend4(r1), extend4(g1), extend4(b1)};
+  int c2[3] = {extend4(r2), extend4(g2), extend4(b2)};
+  int paint[4][3];
+  for(int k = 0; k < 3; ++k) {
+    paint[0][k] = c1[k] + d;
+    paint[1][k] = c1[k] - d;
+    paint[2][k] = c2[k] + d;
+    paint[3][k] = c2[k] - d;
+  }
+  writePaintColors(bits, paint, out, stride);
+}
+
+
+// Colors at the origin and the horizontal and vertical ends, interpolated
+static void decodePlanarMode(uint8_t const* b, uint8_t *out, int stride) {
+  int ro = extend6((b[0] >> 1) & 0x3f);
+  int go = extend7(((b[0] & 1) << 6) | ((b[1] >> 1) & 0x3f));
+  int bo = extend6(((b[1] & 1) << 5) | (b[2] & 0x18) | ((b[2] & 3) << 1) | (b[3] >> 7));
+  int rh = extend6(((b[3] >> 1) & 0x3e) | (b[3] & 1));
+  int gh = extend7(b[4] >> 1);
+  int bh = extend6(((b[4] & 1) << 5) | (b[5] >> 3));
+  int rv = extend6(((b[5] & 7) << 3) | (b[6] >> 5));
+  int gv = extend7(((b[6] & 0x1f) << 2) | (b[7] >> 6));
+  int bv = extend6(b[7] & 0x3f);
+
+  for(int y = 0; y < 4; ++y) {
+    for(int x = 0; x < 4; ++x) {
+      writeRGB(out + y * stride + x * 4,
+               (x * (rh - ro) + y * (rv - ro) + 4 * ro + 2) >> 2,
+               (x * (gh - go) + y * (gv - go) + 4 * go + 2) >> 2,
+               (x * (bh - bo) + y * (bv - bo) + 4 * bo + 2) >> 2);
+    }
+  }
+}
+
+
+// Differential blocks whose second color overflows select the modes added
+// by ETC2, which ETC1 encoders never produce
+void image_decodeETC2RGBBlock(uint8_t const* b, uint8_t *out, int stride) {
+  uint32_t bits = (uint32_t)b[4] << 24 | b[5] << 16 | b[6] << 8 | b[7];
+  int base1[3];
+  int base2[3];
+
+  if(b[3] & 2) {
+    int r = b[0] >> 3;
+    int g = b[1] >> 3;
+    int bl = b[2] >> 3;
+    int dr = signExtend3(b[0] & 7);
+    int dg = signExtend3(b[1] & 7);
+    int db = signExtend3(b[2] & 7);
+
+    if(r + dr < 0 || r + dr > 31) {
+      decodeTMode(b, bits, out, stride);
+      return;
+    } else if(g + dg < 0 || g + dg > 31) {
+      decodeHMode(b, bits, out, stride);
+      return;
+    } else if(bl + db < 0 || bl + db > 31) {
+      decodePlanarMode(b, out, stride);
+      return;
+    }
+
+    base1[0] = extend5(r);
+    base1[1] = extend5(g);
+    base1[2] = extend5(bl);
+    base2[0] = extend5(r + dr);
+    base2[1] = extend5(g + dg);
+    base2[2] = extend5(bl + db);
+  } else {
+    base1[0] = extend4(b[0] >> 4);
+    base1[1] = extend4(b[1] >> 4);
+    base1[2] = extend4(b[2] >> 4);
+    base2[0] = extend4(b[0] & 15);
+    base2[1] = extend4(b[1] & 15);
+    base2[2] = extend4(b[2] & 15);
+  }
+
+  int const* table1 = etcModifiers[b[3] >> 5];
+  int const* table2 = etcModifiers[(b[3] >> 2) & 7];
+  bool flip = b[3] & 1;
+
+  for(int y = 0; y < 4; ++y) {
+    for(int x = 0; x < 4; ++x) {
+      bool second = flip ? y >= 2 : x >= 2;
+      int const* base = second ? base2 : base1;
+      int m = (second ? table2 : table1)[pixelIndex(bits, x, y)];
+      writeRGB(out + y * stride + x * 4, base[0] + m, base[1] + m, base[2] + m);
+    }
+  }
+}
+
+
+// EAC alpha block in front of an ETC2 color block
+void image_decodeETC2RGBABlock(uint8_t const* block, uint8_t *out, int stride) {
+  image_decodeETC2RGBBlock(block + 8, out, stride);
+
+  int base = block[0];
+  int multiplier = block[1] >> 4;
+  int const* table = eacModifiers[block[1] & 15];
+
+  uint64_t indices = 0;
+  for(int i = 2; i < 8; ++i) {
+    indices = indices << 8 | block[i];
+  }
+
+  for(int y = 0; y < 4; ++y) {
+    for(int x = 0; x < 4; ++x) {
+      int index = (indices >> (45 - 3 * (x * 4 + y))) & 7;
+      out[y * stride + x * 4 + 3] = clamp255(base + table[index] * multiplier);
+    }
+  }
+}
@@ -0,0 +1,23 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+// Decoders for 4x4 compressed blocks, used when the GPU can not sample a
+// format directly. Each writes 16 RGBA texels to out, with stride bytes
+// between rows.
+void image_decodeDXT1Block(uint8_t const* block, uint8_t *out, int stride);
+void image_decodeDXT3Block(uint8_t const* block, uint8_t *out, int stride);
+void image_decodeDXT5Block(uint8_t const* block, uint8_t *out, int stride);
+
+// ETC1 blocks are valid ETC2 RGB blocks
+void image_decodeETC2RGBBlock(uint8_t const* block, uint8_t *out, int stride);
+void image_decodeETC2RGBABlock(uint8_t const* block, uint8_t *out, int stride);
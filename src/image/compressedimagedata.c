@@ -0,0 +1,343 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "compressedimagedata.h"
+#include "blockdecode.h"
+#include "../filesystem/filesystem.h"
+
+typedef void (*BlockDecoder)(uint8_t const* block, uint8_t *out, int stride);
+
+static struct {
+  int width;
+  int height;
+  int bytes;
+  // Null if there is no CPU fallback
+  BlockDecoder decode;
+} const formatInfo[image_CompressedFormat_count] = {
+  { 4,  4,  8, image_decodeDXT1Block},
+  { 4,  4, 16, image_decodeDXT3Block},
+  { 4,  4, 16, image_decodeDXT5Block},
+  { 4,  4,  8, image_decodeETC2RGBBlock},
+  { 4,  4,  8, image_decodeETC2RGBBlock},
+  { 4,  4, 16, image_decodeETC2RGBABlock},
+  { 4,  4, 16, 0},
+  { 5,  5, 16, 0},
+  { 6,  6, 16, 0},
+  { 8,  8, 16, 0},
+  {10, 10, 16, 0},
+  {12, 12, 16, 0}
+};
+
+static char const ktxIdentifier[12] = {
+  (char)0xAB, 'K', 'T', 'X', ' ', '1', '1', (char)0xBB, '\r', '\n', 0x1A, '\n'
+};
+
+static char const* lastError = "";
+
+
+char const* image_compressedLastError(void) {
+  return lastError;
+}
+
+
+static uint32_t readU32(uint8_t const* p) {
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static int levelSize(image_CompressedFormat format, int width, int height) {
+  int bw = formatInfo[format].width;
+  int bh = formatInfo[format].height;
+  return ((width + bw - 1) / bw) * ((height + bh - 1) / bh) * formatInfo[format].bytes;
+}
+
+
+void image_compressedFormat_getBlockSize(image_CompressedFormat format, int *width, int *height, int *bytes) {
+  *width = formatInfo[format].width;
+  *height = formatInfo[format].height;
+  *bytes = formatInfo[format].bytes;
+}
+
+
+bool image_compressedFormat_canDecode(image_CompressedFormat format) {
+  return formatInfo[format].decode != 0;
+}
+
+
+static bool fail(char const* error) {
+  lastError = error;
+  return false;
+}
+
+
+static bool allocateMipmaps(image_CompressedImageData *dst, uint32_t width, uint32_t height, uint32_t levels) {
+  if(width == 0 || height == 0 || width > 16384 || height > 16384) {
+    return fail("invalid texture size");
+  }
+
+  if(levels == 0) {
+    levels = 1;
+  }
+
+  // Levels beyond 1x1 make no sense
+  int maxLevels = 1;
+  while((width | height) >> maxLevels) {
+    ++maxLevels;
+  }
+  if(levels > (uint32_t)maxLevels) {
+    return fail("too many mipmap levels");
+  }
+
+  dst->mipmapCount = levels;
+  dst->mipmaps = malloc(levels * sizeof(image_CompressedMipmap));
+  for(uint32_t i = 0; i < levels; ++i) {
+    image_CompressedMipmap *mip = dst->mipmaps + i;
+    mip->width = width >> i ? width >> i : 1;
+    mip->height = height >> i ? height >> i : 1;
+    mip->size = levelSize(dst->format, mip->width, mip->height);
+    mip->data = 0;
+  }
+  return true;
+}
+
+
+static bool formatFromGL(uint32_t internalFormat, image_CompressedFormat *format) {
+  switch(internalFormat) {
+  case 0x83F0: // COMPRESSED_RGB_S3TC_DXT1_EXT
+  case 0x83F1: // COMPRESSED_RGBA_S3TC_DXT1_EXT
+    *format = image_CompressedFormat_DXT1;
+    return true;
+  case 0x83F2: // COMPRESSED_RGBA_S3TC_DXT3_EXT
+    *format = image_CompressedFormat_DXT3;
+    return true;
+  case 0x83F3: // COMPRESSED_RGBA_S3TC_DXT5_EXT
+    *format = image_CompressedFormat_DXT5;
+    return true;
+  case 0x8D64: // ETC1_RGB8_OES
+    *format = image_CompressedFormat_ETC1;
+    return true;
+  case 0x9274: // COMPRESSED_RGB8_ETC2
+    *format = image_CompressedFormat_ETC2RGB;
+    return true;
+  case 0x9278: // COMPRESSED_RGBA8_ETC2_EAC
+    *format = image_CompressedFormat_ETC2RGBA;
+    return true;
+  case 0x93B0: // COMPRESSED_RGBA_ASTC_4x4_KHR
+    *format = image_CompressedFormat_ASTC4x4;
+    return true;
+  case 0x93B2:
+    *format = image_CompressedFormat_ASTC5x5;
+    return true;
+  case 0x93B4:
+    *format = image_CompressedFormat_ASTC6x6;
+    return true;
+  case 0x93B7:
+    *format = image_CompressedFormat_ASTC8x8;
+    return true;
+  case 0x93BB:
+    *format = image_CompressedFormat_ASTC10x10;
+    return true;
+  case 0x93BD:
+    *format = image_CompressedFormat_ASTC12x12;
+    return true;
+  default:
+    return false;
+  }
+}
+
+
+// Only the first face or array layer of each level is used
+static bool parseKTX(image_CompressedImageData *dst, uint8_t const* file, int size) {
+  if(size < 64) {
+    return fail("truncated KTX header");
+  }
+
+  if(readU32(file + 12) != 0x04030201) {
+    return fail("big endian KTX files are not supported");
+  }
+
+  if(!formatFromGL(readU32(file + 28), &dst->format)) {
+    return fail("unsupported compressed format");
+  }
+
+  uint32_t arrayElements = readU32(file + 48);
+  uint32_t faces = readU32(file + 52);
+  if(!allocateMipmaps(dst, readU32(file + 36), readU32(file + 40), readU32(file + 56))) {
+    return false;
+  }
+
+  uint32_t keyValueBytes = readU32(file + 60);
+  if(keyValueBytes > (uint32_t)size - 64) {
+    return fail("truncated KTX file");
+  }
+
+  uint32_t offset = 64 + keyValueBytes;
+  for(int i = 0; i < dst->mipmapCount; ++i) {
+    image_CompressedMipmap *mip = dst->mipmaps + i;
+    if(offset > (uint32_t)size - 4) {
+      return fail("truncated KTX file");
+    }
+
+    uint32_t imageSize = readU32(file + offset);
+    offset += 4;
+    if(imageSize < (uint32_t)mip->size || imageSize > (uint32_t)size - offset) {
+      return fail("truncated KTX file");
+    }
+
+    mip->data = file + offset;
+
+    // Non-array cube maps store every face with its own padding
+    uint32_t padded = (imageSize + 3) & ~3u;
+    offset += (faces == 6 && arrayElements == 0) ? 6 * padded : padded;
+  }
+
+  return true;
+}
+
+
+static bool parseDDS(image_CompressedImageData *dst, uint8_t const* file, int size) {
+  if(size < 128) {
+    return fail("truncated DDS header");
+  }
+
+  uint8_t const* header = file + 4;
+  uint32_t const fourCCFlag = 0x4;
+  if(!(readU32(header + 76) & fourCCFlag)) {
+    return fail("uncompressed DDS files are not supported");
+  }
+
+  int offset = 128;
+  char const* fourCC = (char const*)header + 80;
+  if(!memcmp(fourCC, "DXT1", 4)) {
+    dst->format = image_CompressedFormat_DXT1;
+  } else if(!memcmp(fourCC, "DXT2", 4) || !memcmp(fourCC, "DXT3", 4)) {
+    dst->format = image_CompressedFormat_DXT3;
+  } else if(!memcmp(fourCC, "DXT4", 4) || !memcmp(fourCC, "DXT5", 4)) {
+    dst->format = image_CompressedFormat_DXT5;
+  } else if(!memcmp(fourCC, "DX10", 4) && size >= 148) {
+    offset = 148;
+    switch(readU32(file + 128)) {
+    case 71: // DXGI_FORMAT_BC1_UNORM
+    case 72: // DXGI_FORMAT_BC1_UNORM_SRGB
+      dst->format = image_CompressedFormat_DXT1;
+      break;
+    case 74: // DXGI_FORMAT_BC2_UNORM
+    case 75:
+      dst->format = image_CompressedFormat_DXT3;
+      break;
+    case 77: // DXGI_FORMAT_BC3_UNORM
+    case 78:
+      dst->format = image_CompressedFormat_DXT5;
+      break;
+    default:
+      return fail("unsupported compressed format");
+    }
+  } else {
+    return fail("unsupported compressed format");
+  }
+
+  if(!allocateMipmaps(dst, readU32(header + 12), readU32(header + 8), readU32(header + 24))) {
+    return false;
+  }
+
+  for(int i = 0; i < dst->mipmapCount; ++i) {
+    image_CompressedMipmap *mip = dst->mipmaps + i;
+    if(mip->size > size - offset) {
+      return fail("truncated DDS file");
+    }
+    mip->data = file + offset;
+    offset += mip->size;
+  }
+
+  return true;
+}
+
+
+bool image_isCompressed(char const* filename) {
+  char *header = 0;
+  int size = filesystem_read(filename, sizeof(ktxIdentifier), &header);
+  bool compressed = (size >= 4 && !memcmp(header, "DDS ", 4))
+                 || (size >= (int)sizeof(ktxIdentifier) && !memcmp(header, ktxIdentifier, sizeof(ktxIdentifier)));
+  free(header);
+  return compressed;
+}
+
+
+bool image_CompressedImageData_new_with_filename(image_CompressedImageData *dst, char const* filename) {
+  dst->mipmaps = 0;
+  dst->mipmapCount = 0;
+  dst->fileData = 0;
+
+  int size = filesystem_read(filename, -1, &dst->fileData);
+  if(size < 0) {
+    return fail("could not open file");
+  }
+
+  uint8_t const* file = (uint8_t const*)dst->fileData;
+  bool loaded;
+  if(size >= 4 && !memcmp(file, "DDS ", 4)) {
+    loaded = parseDDS(dst, file, size);
+  } else if(size >= (int)sizeof(ktxIdentifier) && !memcmp(file, ktxIdentifier, sizeof(ktxIdentifier))) {
+    loaded = parseKTX(dst, file, size);
+  } else {
+    loaded = fail("not a KTX or DDS file");
+  }
+
+  if(!loaded) {
+    image_CompressedImageData_free(dst);
+  }
+  return loaded;
+}
+
+
+void image_CompressedImageData_free(image_CompressedImageData *data) {
+  free(data->mipmaps);
+  free(data->fileData);
+  data->mipmaps = 0;
+  data->fileData = 0;
+}
+
+
+// Software fallback for GPUs without support for the format. Blocks
+// sticking out of the image are decoded to a scratch block and cropped.
+bool image_CompressedImageData_decode(image_CompressedImageData const* data, int level, image_ImageData *dst) {
+  BlockDecoder decode = formatInfo[data->format].decode;
+  if(!decode) {
+    return fail("no software decoder for this format");
+  }
+
+  image_CompressedMipmap const* mip = data->mipmaps + level;
+  image_ImageData_new_with_size(dst, mip->width, mip->height);
+
+  int const stride = mip->width * 4;
+  int const blockBytes = formatInfo[data->format].bytes;
+  uint8_t const* block = mip->data;
+  uint8_t scratch[4 * 4 * 4];
+
+  for(int y = 0; y < mip->height; y += 4) {
+    for(int x = 0; x < mip->width; x += 4) {
+      uint8_t *out = dst->surface + y * stride + x * 4;
+      if(x + 4 <= mip->width && y + 4 <= mip->height) {
+        decode(block, out, stride);
+      } else {
+        decode(block, scratch, 16);
+        int w = mip->width - x < 4 ? mip->width - x : 4;
+        int h = mip->height - y < 4 ? mip->height - y : 4;
+        for(int row = 0; row < h; ++row) {
+          memcpy(out + row * stride, scratch + row * 16, w * 4);
+        }
+      }
+      block += blockBytes;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,55 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "imagedata.h"
+
+typedef enum {
+  image_CompressedFormat_DXT1,
+  image_CompressedFormat_DXT3,
+  image_CompressedFormat_DXT5,
+  image_CompressedFormat_ETC1,
+  image_CompressedFormat_ETC2RGB,
+  image_CompressedFormat_ETC2RGBA,
+  image_CompressedFormat_ASTC4x4,
+  image_CompressedFormat_ASTC5x5,
+  image_CompressedFormat_ASTC6x6,
+  image_CompressedFormat_ASTC8x8,
+  image_CompressedFormat_ASTC10x10,
+  image_CompressedFormat_ASTC12x12,
+  image_CompressedFormat_count
+} image_CompressedFormat;
+
+typedef struct {
+  int width;
+  int height;
+  int size;
+  // Points into the file contents
+  uint8_t const* data;
+} image_CompressedMipmap;
+
+// Block compressed texture with all its mipmap levels, loaded from a KTX
+// (version 1) or DDS file
+typedef struct {
+  image_CompressedFormat format;
+  int mipmapCount;
+  image_CompressedMipmap *mipmaps;
+  char *fileData;
+} image_CompressedImageData;
+
+char const* image_compressedLastError(void);
+bool image_isCompressed(char const* filename);
+bool image_CompressedImageData_new_with_filename(image_CompressedImageData *dst, char const* filename);
+void image_CompressedImageData_free(image_CompressedImageData *data);
+void image_compressedFormat_getBlockSize(image_CompressedFormat format, int *width, int *height, int *bytes);
+bool image_compressedFormat_canDecode(image_CompressedFormat format);
+bool image_CompressedImageData_decode(image_CompressedImageData const* data, int level, image_ImageData *dst);
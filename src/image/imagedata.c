@@ -9,17 +9,22 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include "../3rdparty/stb/stb_image.c"
 #include "imagedata.h"
 #include "../filesystem/filesystem.h"
+#include "../tools/threadpool.h"
+#include "../math/simd.h"
 
 
 char const* image_lastError(void) {
   return stbi_failure_reason();
 }
 
-bool image_ImageData_new_with_filename(image_ImageData *dst, char const* filename) {
+// premultiply multiplies the colour channels by alpha right after decoding
+bool image_ImageData_new_with_filename(image_ImageData *dst, char const* filename, bool premultiply) {
   int n;
 
   char const *file = filesystem_locateReadableFile(filename);
@@ -30,17 +35,335 @@ bool image_ImageData_new_with_filename(image_ImageData *dst, char const* filenam
   if(dst->surface == 0) {
     return false;
   }
+  if(premultiply) {
+    image_ImageData_premultiply(dst);
+  }
+  image_ImageData_clearDirty(dst);
   return true;
 }
 
 void image_ImageData_new_with_size(image_ImageData *dst, int width, int height) {
+  dst->w = width;
+  dst->h = height;
   dst->surface = malloc(width*height*4);
   memset(dst->surface, 0, width*height*4);
+  image_ImageData_clearDirty(dst);
 }
 
 void image_ImageData_free(image_ImageData *data) {
   free(data->surface);
 }
 
+// Intersects rect with the image, returns false if nothing is left
+bool image_ImageData_clipRect(image_ImageData const* data, image_Rect *rect) {
+  int x1 = rect->x < 0 ? 0 : rect->x;
+  int y1 = rect->y < 0 ? 0 : rect->y;
+  int x2 = rect->x + rect->w > data->w ? data->w : rect->x + rect->w;
+  int y2 = rect->y + rect->h > data->h ? data->h : rect->y + rect->h;
+
+  if(x2 <= x1 || y2 <= y1) {
+    rect->w = 0;
+    rect->h = 0;
+    return false;
+  }
+
+  rect->x = x1;
+  rect->y = y1;
+  rect->w = x2 - x1;
+  rect->h = y2 - y1;
+  return true;
+}
+
+// Grows the dirty rectangle to include the given region
+void image_ImageData_markDirty(image_ImageData *data, int x, int y, int w, int h) {
+  image_Rect rect = {x, y, w, h};
+  if(!image_ImageData_clipRect(data, &rect)) {
+    return;
+  }
+
+  image_Rect *dirty = &data->dirty;
+  if(dirty->w == 0) {
+    *dirty = rect;
+    return;
+  }
+
+  int x2 = dirty->x + dirty->w > rect.x + rect.w ? dirty->x + dirty->w : rect.x + rect.w;
+  int y2 = dirty->y + dirty->h > rect.y + rect.h ? dirty->y + dirty->h : rect.y + rect.h;
+  dirty->x = dirty->x < rect.x ? dirty->x : rect.x;
+  dirty->y = dirty->y < rect.y ? dirty->y : rect.y;
+  dirty->w = x2 - dirty->x;
+  dirty->h = y2 - dirty->y;
+}
+
+void image_ImageData_clearDirty(image_ImageData *data) {
+  data->dirty.x = 0;
+  data->dirty.y = 0;
+  data->dirty.w = 0;
+  data->dirty.h = 0;
+}
+
+// Coordinates must be inside the image
+void image_ImageData_setPixel(image_ImageData *data, int x, int y, uint8_t const* rgba) {
+  memcpy(data->surface + (y * data->w + x) * 4, rgba, 4);
+  image_ImageData_markDirty(data, x, y, 1, 1);
+}
+
+// Clips a copy of the region source in src to position dx, dy in dst.
+// On return source and target have the same size.
+static bool clipCopy(image_ImageData const* dst, image_ImageData const* src, int dx, int dy,
+                     image_Rect *source, image_Rect *target) {
+  int sx = source->x;
+  int sy = source->y;
+  if(!image_ImageData_clipRect(src, source)) {
+    return false;
+  }
+  dx += source->x - sx;
+  dy += source->y - sy;
+
+  target->x = dx;
+  target->y = dy;
+  target->w = source->w;
+  target->h = source->h;
+  if(!image_ImageData_clipRect(dst, target)) {
+    return false;
+  }
+  source->x += target->x - dx;
+  source->y += target->y - dy;
+  source->w = target->w;
+  source->h = target->h;
+  return true;
+}
+
+// Copies a region of src to dst, clipped to both images
+void image_ImageData_paste(image_ImageData *dst, image_ImageData const* src, int dx, int dy, int sx, int sy, int w, int h) {
+  image_Rect rect = {sx, sy, w, h};
+  image_Rect target;
+  if(!clipCopy(dst, src, dx, dy, &rect, &target)) {
+    return;
+  }
+
+  // src and dst may be the same image, copy rows in an order that does not
+  // overwrite rows that still have to be read
+  bool backwards = dst == src && target.y > rect.y;
+  for(int i = 0; i < target.h; ++i) {
+    int row = backwards ? target.h - 1 - i : i;
+    memmove(dst->surface + ((target.y + row) * dst->w + target.x) * 4,
+            src->surface + ((rect.y + row) * src->w + rect.x) * 4,
+            target.w * 4);
+  }
+  image_ImageData_markDirty(dst, target.x, target.y, target.w, target.h);
+}
+
+// Like paste, but blends src over dst like the "alpha" blend mode:
+// rgb = src * srcAlpha + dst * (1 - srcAlpha), alpha = srcAlpha + dstAlpha * (1 - srcAlpha)
+void image_ImageData_blit(image_ImageData *dst, image_ImageData const* src, int dx, int dy, int sx, int sy, int w, int h) {
+  image_Rect rect = {sx, sy, w, h};
+  image_Rect target;
+  if(!clipCopy(dst, src, dx, dy, &rect, &target)) {
+    return;
+  }
+
+  // Overlapping regions of the same image would read pixels that were
+  // already blended
+  image_ImageData copy;
+  if(dst == src) {
+    image_ImageData_new_with_size(&copy, rect.w, rect.h);
+    image_ImageData_paste(&copy, src, 0, 0, rect.x, rect.y, rect.w, rect.h);
+    src = &copy;
+    rect.x = 0;
+    rect.y = 0;
+  }
+
+  math_float4 const inv255 = math_float4_set1(1.0f / 255.0f);
+  math_float4 const one = math_float4_set1(1.0f);
+  math_float4 const keepAlpha = math_float4_set(0.0f, 0.0f, 0.0f, 1.0f);
+  for(int row = 0; row < target.h; ++row) {
+    uint8_t const* s = src->surface + ((rect.y + row) * src->w + rect.x) * 4;
+    uint8_t *d = dst->surface + ((target.y + row) * dst->w + target.x) * 4;
+    for(int i = 0; i < target.w; ++i, s += 4, d += 4) {
+      // Fully transparent and fully opaque pixels are common in sprites
+      if(s[3] == 0) {
+        continue;
+      } else if(s[3] == 255) {
+        memcpy(d, s, 4);
+        continue;
+      }
+      math_float4 vs = math_float4_loadBytes(s);
+      math_float4 vd = math_float4_loadBytes(d);
+      math_float4 alpha = math_float4_mul(math_float4_splatW(vs), inv255);
+      // alpha lane of the source is taken as is
+      math_float4 srcFactor = math_float4_max(alpha, keepAlpha);
+      math_float4 dstFactor = math_float4_sub(one, alpha);
+      math_float4_storeBytes(d, math_float4_madd(math_float4_mul(vs, srcFactor), vd, dstFactor));
+    }
+  }
+
+  if(src == &copy) {
+    image_ImageData_free(&copy);
+  }
+  image_ImageData_markDirty(dst, target.x, target.y, target.w, target.h);
+}
+
+void image_ImageData_fill(image_ImageData *data, int x, int y, int w, int h, uint8_t const* rgba) {
+  image_Rect rect = {x, y, w, h};
+  if(!image_ImageData_clipRect(data, &rect)) {
+    return;
+  }
+
+  uint32_t pixel;
+  memcpy(&pixel, rgba, 4);
+  for(int row = 0; row < rect.h; ++row) {
+    uint32_t *p = (uint32_t*)data->surface + (rect.y + row) * data->w + rect.x;
+    for(int i = 0; i < rect.w; ++i) {
+      p[i] = pixel;
+    }
+  }
+  image_ImageData_markDirty(data, rect.x, rect.y, rect.w, rect.h);
+}
+
+// Multiplies the colour channels by alpha
+void image_ImageData_premultiply(image_ImageData *data) {
+  math_float4 const inv255 = math_float4_set1(1.0f / 255.0f);
+  math_float4 const keepAlpha = math_float4_set(0.0f, 0.0f, 0.0f, 1.0f);
+  uint8_t *p = data->surface;
+  uint8_t *end = p + data->w * data->h * 4;
+  for(; p != end; p += 4) {
+    if(p[3] == 255) {
+      continue;
+    }
+    math_float4 v = math_float4_loadBytes(p);
+    math_float4 factor = math_float4_max(math_float4_mul(math_float4_splatW(v), inv255), keepAlpha);
+    math_float4_storeBytes(p, math_float4_mul(v, factor));
+  }
+  image_ImageData_markDirty(data, 0, 0, data->w, data->h);
+}
+
+void image_ImageData_flip(image_ImageData *data, bool horizontal) {
+  uint32_t *pixels = (uint32_t*)data->surface;
+  int const w = data->w;
+  int const h = data->h;
+  if(horizontal) {
+    for(int row = 0; row < h; ++row) {
+      uint32_t *a = pixels + row * w;
+      uint32_t *b = a + w - 1;
+      for(; a < b; ++a, --b) {
+        uint32_t t = *a;
+        *a = *b;
+        *b = t;
+      }
+    }
+  } else {
+    uint32_t *tmp = malloc(w * 4);
+    for(int row = 0; row < h / 2; ++row) {
+      uint32_t *a = pixels + row * w;
+      uint32_t *b = pixels + (h - 1 - row) * w;
+      memcpy(tmp, a, w * 4);
+      memcpy(a, b, w * 4);
+      memcpy(b, tmp, w * 4);
+    }
+    free(tmp);
+  }
+  image_ImageData_markDirty(data, 0, 0, w, h);
+}
+
+
+// Shared by the owner and the decode job, whichever lets go last frees it
+struct image_ImageDataLoad {
+  char *path;
+  bool premultiply;
+  image_ImageData data;
+  char const* error;
+  SDL_atomic_t done;
+  SDL_atomic_t refs;
+};
+
+
+static void releaseLoad(image_ImageDataLoad *load) {
+  if(SDL_AtomicDecRef(&load->refs)) {
+    free(load->path);
+    free(load->data.surface);
+    free(load);
+  }
+}
+
+
+static void decodeJob(void *data) {
+  image_ImageDataLoad *load = (image_ImageDataLoad*)data;
+  int n;
+  load->data.surface = stbi_load(load->path, &load->data.w, &load->data.h, &n, 4);
+  if(!load->data.surface) {
+    // stb_image keeps the reason in a global shared by all threads
+    load->error = "Could not decode image";
+  } else if(load->premultiply) {
+    image_ImageData_premultiply(&load->data);
+    image_ImageData_clearDirty(&load->data);
+  }
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&load->done, 1);
+  releaseLoad(load);
+}
+
+
+// Returns 0 if the file does not exist. Decoding happens on the thread
+// pool, poll image_ImageDataLoad_isDone to find out when it is finished.
+image_ImageDataLoad* image_ImageDataLoad_new(char const* filename, bool premultiply) {
+  char const *file = filesystem_locateReadableFile(filename);
+  if(file == 0) {
+    return 0;
+  }
+
+  image_ImageDataLoad *load = malloc(sizeof(image_ImageDataLoad));
+  load->path = malloc(strlen(file) + 1);
+  strcpy(load->path, file);
+  load->premultiply = premultiply;
+  load->data.w = 0;
+  load->data.h = 0;
+  load->data.surface = 0;
+  image_ImageData_clearDirty(&load->data);
+  load->error = 0;
+  SDL_AtomicSet(&load->done, 0);
+  SDL_AtomicSet(&load->refs, 2);
+
+  threadpool_push(decodeJob, load);
+  return load;
+}
+
+
+bool image_ImageDataLoad_isDone(image_ImageDataLoad const* load) {
+  if(SDL_AtomicGet((SDL_atomic_t*)&load->done)) {
+    SDL_MemoryBarrierAcquire();
+    return true;
+  }
+  return false;
+}
+
+
+// Moves the decoded image to dst. Only valid once the load is done, returns
+// false if decoding failed or the image was taken before.
+bool image_ImageDataLoad_take(image_ImageDataLoad *load, image_ImageData *dst) {
+  if(!load->data.surface) {
+    return false;
+  }
+  *dst = load->data;
+  load->data.surface = 0;
+  return true;
+}
+
+
+char const* image_ImageDataLoad_getError(image_ImageDataLoad const* load) {
+  return load->error;
+}
+
+
+// Can be called while the decode job is still running
+void image_ImageDataLoad_free(image_ImageDataLoad *load) {
+  releaseLoad(load);
+}
+
+
 void image_init(void) {
+  // stb_image fills its fixed Huffman tables on first use, which races when
+  // several PNGs are decoded at once. Do it before any decode job runs.
+  stbi__init_zdefaults();
 }
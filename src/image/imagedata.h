@@ -12,14 +12,40 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+typedef struct {
+  int x;
+  int y;
+  int w;
+  int h;
+} image_Rect;
+
 typedef struct {
   int w;
   int h;
   uint8_t *surface;
+  // Pixels changed since the last partial texture upload, w is 0 if none
+  image_Rect dirty;
 } image_ImageData;
 
+// Image file being decoded on a worker thread
+typedef struct image_ImageDataLoad image_ImageDataLoad;
+
 char const* image_lastError(void);
 void image_ImageData_new_with_size(image_ImageData *dst, int width, int height);
-bool image_ImageData_new_with_filename(image_ImageData *dst, char const* filename);
+bool image_ImageData_new_with_filename(image_ImageData *dst, char const* filename, bool premultiply);
 void image_ImageData_free(image_ImageData *data);
+bool image_ImageData_clipRect(image_ImageData const* data, image_Rect *rect);
+void image_ImageData_markDirty(image_ImageData *data, int x, int y, int w, int h);
+void image_ImageData_clearDirty(image_ImageData *data);
+void image_ImageData_setPixel(image_ImageData *data, int x, int y, uint8_t const* rgba);
+void image_ImageData_paste(image_ImageData *dst, image_ImageData const* src, int dx, int dy, int sx, int sy, int w, int h);
+void image_ImageData_blit(image_ImageData *dst, image_ImageData const* src, int dx, int dy, int sx, int sy, int w, int h);
+void image_ImageData_fill(image_ImageData *data, int x, int y, int w, int h, uint8_t const* rgba);
+void image_ImageData_premultiply(image_ImageData *data);
+void image_ImageData_flip(image_ImageData *data, bool horizontal);
+image_ImageDataLoad* image_ImageDataLoad_new(char const* filename, bool premultiply);
+bool image_ImageDataLoad_isDone(image_ImageDataLoad const* load);
+bool image_ImageDataLoad_take(image_ImageDataLoad *load, image_ImageData *dst);
+char const* image_ImageDataLoad_getError(image_ImageDataLoad const* load);
+void image_ImageDataLoad_free(image_ImageDataLoad *load);
 void image_init(void);
@@ -29,7 +29,8 @@ static char const bootScript[] =
   "local conf = {\n"
   "  window = {\n"
   "    width = 800,\n"
-  "    height = 600\n"
+  "    height = 600,\n"
+  "    srgb = false\n"
   "  },\n"
   "  modules = {}\n"
   "}\n"
@@ -72,6 +73,11 @@ int l_boot(lua_State* state, motor_Config *config) {
   lua_pushstring(state, "height");
   lua_rawget(state, -2);
   config->window.height = lua_tointeger(state, -1);
+  lua_pop(state, 1);
+
+  lua_pushstring(state, "srgb");
+  lua_rawget(state, -2);
+  config->window.srgb = lua_toboolean(state, -1);
 
   lua_pop(state, 3);
 
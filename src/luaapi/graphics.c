@@ -7,6 +7,7 @@
     under the terms of the MIT license. See LICENSE.md for details.
 */
 
+#include <string.h>
 #include <lauxlib.h>
 #include "graphics.h"
 #include "tools.h"
@@ -25,6 +26,7 @@
 #include "graphics_window.h"
 #include "graphics_geometry.h"
 #include "graphics_mesh.h"
+#include "graphics_polyline.h"
 
 
 static int l_graphics_getBackgroundColor(lua_State* state) {
@@ -97,8 +99,9 @@ static int l_graphics_draw(lua_State* state) {
   l_graphics_Image          const * image  = NULL;
   l_graphics_Batch          const * batch  = NULL;
   graphics_Canvas           const * canvas = NULL;
-  l_graphics_Mesh           const * mesh   = NULL;
+  l_graphics_Mesh                 * mesh   = NULL;
   l_graphics_ParticleSystem       * ps     = NULL;
+  l_graphics_Polyline             * line   = NULL;
 
   graphics_Quad const * quad = &defaultQuad;
   int baseidx = 2;
@@ -113,8 +116,10 @@ static int l_graphics_draw(lua_State* state) {
     mesh = l_graphics_toMesh(state, 1);
   } else if(l_graphics_isParticleSystem(state, 1)) {
     ps = l_graphics_toParticleSystem(state, 1);
+  } else if(l_graphics_isPolyline(state, 1)) {
+    line = l_graphics_toPolyline(state, 1);
   } else {
-    lua_pushstring(state, "expected canvas, image, spritebatch or mesh");
+    lua_pushstring(state, "expected canvas, image, spritebatch, mesh, particlesystem or polyline");
     lua_error(state);
   }
 
@@ -145,6 +150,8 @@ static int l_graphics_draw(lua_State* state) {
     graphics_Mesh_draw(&mesh->mesh, x, y, r, sx, sy, ox, oy, kx, ky);
   } else if(ps) {
     graphics_ParticleSystem_draw(&ps->particleSystem, x, y, r, sx, sy, ox, oy, kx, ky);
+  } else if(line) {
+    graphics_Polyline_draw(&line->polyline, x, y, r, sx, sy, ox, oy, kx, ky);
   }
   return 0;
 }
@@ -350,13 +357,53 @@ static int l_graphics_setDefaultFilter(lua_State* state) {
 }
 
 
+static int l_graphics_isGammaCorrect(lua_State* state) {
+  lua_pushboolean(state, graphics_isGammaCorrect());
+  return 1;
+}
+
+
+static void setStatsField(lua_State *state, char const* name, lua_Number value) {
+  lua_pushstring(state, name);
+  lua_pushnumber(state, value);
+  lua_settable(state, -3);
+}
+
+
+// Counts since the start of the frame, texturememory is the current total
+static int l_graphics_getStats(lua_State* state) {
+  graphics_Stats const* stats = graphics_getStats();
+
+  lua_newtable(state);
+  setStatsField(state, "drawcalls",         stats->drawCalls);
+  setStatsField(state, "vertices",          stats->vertices);
+  setStatsField(state, "shaderswitches",    stats->shaderSwitches);
+  setStatsField(state, "canvasswitches",    stats->canvasSwitches);
+  setStatsField(state, "texturebinds",      stats->textureBinds);
+  setStatsField(state, "bufferuploads",     stats->bufferUploads);
+  setStatsField(state, "bufferuploadbytes", stats->bufferUploadBytes);
+  setStatsField(state, "texturememory",     graphics_image_getTextureMemory());
+  return 1;
+}
+
+
+// Only instancing and srgb are actually checked, everything else is assumed to work
 static int l_graphics_isSupported(lua_State *state) {
   static bool warned = false;
-  if(!warned) {
-    printf("WARNING: love.graphics.isSupported is a stub\n");
-    warned = true;
+  bool supported = true;
+  int top = lua_gettop(state);
+  for(int i = 1; i <= top; ++i) {
+    char const* feature = l_tools_toStringOrError(state, i);
+    if(!strcmp(feature, "instancing")) {
+      supported = supported && graphics_mesh_isInstancingSupported();
+    } else if(!strcmp(feature, "srgb")) {
+      supported = supported && graphics_image_isSRGBSupported();
+    } else if(!warned) {
+      printf("WARNING: love.graphics.isSupported is a stub\n");
+      warned = true;
+    }
   }
-  lua_pushboolean(state, true);
+  lua_pushboolean(state, supported);
   return 1;
 }
 
@@ -388,7 +435,9 @@ static luaL_Reg const regFuncs[] = {
   {"setStencil",         l_graphics_setStencil},
   {"setInvertedStencil", l_graphics_setInvertedStencil},
   {"setDefaultFilter",   l_graphics_setDefaultFilter},
+  {"isGammaCorrect",     l_graphics_isGammaCorrect},
   {"isSupported",        l_graphics_isSupported},
+  {"getStats",           l_graphics_getStats},
   {NULL, NULL}
 };
 
@@ -398,6 +447,7 @@ int l_graphics_register(lua_State* state) {
   
   l_graphics_particlesystem_register(state);
   l_graphics_mesh_register(state);
+  l_graphics_polyline_register(state);
   l_graphics_image_register(state);
   l_graphics_quad_register(state);
   l_graphics_font_register(state);
@@ -11,6 +11,7 @@
 #include <lauxlib.h>
 #include "tools.h"
 #include "graphics_canvas.h"
+#include "graphics_image.h"
 #include "../graphics/graphics.h"
 #include "graphics.h"
 
@@ -29,8 +30,13 @@ int l_graphics_newCanvas(lua_State* state) {
   int width  = luaL_optint(state, 1, graphics_getWidth());
   int height = luaL_optint(state, 2, graphics_getHeight());
   
+  bool mipmaps = l_tools_optBooleanField(state, 3, "mipmaps", false);
+  
   graphics_Canvas *canvas = lua_newuserdata(state, sizeof(graphics_Canvas));
   graphics_Canvas_new(canvas, width, height);
+  if(mipmaps) {
+    l_graphics_useMipmaps(&canvas->image);
+  }
 
   lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.canvasMT);
   lua_setmetatable(state, -2);
@@ -240,6 +246,52 @@ static int l_graphics_Canvas_setFilter(lua_State* state) {
   return 0;
 }
 
+static int l_graphics_Canvas_setMipmapFilter(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isCanvas);
+
+  graphics_Canvas* img = l_graphics_toCanvas(state, 1);
+  graphics_Filter newFilter;
+  graphics_Image_getFilter(&img->image, &newFilter);
+
+  if(lua_isnoneornil(state, 2)) {
+    newFilter.mipmapMode = graphics_FilterMode_none;
+    newFilter.mipmapLodBias = 0.0f;
+  } else {
+    newFilter.mipmapMode = l_tools_toEnumOrError(state, 2, l_graphics_FilterMode);
+    newFilter.mipmapLodBias = -luaL_optnumber(state, 3, 0.0f);
+  }
+  graphics_Image_setFilter(&img->image, &newFilter);
+
+  return 0;
+}
+
+static int l_graphics_Canvas_getMipmapFilter(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isCanvas);
+
+  graphics_Canvas* img = l_graphics_toCanvas(state, 1);
+  graphics_Filter filter;
+  graphics_Image_getFilter(&img->image, &filter);
+
+  l_tools_pushEnum(state, filter.mipmapMode, l_graphics_FilterMode);
+  lua_pushnumber(state, filter.mipmapLodBias);
+
+  return 2;
+}
+
+// Canvases with mipmaps update them when they stop being the render target,
+// this is only needed after drawing to the active canvas
+static int l_graphics_Canvas_generateMipmaps(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isCanvas);
+
+  graphics_Canvas* img = l_graphics_toCanvas(state, 1);
+  if(!graphics_Image_generateMipmaps(&img->image)) {
+    lua_pushstring(state, "mipmaps can not be generated for this canvas");
+    return lua_error(state);
+  }
+
+  return 0;
+}
+
 static luaL_Reg const canvasMetatableFuncs[] = {
   {"__gc",               l_graphics_gcCanvas},
   {"renderTo",           l_graphics_Canvas_renderTo},
@@ -248,6 +300,9 @@ static luaL_Reg const canvasMetatableFuncs[] = {
   {"getHeight",          l_graphics_Canvas_getHeight},
   {"setFilter",          l_graphics_Canvas_setFilter},
   {"getFilter",          l_graphics_Canvas_getFilter},
+  {"setMipmapFilter",    l_graphics_Canvas_setMipmapFilter},
+  {"getMipmapFilter",    l_graphics_Canvas_getMipmapFilter},
+  {"generateMipmaps",    l_graphics_Canvas_generateMipmaps},
   {"setWrap",            l_graphics_Canvas_setWrap},
   {"getWrap",            l_graphics_Canvas_getWrap},
   {"clear",              l_graphics_Canvas_clear},
@@ -11,37 +11,207 @@
 #include "graphics.h"
 #include "graphics_image.h"
 #include "tools.h"
+#include "../graphics/graphics.h"
 
 static struct {
   int imageMT;
+  int imageLoadMT;
 } moduleData;
 
+static l_graphics_Image* pushImage(lua_State* state, int imageDataRef) {
+  l_graphics_Image *image = (l_graphics_Image*)lua_newuserdata(state, sizeof(l_graphics_Image));
+  image->imageDataRef = imageDataRef;
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.imageMT);
+  lua_setmetatable(state, -2);
+
+  return image;
+}
+
+static l_graphics_Image* newImageFromCompressedData(lua_State* state, bool srgb) {
+  image_CompressedImageData *data = l_image_toCompressedData(state, 1);
+  if(!graphics_image_isCompressedFormatSupported(data->format)
+     && !image_compressedFormat_canDecode(data->format)) {
+    lua_pushstring(state, "compressed format ");
+    l_tools_pushEnum(state, data->format, l_image_CompressedFormat);
+    lua_pushstring(state, " is not supported by the graphics card");
+    lua_concat(state, 3);
+    lua_error(state);
+  }
+
+  int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+  l_graphics_Image *image = pushImage(state, ref);
+  graphics_Image_new_with_CompressedImageData(&image->image, data, srgb);
+
+  return image;
+}
+
+// Switches to linear mipmap filtering, which creates the levels
+void l_graphics_useMipmaps(graphics_Image *image) {
+  graphics_Filter filter;
+  graphics_Image_getFilter(image, &filter);
+  filter.mipmapMode = graphics_FilterMode_linear;
+  graphics_Image_setFilter(image, &filter);
+}
+
+// newImage(filename or data, settings). settings may hold mipmaps, srgb
+// (defaults to whether gamma correct rendering is active) and premultiply,
+// which only applies when loading from a file.
 int l_graphics_newImage(lua_State* state) {
+  bool mipmaps = l_tools_optBooleanField(state, 2, "mipmaps", false);
+  bool srgb = l_tools_optBooleanField(state, 2, "srgb", graphics_isGammaCorrect());
+  lua_settop(state, 2);
+
   if(lua_type(state, 1) == LUA_TSTRING) {
-    l_image_newImageData(state);
-    lua_remove(state, 1);
+    // newImageData reads premultiply from the same settings table
+    if(image_isCompressed(lua_tostring(state, 1))) {
+      l_image_newCompressedData(state);
+    } else {
+      l_image_newImageData(state);
+    }
+    lua_replace(state, 1);
   } 
-  
-  if(!l_image_isImageData(state, 1)) {
-    lua_pushstring(state, "expected ImageData");
+  lua_settop(state, 1);
+
+  l_graphics_Image *image;
+  if(l_image_isCompressedData(state, 1)) {
+    image = newImageFromCompressedData(state, srgb);
+  } else if(l_image_isImageData(state, 1)) {
+    image_ImageData * imageData = (image_ImageData*)lua_touserdata(state, 1);
+    int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+
+    image = pushImage(state, ref);
+    graphics_Image_new_with_ImageData(&image->image, imageData, srgb);
+    // imageDataRef keeps the pixels alive for re-uploads after eviction
+    graphics_Image_setSource(&image->image, imageData);
+  } else {
+    lua_pushstring(state, "expected ImageData or CompressedData");
     return lua_error(state);
   }
 
-  lua_settop(state, 1);
-  image_ImageData * imageData = (image_ImageData*)lua_touserdata(state, 1);
-  int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+  if(mipmaps) {
+    l_graphics_useMipmaps(&image->image);
+  }
 
-  l_graphics_Image *image = (l_graphics_Image*)lua_newuserdata(state, sizeof(l_graphics_Image));
+  return 1;
+}
 
-  graphics_Image_new_with_ImageData(&image->image, imageData);
-  image->imageDataRef = ref;
+// The file is decoded on a worker thread and uploaded over the next frames,
+// within the budget set by setImageUploadBudget
+static int l_graphics_newImageAsync(lua_State* state) {
+  char const* filename = l_tools_toStringOrError(state, 1);
+  bool premultiply = l_tools_optBooleanField(state, 2, "premultiply", false);
+  bool srgb = l_tools_optBooleanField(state, 2, "srgb", graphics_isGammaCorrect());
+  image_ImageDataLoad *decode = image_ImageDataLoad_new(filename, premultiply);
+  if(!decode) {
+    lua_pushstring(state, "Could not open image file ");
+    lua_pushstring(state, filename);
+    lua_concat(state, 2);
+    return lua_error(state);
+  }
 
-  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.imageMT);
+  l_graphics_ImageLoad *obj = (l_graphics_ImageLoad*)lua_newuserdata(state, sizeof(l_graphics_ImageLoad));
+  graphics_ImageLoad_new(&obj->load, decode, srgb);
+  obj->imageRef = LUA_NOREF;
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.imageLoadMT);
   lua_setmetatable(state, -2);
 
   return 1;
 }
 
+static int l_graphics_gcImageLoad(lua_State* state) {
+  l_graphics_ImageLoad *obj = l_graphics_toImageLoad(state, 1);
+  graphics_ImageLoad_free(&obj->load);
+  luaL_unref(state, LUA_REGISTRYINDEX, obj->imageRef);
+  return 0;
+}
+
+static int l_graphics_ImageLoad_isReady(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isImageLoad);
+  l_graphics_ImageLoad *obj = l_graphics_toImageLoad(state, 1);
+  lua_pushboolean(state, graphics_ImageLoad_isReady(&obj->load));
+  return 1;
+}
+
+// Returns the same Image every time once it is ready
+static int l_graphics_ImageLoad_getImage(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isImageLoad);
+  l_graphics_ImageLoad *obj = l_graphics_toImageLoad(state, 1);
+
+  if(obj->imageRef == LUA_NOREF) {
+    if(!graphics_ImageLoad_isReady(&obj->load)) {
+      lua_pushstring(state, "image is not ready yet");
+      return lua_error(state);
+    }
+
+    graphics_Image image;
+    image_ImageData data;
+    if(!graphics_ImageLoad_take(&obj->load, &image, &data)) {
+      lua_pushstring(state, "Could not decode image: ");
+      lua_pushstring(state, obj->load.error);
+      lua_concat(state, 2);
+      return lua_error(state);
+    }
+
+    l_image_pushImageData(state, &data);
+    image_ImageData const* source = l_image_toImageData(state, -1);
+    int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    l_graphics_Image *img = pushImage(state, ref);
+    img->image = image;
+    graphics_Image_setSource(&img->image, source);
+    obj->imageRef = luaL_ref(state, LUA_REGISTRYINDEX);
+  }
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, obj->imageRef);
+  return 1;
+}
+
+static int l_graphics_ImageLoad_getError(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isImageLoad);
+  l_graphics_ImageLoad *obj = l_graphics_toImageLoad(state, 1);
+
+  if(obj->load.failed && obj->load.error) {
+    lua_pushstring(state, obj->load.error);
+  } else {
+    lua_pushnil(state);
+  }
+  return 1;
+}
+
+static int l_graphics_setImageUploadBudget(lua_State* state) {
+  graphics_image_setUploadBudget(l_tools_toNumberOrError(state, 1));
+  return 0;
+}
+
+static int l_graphics_getImageUploadBudget(lua_State* state) {
+  lua_pushinteger(state, graphics_image_getUploadBudget());
+  return 1;
+}
+
+// A budget of 0 disables eviction
+static int l_graphics_setTextureMemoryBudget(lua_State* state) {
+  float bytes = l_tools_toNumberOrError(state, 1);
+  if(bytes < 0) {
+    lua_pushstring(state, "budget must not be negative");
+    return lua_error(state);
+  }
+  graphics_image_setTextureBudget(bytes);
+  return 0;
+}
+
+static int l_graphics_getTextureMemoryBudget(lua_State* state) {
+  lua_pushnumber(state, graphics_image_getTextureBudget());
+  return 1;
+}
+
+// Returns the current and peak size of all textures in bytes
+static int l_graphics_getTextureMemory(lua_State* state) {
+  lua_pushnumber(state, graphics_image_getTextureMemory());
+  lua_pushnumber(state, graphics_image_getPeakTextureMemory());
+  return 2;
+}
+
 static int l_graphics_gcImage(lua_State* state) {
   /*
   if(!l_graphics_isImage(state, 1)) {
@@ -186,18 +356,86 @@ static int l_graphics_Image_getData(lua_State* state) {
   return 1;
 }
 
+// replacePixels(data, x, y, w, h) uploads the given region of data, without
+// a region the pixels changed since the last call are uploaded
+static int l_graphics_Image_replacePixels(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isImage);
+  l_assertType(state, 2, l_image_isImageData);
+  l_graphics_Image* img = l_graphics_toImage(state, 1);
+  image_ImageData *data = l_image_toImageData(state, 2);
+
+  if(img->image.compressed || data->w != img->image.width || data->h != img->image.height) {
+    lua_pushstring(state, "ImageData must have the size of the image");
+    return lua_error(state);
+  }
+
+  image_Rect rect;
+  if(lua_isnoneornil(state, 3)) {
+    rect = data->dirty;
+    image_ImageData_clearDirty(data);
+  } else {
+    rect.x = l_tools_toNumberOrError(state, 3);
+    rect.y = l_tools_toNumberOrError(state, 4);
+    rect.w = l_tools_toNumberOrError(state, 5);
+    rect.h = l_tools_toNumberOrError(state, 6);
+    image_ImageData_clipRect(data, &rect);
+  }
+
+  graphics_Image_replacePixels(&img->image, data, &rect);
+
+  return 0;
+}
+
+static int l_graphics_Image_generateMipmaps(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isImage);
+  l_graphics_Image* img = l_graphics_toImage(state, 1);
+
+  if(!graphics_Image_generateMipmaps(&img->image)) {
+    lua_pushstring(state, "mipmaps can not be generated for this image");
+    return lua_error(state);
+  }
+
+  return 0;
+}
+
+static int l_graphics_Image_isCompressed(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isImage);
+  l_graphics_Image* img = l_graphics_toImage(state, 1);
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, img->imageDataRef);
+  lua_pushboolean(state, l_image_isCompressedData(state, -1));
+
+  return 1;
+}
+
 static int l_graphics_Image_refresh(lua_State* state) {
   l_assertType(state, 1, l_graphics_isImage);
   l_graphics_Image* img = l_graphics_toImage(state, 1);
 
   lua_rawgeti(state, LUA_REGISTRYINDEX, img->imageDataRef);
+  if(!l_image_isImageData(state, -1)) {
+    lua_pushstring(state, "only images created from ImageData can be refreshed");
+    return lua_error(state);
+  }
   image_ImageData *data = l_image_toImageData(state, -1);
 
   graphics_Image_refresh(&img->image, data);
+  image_ImageData_clearDirty(data);
 
   return 0;
 }
 
+// Formats the graphics card can use without decoding them first
+static int l_graphics_getCompressedImageFormats(lua_State* state) {
+  lua_newtable(state);
+  for(int i = 0; i < image_CompressedFormat_count; ++i) {
+    l_tools_pushEnum(state, i, l_image_CompressedFormat);
+    lua_pushboolean(state, graphics_image_isCompressedFormatSupported(i));
+    lua_rawset(state, -3);
+  }
+  return 1;
+}
+
 static luaL_Reg const imageMetatableFuncs[] = {
   {"__gc",               l_graphics_gcImage},
   {"getDimensions",      l_graphics_Image_getDimensions},
@@ -211,18 +449,39 @@ static luaL_Reg const imageMetatableFuncs[] = {
   {"getWrap",            l_graphics_Image_getWrap},
   {"getData",            l_graphics_Image_getData},
   {"refresh",            l_graphics_Image_refresh},
+  {"isCompressed",       l_graphics_Image_isCompressed},
+  {"generateMipmaps",    l_graphics_Image_generateMipmaps},
+  {"replacePixels",      l_graphics_Image_replacePixels},
+  {NULL, NULL}
+};
+
+static luaL_Reg const imageLoadMetatableFuncs[] = {
+  {"__gc",               l_graphics_gcImageLoad},
+  {"isReady",            l_graphics_ImageLoad_isReady},
+  {"getImage",           l_graphics_ImageLoad_getImage},
+  {"getError",           l_graphics_ImageLoad_getError},
   {NULL, NULL}
 };
 
 static luaL_Reg const imageFreeFuncs[] = {
-  {"newImage",           l_graphics_newImage},
+  {"newImage",               l_graphics_newImage},
+  {"newImageAsync",          l_graphics_newImageAsync},
+  {"setImageUploadBudget",   l_graphics_setImageUploadBudget},
+  {"getImageUploadBudget",   l_graphics_getImageUploadBudget},
+  {"setTextureMemoryBudget", l_graphics_setTextureMemoryBudget},
+  {"getTextureMemoryBudget", l_graphics_getTextureMemoryBudget},
+  {"getTextureMemory",       l_graphics_getTextureMemory},
+  {"getCompressedImageFormats", l_graphics_getCompressedImageFormats},
   {NULL, NULL}
 };
 
 void l_graphics_image_register(lua_State* state) {
   l_tools_registerFuncsInModule(state, "graphics", imageFreeFuncs);
   moduleData.imageMT  = l_tools_makeTypeMetatable(state, imageMetatableFuncs);
+  moduleData.imageLoadMT  = l_tools_makeTypeMetatable(state, imageLoadMetatableFuncs);
 }
 
 l_checkTypeFn(l_graphics_isImage, moduleData.imageMT)
 l_toTypeFn(l_graphics_toImage, l_graphics_Image)
+l_checkTypeFn(l_graphics_isImageLoad, moduleData.imageLoadMT)
+l_toTypeFn(l_graphics_toImageLoad, l_graphics_ImageLoad)
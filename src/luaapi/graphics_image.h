@@ -18,7 +18,15 @@ typedef struct {
   int imageDataRef;
 } l_graphics_Image;
 
+typedef struct {
+  graphics_ImageLoad load;
+  int imageRef;
+} l_graphics_ImageLoad;
+
 void l_graphics_image_register(lua_State* state);
 bool l_graphics_isImage(lua_State* state, int index);
 l_graphics_Image* l_graphics_toImage(lua_State* state, int index);
 int l_graphics_newImage(lua_State* state);
+bool l_graphics_isImageLoad(lua_State* state, int index);
+l_graphics_ImageLoad* l_graphics_toImageLoad(lua_State* state, int index);
+void l_graphics_useMipmaps(graphics_Image *image);
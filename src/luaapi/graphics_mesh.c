@@ -8,6 +8,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include <tgmath.h>
 #include <lauxlib.h>
 #include "graphics_mesh.h"
@@ -24,10 +25,37 @@ static const l_tools_Enum l_graphics_MeshDrawMode[] = {
 };
 
 
+static const l_tools_Enum l_graphics_MeshUsage[] = {
+  {"static",  graphics_MeshUsage_static},
+  {"dynamic", graphics_MeshUsage_dynamic},
+  {"stream",  graphics_MeshUsage_stream},
+  {NULL, 0}
+};
+
+
+static const l_tools_Enum l_graphics_MeshAttributeType[] = {
+  {"float", graphics_MeshAttributeType_float},
+  {"byte",  graphics_MeshAttributeType_byte},
+  {"unorm", graphics_MeshAttributeType_unorm},
+  {NULL, 0}
+};
+
+
+// Values are the perInstance flag of graphics_Mesh_attachAttribute
+static const l_tools_Enum l_graphics_AttributeStep[] = {
+  {"pervertex",   0},
+  {"perinstance", 1},
+  {NULL, 0}
+};
+
+
 static struct {
   int meshMT;
   void* buffer;
   size_t bufferSize;
+  // Scratch space for custom formats, kept here so Lua errors raised while
+  // reading the rest of the arguments can not leak it
+  graphics_VertexFormat format;
 } moduleData;
 
 
@@ -35,36 +63,66 @@ static void ensureBufferSize(size_t size) {
   if(moduleData.bufferSize < size) {
     free(moduleData.buffer);
     moduleData.buffer = malloc(size); // count * sizeof(graphics_Vertex));
+    moduleData.bufferSize = size;
   }
 }
 
 
-static void readVertex(lua_State* state, graphics_Vertex* out, bool *hasVertexColor) {
-  if(!lua_istable(state, -1) || lua_objlen(state, -1) < 4) {
-    lua_pushstring(state, "Table entry is not a vertex");
-    lua_error(state); // does not return
-    return;           // hint the compiler
+// Byte and unorm components are given as 0 to 255 and default to 255, like
+// vertex colors. Values come from consecutive table entries if fromTable is
+// set, consecutive stack slots otherwise.
+static void readVertexValues(lua_State* state, graphics_VertexFormat const* format, uint8_t* out, int first, bool fromTable, bool *hasVertexColor) {
+  int k = 0;
+  for(int a = 0; a < format->attributeCount; ++a) {
+    graphics_MeshAttribute const* attr = format->attributes + a;
+    bool isColor = !strcmp(attr->name, "VertexColor");
+
+    for(int c = 0; c < attr->components; ++c, ++k) {
+      int index = first + k;
+      if(fromTable) {
+        lua_rawgeti(state, first, k + 1);
+        index = -1;
+      }
+
+      if(attr->type == graphics_MeshAttributeType_float) {
+        ((float*)(out + attr->offset))[c] = l_tools_toNumberOrError(state, index);
+      } else {
+        float v = luaL_optnumber(state, index, 255.0f);
+        v = v < 0.0f ? 0.0f : (v > 255.0f ? 255.0f : v);
+        out[attr->offset + c] = (uint8_t)(v + 0.5f);
+        *hasVertexColor = (*hasVertexColor) || (isColor && v != 255.0f);
+      }
+
+      if(fromTable) {
+        lua_pop(state, 1);
+      }
+    }
   }
+}
 
-  _Static_assert(sizeof(graphics_Vertex) == 8*sizeof(float), "");
-  float *t = (float*)out;
 
-  for(int i = 0; i < 4; ++i) {
-    lua_rawgeti(state, -1, i+1);
-    t[i] = l_tools_toNumberOrError(state, -1);
-    lua_pop(state, 1);
-  }
+static int pushVertexValues(lua_State* state, graphics_VertexFormat const* format, uint8_t const* vertex, bool toTable) {
+  int k = 0;
+  for(int a = 0; a < format->attributeCount; ++a) {
+    graphics_MeshAttribute const* attr = format->attributes + a;
 
-  for(int i = 4; i < 8; ++i) {
-    lua_rawgeti(state, -1, i+1);
-    t[i] = luaL_optnumber(state, -1, 255.0f) / 255.0f;
-    *hasVertexColor = (*hasVertexColor) || t[i] != 1.0f;
-    lua_pop(state, 1);
+    for(int c = 0; c < attr->components; ++c, ++k) {
+      if(attr->type == graphics_MeshAttributeType_float) {
+        lua_pushnumber(state, ((float const*)(vertex + attr->offset))[c]);
+      } else {
+        lua_pushnumber(state, vertex[attr->offset + c]);
+      }
+
+      if(toTable) {
+        lua_rawseti(state, -2, k + 1);
+      }
+    }
   }
+  return k;
 }
 
 
-static size_t readVertices(lua_State* state, bool *hasVertexColor, int base) {
+static size_t readVertices(lua_State* state, graphics_VertexFormat const* format, bool *hasVertexColor, int base) {
   if(!lua_istable(state, base)) {
     lua_pushstring(state, "Need table of vertices");
     lua_error(state); // does not return
@@ -72,12 +130,16 @@ static size_t readVertices(lua_State* state, bool *hasVertexColor, int base) {
   }
 
   size_t count = lua_objlen(state, base);
-  ensureBufferSize(count * sizeof(graphics_Vertex));
+  ensureBufferSize(count * format->stride);
 
   *hasVertexColor = false;
   for(size_t i = 0; i < count; ++i) {
     lua_rawgeti(state, base, i+1);
-    readVertex(state, ((graphics_Vertex*)moduleData.buffer) + i, hasVertexColor);
+    if(!lua_istable(state, -1)) {
+      lua_pushstring(state, "Table entry is not a vertex");
+      lua_error(state); // does not return
+    }
+    readVertexValues(state, format, ((uint8_t*)moduleData.buffer) + i * format->stride, lua_gettop(state), true, hasVertexColor);
     lua_pop(state, 1);
   }
 
@@ -85,17 +147,97 @@ static size_t readVertices(lua_State* state, bool *hasVertexColor, int base) {
 }
 
 
+// A format is a table of {name, type, components} tables
+static bool isVertexFormat(lua_State* state, int index) {
+  if(!lua_istable(state, index)) {
+    return false;
+  }
+
+  lua_rawgeti(state, index, 1);
+  bool isFormat = lua_istable(state, -1);
+  if(isFormat) {
+    lua_rawgeti(state, -1, 1);
+    isFormat = lua_type(state, -1) == LUA_TSTRING;
+    lua_pop(state, 1);
+  }
+  lua_pop(state, 1);
+  return isFormat;
+}
+
+
+static graphics_VertexFormat const* readVertexFormat(lua_State* state, int index) {
+  graphics_VertexFormat *format = &moduleData.format;
+  graphics_VertexFormat_free(format);
+  graphics_VertexFormat_new(format);
+
+  size_t count = lua_objlen(state, index);
+  for(size_t i = 0; i < count; ++i) {
+    lua_rawgeti(state, index, i + 1);
+    lua_rawgeti(state, -1, 1);
+    lua_rawgeti(state, -2, 2);
+    lua_rawgeti(state, -3, 3);
+
+    char const* name = lua_tostring(state, -3);
+    graphics_MeshAttributeType type = l_tools_toEnumOrError(state, -2, l_graphics_MeshAttributeType);
+    int components = l_tools_toNumberOrError(state, -1);
+    if(!name || components < 1 || components > 4) {
+      lua_pushstring(state, "Vertex attributes need a name and 1 to 4 components");
+      lua_error(state); // does not return
+    }
+
+    graphics_VertexFormat_add(format, name, type, components);
+    lua_pop(state, 4);
+  }
+
+  return format;
+}
+
+
 static int l_graphics_newMesh(lua_State* state) {
+  graphics_VertexFormat const* format = graphics_mesh_getDefaultFormat();
+  int base = 1;
+  if(isVertexFormat(state, 1)) {
+    format = readVertexFormat(state, 1);
+    base = 2;
+  }
+
+  // Either a table of vertices or the number of vertices to allocate
   bool useVertexColor;
-  size_t count = readVertices(state, &useVertexColor, 1);
-  graphics_Image const* texture = l_graphics_toTextureOrError(state, 2);
-  graphics_MeshDrawMode mode = l_tools_toEnumOrError(state, 3, l_graphics_MeshDrawMode);
+  size_t count;
+  void const* vertices;
+  if(lua_type(state, base) == LUA_TNUMBER) {
+    lua_Integer n = lua_tointeger(state, base);
+    if(n < 1) {
+      lua_pushstring(state, "Need at least one vertex");
+      lua_error(state); // does not return
+    }
+    count = n;
+    vertices = 0;
+    useVertexColor = format != graphics_mesh_getDefaultFormat() && graphics_VertexFormat_find(format, "VertexColor");
+  } else {
+    count = readVertices(state, format, &useVertexColor, base);
+    vertices = moduleData.buffer;
+    if(format != graphics_mesh_getDefaultFormat()) {
+      useVertexColor = graphics_VertexFormat_find(format, "VertexColor");
+    }
+  }
+
+  graphics_Image const* texture = 0;
+  if(!lua_isnoneornil(state, base + 1)) {
+    texture = l_graphics_toTextureOrError(state, base + 1);
+  }
+  graphics_MeshDrawMode mode = l_tools_toEnumOrError(state, base + 2, l_graphics_MeshDrawMode);
+  graphics_MeshUsage usage = graphics_MeshUsage_dynamic;
+  if(!lua_isnoneornil(state, base + 3)) {
+    usage = l_tools_toEnumOrError(state, base + 3, l_graphics_MeshUsage);
+  }
 
   l_graphics_Mesh* mesh = lua_newuserdata(state, sizeof(l_graphics_Mesh));
-  graphics_Mesh_new(&mesh->mesh, count, (graphics_Vertex*)moduleData.buffer, texture, mode, useVertexColor);
+  graphics_Mesh_new(&mesh->mesh, format, count, vertices, texture, mode, useVertexColor, usage);
 
-  lua_pushvalue(state, 2);
+  lua_pushvalue(state, base + 1);
   mesh->textureRef = luaL_ref(state, LUA_REGISTRYINDEX);
+  mesh->attachmentsRef = LUA_NOREF;
 
   lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.meshMT);
   lua_setmetatable(state, -2);
@@ -107,6 +249,7 @@ static int l_graphics_gcMesh(lua_State* state) {
   l_graphics_Mesh *mesh = l_graphics_toMesh(state, 1);
   graphics_Mesh_free(&mesh->mesh);
   luaL_unref(state, LUA_REGISTRYINDEX, mesh->textureRef);
+  luaL_unref(state, LUA_REGISTRYINDEX, mesh->attachmentsRef);
 
   return 0;
 }
@@ -262,33 +405,56 @@ static int l_graphics_Mesh_setVertices(lua_State* state) {
   l_graphics_Mesh *mesh = l_graphics_toMesh(state, 1);
 
   bool hasColor;
-  size_t count = readVertices(state, &hasColor, 2);
+  size_t count = readVertices(state, &mesh->mesh.format, &hasColor, 2);
 
-  graphics_Mesh_setVertices(&mesh->mesh, count, (graphics_Vertex const*)moduleData.buffer);
+  // With a start index only that part of the mesh is replaced and uploaded
+  if(lua_isnoneornil(state, 3)) {
+    graphics_Mesh_setVertices(&mesh->mesh, count, moduleData.buffer);
+  } else {
+    size_t start = l_tools_toNumberOrError(state, 3) - 1;
+    if(start >= mesh->mesh.vertexCount || count > mesh->mesh.vertexCount - start) {
+      lua_pushstring(state, "Vertices do not fit into mesh");
+      return lua_error(state);
+    }
+    graphics_Mesh_setVertexRange(&mesh->mesh, start, count, moduleData.buffer);
+  }
 
   return 0;
 }
 
 
+static int l_graphics_Mesh_flush(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isMesh);
+  l_graphics_Mesh *mesh = l_graphics_toMesh(state, 1);
+
+  graphics_Mesh_flush(&mesh->mesh);
+
+  return 0;
+}
+
+
+static int l_graphics_Mesh_getUsage(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isMesh);
+  l_graphics_Mesh const *mesh = l_graphics_toMesh(state, 1);
+
+  l_tools_pushEnum(state, graphics_Mesh_getUsage(&mesh->mesh), l_graphics_MeshUsage);
+
+  return 1;
+}
+
+
 static int l_graphics_Mesh_getVertices(lua_State* state) {
   l_assertType(state, 1, l_graphics_isMesh);
   l_graphics_Mesh const* mesh = l_graphics_toMesh(state, 1);
 
   size_t count;
-  graphics_Vertex const *vertices = graphics_Mesh_getVertices(&mesh->mesh, &count);
+  uint8_t const *vertices = graphics_Mesh_getVertices(&mesh->mesh, &count);
+  graphics_VertexFormat const* format = graphics_Mesh_getVertexFormat(&mesh->mesh);
 
   lua_createtable(state, count, 0);
   for(size_t i = 0; i < count; ++i) {
-    lua_createtable(state, 8, 0);
-    float const *vertex = (float const*)(vertices+i);
-    for(size_t j = 0; j < 4; ++j) {
-      lua_pushnumber(state, vertex[j]);
-      lua_rawseti(state, -2, j + 1);
-    }
-    for(size_t j = 4; j < 8; ++j) {
-      lua_pushnumber(state, floor(vertex[j] * 255.0f));
-      lua_rawseti(state, -2, j + 1);
-    }
+    lua_newtable(state);
+    pushVertexValues(state, format, vertices + i * format->stride, true);
     lua_rawseti(state, -2, i + 1);
   }
 
@@ -296,42 +462,111 @@ static int l_graphics_Mesh_getVertices(lua_State* state) {
 }
 
 
+static size_t toVertexIndex(lua_State* state, int index, graphics_Mesh const* mesh) {
+  lua_Number i = l_tools_toNumberOrError(state, index);
+  if(i < 1 || i > mesh->vertexCount) {
+    lua_pushstring(state, "Vertex index out of range");
+    lua_error(state); // does not return
+  }
+  return (size_t)i - 1;
+}
+
+
 static int l_graphics_Mesh_getVertex(lua_State* state) {
   l_assertType(state, 1, l_graphics_isMesh);
   l_graphics_Mesh const* mesh = l_graphics_toMesh(state, 1);
 
-  size_t index = l_tools_toNumberOrError(state, 2) - 1;
-
-  graphics_Vertex const* vertex = graphics_Mesh_getVertex(&mesh->mesh, index);
-  float const* vf = (float const*)vertex;
+  size_t index = toVertexIndex(state, 2, &mesh->mesh);
 
-  for(size_t j = 0; j < 4; ++j) {
-    lua_pushnumber(state, vf[j]);
-  }
-  for(size_t j = 4; j < 8; ++j) {
-    lua_pushnumber(state, floor(vf[j] * 255.0f));
-  }
-
-  return 8;
+  uint8_t const* vertex = graphics_Mesh_getVertex(&mesh->mesh, index);
+  return pushVertexValues(state, graphics_Mesh_getVertexFormat(&mesh->mesh), vertex, false);
 }
 
 
+// Takes the values either as separate arguments or as one table
 static int l_graphics_Mesh_setVertex(lua_State* state) {
   l_assertType(state, 1, l_graphics_isMesh);
   l_graphics_Mesh * mesh = l_graphics_toMesh(state, 1);
 
-  size_t index = l_tools_toNumberOrError(state, 2) - 1;
+  size_t index = toVertexIndex(state, 2, &mesh->mesh);
+
+  graphics_VertexFormat const* format = graphics_Mesh_getVertexFormat(&mesh->mesh);
+  ensureBufferSize(format->stride);
+  bool hasColor = false;
+  readVertexValues(state, format, moduleData.buffer, 3, lua_istable(state, 3), &hasColor);
+
+  graphics_Mesh_setVertex(&mesh->mesh, index, moduleData.buffer);
+
+  return 0;
+}
+
+
+static int l_graphics_Mesh_getVertexFormat(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isMesh);
+  l_graphics_Mesh const* mesh = l_graphics_toMesh(state, 1);
+
+  graphics_VertexFormat const* format = graphics_Mesh_getVertexFormat(&mesh->mesh);
+  lua_createtable(state, format->attributeCount, 0);
+  for(int i = 0; i < format->attributeCount; ++i) {
+    graphics_MeshAttribute const* attr = format->attributes + i;
+    lua_createtable(state, 3, 0);
+    lua_pushstring(state, attr->name);
+    lua_rawseti(state, -2, 1);
+    l_tools_pushEnum(state, attr->type, l_graphics_MeshAttributeType);
+    lua_rawseti(state, -2, 2);
+    lua_pushnumber(state, attr->components);
+    lua_rawseti(state, -2, 3);
+    lua_rawseti(state, -2, i + 1);
+  }
+
+  return 1;
+}
+
 
-  graphics_Vertex v;
-  float *vf = (float*)&v;
-  for(int i = 0; i < 4; ++i) {
-    vf[i] = l_tools_toNumberOrError(state, i+3);
+// The attached meshes are kept in a table so they can not be collected
+// while in use
+static int l_graphics_Mesh_attachAttribute(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isMesh);
+  l_graphics_Mesh *mesh = l_graphics_toMesh(state, 1);
+  char const* name = l_tools_toStringOrError(state, 2);
+  l_assertType(state, 3, l_graphics_isMesh);
+  l_graphics_Mesh *other = l_graphics_toMesh(state, 3);
+  bool perInstance = false;
+  if(!lua_isnoneornil(state, 4)) {
+    perInstance = l_tools_toEnumOrError(state, 4, l_graphics_AttributeStep);
   }
-  for(int i = 4; i < 8; ++i) {
-    vf[i] = luaL_optnumber(state, i+3, 255.0f) / 255.0f;
+
+  if(!graphics_Mesh_attachAttribute(&mesh->mesh, name, &other->mesh, perInstance)) {
+    lua_pushstring(state, "Mesh does not have the attribute");
+    return lua_error(state);
   }
 
-  graphics_Mesh_setVertex(&mesh->mesh, index, &v);
+  if(mesh->attachmentsRef == LUA_NOREF) {
+    lua_newtable(state);
+    mesh->attachmentsRef = luaL_ref(state, LUA_REGISTRYINDEX);
+  }
+  lua_rawgeti(state, LUA_REGISTRYINDEX, mesh->attachmentsRef);
+  lua_pushvalue(state, 2);
+  lua_pushvalue(state, 3);
+  lua_rawset(state, -3);
+
+  return 0;
+}
+
+
+static int l_graphics_Mesh_detachAttribute(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isMesh);
+  l_graphics_Mesh *mesh = l_graphics_toMesh(state, 1);
+  char const* name = l_tools_toStringOrError(state, 2);
+
+  graphics_Mesh_detachAttribute(&mesh->mesh, name);
+
+  if(mesh->attachmentsRef != LUA_NOREF) {
+    lua_rawgeti(state, LUA_REGISTRYINDEX, mesh->attachmentsRef);
+    lua_pushvalue(state, 2);
+    lua_pushnil(state);
+    lua_rawset(state, -3);
+  }
 
   return 0;
 }
@@ -391,11 +626,47 @@ static luaL_Reg const meshMetatableFuncs[] = {
   {"getVertexCount",     l_graphics_Mesh_getVertexCount},
   {"getDrawMode",        l_graphics_Mesh_getDrawMode},
   {"setDrawMode",        l_graphics_Mesh_setDrawMode},
+  {"flush",              l_graphics_Mesh_flush},
+  {"getVertexFormat",    l_graphics_Mesh_getVertexFormat},
+  {"attachAttribute",    l_graphics_Mesh_attachAttribute},
+  {"detachAttribute",    l_graphics_Mesh_detachAttribute},
+  {"getUsage",           l_graphics_Mesh_getUsage},
   {NULL, NULL}
 };
 
+static int l_graphics_drawInstanced(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isMesh);
+  l_graphics_Mesh *mesh = l_graphics_toMesh(state, 1);
+  int instances = l_tools_toNumberOrError(state, 2);
+
+  if(!graphics_mesh_isInstancingSupported()) {
+    lua_pushstring(state, "Instancing is not supported on this system");
+    return lua_error(state);
+  }
+
+  if(instances < 0) {
+    lua_pushstring(state, "Instance count must not be negative");
+    return lua_error(state);
+  }
+
+  float x  = luaL_optnumber(state, 3,  0.0f);
+  float y  = luaL_optnumber(state, 4,  0.0f);
+  float r  = luaL_optnumber(state, 5,  0.0f);
+  float sx = luaL_optnumber(state, 6,  1.0f);
+  float sy = luaL_optnumber(state, 7,  sx);
+  float ox = luaL_optnumber(state, 8,  0.0f);
+  float oy = luaL_optnumber(state, 9,  0.0f);
+  float kx = luaL_optnumber(state, 10, 0.0f);
+  float ky = luaL_optnumber(state, 11, 0.0f);
+
+  graphics_Mesh_drawInstanced(&mesh->mesh, instances, x, y, r, sx, sy, ox, oy, kx, ky);
+  return 0;
+}
+
+
 static luaL_Reg const meshFreeFuncs[] = {
   {"newMesh",            l_graphics_newMesh},
+  {"drawInstanced",      l_graphics_drawInstanced},
   {NULL, NULL}
 };
 
@@ -16,6 +16,7 @@
 typedef struct {
   graphics_Mesh mesh;
   int textureRef;
+  int attachmentsRef;
 } l_graphics_Mesh;
 
 void l_graphics_mesh_register(lua_State* state);
@@ -7,6 +7,7 @@
     under the terms of the MIT license. See LICENSE.md for details.
 */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <tgmath.h>
 #include <lauxlib.h>
@@ -32,6 +33,12 @@ static const l_tools_Enum l_graphics_ParticleInsertMode[] = {
   {NULL, 0}
 };
 
+static const l_tools_Enum l_graphics_ParticleMode[] = {
+  {"cpu", graphics_ParticleMode_cpu},
+  {"gpu", graphics_ParticleMode_gpu},
+  {NULL, 0}
+};
+
 static struct {
   int particleSystemMT;
   void* buffer;
@@ -66,6 +73,46 @@ static int l_graphics_newParticleSystem(lua_State *state) {
 }
 
 
+static int comparePointers(void const* a, void const* b) {
+  uintptr_t pa = (uintptr_t)*(void* const*)a;
+  uintptr_t pb = (uintptr_t)*(void* const*)b;
+  return (pa > pb) - (pa < pb);
+}
+
+
+static int l_graphics_updateParticleSystems(lua_State *state) {
+  if(!lua_istable(state, 1)) {
+    lua_pushstring(state, "expected table");
+    return lua_error(state);
+  }
+  float dt = l_tools_toNumberOrError(state, 2);
+
+  int count = lua_objlen(state, 1);
+  ensureBufferSize(count * sizeof(graphics_ParticleSystem*));
+  graphics_ParticleSystem **systems = (graphics_ParticleSystem**)moduleData.buffer;
+
+  for(int i = 0; i < count; ++i) {
+    lua_rawgeti(state, 1, i + 1);
+    l_assertType(state, -1, l_graphics_isParticleSystem);
+    systems[i] = &l_graphics_toParticleSystem(state, -1)->particleSystem;
+    lua_pop(state, 1);
+  }
+
+  // The same system on two workers would race, order does not matter here
+  qsort(systems, count, sizeof(graphics_ParticleSystem*), comparePointers);
+  for(int i = 1; i < count; ++i) {
+    if(systems[i] == systems[i - 1]) {
+      lua_pushstring(state, "ParticleSystem listed more than once");
+      return lua_error(state);
+    }
+  }
+
+  graphics_particlesystem_updateMany(systems, count, dt);
+
+  return 0;
+}
+
+
 static int l_graphics_gcParticleSystem(lua_State *state) {
   l_graphics_ParticleSystem *ps = l_graphics_toParticleSystem(state, 1);
   graphics_ParticleSystem_free(&ps->particleSystem);
@@ -295,6 +342,49 @@ static int l_graphics_ParticleSystem_getInsertMode(lua_State *state) {
 }
 
 
+static int l_graphics_ParticleSystem_prewarm(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isParticleSystem);
+  l_graphics_ParticleSystem *ps = l_graphics_toParticleSystem(state, 1);
+  float seconds = l_tools_toNumberOrError(state, 2);
+  float step = luaL_optnumber(state, 3, 0.0f);
+
+  graphics_ParticleSystem_prewarm(&ps->particleSystem, seconds, step);
+
+  return 0;
+}
+
+
+static int l_graphics_ParticleSystem_setMode(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isParticleSystem);
+  l_graphics_ParticleSystem *ps = l_graphics_toParticleSystem(state, 1);
+  graphics_ParticleMode mode = l_tools_toEnumOrError(state, 2, l_graphics_ParticleMode);
+
+  if(!graphics_ParticleSystem_setMode(&ps->particleSystem, mode)) {
+    graphics_Shader const* shader = graphics_particlesystem_getGPUShader();
+    lua_pushstring(state, "Could not build GPU particle shader:\n");
+    lua_pushstring(state, shader->warnings.vertex);
+    lua_pushstring(state, shader->warnings.fragment);
+    lua_pushstring(state, shader->warnings.program);
+    lua_concat(state, 4);
+    return lua_error(state);
+  }
+
+  return 0;
+}
+
+
+static int l_graphics_ParticleSystem_getMode(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isParticleSystem);
+  l_graphics_ParticleSystem const *ps = l_graphics_toParticleSystem(state, 1);
+
+  graphics_ParticleMode mode = graphics_ParticleSystem_getMode(&ps->particleSystem);
+
+  l_tools_pushEnum(state, mode, l_graphics_ParticleMode);
+
+  return 1;
+}
+
+
 static int l_graphics_ParticleSystem_clone(lua_State *state) {
   l_assertType(state, 1, l_graphics_isParticleSystem);
   l_graphics_ParticleSystem const *ps = l_graphics_toParticleSystem(state, 1);
@@ -481,11 +571,13 @@ static luaL_Reg const particleSystemMetatableFuncs[] = {
   {"setQuads",                  l_graphics_ParticleSystem_setQuads},
   {"setRelativeRotation",       l_graphics_ParticleSystem_setRelativeRotation},
   {"setInsertMode",             l_graphics_ParticleSystem_setInsertMode},
+  {"setMode",                   l_graphics_ParticleSystem_setMode},
   {"setLinearAcceleration",     l_graphics_ParticleSystem_setLinearAcceleration},
 
   // Single Num Param
   {"update",                    l_graphics_ParticleSystem_update},
   {"emit",                      l_graphics_ParticleSystem_emit},
+  {"prewarm",                   l_graphics_ParticleSystem_prewarm},
   {"setBufferSize", 			      l_graphics_ParticleSystem_setBufferSize},
   {"setDirection",              l_graphics_ParticleSystem_setDirection},
   {"setEmissionRate",           l_graphics_ParticleSystem_setEmissionRate},
@@ -512,6 +604,7 @@ static luaL_Reg const particleSystemMetatableFuncs[] = {
   {"getTexture",                l_graphics_ParticleSystem_getTexture},
   {"getSizes",                  l_graphics_ParticleSystem_getSizes},
   {"getInsertMode",             l_graphics_ParticleSystem_getInsertMode},
+  {"getMode",                   l_graphics_ParticleSystem_getMode},
   {"getLinearAcceleration",     l_graphics_ParticleSystem_getLinearAcceleration},
 
   // Single Num Param
@@ -553,6 +646,7 @@ static luaL_Reg const particleSystemMetatableFuncs[] = {
 
 static luaL_Reg const particleSystemFreeFuncs[] = {
   {"newParticleSystem",         l_graphics_newParticleSystem},
+  {"updateParticleSystems",     l_graphics_updateParticleSystems},
   {NULL, NULL}
 };
 
@@ -0,0 +1,150 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include <lauxlib.h>
+#include "graphics_polyline.h"
+#include "tools.h"
+#include "polygon.h"
+
+static const l_tools_Enum l_graphics_PolylineJoin[] = {
+  {"none",  graphics_LineJoin_none},
+  {"miter", graphics_LineJoin_miter},
+  {NULL, 0}
+};
+
+
+static struct {
+  int polylineMT;
+} moduleData;
+
+
+// newPolyline(points, width, join), width and join default to the current
+// line settings
+static int l_graphics_newPolyline(lua_State* state) {
+  if(!lua_istable(state, 1)) {
+    lua_pushstring(state, "Expected table of points");
+    return lua_error(state);
+  }
+
+  float width = luaL_optnumber(state, 2, graphics_geometry_getLineWidth());
+  graphics_LineJoin join = graphics_geometry_getLineJoin();
+  if(!lua_isnoneornil(state, 3)) {
+    join = l_tools_toEnumOrError(state, 3, l_graphics_PolylineJoin);
+  }
+
+  lua_settop(state, 1);
+  float *points;
+  int count = l_geometry_read_vertices(state, 0, &points, 0);
+
+  l_graphics_Polyline *line = lua_newuserdata(state, sizeof(l_graphics_Polyline));
+  graphics_Polyline_new(&line->polyline, count, points, width, join);
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.polylineMT);
+  lua_setmetatable(state, -2);
+  return 1;
+}
+
+
+static int l_graphics_gcPolyline(lua_State* state) {
+  l_graphics_Polyline *line = l_graphics_toPolyline(state, 1);
+  graphics_Polyline_free(&line->polyline);
+  return 0;
+}
+
+
+static int l_graphics_Polyline_append(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isPolyline);
+  l_graphics_Polyline *line = l_graphics_toPolyline(state, 1);
+
+  float *points;
+  int count = l_geometry_read_vertices(state, 1, &points, 2);
+  graphics_Polyline_append(&line->polyline, count, points);
+  return 0;
+}
+
+
+static int l_graphics_Polyline_setPoints(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isPolyline);
+  l_graphics_Polyline *line = l_graphics_toPolyline(state, 1);
+
+  float *points;
+  int count = l_geometry_read_vertices(state, 1, &points, 0);
+  graphics_Polyline_setPoints(&line->polyline, count, points);
+  return 0;
+}
+
+
+static int l_graphics_Polyline_getPoints(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isPolyline);
+  l_graphics_Polyline const *line = l_graphics_toPolyline(state, 1);
+
+  int count;
+  float const* points = graphics_Polyline_getPoints(&line->polyline, &count);
+  lua_createtable(state, 2 * count, 0);
+  for(int i = 0; i < 2 * count; ++i) {
+    lua_pushnumber(state, points[i]);
+    lua_rawseti(state, -2, i + 1);
+  }
+  return 1;
+}
+
+
+static int l_graphics_Polyline_getPointCount(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isPolyline);
+  l_graphics_Polyline const *line = l_graphics_toPolyline(state, 1);
+
+  int count;
+  graphics_Polyline_getPoints(&line->polyline, &count);
+  lua_pushinteger(state, count);
+  return 1;
+}
+
+
+static int l_graphics_Polyline_getWidth(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isPolyline);
+  l_graphics_Polyline const *line = l_graphics_toPolyline(state, 1);
+
+  lua_pushnumber(state, graphics_Polyline_getWidth(&line->polyline));
+  return 1;
+}
+
+
+static int l_graphics_Polyline_getJoin(lua_State* state) {
+  l_assertType(state, 1, l_graphics_isPolyline);
+  l_graphics_Polyline const *line = l_graphics_toPolyline(state, 1);
+
+  l_tools_pushEnum(state, graphics_Polyline_getJoin(&line->polyline), l_graphics_PolylineJoin);
+  return 1;
+}
+
+
+l_checkTypeFn(l_graphics_isPolyline, moduleData.polylineMT)
+l_toTypeFn(l_graphics_toPolyline, l_graphics_Polyline)
+
+
+static luaL_Reg const polylineMetatableFuncs[] = {
+  {"__gc",               l_graphics_gcPolyline},
+  {"append",             l_graphics_Polyline_append},
+  {"setPoints",          l_graphics_Polyline_setPoints},
+  {"getPoints",          l_graphics_Polyline_getPoints},
+  {"getPointCount",      l_graphics_Polyline_getPointCount},
+  {"getWidth",           l_graphics_Polyline_getWidth},
+  {"getJoin",            l_graphics_Polyline_getJoin},
+  {NULL, NULL}
+};
+
+static luaL_Reg const polylineFreeFuncs[] = {
+  {"newPolyline",        l_graphics_newPolyline},
+  {NULL, NULL}
+};
+
+void l_graphics_polyline_register(lua_State* state) {
+  l_tools_registerFuncsInModule(state, "graphics", polylineFreeFuncs);
+  moduleData.polylineMT = l_tools_makeTypeMetatable(state, polylineMetatableFuncs);
+}
@@ -0,0 +1,22 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <lua.h>
+#include "../graphics/polyline.h"
+
+typedef struct {
+  graphics_Polyline polyline;
+} l_graphics_Polyline;
+
+void l_graphics_polyline_register(lua_State* state);
+bool l_graphics_isPolyline(lua_State* state, int index);
+l_graphics_Polyline* l_graphics_toPolyline(lua_State* state, int index);
@@ -28,14 +28,16 @@ static struct {
 } moduleData;
 
 
-int static l_graphics_newShader(lua_State* state) {
-  char const* vertexSrc = l_tools_toStringOrError(state, 1);
+// Reads shader code or file names from index and index + 1. Files are
+// loaded into loadedFile1 and loadedFile2, which the caller has to free.
+static void readShaderSources(lua_State* state, int index, char const** vertexOut, char const** fragmentOut, char **loadedFile1Out, char **loadedFile2Out) {
+  char const* vertexSrc = l_tools_toStringOrError(state, index);
   char const* fragmentSrc = NULL;
   char * loadedFile1 = NULL;
   char * loadedFile2 = NULL;
 
-  if(lua_isstring(state, 2)) {
-    fragmentSrc = lua_tostring(state, 2);
+  if(lua_isstring(state, index + 1)) {
+    fragmentSrc = lua_tostring(state, index + 1);
     
     if(!graphics_shader_isVertexShader(vertexSrc)) {
       // TODO
@@ -44,7 +46,7 @@ int static l_graphics_newShader(lua_State* state) {
       if(!loadedFile1 || !graphics_shader_isVertexShader(loadedFile1)) {
         free(loadedFile1);
         lua_pushstring(state, "input 1 is not a valid vertex shader");
-        return lua_error(state);
+        lua_error(state);
       }
       vertexSrc = loadedFile1;
     }
@@ -58,7 +60,7 @@ int static l_graphics_newShader(lua_State* state) {
         free(loadedFile1);
         free(loadedFile2);
         lua_pushstring(state, "input 2 is not a valid fragment shader");
-        return lua_error(state);
+        lua_error(state);
       }
       fragmentSrc = loadedFile2;
     }
@@ -75,7 +77,7 @@ int static l_graphics_newShader(lua_State* state) {
       (void) loadedFile1Size;
       if(!loadedFile1) {
         lua_pushstring(state, "could not open file");
-        return lua_error(state);
+        lua_error(state);
       }
 
       if(graphics_shader_isFragmentShader(loadedFile1)) {
@@ -87,29 +89,110 @@ int static l_graphics_newShader(lua_State* state) {
       } else {
         free(loadedFile1);
         lua_pushstring(state, "input is not a valid shader");
-        return lua_error(state);
+        lua_error(state);
       }
     }
   }
 
+  *vertexOut = vertexSrc;
+  *fragmentOut = fragmentSrc;
+  *loadedFile1Out = loadedFile1;
+  *loadedFile2Out = loadedFile2;
+}
+
+
+// Starts building the shader without waiting for the driver
+static l_graphics_Shader* pushNewShader(lua_State* state, char const* vertexSrc, char const* fragmentSrc) {
   l_graphics_Shader * shader = lua_newuserdata(state, sizeof(l_graphics_Shader));
-  graphics_ShaderCompileStatus status = graphics_Shader_new(&shader->shader, vertexSrc, fragmentSrc);
-  if(status != graphics_ShaderCompileStatus_okay) {
-    pushShaderInfoLog(state, &shader->shader);
-    return lua_error(state);
-  }
+  graphics_Shader_newAsync(&shader->shader, vertexSrc, fragmentSrc);
+  shader->referencedTextures = NULL;
+  shader->finished = false;
 
   lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.shaderMT);
   lua_setmetatable(state, -2);
 
-  free(loadedFile1);
-  free(loadedFile2);
+  return shader;
+}
+
+
+// Waits for the shader to be built, raising its compile errors if it
+// failed. Shaders from compileShaders report their errors here, on first
+// use.
+static void finishShader(lua_State* state, l_graphics_Shader* shader) {
+  if(shader->finished) {
+    return;
+  }
+
+  if(graphics_Shader_finish(&shader->shader) != graphics_ShaderCompileStatus_okay) {
+    pushShaderInfoLog(state, &shader->shader);
+    lua_error(state);
+  }
 
   int const textureUnits = shader->shader.textureUnitCount;
   shader->referencedTextures = malloc(textureUnits * sizeof(int));
   for(int i = 0; i < textureUnits; ++i) {
     shader->referencedTextures[i] = LUA_NOREF;
   }
+  shader->finished = true;
+}
+
+
+int static l_graphics_newShader(lua_State* state) {
+  char const* vertexSrc;
+  char const* fragmentSrc;
+  char * loadedFile1;
+  char * loadedFile2;
+  readShaderSources(state, 1, &vertexSrc, &fragmentSrc, &loadedFile1, &loadedFile2);
+
+  l_graphics_Shader * shader = pushNewShader(state, vertexSrc, fragmentSrc);
+
+  free(loadedFile1);
+  free(loadedFile2);
+
+  finishShader(state, shader);
+
+  return 1;
+}
+
+
+// Takes a list of shaders, each given like the arguments of newShader as
+// a table or as a single string. All of them are started before any is
+// waited for, so the driver can compile them in parallel with whatever
+// the game does next.
+static int l_graphics_compileShaders(lua_State* state) {
+  if(!lua_istable(state, 1)) {
+    lua_pushstring(state, "expected table of shaders");
+    return lua_error(state);
+  }
+
+  int const count = lua_objlen(state, 1);
+  lua_settop(state, 1);
+  lua_createtable(state, count, 0);
+
+  for(int i = 1; i <= count; ++i) {
+    lua_rawgeti(state, 1, i);
+    if(lua_istable(state, 3)) {
+      lua_rawgeti(state, 3, 1);
+      lua_rawgeti(state, 3, 2);
+    } else {
+      lua_pushvalue(state, 3);
+      lua_pushnil(state);
+    }
+
+    char const* vertexSrc;
+    char const* fragmentSrc;
+    char * loadedFile1;
+    char * loadedFile2;
+    readShaderSources(state, 4, &vertexSrc, &fragmentSrc, &loadedFile1, &loadedFile2);
+
+    pushNewShader(state, vertexSrc, fragmentSrc);
+
+    free(loadedFile1);
+    free(loadedFile2);
+
+    lua_rawseti(state, 2, i);
+    lua_settop(state, 2);
+  }
 
   return 1;
 }
@@ -119,12 +202,14 @@ l_toTypeFn(l_graphics_toShader, l_graphics_Shader)
 
 static int l_graphics_gcShader(lua_State* state) {
   l_graphics_Shader *shader = l_graphics_toShader(state, 1);
-  free(shader->referencedTextures);
 
   // Unref textures to allow gc'ing them
-  for(int i = 0; i < shader->shader.textureUnitCount; ++i) {
-    luaL_unref(state, LUA_REGISTRYINDEX, shader->referencedTextures[i]);
+  if(shader->finished) {
+    for(int i = 0; i < shader->shader.textureUnitCount; ++i) {
+      luaL_unref(state, LUA_REGISTRYINDEX, shader->referencedTextures[i]);
+    }
   }
+  free(shader->referencedTextures);
   
   graphics_Shader_free(&shader->shader);
   return 0;
@@ -143,6 +228,7 @@ static int l_graphics_setShader(lua_State *state) {
     return 0;
   } else if(l_graphics_isShader(state, 1)) {
     l_graphics_Shader* shader = l_graphics_toShader(state, 1);
+    finishShader(state, shader);
     luaL_unref(state, LUA_REGISTRYINDEX, moduleData.currentShaderRef);
     lua_settop(state, 1);
     moduleData.currentShaderRef = luaL_ref(state, LUA_REGISTRYINDEX);
@@ -163,7 +249,7 @@ static void growBuffer(int size) {
 }
 
 #define mkScalarSendFunc(name, type, totypefunc) \
-  static void name(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo const* info) { \
+  static void name(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo *info) { \
     int count = min(lua_gettop(state) - 2, info->elements);         \
                                                                     \
     growBuffer(sizeof(type) * count);                               \
@@ -183,7 +269,7 @@ mkScalarSendFunc(sendBooleans, GLint,   l_tools_toBooleanOrError)
 #undef mkScalarSendFunc
 
 #define mkVectorSendFunc(name, valuetype, totypefunc) \
-  static void name(lua_State *state, l_graphics_Shader *shader, graphics_ShaderUniformInfo const* info) { \
+  static void name(lua_State *state, l_graphics_Shader *shader, graphics_ShaderUniformInfo *info) { \
     int components = graphics_shader_toMotorComponents(info->type); \
     int count = min(lua_gettop(state) - 2, info->elements);         \
                                                                     \
@@ -205,7 +291,7 @@ mkVectorSendFunc(sendFloatVectors,   GLfloat, l_tools_toNumberOrError)
 mkVectorSendFunc(sendBooleanVectors, GLint,   l_tools_toBooleanOrError)
 
 
-static void sendFloatMatrices(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo const* info) {
+static void sendFloatMatrices(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo *info) {
   int components = graphics_shader_toMotorComponents(info->type);
   int count = min(lua_gettop(state) - 2, info->elements);
   growBuffer(sizeof(float) * components * components * count);
@@ -229,19 +315,21 @@ static void sendFloatMatrices(lua_State *state, l_graphics_Shader* shader, graph
   graphics_Shader_sendFloatMatrices(&shader->shader, info, count, numbers);
 }
 
-static void referenceAndSendTexture(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo const* info, GLuint texture) {
+static void referenceAndSendTexture(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo *info, GLuint texture) {
   int index = (graphics_ShaderTextureUnitInfo*) info->extra - shader->shader.textureUnits;
   lua_settop(state, 3);
   shader->referencedTextures[index] = luaL_ref(state, LUA_REGISTRYINDEX);
   graphics_Shader_sendTexture(&shader->shader, info, texture);
 }
 
-static void sendSamplers(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo const* info) {
+static void sendSamplers(lua_State *state, l_graphics_Shader* shader, graphics_ShaderUniformInfo *info) {
   if(l_graphics_isCanvas(state, 3)) {
     graphics_Canvas * canvas = l_graphics_toCanvas(state, 3);
     referenceAndSendTexture(state, shader, info, canvas->image.texID);
   } else if(l_graphics_isImage(state,3)) {
     l_graphics_Image * image = l_graphics_toImage(state, 3);
+    // The shader binds the texture itself and can not restore it
+    graphics_Image_setSource(&image->image, 0);
     referenceAndSendTexture(state, shader, info, image->image.texID);
   } else {
     lua_pushstring(state, "Expected texture");
@@ -249,14 +337,8 @@ static void sendSamplers(lua_State *state, l_graphics_Shader* shader, graphics_S
   }
 }
 
-static int l_graphics_Shader_send(lua_State *state) {
-  l_assertType(state, 1, l_graphics_isShader); 
-  l_graphics_Shader* shader = l_graphics_toShader(state, 1);
-
-  char const* name = l_tools_toStringOrError(state, 2);
-
-  graphics_ShaderUniformInfo const* info = graphics_Shader_getUniform(&shader->shader, name);
-
+// Values start at index 3
+static void sendUniform(lua_State *state, l_graphics_Shader *shader, graphics_ShaderUniformInfo *info) {
   switch(info->type) {
   case GL_INT:
     sendIntegers(state, shader, info);
@@ -299,6 +381,57 @@ static int l_graphics_Shader_send(lua_State *state) {
     break;
 
   };
+}
+
+static int l_graphics_Shader_send(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isShader); 
+  l_graphics_Shader* shader = l_graphics_toShader(state, 1);
+  finishShader(state, shader);
+
+  char const* name = l_tools_toStringOrError(state, 2);
+
+  graphics_ShaderUniformInfo *info = graphics_Shader_getUniform(&shader->shader, name);
+  if(!info) {
+    lua_pushstring(state, "uniform does not exist");
+    return lua_error(state);
+  }
+
+  sendUniform(state, shader, info);
+
+  return 0;
+}
+
+// Handles are indices into the sorted uniform list, starting at 1.
+// Sending through a handle skips the name lookup.
+static int l_graphics_Shader_getUniformHandle(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isShader);
+  l_graphics_Shader* shader = l_graphics_toShader(state, 1);
+  finishShader(state, shader);
+
+  char const* name = l_tools_toStringOrError(state, 2);
+
+  graphics_ShaderUniformInfo *info = graphics_Shader_getUniform(&shader->shader, name);
+  if(!info) {
+    lua_pushnil(state);
+    return 1;
+  }
+
+  lua_pushinteger(state, info - shader->shader.uniforms + 1);
+  return 1;
+}
+
+static int l_graphics_Shader_sendHandle(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isShader);
+  l_graphics_Shader* shader = l_graphics_toShader(state, 1);
+  finishShader(state, shader);
+
+  int handle = l_tools_toNumberOrError(state, 2);
+  if(handle < 1 || handle > shader->shader.uniformCount) {
+    lua_pushstring(state, "invalid uniform handle");
+    return lua_error(state);
+  }
+
+  sendUniform(state, shader, shader->shader.uniforms + handle - 1);
 
   return 0;
 }
@@ -312,11 +445,12 @@ static const l_tools_Enum l_graphics_ShaderUniformType[] = {
 
 static int l_graphics_Shader_getExternVariable(lua_State* state) {
   l_assertType(state, 1, l_graphics_isShader); 
-  l_graphics_Shader const* shader = l_graphics_toShader(state, 1);
+  l_graphics_Shader * shader = l_graphics_toShader(state, 1);
+  finishShader(state, shader);
 
   char const* name = l_tools_toStringOrError(state, 2);
 
-  graphics_ShaderUniformInfo const* info = graphics_Shader_getUniform(&shader->shader, name);
+  graphics_ShaderUniformInfo *info = graphics_Shader_getUniform(&shader->shader, name);
 
   if(!info) {
     goto errout;
@@ -367,25 +501,41 @@ static void pushShaderInfoLog(lua_State *state, graphics_Shader const* shader) {
 
 static int l_graphics_Shader_getWarnings(lua_State *state) {
   l_assertType(state, 1, l_graphics_isShader); 
-  l_graphics_Shader const* shader = l_graphics_toShader(state, 1);
+  l_graphics_Shader * shader = l_graphics_toShader(state, 1);
 
+  // Failed shaders report their errors here instead of raising them
+  graphics_Shader_finish(&shader->shader);
   pushShaderInfoLog(state, &shader->shader);
 
   return 1;
 }
 
 
+static int l_graphics_Shader_isReady(lua_State *state) {
+  l_assertType(state, 1, l_graphics_isShader);
+  l_graphics_Shader const* shader = l_graphics_toShader(state, 1);
+
+  lua_pushboolean(state, graphics_Shader_isReady(&shader->shader));
+
+  return 1;
+}
+
+
 static luaL_Reg const shaderMetatableFuncs[] = {
   {"__gc",              l_graphics_gcShader},
   {"send",              l_graphics_Shader_send},
+  {"getUniformHandle",  l_graphics_Shader_getUniformHandle},
+  {"sendHandle",        l_graphics_Shader_sendHandle},
   {"getExternVariable", l_graphics_Shader_getExternVariable},
   {"getWarnings",       l_graphics_Shader_getWarnings},
+  {"isReady",           l_graphics_Shader_isReady},
   {NULL, NULL}
 };
 
 
 static luaL_Reg const shaderFreeFuncs[] = {
   {"newShader", l_graphics_newShader},
+  {"compileShaders", l_graphics_compileShaders},
   {"setShader", l_graphics_setShader},
   {"getShader", l_graphics_getShader},
   {NULL, NULL}
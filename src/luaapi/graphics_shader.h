@@ -14,6 +14,8 @@
 typedef struct {
   graphics_Shader shader;
   int *referencedTextures;
+  // Set once the shader was built successfully and referencedTextures exists
+  bool finished;
 } l_graphics_Shader;
 
 //int l_graphics_newShader(lua_State* state);
@@ -67,7 +67,7 @@ static int l_graphics_window_getMode(lua_State* state) {
   lua_settable(state, 3);
 
   lua_pushstring(state, "srgb");
-  lua_pushboolean(state, false);
+  lua_pushboolean(state, graphics_isGammaCorrect());
   lua_settable(state, 3);
   
   lua_pushstring(state, "refreshrate");
@@ -7,13 +7,33 @@
     under the terms of the MIT license. See LICENSE.md for details.
 */
 
+#include <limits.h>
 #include <lauxlib.h>
 #include "image.h"
 #include "tools.h"
 #include "../image/imagedata.h"
 
+
+const l_tools_Enum l_image_CompressedFormat[] = {
+  {"DXT1", image_CompressedFormat_DXT1},
+  {"DXT3", image_CompressedFormat_DXT3},
+  {"DXT5", image_CompressedFormat_DXT5},
+  {"ETC1", image_CompressedFormat_ETC1},
+  {"ETC2rgb", image_CompressedFormat_ETC2RGB},
+  {"ETC2rgba", image_CompressedFormat_ETC2RGBA},
+  {"ASTC4x4", image_CompressedFormat_ASTC4x4},
+  {"ASTC5x5", image_CompressedFormat_ASTC5x5},
+  {"ASTC6x6", image_CompressedFormat_ASTC6x6},
+  {"ASTC8x8", image_CompressedFormat_ASTC8x8},
+  {"ASTC10x10", image_CompressedFormat_ASTC10x10},
+  {"ASTC12x12", image_CompressedFormat_ASTC12x12},
+  {NULL, 0}
+};
+
 static struct {
   int imageDataMT;
+  int imageDataLoadMT;
+  int compressedDataMT;
 } moduleData;
 
 
@@ -21,7 +41,8 @@ int l_image_newImageData(lua_State* state) {
   image_ImageData* imageData = (image_ImageData*)lua_newuserdata(state, sizeof(image_ImageData));
   int s1type = lua_type(state, 1);
   if(s1type == LUA_TSTRING) {
-    if(!image_ImageData_new_with_filename(imageData, lua_tostring(state, 1))) {
+    bool premultiply = l_tools_optBooleanField(state, 2, "premultiply", false);
+    if(!image_ImageData_new_with_filename(imageData, lua_tostring(state, 1), premultiply)) {
       lua_pushstring(state, "Could not load image file ");
       lua_pushstring(state, lua_tostring(state, 1));
       lua_pushstring(state, ": ");
@@ -30,7 +51,24 @@ int l_image_newImageData(lua_State* state) {
       return lua_error(state);
     }
   } else if(s1type == LUA_TNUMBER && lua_type(state, 2) == LUA_TNUMBER) {
-    image_ImageData_new_with_size(imageData, lua_tointeger(state, 1), lua_tointeger(state, 2));
+    lua_Integer w = lua_tointeger(state, 1);
+    lua_Integer h = lua_tointeger(state, 2);
+    if(w <= 0 || h <= 0 || w > INT_MAX / 4 / h) {
+      lua_pushstring(state, "invalid imagedata size");
+      return lua_error(state);
+    }
+    int width = w;
+    int height = h;
+    size_t size = 0;
+    char const* bytes = lua_tolstring(state, 3, &size);
+    if(bytes && size != (size_t)width * height * 4) {
+      lua_pushstring(state, "string must hold width * height RGBA pixels");
+      return lua_error(state);
+    }
+    image_ImageData_new_with_size(imageData, width, height);
+    if(bytes) {
+      memcpy(imageData->surface, bytes, size);
+    }
   } else {
     lua_pushstring(state, "need filename or size for imagedata");
     return lua_error(state);
@@ -43,6 +81,66 @@ int l_image_newImageData(lua_State* state) {
 }
 
 
+int l_image_newCompressedData(lua_State* state) {
+  char const* filename = l_tools_toStringOrError(state, 1);
+  image_CompressedImageData* data = (image_CompressedImageData*)lua_newuserdata(state, sizeof(image_CompressedImageData));
+  if(!image_CompressedImageData_new_with_filename(data, filename)) {
+    lua_pushstring(state, "Could not load compressed image file ");
+    lua_pushstring(state, filename);
+    lua_pushstring(state, ": ");
+    lua_pushstring(state, image_compressedLastError());
+    lua_concat(state, 4);
+    return lua_error(state);
+  }
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.compressedDataMT);
+  lua_setmetatable(state, -2);
+
+  return 1;
+}
+
+
+static int l_image_isCompressed(lua_State* state) {
+  char const* filename = l_tools_toStringOrError(state, 1);
+  lua_pushboolean(state, image_isCompressed(filename));
+  return 1;
+}
+
+
+// Takes over the pixels in data
+void l_image_pushImageData(lua_State* state, image_ImageData const* data) {
+  image_ImageData* imageData = (image_ImageData*)lua_newuserdata(state, sizeof(image_ImageData));
+  *imageData = *data;
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.imageDataMT);
+  lua_setmetatable(state, -2);
+}
+
+
+// Decodes the file on a worker thread. The returned object tells when the
+// ImageData is available.
+static int l_image_newImageDataAsync(lua_State* state) {
+  char const* filename = l_tools_toStringOrError(state, 1);
+  bool premultiply = l_tools_optBooleanField(state, 2, "premultiply", false);
+  image_ImageDataLoad *load = image_ImageDataLoad_new(filename, premultiply);
+  if(!load) {
+    lua_pushstring(state, "Could not open image file ");
+    lua_pushstring(state, filename);
+    lua_concat(state, 2);
+    return lua_error(state);
+  }
+
+  l_image_ImageDataLoad *obj = (l_image_ImageDataLoad*)lua_newuserdata(state, sizeof(l_image_ImageDataLoad));
+  obj->load = load;
+  obj->imageDataRef = LUA_NOREF;
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, moduleData.imageDataLoadMT);
+  lua_setmetatable(state, -2);
+
+  return 1;
+}
+
+
 static int l_image_gcImageData(lua_State* state) {
   image_ImageData* imagedata = (image_ImageData*)lua_touserdata(state, 1);
   image_ImageData_free(imagedata);
@@ -70,6 +168,12 @@ static int l_graphics_Image_mapPixel(lua_State* state) {
   int width  = luaL_optinteger(state, 5, data->w - x);
   int height = luaL_optinteger(state, 6, data->h - y);
 
+  if(x < 0 || y < 0 || width < 0 || height < 0 || x + width > data->w || y + height > data->h) {
+    lua_pushstring(state, "region is outside of the ImageData");
+    return lua_error(state);
+  }
+  image_ImageData_markDirty(data, x, y, width, height);
+
   for(int r = y; r < y + height; ++r) {
     for(int c = x; c < x + width; ++c) {
       uint8_t *pixel = data->surface + (r * data->w + c) * 4;
@@ -83,8 +187,8 @@ static int l_graphics_Image_mapPixel(lua_State* state) {
       lua_call(state, 6, 4);
       pixel[0] = lua_tonumber(state, -4);
       pixel[1] = lua_tonumber(state, -3);
-      pixel[3] = lua_tonumber(state, -2);
-      pixel[4] = lua_tonumber(state, -1);
+      pixel[2] = lua_tonumber(state, -2);
+      pixel[3] = lua_tonumber(state, -1);
       lua_pop(state, 4);
     }
   }
@@ -93,6 +197,138 @@ static int l_graphics_Image_mapPixel(lua_State* state) {
 }
 
 
+static void checkPixelPosition(lua_State* state, image_ImageData const* data, int x, int y) {
+  if(x < 0 || y < 0 || x >= data->w || y >= data->h) {
+    lua_pushstring(state, "pixel position is outside of the ImageData");
+    lua_error(state);
+  }
+}
+
+
+static int l_image_ImageData_getPixel(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  image_ImageData *data = l_image_toImageData(state, 1);
+  int x = l_tools_toNumberOrError(state, 2);
+  int y = l_tools_toNumberOrError(state, 3);
+  checkPixelPosition(state, data, x, y);
+
+  uint8_t const* pixel = data->surface + (y * data->w + x) * 4;
+  lua_pushnumber(state, pixel[0]);
+  lua_pushnumber(state, pixel[1]);
+  lua_pushnumber(state, pixel[2]);
+  lua_pushnumber(state, pixel[3]);
+  return 4;
+}
+
+
+static int l_image_ImageData_setPixel(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  image_ImageData *data = l_image_toImageData(state, 1);
+  int x = l_tools_toNumberOrError(state, 2);
+  int y = l_tools_toNumberOrError(state, 3);
+  checkPixelPosition(state, data, x, y);
+
+  uint8_t pixel[4] = {
+    l_tools_toNumberOrError(state, 4),
+    l_tools_toNumberOrError(state, 5),
+    l_tools_toNumberOrError(state, 6),
+    luaL_optnumber(state, 7, 255)
+  };
+  image_ImageData_setPixel(data, x, y, pixel);
+  return 0;
+}
+
+
+// paste(source, dx, dy, sx, sy, sw, sh), clipped to both images
+static int l_image_ImageData_paste(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  l_assertType(state, 2, l_image_isImageData);
+  image_ImageData *dst = l_image_toImageData(state, 1);
+  image_ImageData const* src = l_image_toImageData(state, 2);
+  int dx = l_tools_toNumberOrError(state, 3);
+  int dy = l_tools_toNumberOrError(state, 4);
+  int sx = luaL_optinteger(state, 5, 0);
+  int sy = luaL_optinteger(state, 6, 0);
+  int sw = luaL_optinteger(state, 7, src->w);
+  int sh = luaL_optinteger(state, 8, src->h);
+
+  image_ImageData_paste(dst, src, dx, dy, sx, sy, sw, sh);
+  return 0;
+}
+
+
+// Same arguments as paste, blends with the "alpha" blend mode
+static int l_image_ImageData_blit(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  l_assertType(state, 2, l_image_isImageData);
+  image_ImageData *dst = l_image_toImageData(state, 1);
+  image_ImageData const* src = l_image_toImageData(state, 2);
+  int dx = l_tools_toNumberOrError(state, 3);
+  int dy = l_tools_toNumberOrError(state, 4);
+  int sx = luaL_optinteger(state, 5, 0);
+  int sy = luaL_optinteger(state, 6, 0);
+  int sw = luaL_optinteger(state, 7, src->w);
+  int sh = luaL_optinteger(state, 8, src->h);
+
+  image_ImageData_blit(dst, src, dx, dy, sx, sy, sw, sh);
+  return 0;
+}
+
+
+// fill(r, g, b, a, x, y, w, h), the whole image without a region
+static int l_image_ImageData_fill(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  image_ImageData *data = l_image_toImageData(state, 1);
+
+  uint8_t pixel[4] = {
+    l_tools_toNumberOrError(state, 2),
+    l_tools_toNumberOrError(state, 3),
+    l_tools_toNumberOrError(state, 4),
+    luaL_optnumber(state, 5, 255)
+  };
+  int x = luaL_optinteger(state, 6, 0);
+  int y = luaL_optinteger(state, 7, 0);
+  int w = luaL_optinteger(state, 8, data->w);
+  int h = luaL_optinteger(state, 9, data->h);
+
+  image_ImageData_fill(data, x, y, w, h, pixel);
+  return 0;
+}
+
+
+static int l_image_ImageData_premultiply(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  image_ImageData_premultiply(l_image_toImageData(state, 1));
+  return 0;
+}
+
+
+static l_tools_Enum const flipDirection[] = {
+  {"horizontal", 1},
+  {"vertical", 0},
+  {NULL, 0}
+};
+
+
+static int l_image_ImageData_flip(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  image_ImageData *data = l_image_toImageData(state, 1);
+  bool horizontal = l_tools_toEnumOrError(state, 2, flipDirection);
+
+  image_ImageData_flip(data, horizontal);
+  return 0;
+}
+
+
+// Raw RGBA bytes, row by row from the top
+static int l_image_ImageData_getString(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageData);
+  image_ImageData *data = l_image_toImageData(state, 1);
+  lua_pushlstring(state, (char const*)data->surface, data->w * data->h * 4);
+  return 1;
+}
+
+
 static int l_graphics_Image_getWidth(lua_State *state) {
   image_ImageData *data = l_image_toImageData(state, 1);
   lua_pushnumber(state, data->w);
@@ -117,16 +353,162 @@ static int l_graphics_Image_getDimensions(lua_State *state) {
 
 static luaL_Reg const regFuncs[] = {
   {"newImageData", l_image_newImageData},
+  {"newImageDataAsync", l_image_newImageDataAsync},
+  {"newCompressedData", l_image_newCompressedData},
+  {"isCompressed", l_image_isCompressed},
   {NULL, NULL}
 };
 
 
 l_checkTypeFn(l_image_isImageData, moduleData.imageDataMT)
 l_toTypeFn(l_image_toImageData, image_ImageData)
+l_checkTypeFn(l_image_isImageDataLoad, moduleData.imageDataLoadMT)
+l_toTypeFn(l_image_toImageDataLoad, l_image_ImageDataLoad)
+l_checkTypeFn(l_image_isCompressedData, moduleData.compressedDataMT)
+l_toTypeFn(l_image_toCompressedData, image_CompressedImageData)
+
+
+static int l_image_gcImageDataLoad(lua_State* state) {
+  l_image_ImageDataLoad *obj = l_image_toImageDataLoad(state, 1);
+  image_ImageDataLoad_free(obj->load);
+  luaL_unref(state, LUA_REGISTRYINDEX, obj->imageDataRef);
+  return 0;
+}
+
+
+static int l_image_ImageDataLoad_isReady(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageDataLoad);
+  l_image_ImageDataLoad *obj = l_image_toImageDataLoad(state, 1);
+  lua_pushboolean(state, image_ImageDataLoad_isDone(obj->load));
+  return 1;
+}
+
+
+// Returns the same ImageData every time once decoding has finished
+static int l_image_ImageDataLoad_getImageData(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageDataLoad);
+  l_image_ImageDataLoad *obj = l_image_toImageDataLoad(state, 1);
+
+  if(obj->imageDataRef == LUA_NOREF) {
+    if(!image_ImageDataLoad_isDone(obj->load)) {
+      lua_pushstring(state, "image is not decoded yet");
+      return lua_error(state);
+    }
+
+    image_ImageData data;
+    if(!image_ImageDataLoad_take(obj->load, &data)) {
+      lua_pushstring(state, "Could not decode image: ");
+      lua_pushstring(state, image_ImageDataLoad_getError(obj->load));
+      lua_concat(state, 2);
+      return lua_error(state);
+    }
+
+    l_image_pushImageData(state, &data);
+    obj->imageDataRef = luaL_ref(state, LUA_REGISTRYINDEX);
+  }
+
+  lua_rawgeti(state, LUA_REGISTRYINDEX, obj->imageDataRef);
+  return 1;
+}
+
+
+static int l_image_ImageDataLoad_getError(lua_State* state) {
+  l_assertType(state, 1, l_image_isImageDataLoad);
+  l_image_ImageDataLoad *obj = l_image_toImageDataLoad(state, 1);
+
+  if(image_ImageDataLoad_isDone(obj->load) && image_ImageDataLoad_getError(obj->load)) {
+    lua_pushstring(state, image_ImageDataLoad_getError(obj->load));
+  } else {
+    lua_pushnil(state);
+  }
+  return 1;
+}
+
+
+static int l_image_gcCompressedData(lua_State* state) {
+  image_CompressedImageData* data = l_image_toCompressedData(state, 1);
+  image_CompressedImageData_free(data);
+  return 0;
+}
+
+
+static int l_image_CompressedData_getWidth(lua_State* state) {
+  l_assertType(state, 1, l_image_isCompressedData);
+  image_CompressedImageData* data = l_image_toCompressedData(state, 1);
+  int level = luaL_optinteger(state, 2, 1);
+  if(level < 1 || level > data->mipmapCount) {
+    lua_pushstring(state, "invalid mipmap level");
+    return lua_error(state);
+  }
+  lua_pushinteger(state, data->mipmaps[level - 1].width);
+  return 1;
+}
+
+
+static int l_image_CompressedData_getHeight(lua_State* state) {
+  l_assertType(state, 1, l_image_isCompressedData);
+  image_CompressedImageData* data = l_image_toCompressedData(state, 1);
+  int level = luaL_optinteger(state, 2, 1);
+  if(level < 1 || level > data->mipmapCount) {
+    lua_pushstring(state, "invalid mipmap level");
+    return lua_error(state);
+  }
+  lua_pushinteger(state, data->mipmaps[level - 1].height);
+  return 1;
+}
+
+
+static int l_image_CompressedData_getDimensions(lua_State* state) {
+  l_assertType(state, 1, l_image_isCompressedData);
+  image_CompressedImageData* data = l_image_toCompressedData(state, 1);
+  int level = luaL_optinteger(state, 2, 1);
+  if(level < 1 || level > data->mipmapCount) {
+    lua_pushstring(state, "invalid mipmap level");
+    return lua_error(state);
+  }
+  lua_pushinteger(state, data->mipmaps[level - 1].width);
+  lua_pushinteger(state, data->mipmaps[level - 1].height);
+  return 2;
+}
+
+
+static int l_image_CompressedData_getMipmapCount(lua_State* state) {
+  l_assertType(state, 1, l_image_isCompressedData);
+  image_CompressedImageData* data = l_image_toCompressedData(state, 1);
+  lua_pushinteger(state, data->mipmapCount);
+  return 1;
+}
+
+
+static int l_image_CompressedData_getFormat(lua_State* state) {
+  l_assertType(state, 1, l_image_isCompressedData);
+  image_CompressedImageData* data = l_image_toCompressedData(state, 1);
+  l_tools_pushEnum(state, data->format, l_image_CompressedFormat);
+  return 1;
+}
+
+
+static luaL_Reg const compressedDataMetatableFuncs[] = {
+  {"getWidth", l_image_CompressedData_getWidth},
+  {"getHeight", l_image_CompressedData_getHeight},
+  {"getDimensions", l_image_CompressedData_getDimensions},
+  {"getMipmapCount", l_image_CompressedData_getMipmapCount},
+  {"getFormat", l_image_CompressedData_getFormat},
+  {"__gc", l_image_gcCompressedData},
+  {NULL, NULL}
+};
 
 
 static luaL_Reg const imageDataMetatableFuncs[] = {
   {"mapPixel", l_graphics_Image_mapPixel},
+  {"getPixel", l_image_ImageData_getPixel},
+  {"setPixel", l_image_ImageData_setPixel},
+  {"paste", l_image_ImageData_paste},
+  {"blit", l_image_ImageData_blit},
+  {"fill", l_image_ImageData_fill},
+  {"premultiply", l_image_ImageData_premultiply},
+  {"flip", l_image_ImageData_flip},
+  {"getString", l_image_ImageData_getString},
   {"getWidth", l_graphics_Image_getWidth},
   {"getHeight", l_graphics_Image_getHeight},
   {"getDimensions", l_graphics_Image_getDimensions},
@@ -135,10 +517,21 @@ static luaL_Reg const imageDataMetatableFuncs[] = {
 };
 
 
+static luaL_Reg const imageDataLoadMetatableFuncs[] = {
+  {"isReady", l_image_ImageDataLoad_isReady},
+  {"getImageData", l_image_ImageDataLoad_getImageData},
+  {"getError", l_image_ImageDataLoad_getError},
+  {"__gc", l_image_gcImageDataLoad},
+  {NULL, NULL}
+};
+
+
 int l_image_register(lua_State* state) {
   l_tools_registerModule(state, "image", regFuncs);
 
   moduleData.imageDataMT = l_tools_makeTypeMetatable(state, imageDataMetatableFuncs);
+  moduleData.imageDataLoadMT = l_tools_makeTypeMetatable(state, imageDataLoadMetatableFuncs);
+  moduleData.compressedDataMT = l_tools_makeTypeMetatable(state, compressedDataMetatableFuncs);
   
   return 0;
 }
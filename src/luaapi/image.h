@@ -11,9 +11,24 @@
 
 #include <lua.h>
 #include <stdbool.h>
+#include "tools.h"
 #include "../image/imagedata.h"
+#include "../image/compressedimagedata.h"
+
+extern const l_tools_Enum l_image_CompressedFormat[];
+
+typedef struct {
+  image_ImageDataLoad *load;
+  int imageDataRef;
+} l_image_ImageDataLoad;
 
 bool l_image_isImageData(lua_State* state, int index);
 image_ImageData* l_image_toImageData(lua_State* state, int index);
 int l_image_register(lua_State* state);
 int l_image_newImageData(lua_State* state);
+void l_image_pushImageData(lua_State* state, image_ImageData const* data);
+bool l_image_isImageDataLoad(lua_State* state, int index);
+l_image_ImageDataLoad* l_image_toImageDataLoad(lua_State* state, int index);
+int l_image_newCompressedData(lua_State* state);
+bool l_image_isCompressedData(lua_State* state, int index);
+image_CompressedImageData* l_image_toCompressedData(lua_State* state, int index);
@@ -18,12 +18,15 @@
 #include "../3rdparty/noise1234/simplexnoise1234.h"
 #include <math.h>
 #include <inttypes.h>
+#include <stdlib.h>
 
 static struct {
   math_RandomGenerator defaultRandomGenerator;
   int randomGeneratorMT;
   int polygonDatSize;
   float *polygonData;
+  int holeStartSize;
+  int *holeStarts;
 
 } moduleData;
 
@@ -188,11 +191,64 @@ static int l_math_RandomGenerator_setState(lua_State* state) {
 }
 
 
+// Reads triangulate(outer, hole1, hole2, ...) where every argument is a
+// flat table of coordinates. Returns the number of vertices.
+static int readPolygonWithHoles(lua_State* state, int *holeCount) {
+  int args = lua_gettop(state);
+  int values = 0;
+  for(int i = 1; i <= args; ++i) {
+    if(!lua_istable(state, i)) {
+      lua_pushstring(state, "Expected table");
+      return lua_error(state);
+    }
+    int len = lua_objlen(state, i);
+    if(len % 2 || len < 6) {
+      lua_pushstring(state, "Polygons and holes need at least 3 vertices");
+      return lua_error(state);
+    }
+    values += len;
+  }
+
+  if(values > moduleData.polygonDatSize) {
+    moduleData.polygonData = realloc(moduleData.polygonData, values * sizeof(float));
+    moduleData.polygonDatSize = values;
+  }
+  if(args - 1 > moduleData.holeStartSize) {
+    moduleData.holeStarts = realloc(moduleData.holeStarts, (args - 1) * sizeof(int));
+    moduleData.holeStartSize = args - 1;
+  }
+
+  int pos = 0;
+  for(int i = 1; i <= args; ++i) {
+    if(i > 1) {
+      moduleData.holeStarts[i-2] = pos / 2;
+    }
+    int len = lua_objlen(state, i);
+    for(int j = 1; j <= len; ++j) {
+      lua_rawgeti(state, i, j);
+      moduleData.polygonData[pos++] = l_tools_toNumberOrError(state, -1);
+      lua_pop(state, 1);
+    }
+  }
+
+  *holeCount = args - 1;
+  return values / 2;
+}
+
+
 static int l_math_triangulate(lua_State* state) {
   float *vertices;
-  int count = l_geometry_read_vertices(state, 0, &vertices, 6);
   int *indices;
-  int triangles = math_triangulation_triangulate(vertices, count, &indices);
+  int triangles;
+  if(lua_istable(state, 1) && lua_istable(state, 2)) {
+    int holeCount;
+    int count = readPolygonWithHoles(state, &holeCount);
+    vertices = moduleData.polygonData;
+    triangles = math_triangulation_triangulateWithHoles(vertices, count, moduleData.holeStarts, holeCount, &indices);
+  } else {
+    int count = l_geometry_read_vertices(state, 0, &vertices, 6);
+    triangles = math_triangulation_triangulate(vertices, count, &indices);
+  }
 
   lua_createtable(state, triangles, 0);
   for(int i = 0; i < triangles; ++i) {
@@ -26,7 +26,7 @@ static int l_mouse_newCursor(lua_State *state) {
   if(lua_isstring(state, 1)) {
     char const* filename = lua_tostring(state, 1);
     image_ImageData data;
-    image_ImageData_new_with_filename(&data, filename);
+    image_ImageData_new_with_filename(&data, filename, false);
 
     mouse_Cursor_new(cursor, &data, hotx, hoty);
     image_ImageData_free(&data);
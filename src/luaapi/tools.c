@@ -73,6 +73,20 @@ void l_tools_pushEnum(lua_State* state, int value, l_tools_Enum const* values) {
 }
 
 
+// Reads a field of an optional settings table, def if the table or the
+// field are missing
+bool l_tools_optBooleanField(lua_State* state, int index, char const* name, bool def) {
+  if(!lua_istable(state, index)) {
+    return def;
+  }
+
+  lua_getfield(state, index, name);
+  bool value = lua_isnil(state, -1) ? def : lua_toboolean(state, -1);
+  lua_pop(state, 1);
+  return value;
+}
+
+
 int l_tools_readNumbers(lua_State* state, int offset, float **numbers, int minNums, int components) {
   bool table = lua_istable(state, 1 + offset);
 
@@ -123,6 +123,7 @@ void l_tools_pushEnum(lua_State* state, int value, l_tools_Enum const* values);
 #endif
 
 int l_tools_readNumbers(lua_State* state, int offset, float **numbers, int minNums, int components);
+bool l_tools_optBooleanField(lua_State* state, int index, char const* name, bool def);
 
 #define l_tools_stub(name, fname)               \
   int fname(lua_State* state) {                 \
@@ -33,6 +33,7 @@
 
 #include "graphics/graphics.h"
 #include "graphics/matrixstack.h"
+#include "graphics/image.h"
 
 #include "audio/audio.h"
 
@@ -44,6 +45,7 @@
 #include "math/math.h"
 #include "errorhandler.h"
 #include "filesystem/filesystem.h"
+#include "tools/threadpool.h"
 
 
 typedef struct {
@@ -60,6 +62,7 @@ void main_loop(void *data) {
   chdir("love");
 
   timer_step();
+  graphics_image_uploadPending();
   graphics_clear();
   matrixstack_origin();
   lua_rawgeti(loopData->luaState, LUA_REGISTRYINDEX, loopData->errhand);
@@ -172,10 +175,11 @@ int main() {
     filesystem_setIdentity(config.identity, false);
   }
 
+  threadpool_init();
   image_init();
   joystick_init();
   keyboard_init();
-  graphics_init(config.window.width, config.window.height);
+  graphics_init(config.window.width, config.window.height, config.window.srgb);
   audio_init();
   math_init();
 
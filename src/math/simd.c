@@ -0,0 +1,26 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include "simd.h"
+
+extern inline math_float4 math_float4_load(float const* p);
+extern inline void math_float4_store(float *p, math_float4 a);
+extern inline math_float4 math_float4_set(float x, float y, float z, float w);
+extern inline math_float4 math_float4_set1(float f);
+extern inline math_float4 math_float4_add(math_float4 a, math_float4 b);
+extern inline math_float4 math_float4_sub(math_float4 a, math_float4 b);
+extern inline math_float4 math_float4_mul(math_float4 a, math_float4 b);
+extern inline math_float4 math_float4_div(math_float4 a, math_float4 b);
+extern inline math_float4 math_float4_min(math_float4 a, math_float4 b);
+extern inline math_float4 math_float4_max(math_float4 a, math_float4 b);
+extern inline math_float4 math_float4_sqrt(math_float4 a);
+extern inline math_float4 math_float4_madd(math_float4 a, math_float4 b, math_float4 c);
+extern inline math_float4 math_float4_splatW(math_float4 a);
+extern inline math_float4 math_float4_loadBytes(uint8_t const* p);
+extern inline void math_float4_storeBytes(uint8_t *p, math_float4 a);
@@ -0,0 +1,183 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <tgmath.h>
+
+// Minimal 4-wide float vector. Maps to SSE on native x86 builds, to WASM SIMD
+// when the web build is compiled with -msimd128, and to plain scalar code
+// everywhere else. Loads and stores are unaligned.
+
+#if defined(__SSE__)
+# include <xmmintrin.h>
+# if defined(__SSE2__)
+#  include <emmintrin.h>
+# endif
+typedef __m128 math_float4;
+#elif defined(__wasm_simd128__)
+# include <wasm_simd128.h>
+typedef v128_t math_float4;
+#else
+typedef struct {
+  float v[4];
+} math_float4;
+#endif
+
+inline math_float4 math_float4_load(float const* p) {
+#if defined(__SSE__)
+  return _mm_loadu_ps(p);
+#elif defined(__wasm_simd128__)
+  return wasm_v128_load(p);
+#else
+  math_float4 r = {{p[0], p[1], p[2], p[3]}};
+  return r;
+#endif
+}
+
+inline void math_float4_store(float *p, math_float4 a) {
+#if defined(__SSE__)
+  _mm_storeu_ps(p, a);
+#elif defined(__wasm_simd128__)
+  wasm_v128_store(p, a);
+#else
+  p[0] = a.v[0];
+  p[1] = a.v[1];
+  p[2] = a.v[2];
+  p[3] = a.v[3];
+#endif
+}
+
+inline math_float4 math_float4_set(float x, float y, float z, float w) {
+#if defined(__SSE__)
+  return _mm_setr_ps(x, y, z, w);
+#elif defined(__wasm_simd128__)
+  return wasm_f32x4_make(x, y, z, w);
+#else
+  math_float4 r = {{x, y, z, w}};
+  return r;
+#endif
+}
+
+inline math_float4 math_float4_set1(float f) {
+#if defined(__SSE__)
+  return _mm_set1_ps(f);
+#elif defined(__wasm_simd128__)
+  return wasm_f32x4_splat(f);
+#else
+  math_float4 r = {{f, f, f, f}};
+  return r;
+#endif
+}
+
+#if defined(__SSE__)
+# define math_float4_binop(name, sse, wasm, op)                           \
+  inline math_float4 math_float4_ ## name(math_float4 a, math_float4 b) { \
+    return sse(a, b);                                                     \
+  }
+#elif defined(__wasm_simd128__)
+# define math_float4_binop(name, sse, wasm, op)                           \
+  inline math_float4 math_float4_ ## name(math_float4 a, math_float4 b) { \
+    return wasm(a, b);                                                    \
+  }
+#else
+# define math_float4_binop(name, sse, wasm, op)                           \
+  inline math_float4 math_float4_ ## name(math_float4 a, math_float4 b) { \
+    for(int i = 0; i < 4; ++i) {                                          \
+      a.v[i] = op(a.v[i], b.v[i]);                                        \
+    }                                                                     \
+    return a;                                                             \
+  }
+#endif
+
+#define math_float4_opAdd(a, b) ((a) + (b))
+#define math_float4_opSub(a, b) ((a) - (b))
+#define math_float4_opMul(a, b) ((a) * (b))
+#define math_float4_opDiv(a, b) ((a) / (b))
+#define math_float4_opMin(a, b) ((a) < (b) ? (a) : (b))
+#define math_float4_opMax(a, b) ((a) > (b) ? (a) : (b))
+
+math_float4_binop(add, _mm_add_ps, wasm_f32x4_add, math_float4_opAdd)
+math_float4_binop(sub, _mm_sub_ps, wasm_f32x4_sub, math_float4_opSub)
+math_float4_binop(mul, _mm_mul_ps, wasm_f32x4_mul, math_float4_opMul)
+math_float4_binop(div, _mm_div_ps, wasm_f32x4_div, math_float4_opDiv)
+math_float4_binop(min, _mm_min_ps, wasm_f32x4_min, math_float4_opMin)
+math_float4_binop(max, _mm_max_ps, wasm_f32x4_max, math_float4_opMax)
+
+inline math_float4 math_float4_sqrt(math_float4 a) {
+#if defined(__SSE__)
+  return _mm_sqrt_ps(a);
+#elif defined(__wasm_simd128__)
+  return wasm_f32x4_sqrt(a);
+#else
+  for(int i = 0; i < 4; ++i) {
+    a.v[i] = sqrt(a.v[i]);
+  }
+  return a;
+#endif
+}
+
+// a + b * c
+inline math_float4 math_float4_madd(math_float4 a, math_float4 b, math_float4 c) {
+  return math_float4_add(a, math_float4_mul(b, c));
+}
+
+// All lanes set to the last lane of a
+inline math_float4 math_float4_splatW(math_float4 a) {
+#if defined(__SSE__)
+  return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3));
+#elif defined(__wasm_simd128__)
+  return wasm_i32x4_shuffle(a, a, 3, 3, 3, 3);
+#else
+  math_float4 r = {{a.v[3], a.v[3], a.v[3], a.v[3]}};
+  return r;
+#endif
+}
+
+// Four bytes, typically an RGBA pixel, widened to floats in 0..255
+inline math_float4 math_float4_loadBytes(uint8_t const* p) {
+#if defined(__SSE2__)
+  int32_t packed;
+  memcpy(&packed, p, 4);
+  __m128i zero = _mm_setzero_si128();
+  __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+  return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+#elif defined(__wasm_simd128__)
+  v128_t v = wasm_u16x8_extend_low_u8x16(wasm_v128_load32_zero(p));
+  return wasm_f32x4_convert_u32x4(wasm_u32x4_extend_low_u16x8(v));
+#else
+  float f[4] = {p[0], p[1], p[2], p[3]};
+  return math_float4_load(f);
+#endif
+}
+
+// Rounds to the nearest integer and saturates to 0..255
+inline void math_float4_storeBytes(uint8_t *p, math_float4 a) {
+#if defined(__SSE2__)
+  __m128i v = _mm_cvtps_epi32(a);
+  v = _mm_packs_epi32(v, v);
+  v = _mm_packus_epi16(v, v);
+  int32_t packed = _mm_cvtsi128_si32(v);
+  memcpy(p, &packed, 4);
+#elif defined(__wasm_simd128__)
+  v128_t v = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(a));
+  v = wasm_u16x8_narrow_i32x4(v, v);
+  v = wasm_u8x16_narrow_i16x8(v, v);
+  wasm_v128_store32_lane(p, v, 0);
+#else
+  float f[4];
+  math_float4_store(f, a);
+  for(int i = 0; i < 4; ++i) {
+    float c = f[i] < 0.0f ? 0.0f : (f[i] > 255.0f ? 255.0f : f[i]);
+    p[i] = (uint8_t)(c + 0.5f);
+  }
+#endif
+}
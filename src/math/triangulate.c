@@ -9,6 +9,9 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <tgmath.h>
+#include "triangulate.h"
 
 
 typedef struct IntList {
@@ -16,12 +19,33 @@ typedef struct IntList {
   struct IntList* next;
 } IntList;
 
+// Node of the earcut vertex rings. Every ring is a circular list through
+// prev/next, the z-order index is a second, sorted list through prevZ/nextZ.
+typedef struct Node {
+  int i;
+  double x;
+  double y;
+  struct Node *prev;
+  struct Node *next;
+  int32_t z;
+  struct Node *prevZ;
+  struct Node *nextZ;
+  bool steiner;
+} Node;
+
 static struct {
   int vertexCount;
   int *next;
   int *prev;
   int *triangles;
   IntList *concavePool;
+
+  Node *nodes;
+  int nodeCount;
+  int nodeCapacity;
+  int *earcutTriangles;
+  int earcutTriangleCapacity;
+  int triangleCount;
 } moduleData;
 
 typedef struct {
@@ -47,6 +71,7 @@ static void resizeBuffers(int count) {
     moduleData.prev        = malloc(sizeof(int) * count);
     moduleData.triangles   = malloc(sizeof(int) * (count - 2) * 3);
     moduleData.concavePool = malloc(sizeof(IntList) * count);
+    moduleData.vertexCount = count;
   }
 }
 
@@ -100,7 +125,7 @@ static void removeFromList(IntList **list, int value) {
 }
 
 
-int math_triangulation_triangulate(float const* verts, int count, int **indices) {
+int math_triangulation_triangulateEarClipping(float const* verts, int count, int **indices) {
   vertex const* vertices = (vertex const*)verts;
 
   resizeBuffers(count);
@@ -180,6 +205,844 @@ int math_triangulation_triangulate(float const* verts, int count, int **indices)
 }
 
 
+// Earcut, ported to C from mapbox/earcut. Ear candidates are only checked
+// against the vertices whose z-order (Morton) index falls into the
+// candidate's bounding box, which makes large polygons roughly O(n log n).
+// Holes are bridged into the outer ring before clipping.
+
+static Node* newNode(int i, double x, double y) {
+  Node *p = moduleData.nodes + moduleData.nodeCount++;
+  p->i = i;
+  p->x = x;
+  p->y = y;
+  p->prev = 0;
+  p->next = 0;
+  p->z = -1;
+  p->prevZ = 0;
+  p->nextZ = 0;
+  p->steiner = false;
+  return p;
+}
+
+
+static Node* insertNode(int i, double x, double y, Node *last) {
+  Node *p = newNode(i, x, y);
+  if(!last) {
+    p->prev = p;
+    p->next = p;
+  } else {
+    p->next = last->next;
+    p->prev = last;
+    last->next->prev = p;
+    last->next = p;
+  }
+  return p;
+}
+
+
+static void removeNode(Node *p) {
+  p->next->prev = p->prev;
+  p->prev->next = p->next;
+
+  if(p->prevZ) {
+    p->prevZ->nextZ = p->nextZ;
+  }
+  if(p->nextZ) {
+    p->nextZ->prevZ = p->prevZ;
+  }
+}
+
+
+static void pushTriangle(int a, int b, int c) {
+  int *t = moduleData.earcutTriangles + 3 * moduleData.triangleCount++;
+  t[0] = a;
+  t[1] = b;
+  t[2] = c;
+}
+
+
+static double area(Node const* p, Node const* q, Node const* r) {
+  return (q->y - p->y) * (r->x - q->x) - (q->x - p->x) * (r->y - q->y);
+}
+
+
+static bool equals(Node const* p1, Node const* p2) {
+  return p1->x == p2->x && p1->y == p2->y;
+}
+
+
+static bool pointInTriangleXY(double ax, double ay, double bx, double by, double cx, double cy, double px, double py) {
+  return (cx - px) * (ay - py) >= (ax - px) * (cy - py) &&
+         (ax - px) * (by - py) >= (bx - px) * (ay - py) &&
+         (bx - px) * (cy - py) >= (cx - px) * (by - py);
+}
+
+
+static int sign(double v) {
+  return (v > 0) - (v < 0);
+}
+
+
+static bool onSegment(Node const* p, Node const* q, Node const* r) {
+  return q->x <= fmax(p->x, r->x) && q->x >= fmin(p->x, r->x) &&
+         q->y <= fmax(p->y, r->y) && q->y >= fmin(p->y, r->y);
+}
+
+
+static bool intersects(Node const* p1, Node const* q1, Node const* p2, Node const* q2) {
+  int o1 = sign(area(p1, q1, p2));
+  int o2 = sign(area(p1, q1, q2));
+  int o3 = sign(area(p2, q2, p1));
+  int o4 = sign(area(p2, q2, q1));
+
+  return (o1 != o2 && o3 != o4) ||
+         (o1 == 0 && onSegment(p1, p2, q1)) ||
+         (o2 == 0 && onSegment(p1, q2, q1)) ||
+         (o3 == 0 && onSegment(p2, p1, q2)) ||
+         (o4 == 0 && onSegment(p2, q1, q2));
+}
+
+
+static bool intersectsPolygon(Node const* a, Node const* b) {
+  Node const* p = a;
+  do {
+    if(p->i != a->i && p->next->i != a->i && p->i != b->i && p->next->i != b->i &&
+       intersects(p, p->next, a, b)) {
+      return true;
+    }
+    p = p->next;
+  } while(p != a);
+  return false;
+}
+
+
+static bool locallyInside(Node const* a, Node const* b) {
+  return area(a->prev, a, a->next) < 0
+    ? area(a, b, a->next) >= 0 && area(a, a->prev, b) >= 0
+    : area(a, b, a->prev) < 0 || area(a, a->next, b) < 0;
+}
+
+
+static bool middleInside(Node const* a, Node const* b) {
+  Node const* p = a;
+  bool inside = false;
+  double px = (a->x + b->x) / 2;
+  double py = (a->y + b->y) / 2;
+  do {
+    if(((p->y > py) != (p->next->y > py)) && p->next->y != p->y &&
+       (px < (p->next->x - p->x) * (py - p->y) / (p->next->y - p->y) + p->x)) {
+      inside = !inside;
+    }
+    p = p->next;
+  } while(p != a);
+  return inside;
+}
+
+
+static bool isValidDiagonal(Node const* a, Node const* b) {
+  return a->next->i != b->i && a->prev->i != b->i && !intersectsPolygon(a, b) &&
+    ((locallyInside(a, b) && locallyInside(b, a) && middleInside(a, b) &&
+      (area(a->prev, a, b->prev) != 0 || area(a, b->prev, b) != 0)) ||
+     (equals(a, b) && area(a->prev, a, a->next) > 0 && area(b->prev, b, b->next) > 0));
+}
+
+
+// Links a and b with a diagonal. If they belong to the same ring, it is
+// split in two, if not the rings are merged. Returns the copy of b.
+static Node* splitPolygon(Node *a, Node *b) {
+  Node *a2 = newNode(a->i, a->x, a->y);
+  Node *b2 = newNode(b->i, b->x, b->y);
+  Node *an = a->next;
+  Node *bp = b->prev;
+
+  a->next = b;
+  b->prev = a;
+
+  a2->next = an;
+  an->prev = a2;
+
+  b2->next = a2;
+  a2->prev = b2;
+
+  bp->next = b2;
+  b2->prev = bp;
+
+  return b2;
+}
+
+
+static double signedArea(float const* verts, int start, int end) {
+  double sum = 0;
+  for(int i = start, j = end - 1; i < end; j = i++) {
+    sum += ((double)verts[2*j] - verts[2*i]) * ((double)verts[2*i+1] + verts[2*j+1]);
+  }
+  return sum;
+}
+
+
+static Node* linkedList(float const* verts, int start, int end, bool clockwise) {
+  Node *last = 0;
+  if(clockwise == (signedArea(verts, start, end) > 0)) {
+    for(int i = start; i < end; ++i) {
+      last = insertNode(i, verts[2*i], verts[2*i+1], last);
+    }
+  } else {
+    for(int i = end - 1; i >= start; --i) {
+      last = insertNode(i, verts[2*i], verts[2*i+1], last);
+    }
+  }
+
+  if(last && equals(last, last->next)) {
+    removeNode(last);
+    last = last->next;
+  }
+
+  return last;
+}
+
+
+// Removes duplicate and collinear points
+static Node* filterPoints(Node *start, Node *end) {
+  if(!start) {
+    return start;
+  }
+  if(!end) {
+    end = start;
+  }
+
+  Node *p = start;
+  bool again;
+  do {
+    again = false;
+    if(!p->steiner && (equals(p, p->next) || area(p->prev, p, p->next) == 0)) {
+      removeNode(p);
+      p = end = p->prev;
+      if(p == p->next) {
+        break;
+      }
+      again = true;
+    } else {
+      p = p->next;
+    }
+  } while(again || p != end);
+
+  return end;
+}
+
+
+// Interleaves the bits of the coordinates scaled to 0..32767
+static int32_t zOrder(double x, double y, double minX, double minY, double invSize) {
+  int32_t ix = (int32_t)((x - minX) * invSize);
+  int32_t iy = (int32_t)((y - minY) * invSize);
+
+  ix = (ix | (ix << 8)) & 0x00FF00FF;
+  ix = (ix | (ix << 4)) & 0x0F0F0F0F;
+  ix = (ix | (ix << 2)) & 0x33333333;
+  ix = (ix | (ix << 1)) & 0x55555555;
+
+  iy = (iy | (iy << 8)) & 0x00FF00FF;
+  iy = (iy | (iy << 4)) & 0x0F0F0F0F;
+  iy = (iy | (iy << 2)) & 0x33333333;
+  iy = (iy | (iy << 1)) & 0x55555555;
+
+  return ix | (iy << 1);
+}
+
+
+// Merge sort on the z list, see
+// http://www.chiark.greenend.org.uk/~sgtatham/algorithms/listsort.html
+static Node* sortLinked(Node *list) {
+  int inSize = 1;
+  int numMerges;
+  do {
+    Node *p = list;
+    Node *tail = 0;
+    list = 0;
+    numMerges = 0;
+
+    while(p) {
+      ++numMerges;
+      Node *q = p;
+      int pSize = 0;
+      for(int i = 0; i < inSize; ++i) {
+        ++pSize;
+        q = q->nextZ;
+        if(!q) {
+          break;
+        }
+      }
+      int qSize = inSize;
+
+      while(pSize > 0 || (qSize > 0 && q)) {
+        Node *e;
+        if(pSize != 0 && (qSize == 0 || !q || p->z <= q->z)) {
+          e = p;
+          p = p->nextZ;
+          --pSize;
+        } else {
+          e = q;
+          q = q->nextZ;
+          --qSize;
+        }
+
+        if(tail) {
+          tail->nextZ = e;
+        } else {
+          list = e;
+        }
+        e->prevZ = tail;
+        tail = e;
+      }
+
+      p = q;
+    }
+
+    tail->nextZ = 0;
+    inSize *= 2;
+  } while(numMerges > 1);
+
+  return list;
+}
+
+
+static void indexCurve(Node *start, double minX, double minY, double invSize) {
+  Node *p = start;
+  do {
+    if(p->z < 0) {
+      p->z = zOrder(p->x, p->y, minX, minY, invSize);
+    }
+    p->prevZ = p->prev;
+    p->nextZ = p->next;
+    p = p->next;
+  } while(p != start);
+
+  p->prevZ->nextZ = 0;
+  p->prevZ = 0;
+
+  sortLinked(p);
+}
+
+
+static bool isNodeEar(Node const* ear) {
+  Node const* a = ear->prev;
+  Node const* b = ear;
+  Node const* c = ear->next;
+
+  // Reflex, can't be an ear
+  if(area(a, b, c) >= 0) {
+    return false;
+  }
+
+  Node const* p = ear->next->next;
+  while(p != ear->prev) {
+    if(pointInTriangleXY(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+       area(p->prev, p, p->next) >= 0) {
+      return false;
+    }
+    p = p->next;
+  }
+
+  return true;
+}
+
+
+static bool blocksEar(Node const* ear, Node const* p) {
+  Node const* a = ear->prev;
+  Node const* b = ear;
+  Node const* c = ear->next;
+  return p != a && p != c &&
+         pointInTriangleXY(a->x, a->y, b->x, b->y, c->x, c->y, p->x, p->y) &&
+         area(p->prev, p, p->next) >= 0;
+}
+
+
+// Like isNodeEar, but only looks at points inside the triangle's z range
+static bool isEarHashed(Node const* ear, double minX, double minY, double invSize) {
+  Node const* a = ear->prev;
+  Node const* b = ear;
+  Node const* c = ear->next;
+
+  if(area(a, b, c) >= 0) {
+    return false;
+  }
+
+  double minTX = fmin(a->x, fmin(b->x, c->x));
+  double minTY = fmin(a->y, fmin(b->y, c->y));
+  double maxTX = fmax(a->x, fmax(b->x, c->x));
+  double maxTY = fmax(a->y, fmax(b->y, c->y));
+
+  int32_t minZ = zOrder(minTX, minTY, minX, minY, invSize);
+  int32_t maxZ = zOrder(maxTX, maxTY, minX, minY, invSize);
+
+  Node const* p = ear->prevZ;
+  Node const* n = ear->nextZ;
+
+  // Look for points in both directions at once
+  while(p && p->z >= minZ && n && n->z <= maxZ) {
+    if(blocksEar(ear, p)) {
+      return false;
+    }
+    p = p->prevZ;
+
+    if(blocksEar(ear, n)) {
+      return false;
+    }
+    n = n->nextZ;
+  }
+
+  while(p && p->z >= minZ) {
+    if(blocksEar(ear, p)) {
+      return false;
+    }
+    p = p->prevZ;
+  }
+
+  while(n && n->z <= maxZ) {
+    if(blocksEar(ear, n)) {
+      return false;
+    }
+    n = n->nextZ;
+  }
+
+  return true;
+}
+
+
+// Clips off triangles around a local self intersection
+static Node* cureLocalIntersections(Node *start) {
+  Node *p = start;
+  do {
+    Node *a = p->prev;
+    Node *b = p->next->next;
+
+    if(!equals(a, b) && intersects(a, p, p->next, b) && locallyInside(a, b) && locallyInside(b, a)) {
+      pushTriangle(a->i, p->i, b->i);
+      removeNode(p);
+      removeNode(p->next);
+      p = start = b;
+    }
+    p = p->next;
+  } while(p != start);
+
+  return filterPoints(p, 0);
+}
+
+
+static void earcutLinked(Node *ear, double minX, double minY, double invSize, int pass);
+
+// Last resort: split the polygon along a valid diagonal and clip the halves
+static void splitEarcut(Node *start, double minX, double minY, double invSize) {
+  Node *a = start;
+  do {
+    Node *b = a->next->next;
+    while(b != a->prev) {
+      if(a->i != b->i && isValidDiagonal(a, b)) {
+        Node *c = splitPolygon(a, b);
+
+        a = filterPoints(a, a->next);
+        c = filterPoints(c, c->next);
+
+        earcutLinked(a, minX, minY, invSize, 0);
+        earcutLinked(c, minX, minY, invSize, 0);
+        return;
+      }
+      b = b->next;
+    }
+    a = a->next;
+  } while(a != start);
+}
+
+
+// invSize is 0 for small polygons, which are clipped without z-order index
+static void earcutLinked(Node *ear, double minX, double minY, double invSize, int pass) {
+  if(!ear) {
+    return;
+  }
+
+  if(!pass && invSize) {
+    indexCurve(ear, minX, minY, invSize);
+  }
+
+  Node *stop = ear;
+  while(ear->prev != ear->next) {
+    Node *prev = ear->prev;
+    Node *next = ear->next;
+
+    if(invSize ? isEarHashed(ear, minX, minY, invSize) : isNodeEar(ear)) {
+      pushTriangle(prev->i, ear->i, next->i);
+      removeNode(ear);
+
+      // Skipping the next vertex leads to less sliver triangles
+      ear = next->next;
+      stop = next->next;
+      continue;
+    }
+
+    ear = next;
+
+    // Went through the whole ring without finding an ear
+    if(ear == stop) {
+      if(pass == 0) {
+        // Retry after removing collinear points
+        earcutLinked(filterPoints(ear, 0), minX, minY, invSize, 1);
+      } else if(pass == 1) {
+        // Then after clipping local self intersections
+        ear = cureLocalIntersections(filterPoints(ear, 0));
+        earcutLinked(ear, minX, minY, invSize, 2);
+      } else {
+        splitEarcut(ear, minX, minY, invSize);
+      }
+      break;
+    }
+  }
+}
+
+
+static Node* getLeftmost(Node *start) {
+  Node *p = start;
+  Node *leftmost = start;
+  do {
+    if(p->x < leftmost->x || (p->x == leftmost->x && p->y < leftmost->y)) {
+      leftmost = p;
+    }
+    p = p->next;
+  } while(p != start);
+  return leftmost;
+}
+
+
+static bool sectorContainsSector(Node const* m, Node const* p) {
+  return area(m->prev, m, p->prev) < 0 && area(p->next, m, m->next) < 0;
+}
+
+
+// David Eberly's algorithm for finding a bridge between a hole and the
+// outer polygon
+static Node* findHoleBridge(Node *hole, Node *outerNode) {
+  Node *p = outerNode;
+  double hx = hole->x;
+  double hy = hole->y;
+  double qx = -INFINITY;
+  Node *m = 0;
+
+  // Find the segment left of the hole point closest to it on a horizontal
+  // ray, m is its endpoint with the smaller x
+  do {
+    if(hy <= p->y && hy >= p->next->y && p->next->y != p->y) {
+      double x = p->x + (hy - p->y) * (p->next->x - p->x) / (p->next->y - p->y);
+      if(x <= hx && x > qx) {
+        qx = x;
+        if(x == hx) {
+          if(hy == p->y) {
+            return p;
+          }
+          if(hy == p->next->y) {
+            return p->next;
+          }
+        }
+        m = p->x < p->next->x ? p : p->next;
+      }
+    }
+    p = p->next;
+  } while(p != outerNode);
+
+  if(!m) {
+    return 0;
+  }
+
+  if(hx == qx) {
+    return m;
+  }
+
+  // If a reflex vertex lies in the triangle between the hole point, the ray
+  // hit and m, connect to the one with the smallest angle to the ray instead
+  Node *stop = m;
+  double mx = m->x;
+  double my = m->y;
+  double tanMin = INFINITY;
+
+  p = m;
+  do {
+    if(hx >= p->x && p->x >= mx && hx != p->x &&
+       pointInTriangleXY(hy < my ? hx : qx, hy, mx, my, hy < my ? qx : hx, hy, p->x, p->y)) {
+      double tan = fabs(hy - p->y) / (hx - p->x);
+      if(locallyInside(p, hole) &&
+         (tan < tanMin || (tan == tanMin && (p->x > m->x || (p->x == m->x && sectorContainsSector(m, p)))))) {
+        m = p;
+        tanMin = tan;
+      }
+    }
+    p = p->next;
+  } while(p != stop);
+
+  return m;
+}
+
+
+static Node* eliminateHole(Node *hole, Node *outerNode) {
+  Node *bridge = findHoleBridge(hole, outerNode);
+  if(!bridge) {
+    return outerNode;
+  }
+
+  Node *bridgeReverse = splitPolygon(bridge, hole);
+
+  Node *filteredBridge = filterPoints(bridge, bridge->next);
+  filterPoints(bridgeReverse, bridgeReverse->next);
+
+  return outerNode == bridge ? filteredBridge : outerNode;
+}
+
+
+static int compareX(void const* a, void const* b) {
+  double ax = (*(Node* const*)a)->x;
+  double bx = (*(Node* const*)b)->x;
+  return (ax > bx) - (ax < bx);
+}
+
+
+static Node* eliminateHoles(float const* verts, int count, int const* holeStarts, int holeCount, Node *outerNode) {
+  Node **queue = malloc(holeCount * sizeof(Node*));
+  int queued = 0;
+
+  for(int i = 0; i < holeCount; ++i) {
+    int start = holeStarts[i];
+    int end = i < holeCount - 1 ? holeStarts[i+1] : count;
+    Node *list = linkedList(verts, start, end, false);
+    if(!list) {
+      continue;
+    }
+    if(list == list->next) {
+      list->steiner = true;
+    }
+    queue[queued++] = getLeftmost(list);
+  }
+
+  // Bridging left to right keeps earlier bridges from blocking later ones
+  qsort(queue, queued, sizeof(Node*), compareX);
+
+  for(int i = 0; i < queued; ++i) {
+    outerNode = eliminateHole(queue[i], outerNode);
+    outerNode = filterPoints(outerNode, outerNode->next);
+  }
+
+  free(queue);
+  return outerNode;
+}
+
+
+static void ensureEarcutBuffers(int count, int holeCount) {
+  // Splitting a ring adds two nodes and never happens more often than
+  // there are triangles
+  int nodes = 3 * count + 4 * holeCount + 4;
+  if(moduleData.nodeCapacity < nodes) {
+    free(moduleData.nodes);
+    moduleData.nodes = malloc(nodes * sizeof(Node));
+    moduleData.nodeCapacity = nodes;
+  }
+
+  int indices = 3 * (count + 2 * holeCount);
+  if(moduleData.earcutTriangleCapacity < indices) {
+    free(moduleData.earcutTriangles);
+    moduleData.earcutTriangles = malloc(indices * sizeof(int));
+    moduleData.earcutTriangleCapacity = indices;
+  }
+
+  moduleData.nodeCount = 0;
+  moduleData.triangleCount = 0;
+}
+
+
+// Orientation of the path a -> b -> c. Zero for collinear points.
+static double turn(float const* verts, int a, int b, int c) {
+  return ((double)verts[2*b] - verts[2*a]) * ((double)verts[2*c+1] - verts[2*b+1]) -
+         ((double)verts[2*b+1] - verts[2*a+1]) * ((double)verts[2*c] - verts[2*b]);
+}
+
+
+// Lexicographic (x, then y) order. Sweeping in this order is sweeping along
+// x with ties broken as if the polygon was rotated by a tiny angle, which
+// lets vertical edges take part in monotone chains.
+static int compareLex(float const* verts, int a, int b) {
+  if(verts[2*a] != verts[2*b]) {
+    return verts[2*a] < verts[2*b] ? -1 : 1;
+  }
+  if(verts[2*a+1] != verts[2*b+1]) {
+    return verts[2*a+1] < verts[2*b+1] ? -1 : 1;
+  }
+  return 0;
+}
+
+
+// Triangulates polygons that are monotone along x in O(n), including every
+// convex polygon. Returns false, without output, for all other polygons.
+static bool triangulateMonotone(float const* verts, int count) {
+  int first = 0;
+  int last = 0;
+  for(int i = 1; i < count; ++i) {
+    if(compareLex(verts, i, first) < 0) {
+      first = i;
+    }
+    if(compareLex(verts, i, last) > 0) {
+      last = i;
+    }
+  }
+
+  // Walking from the leftmost vertex, the order has to strictly increase up
+  // to the rightmost vertex and strictly decrease afterwards
+  for(int i = first, rising = 1; ; ) {
+    int n = (i + 1) % count;
+    int c = compareLex(verts, i, n);
+    if(c == 0) {
+      return false;
+    }
+    if(i == last) {
+      rising = 0;
+    }
+    if((c < 0) != rising) {
+      return false;
+    }
+    i = n;
+    if(i == first) {
+      break;
+    }
+  }
+
+  // Sign of the turn at convex vertices
+  double polygonArea = signedArea(verts, 0, count);
+  if(polygonArea == 0) {
+    return false;
+  }
+  double orientation = polygonArea > 0 ? 1.0 : -1.0;
+
+  // Merge both chains into sweep order. The chain going forward through
+  // the vertex array from the leftmost vertex is chain 0.
+  int *order = malloc(count * sizeof(int));
+  bool *chain = malloc(count * sizeof(bool));
+  int *stack = malloc(count * sizeof(int));
+
+  int a = first;
+  int b = (first + count - 1) % count;
+  order[0] = first;
+  chain[first] = 0;
+  a = (a + 1) % count;
+  for(int k = 1; k < count; ++k) {
+    if(a == last && b != last) {
+      order[k] = b;
+      chain[b] = 1;
+      b = (b + count - 1) % count;
+    } else if(b == last && a != last) {
+      order[k] = a;
+      chain[a] = 0;
+      a = (a + 1) % count;
+    } else if(compareLex(verts, a, b) < 0) {
+      order[k] = a;
+      chain[a] = 0;
+      a = (a + 1) % count;
+    } else {
+      order[k] = b;
+      chain[b] = 1;
+      b = (b + count - 1) % count;
+    }
+  }
+
+  int top = 0;
+  stack[top++] = order[0];
+  stack[top++] = order[1];
+
+  for(int k = 2; k < count - 1; ++k) {
+    int u = order[k];
+    if(chain[u] != chain[stack[top-1]]) {
+      // Opposite chain: fan to the whole stack
+      for(int j = 0; j < top - 1; ++j) {
+        pushTriangle(stack[j], stack[j+1], u);
+      }
+      stack[0] = order[k-1];
+      stack[1] = u;
+      top = 2;
+    } else {
+      // Same chain: clip as long as the diagonals stay inside
+      int popped = stack[--top];
+      while(top > 0) {
+        double t = chain[u] == 0
+          ? turn(verts, stack[top-1], popped, u)
+          : turn(verts, u, popped, stack[top-1]);
+        if(t * orientation <= 0) {
+          break;
+        }
+        pushTriangle(stack[top-1], popped, u);
+        popped = stack[--top];
+      }
+      stack[top++] = popped;
+      stack[top++] = u;
+    }
+  }
+
+  for(int j = 0; j < top - 1; ++j) {
+    pushTriangle(stack[j], stack[j+1], order[count-1]);
+  }
+
+  free(order);
+  free(chain);
+  free(stack);
+  return true;
+}
+
+
+int math_triangulation_triangulateWithHoles(float const* verts, int count, int const* holeStarts, int holeCount, int **indices) {
+  *indices = moduleData.earcutTriangles;
+  if(count < 3) {
+    return 0;
+  }
+
+  ensureEarcutBuffers(count, holeCount);
+  *indices = moduleData.earcutTriangles;
+
+  int outerCount = holeCount > 0 ? holeStarts[0] : count;
+  if(holeCount == 0 && triangulateMonotone(verts, count)) {
+    return moduleData.triangleCount;
+  }
+
+  Node *outerNode = linkedList(verts, 0, outerCount, true);
+  if(!outerNode || outerNode->next == outerNode->prev) {
+    return 0;
+  }
+
+  if(holeCount > 0) {
+    outerNode = eliminateHoles(verts, count, holeStarts, holeCount, outerNode);
+  }
+
+  // The z-order index only pays off for larger polygons
+  double minX = 0.0;
+  double minY = 0.0;
+  double invSize = 0.0;
+  if(count > 80) {
+    minX = verts[0];
+    minY = verts[1];
+    double maxX = minX;
+    double maxY = minY;
+    for(int i = 1; i < outerCount; ++i) {
+      minX = fmin(minX, verts[2*i]);
+      minY = fmin(minY, verts[2*i+1]);
+      maxX = fmax(maxX, verts[2*i]);
+      maxY = fmax(maxY, verts[2*i+1]);
+    }
+
+    invSize = fmax(maxX - minX, maxY - minY);
+    invSize = invSize != 0.0 ? 32767.0 / invSize : 0.0;
+  }
+
+  earcutLinked(outerNode, minX, minY, invSize, 0);
+
+  return moduleData.triangleCount;
+}
+
+
+int math_triangulation_triangulate(float const* verts, int count, int **indices) {
+  return math_triangulation_triangulateWithHoles(verts, count, 0, 0, indices);
+}
+
+
 static float crossVerts(float const* verts, int i, int j, int k) {
   float dx1 = verts[j*2]   - verts[i*2];
   float dy1 = verts[j*2+1] - verts[i*2+1];
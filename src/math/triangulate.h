@@ -12,5 +12,12 @@
 #include <stdbool.h>
 
 void math_triangulation_init();
+// Returns the number of triangles written to *indices, which stays valid
+// until the next call. Self intersecting polygons give unspecified results.
 int math_triangulation_triangulate(float const* verts, int count, int **indices);
+// verts holds the outer polygon followed by the holes, holeStarts the vertex
+// index each hole starts at
+int math_triangulation_triangulateWithHoles(float const* verts, int count, int const* holeStarts, int holeCount, int **indices);
+// The previous O(n^2) ear clipper, returns -1 if it gets stuck
+int math_triangulation_triangulateEarClipping(float const* verts, int count, int **indices);
 bool math_isConvex(float const* verts, int count);
@@ -0,0 +1,117 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+// Compares the earcut triangulation with the old ear clipper on generated
+// polygons. Not part of the engine build, compile it on its own:
+//
+//   cc -O2 -std=c11 -o triangulate_bench src/math/triangulate_bench.c src/math/triangulate.c -lm
+//
+// The area column is the summed triangle area relative to the polygon area
+// and should be 1 for both implementations.
+
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include "triangulate.h"
+
+typedef int (*Triangulator)(float const* verts, int count, int **indices);
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static double polygonArea(float const* verts, int count) {
+  double sum = 0;
+  for(int i = 0, j = count - 1; i < count; j = i++) {
+    sum += (double)verts[2*j] * verts[2*i+1] - (double)verts[2*i] * verts[2*j+1];
+  }
+  return fabs(sum) / 2;
+}
+
+
+static double trianglesArea(float const* verts, int const* indices, int triangles) {
+  double sum = 0;
+  for(int i = 0; i < triangles; ++i) {
+    float const* a = verts + 2 * indices[3*i];
+    float const* b = verts + 2 * indices[3*i+1];
+    float const* c = verts + 2 * indices[3*i+2];
+    sum += fabs(((double)b[0] - a[0]) * ((double)c[1] - a[1]) - ((double)b[1] - a[1]) * ((double)c[0] - a[0])) / 2;
+  }
+  return sum;
+}
+
+
+// Star shaped polygon with a random radius per vertex, like eroded terrain
+static void makeStar(float *verts, int count) {
+  for(int i = 0; i < count; ++i) {
+    double angle = 2 * 3.14159265358979 * i / count;
+    double radius = 500.0 + rand() % 400;
+    verts[2*i]   = (float)(cos(angle) * radius);
+    verts[2*i+1] = (float)(sin(angle) * radius);
+  }
+}
+
+
+// Terrain strip: a jagged surface over a flat bottom. Monotone along x.
+static void makeTerrain(float *verts, int count) {
+  int top = count - 2;
+  for(int i = 0; i < top; ++i) {
+    verts[2*i]   = (float)i;
+    verts[2*i+1] = (float)(100.0 + 40.0 * sin(i * 0.05) + rand() % 20);
+  }
+  verts[2*top]     = (float)(top - 1);
+  verts[2*top+1]   = 0.0f;
+  verts[2*top+2]   = 0.0f;
+  verts[2*top+3]   = 0.0f;
+}
+
+
+static void run(char const* name, Triangulator triangulate, float const* verts, int count, int repeat) {
+  int *indices = 0;
+  int triangles = 0;
+  double start = now();
+  for(int i = 0; i < repeat; ++i) {
+    triangles = triangulate(verts, count, &indices);
+  }
+  double ms = (now() - start) * 1000.0 / repeat;
+
+  double ratio = triangles > 0 ? trianglesArea(verts, indices, triangles) / polygonArea(verts, count) : 0.0;
+  printf("  %-12s %10.3f ms  %6d triangles  area %.5f\n", name, ms, triangles, ratio);
+}
+
+
+int main(void) {
+  static int const sizes[] = {100, 500, 1000, 2000, 5000};
+  srand(1);
+
+  for(int s = 0; s < (int)(sizeof(sizes) / sizeof(*sizes)); ++s) {
+    int count = sizes[s];
+    float *verts = malloc(2 * count * sizeof(float));
+    int repeat = count > 1000 ? 3 : 20;
+
+    makeStar(verts, count);
+    printf("star, %d vertices\n", count);
+    run("earclipping", math_triangulation_triangulateEarClipping, verts, count, repeat);
+    run("earcut",      math_triangulation_triangulate,            verts, count, repeat);
+
+    makeTerrain(verts, count);
+    printf("terrain, %d vertices\n", count);
+    run("earclipping", math_triangulation_triangulateEarClipping, verts, count, repeat);
+    run("earcut",      math_triangulation_triangulate,            verts, count, repeat);
+
+    free(verts);
+  }
+
+  return 0;
+}
@@ -9,9 +9,12 @@
 
 #pragma once
 
+#include <stdbool.h>
+
 typedef struct {
   int width;
   int height;
+  bool srgb;
 } motor_WindowConfig;
 
 typedef struct {
@@ -14,6 +14,7 @@
 #include "mouse.h"
 #include "image/imagedata.h"
 #include "graphics/image.h"
+#include "graphics/graphics.h"
 
 // TODO:
 // moduleData.getRelativeMode()
@@ -208,7 +209,7 @@ void mouse_setEventCallbacks(mouse_EventCallbacks const *callbacks) {
 }
 
 void mouse_Cursor_new(mouse_Cursor* cursor, image_ImageData const *data, int hotx, int hoty) {
-  graphics_Image_new_with_ImageData(&cursor->image, data);
+  graphics_Image_new_with_ImageData(&cursor->image, data, graphics_isGammaCorrect());
   cursor->hotx = hotx;
   cursor->hoty = hoty;
 }
@@ -0,0 +1,96 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ringbuffer.h"
+
+
+void ringbuffer_RingBuffer_new(ringbuffer_RingBuffer *ring, int size) {
+  int s = 1;
+  while(s < size) {
+    s <<= 1;
+  }
+
+  ring->data = malloc(s);
+  ring->size = s;
+  SDL_AtomicSet(&ring->writePos, 0);
+  SDL_AtomicSet(&ring->readPos, 0);
+}
+
+
+void ringbuffer_RingBuffer_free(ringbuffer_RingBuffer *ring) {
+  free(ring->data);
+  ring->data = 0;
+}
+
+
+// Positions are compared as unsigned, their difference survives the wrap
+static uint32_t position(ringbuffer_RingBuffer const* ring, bool write) {
+  return (uint32_t)SDL_AtomicGet((SDL_atomic_t*)(write ? &ring->writePos : &ring->readPos));
+}
+
+
+int ringbuffer_RingBuffer_getUsed(ringbuffer_RingBuffer const* ring) {
+  return position(ring, true) - position(ring, false);
+}
+
+
+int ringbuffer_RingBuffer_getFree(ringbuffer_RingBuffer const* ring) {
+  return ring->size - ringbuffer_RingBuffer_getUsed(ring);
+}
+
+
+int ringbuffer_RingBuffer_write(ringbuffer_RingBuffer *ring, void const* src, int bytes) {
+  uint32_t w = position(ring, true);
+  uint32_t r = position(ring, false);
+  // The consumer must be done reading the space before it is overwritten
+  SDL_MemoryBarrierAcquire();
+
+  int space = ring->size - (int)(w - r);
+  if(bytes > space) {
+    bytes = space;
+  }
+
+  int start = w & (ring->size - 1);
+  int first = ring->size - start < bytes ? ring->size - start : bytes;
+  memcpy(ring->data + start, src, first);
+  memcpy(ring->data, (uint8_t const*)src + first, bytes - first);
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&ring->writePos, (int)(w + bytes));
+  return bytes;
+}
+
+
+int ringbuffer_RingBuffer_read(ringbuffer_RingBuffer *ring, void *dst, int bytes) {
+  uint32_t r = position(ring, false);
+  uint32_t w = position(ring, true);
+  SDL_MemoryBarrierAcquire();
+
+  int available = (int)(w - r);
+  if(bytes > available) {
+    bytes = available;
+  }
+
+  int start = r & (ring->size - 1);
+  int first = ring->size - start < bytes ? ring->size - start : bytes;
+  memcpy(dst, ring->data + start, first);
+  memcpy((uint8_t*)dst + first, ring->data, bytes - first);
+
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&ring->readPos, (int)(r + bytes));
+  return bytes;
+}
+
+
+void ringbuffer_RingBuffer_clear(ringbuffer_RingBuffer *ring) {
+  SDL_AtomicSet(&ring->readPos, SDL_AtomicGet(&ring->writePos));
+}
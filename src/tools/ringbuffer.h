@@ -0,0 +1,38 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <SDL.h>
+
+// Lock-free byte queue between exactly one producer and one consumer
+// thread. The positions count all bytes ever written and read and wrap
+// around, only the producer moves writePos and only the consumer readPos.
+typedef struct {
+  uint8_t *data;
+  // Power of two
+  int size;
+  SDL_atomic_t writePos;
+  SDL_atomic_t readPos;
+} ringbuffer_RingBuffer;
+
+// size is rounded up to the next power of two
+void ringbuffer_RingBuffer_new(ringbuffer_RingBuffer *ring, int size);
+void ringbuffer_RingBuffer_free(ringbuffer_RingBuffer *ring);
+int ringbuffer_RingBuffer_getUsed(ringbuffer_RingBuffer const* ring);
+int ringbuffer_RingBuffer_getFree(ringbuffer_RingBuffer const* ring);
+
+// Both copy as many bytes as fit or are available, up to bytes, and return
+// the number copied
+int ringbuffer_RingBuffer_write(ringbuffer_RingBuffer *ring, void const* src, int bytes);
+int ringbuffer_RingBuffer_read(ringbuffer_RingBuffer *ring, void *dst, int bytes);
+
+// Neither side may use the ring during this
+void ringbuffer_RingBuffer_clear(ringbuffer_RingBuffer *ring);
@@ -0,0 +1,198 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <SDL.h>
+#include "threadpool.h"
+
+#ifdef EMSCRIPTEN
+
+void threadpool_init(void) {
+}
+
+int threadpool_getWorkerCount(void) {
+  return 0;
+}
+
+void threadpool_push(threadpool_Job job, void *data) {
+  job(data);
+}
+
+void threadpool_parallelFor(threadpool_IndexedJob job, void *data, int count) {
+  for(int i = 0; i < count; ++i) {
+    job(data, i);
+  }
+}
+
+#else
+
+typedef struct {
+  threadpool_Job job;
+  void *data;
+} QueuedJob;
+
+static struct {
+  SDL_Thread **workers;
+  int workerCount;
+
+  SDL_mutex *mutex;
+  SDL_cond *jobAvailable;
+
+  // Ring buffer of pending jobs, grows when full
+  QueuedJob *queue;
+  int queueSize;
+  int queueStart;
+  int queueCount;
+} moduleData;
+
+
+static int workerMain(void *unused) {
+  (void)unused;
+  for(;;) {
+    SDL_LockMutex(moduleData.mutex);
+    while(moduleData.queueCount == 0) {
+      SDL_CondWait(moduleData.jobAvailable, moduleData.mutex);
+    }
+
+    QueuedJob job = moduleData.queue[moduleData.queueStart];
+    moduleData.queueStart = (moduleData.queueStart + 1) % moduleData.queueSize;
+    --moduleData.queueCount;
+    SDL_UnlockMutex(moduleData.mutex);
+
+    job.job(job.data);
+  }
+
+  return 0;
+}
+
+
+void threadpool_init(void) {
+  moduleData.workerCount = SDL_GetCPUCount() - 1;
+  if(moduleData.workerCount < 1) {
+    moduleData.workerCount = 1;
+  }
+
+  moduleData.mutex = SDL_CreateMutex();
+  moduleData.jobAvailable = SDL_CreateCond();
+
+  moduleData.queueSize = 64;
+  moduleData.queue = malloc(sizeof(QueuedJob) * moduleData.queueSize);
+  moduleData.queueStart = 0;
+  moduleData.queueCount = 0;
+
+  moduleData.workers = malloc(sizeof(SDL_Thread*) * moduleData.workerCount);
+  for(int i = 0; i < moduleData.workerCount; ++i) {
+    moduleData.workers[i] = SDL_CreateThread(workerMain, "motor2d worker", NULL);
+  }
+}
+
+
+int threadpool_getWorkerCount(void) {
+  return moduleData.workerCount;
+}
+
+
+void threadpool_push(threadpool_Job job, void *data) {
+  SDL_LockMutex(moduleData.mutex);
+
+  if(moduleData.queueCount == moduleData.queueSize) {
+    int newSize = moduleData.queueSize * 2;
+    QueuedJob *queue = malloc(sizeof(QueuedJob) * newSize);
+    for(int i = 0; i < moduleData.queueCount; ++i) {
+      queue[i] = moduleData.queue[(moduleData.queueStart + i) % moduleData.queueSize];
+    }
+    free(moduleData.queue);
+    moduleData.queue = queue;
+    moduleData.queueSize = newSize;
+    moduleData.queueStart = 0;
+  }
+
+  QueuedJob *slot = &moduleData.queue[(moduleData.queueStart + moduleData.queueCount) % moduleData.queueSize];
+  slot->job = job;
+  slot->data = data;
+  ++moduleData.queueCount;
+
+  SDL_CondSignal(moduleData.jobAvailable);
+  SDL_UnlockMutex(moduleData.mutex);
+}
+
+
+// Shared between the caller of threadpool_parallelFor and its helper jobs.
+// Helpers may only get to run after the caller has already finished all
+// indices itself, so the last one holding a reference frees it.
+typedef struct {
+  threadpool_IndexedJob job;
+  void *data;
+  int count;
+  SDL_atomic_t next;
+  SDL_atomic_t pending;
+  SDL_atomic_t refs;
+  SDL_sem *done;
+} ParallelFor;
+
+
+static void releaseParallelFor(ParallelFor *pf) {
+  if(SDL_AtomicDecRef(&pf->refs)) {
+    SDL_DestroySemaphore(pf->done);
+    free(pf);
+  }
+}
+
+
+static void runParallelFor(ParallelFor *pf) {
+  int i;
+  while((i = SDL_AtomicAdd(&pf->next, 1)) < pf->count) {
+    pf->job(pf->data, i);
+    if(SDL_AtomicDecRef(&pf->pending)) {
+      SDL_SemPost(pf->done);
+    }
+  }
+}
+
+
+static void parallelForHelper(void *data) {
+  ParallelFor *pf = (ParallelFor*)data;
+  runParallelFor(pf);
+  releaseParallelFor(pf);
+}
+
+
+void threadpool_parallelFor(threadpool_IndexedJob job, void *data, int count) {
+  if(count <= 0) {
+    return;
+  } else if(count == 1) {
+    job(data, 0);
+    return;
+  }
+
+  int helpers = count - 1;
+  if(helpers > moduleData.workerCount) {
+    helpers = moduleData.workerCount;
+  }
+
+  ParallelFor *pf = malloc(sizeof(ParallelFor));
+  pf->job = job;
+  pf->data = data;
+  pf->count = count;
+  SDL_AtomicSet(&pf->next, 0);
+  SDL_AtomicSet(&pf->pending, count);
+  SDL_AtomicSet(&pf->refs, helpers + 1);
+  pf->done = SDL_CreateSemaphore(0);
+
+  for(int i = 0; i < helpers; ++i) {
+    threadpool_push(parallelForHelper, pf);
+  }
+
+  runParallelFor(pf);
+  SDL_SemWait(pf->done);
+  releaseParallelFor(pf);
+}
+
+#endif
@@ -0,0 +1,25 @@
+/*
+    motor2d
+
+    Copyright (C) 2015 Florian Kesseler
+
+    This project is free software; you can redistribute it and/or modify it
+    under the terms of the MIT license. See LICENSE.md for details.
+*/
+
+#pragma once
+
+typedef void (*threadpool_Job)(void *data);
+typedef void (*threadpool_IndexedJob)(void *data, int index);
+
+// Starts one worker per additional CPU core. The web build has no threads,
+// all jobs run on the calling thread there.
+void threadpool_init(void);
+int threadpool_getWorkerCount(void);
+
+// Queues job to run on a worker thread at some later point.
+void threadpool_push(threadpool_Job job, void *data);
+
+// Calls job(data, i) for all i in [0, count) spread over the workers and
+// the calling thread. Returns once all calls have finished.
+void threadpool_parallelFor(threadpool_IndexedJob job, void *data, int count);